@@ -0,0 +1,84 @@
+#include "AllocationHints.h"
+#include "IRMutator.h"
+#include "IROperator.h"
+#include "AllocationSize.h"
+#include "Debug.h"
+#include "runtime/HalideRuntime.h"
+
+namespace Halide {
+namespace Internal {
+
+using std::map;
+using std::string;
+
+namespace {
+
+class InjectAllocationHints : public IRMutator {
+public:
+    InjectAllocationHints(const map<string, Function> &env, const Target &t) :
+        no_asserts(t.has_feature(Target::NoAsserts)) {
+        for (map<string, Function>::const_iterator iter = env.begin();
+             iter != env.end(); ++iter) {
+            const Function &f = iter->second;
+            if (f.outputs() == 1) {
+                storage_hints[f.name()] = f.schedule().allocation_hints();
+            } else {
+                for (int i = 0; i < f.outputs(); i++) {
+                    storage_hints[f.name() + "." + int_to_string(i)] = f.schedule().allocation_hints();
+                }
+            }
+        }
+    }
+
+private:
+    bool no_asserts;
+
+    // The hints for each Func's allocation(s), or -1 if not set.
+    map<string, int> storage_hints;
+
+    using IRMutator::visit;
+
+    void visit(const Allocate *op) {
+        // Only Funcs that ask for hints get them. Everything else,
+        // including memory shared by several Funcs (see
+        // MemoryPlanning.cpp), comes from halide_malloc, so that
+        // custom allocators and memory pools still see it.
+        map<string, int>::const_iterator iter = storage_hints.find(op->name);
+        int hints = iter == storage_hints.end() ? -1 : iter->second;
+        if (op->new_expr.defined() || op->memory_type == MemoryType::Stack ||
+            hints <= halide_allocation_hint_none) {
+            IRMutator::visit(op);
+            return;
+        }
+
+        int64_t constant_size;
+        Expr size = allocation_size_in_bytes(op->type, op->extents, &constant_size);
+        if (allocation_goes_on_stack(constant_size, op->memory_type)) {
+            IRMutator::visit(op);
+            return;
+        }
+        Stmt body = mutate(op->body);
+
+        string size_name = op->name + ".hinted_size";
+        Expr size_var = Variable::make(Int(64), size_name);
+        debug(3) << "Allocating " << op->name << " with hints " << hints << "\n";
+        Expr alloc_size = select(op->condition, cast<int32_t>(size_var), 0);
+        Expr new_expr = Call::make(Handle(), "halide_malloc_with_hints",
+                                   vec(alloc_size, Expr(hints)), Call::Extern);
+        Stmt s = Allocate::make(op->name, op->type, op->extents, op->condition, body,
+                                new_expr, "halide_free_with_hints", op->memory_type);
+        if (!no_asserts) {
+            s = Block::make(allocation_size_check(op->name, size_var), s);
+        }
+        stmt = LetStmt::make(size_name, size, s);
+    }
+};
+
+}
+
+Stmt inject_allocation_hints(Stmt s, const map<string, Function> &env, const Target &t) {
+    return InjectAllocationHints(env, t).mutate(s);
+}
+
+}
+}
@@ -0,0 +1,26 @@
+#ifndef HALIDE_ALLOCATION_HINTS_H
+#define HALIDE_ALLOCATION_HINTS_H
+
+/** \file
+ * Defines the lowering pass that asks the runtime for huge pages or
+ * NUMA placement for large allocations.
+ */
+
+#include <map>
+
+#include "IR.h"
+#include "Function.h"
+#include "Target.h"
+
+namespace Halide {
+namespace Internal {
+
+/** Allocate the buffers of Funcs scheduled with
+ * Func::allocation_hints with halide_malloc_with_hints, passing their
+ * hints. Everything else is left to halide_malloc. */
+Stmt inject_allocation_hints(Stmt s, const std::map<std::string, Function> &env, const Target &t);
+
+}
+}
+
+#endif
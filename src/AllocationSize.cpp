@@ -0,0 +1,78 @@
+#include "AllocationSize.h"
+#include "IROperator.h"
+#include "Debug.h"
+
+namespace Halide {
+namespace Internal {
+
+using std::string;
+using std::vector;
+
+bool constant_allocation_size(const vector<Expr> &extents, const string &name, int32_t &size) {
+    int64_t result = 1;
+
+    for (size_t i = 0; i < extents.size(); i++) {
+        if (const IntImm *int_size = extents[i].as<IntImm>()) {
+            // Check if the individual dimension is > 2^31 - 1. Not
+            // currently necessary because it's an int32_t, which is
+            // always smaller than 2^31 - 1. If we ever upgrade the
+            // type of IntImm but not the maximum allocation size, we
+            // should re-enable this.
+            /*
+            if ((int64_t)int_size->value > (((int64_t)(1)<<31) - 1)) {
+                user_error
+                    << "Dimension " << i << " for allocation " << name << " has size " <<
+                    int_size->value << " which is greater than 2^31 - 1.";
+            }
+            */
+            result *= int_size->value;
+            if (result > (static_cast<int64_t>(1)<<31) - 1) {
+                user_error
+                    << "Total size for allocation " << name
+                    << " is constant but exceeds 2^31 - 1.\n";
+            }
+        } else {
+            return false;
+        }
+    }
+
+    size = static_cast<int32_t>(result);
+    return true;
+}
+
+Expr allocation_size_in_bytes(Type type, const vector<Expr> &extents, int64_t *constant_size) {
+    int64_t bytes_per_element = type.bytes() * type.width;
+    Expr size = make_const(Int(64), (int)bytes_per_element);
+    bool constant = true;
+    int64_t result = bytes_per_element;
+    for (size_t i = 0; i < extents.size(); i++) {
+        const IntImm *extent = extents[i].as<IntImm>();
+        if (extent && constant) {
+            result *= extent->value;
+            // Past this, the size overflows the int32 the allocation
+            // is made with anyway.
+            constant = result <= 0x7fffffff;
+        } else {
+            constant = false;
+        }
+        size = size * cast<int64_t>(extents[i]);
+    }
+    if (constant_size) {
+        *constant_size = constant ? result : -1;
+    }
+    return size;
+}
+
+bool allocation_goes_on_stack(int64_t constant_size, MemoryType memory_type) {
+    return (constant_size >= 0 &&
+            constant_size <= max_stack_allocation_bytes &&
+            memory_type != MemoryType::Heap);
+}
+
+Stmt allocation_size_check(const string &name, Expr size) {
+    string message = "32-bit signed overflow computing size of allocation " + name;
+    return AssertStmt::make(size <= make_const(Int(64), 0x7fffffff), message.c_str());
+}
+
+}
+}
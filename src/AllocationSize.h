@@ -0,0 +1,48 @@
+#ifndef HALIDE_ALLOCATION_SIZE_H
+#define HALIDE_ALLOCATION_SIZE_H
+
+/** \file
+ * Defines helpers for working out how big an allocation is, and
+ * whether it goes on the stack or the heap.
+ */
+
+#include <vector>
+
+#include "IR.h"
+
+namespace Halide {
+namespace Internal {
+
+/** Allocations with a constant size at most this many bytes go in a
+ * fixed stack slot, unless they ask for the heap. */
+const int64_t max_stack_allocation_bytes = 1024 * 16;
+
+/** A routine to check if a list of extents are all constants, and if so
+ * verify the total size is less than 2^31 - 1. If the result is constant,
+ * but overflows, this routine asserts. The name parameter is used in the
+ * assertion message. */
+bool constant_allocation_size(const std::vector<Expr> &extents, const std::string &name, int32_t &size);
+
+/** Compute the size in bytes of an allocation of the given type and
+ * extents as an Int(64) expression, so that it can be checked for
+ * 32-bit overflow with allocation_size_check. If constant_size is
+ * not NULL, it's set to the size if all the extents are constants
+ * and the size fits in an int32, and to -1 otherwise. */
+Expr allocation_size_in_bytes(Type type, const std::vector<Expr> &extents,
+                              int64_t *constant_size = NULL);
+
+/** Whether an allocation with the given constant size (or -1 if it
+ * isn't constant) and memory type goes on the stack. This is the
+ * choice CodeGen_Posix::create_allocation makes, so lowering passes
+ * that want to leave stack allocations alone should ask this. */
+bool allocation_goes_on_stack(int64_t constant_size, MemoryType memory_type);
+
+/** An assertion that the Int(64) size of the named allocation fits
+ * in the int32 that the allocation is made with. The same check
+ * codegen makes for allocations from halide_malloc. */
+Stmt allocation_size_check(const std::string &name, Expr size);
+
+}
+}
+
+#endif
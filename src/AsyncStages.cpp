@@ -0,0 +1,236 @@
+#include <set>
+
+#include "AsyncStages.h"
+#include "CodeGen_GPU_Dev.h"
+#include "Debug.h"
+#include "Function.h"
+#include "IRMutator.h"
+#include "IROperator.h"
+#include "IRPrinter.h"
+
+namespace Halide {
+namespace Internal {
+
+using std::map;
+using std::set;
+using std::string;
+
+namespace {
+
+bool is_device_loop(const For *op) {
+    return CodeGen_GPU_Dev::is_gpu_var(op->name) ||
+        (op->device_api != DeviceAPI::Host &&
+         op->device_api != DeviceAPI::Parent);
+}
+
+// The buffers a statement reads and writes. A reference to a buffer's
+// handle (e.g. passing it to an extern stage) could do either, so it
+// counts as both.
+class FindBufferAccesses : public IRVisitor {
+public:
+    set<string> reads, writes;
+    bool uses_device;
+
+    // Trace events are expected in program order, and memoized
+    // productions go through the cache, which this doesn't see into.
+    bool traces, memoizes;
+
+    FindBufferAccesses() : uses_device(false), traces(false), memoizes(false) {}
+
+    // Whether this could be run concurrently with anything at all.
+    bool may_run_concurrently() const {
+        return !uses_device && !traces && !memoizes;
+    }
+
+    // Whether the two statements could interfere if run at the same
+    // time.
+    bool conflicts_with(const FindBufferAccesses &other) const {
+        return (intersects(writes, other.writes) ||
+                intersects(writes, other.reads) ||
+                intersects(other.writes, reads));
+    }
+
+private:
+    static bool intersects(const set<string> &a, const set<string> &b) {
+        for (set<string>::const_iterator it = a.begin(); it != a.end(); ++it) {
+            if (b.count(*it)) return true;
+        }
+        return false;
+    }
+
+    using IRVisitor::visit;
+
+    void visit(const Load *op) {
+        IRVisitor::visit(op);
+        reads.insert(op->name);
+    }
+
+    void visit(const Store *op) {
+        IRVisitor::visit(op);
+        writes.insert(op->name);
+    }
+
+    void visit(const Free *op) {
+        writes.insert(op->name);
+    }
+
+    void visit(const Call *op) {
+        IRVisitor::visit(op);
+        if (op->call_type == Call::Image || op->call_type == Call::Halide) {
+            reads.insert(op->name);
+        } else if (op->name == Call::trace || op->name == Call::trace_expr) {
+            traces = true;
+        } else if (starts_with(op->name, "halide_memoization_cache_")) {
+            memoizes = true;
+        }
+    }
+
+    void visit(const Variable *op) {
+        if (op->type == Handle()) {
+            string buf;
+            if (ends_with(op->name, ".buffer")) {
+                buf = op->name.substr(0, op->name.size() - 7);
+            } else if (ends_with(op->name, ".host")) {
+                buf = op->name.substr(0, op->name.size() - 5);
+            }
+            if (!buf.empty()) {
+                reads.insert(buf);
+                writes.insert(buf);
+            }
+        }
+    }
+
+    void visit(const For *op) {
+        IRVisitor::visit(op);
+        if (is_device_loop(op)) {
+            uses_device = true;
+        }
+    }
+};
+
+FindBufferAccesses find_buffer_accesses(Stmt s) {
+    FindBufferAccesses accesses;
+    s.accept(&accesses);
+    return accesses;
+}
+
+Stmt production(const Pipeline *op) {
+    return op->update.defined() ? Block::make(op->produce, op->update) : op->produce;
+}
+
+class RunAsyncStages : public IRMutator {
+    const map<string, Function> &env;
+    int device_loop_depth;
+
+    using IRMutator::visit;
+
+    // Move the production of the async Func 'name' down into s, and
+    // run it alongside the next production found there. Only
+    // descends through statements that set up that production
+    // (lets, allocations and assertions), and only if they don't read
+    // anything the moved production writes. Returns an undefined
+    // Stmt if that's not possible.
+    Stmt run_alongside_next_stage(const string &name, Stmt stage,
+                                  const FindBufferAccesses &accesses, Stmt s) {
+        if (const LetStmt *let = s.as<LetStmt>()) {
+            if (find_buffer_accesses(Evaluate::make(let->value)).conflicts_with(accesses)) {
+                return Stmt();
+            }
+            Stmt body = run_alongside_next_stage(name, stage, accesses, let->body);
+            return body.defined() ? LetStmt::make(let->name, let->value, body) : Stmt();
+        } else if (const Allocate *alloc = s.as<Allocate>()) {
+            Stmt body = run_alongside_next_stage(name, stage, accesses, alloc->body);
+            return body.defined() ?
+                Allocate::make(alloc->name, alloc->type, alloc->extents, alloc->condition, body,
+                               alloc->new_expr, alloc->free_function, alloc->memory_type) :
+                Stmt();
+        } else if (const Block *block = s.as<Block>()) {
+            if (block->first.as<AssertStmt>() && block->rest.defined()) {
+                if (find_buffer_accesses(block->first).conflicts_with(accesses)) {
+                    return Stmt();
+                }
+                Stmt rest = run_alongside_next_stage(name, stage, accesses, block->rest);
+                return rest.defined() ? Block::make(block->first, rest) : Stmt();
+            } else {
+                Stmt first = run_alongside_next_stage(name, stage, accesses, block->first);
+                return first.defined() ? Block::make(first, block->rest) : Stmt();
+            }
+        } else if (const Pipeline *next = s.as<Pipeline>()) {
+            Stmt next_stage = production(next);
+            FindBufferAccesses next_accesses = find_buffer_accesses(next_stage);
+            map<string, Function>::const_iterator next_func = env.find(next->name);
+            if (!next_accesses.may_run_concurrently() ||
+                (next_func != env.end() && next_func->second.schedule().memoized())) {
+                debug(3) << "Not running " << name << " alongside " << next->name
+                         << " because " << next->name << " is traced, memoized, or runs on a device\n";
+                return Stmt();
+            }
+            if (next_accesses.conflicts_with(accesses)) {
+                debug(3) << "Not running " << name << " alongside " << next->name
+                         << " because they share buffers\n";
+                return Stmt();
+            }
+
+            debug(3) << "Running " << name << " alongside " << next->name << "\n";
+            string fork_name = name + ".fork";
+            Expr fork = Variable::make(Int(32), fork_name);
+            Stmt body = IfThenElse::make(fork == 0, stage, next_stage);
+            body = For::make(fork_name, 0, 2, ForType::Parallel, DeviceAPI::Host, body);
+            return Pipeline::make(next->name, body, Stmt(), next->consume);
+        } else {
+            return Stmt();
+        }
+    }
+
+    void visit(const For *op) {
+        bool device = is_device_loop(op);
+        if (device) device_loop_depth++;
+        IRMutator::visit(op);
+        if (device) device_loop_depth--;
+    }
+
+    void visit(const Pipeline *op) {
+        // Work from the innermost stage outwards, so that a chain of
+        // async stages can all join the same fork.
+        IRMutator::visit(op);
+        op = stmt.as<Pipeline>();
+        internal_assert(op);
+
+        map<string, Function>::const_iterator iter = env.find(op->name);
+        if (device_loop_depth > 0 ||
+            iter == env.end() ||
+            !iter->second.schedule().async()) {
+            return;
+        }
+
+        // The cache lookups of a memoized Func wrap its Pipeline, so
+        // check the schedule too.
+        Stmt stage = production(op);
+        FindBufferAccesses accesses = find_buffer_accesses(stage);
+        if (!accesses.may_run_concurrently() || iter->second.schedule().memoized()) {
+            debug(2) << "Func " << op->name << " is scheduled async, but is traced, "
+                     << "memoized, or runs on a device\n";
+            return;
+        }
+
+        Stmt result = run_alongside_next_stage(op->name, stage, accesses, op->consume);
+        if (result.defined()) {
+            stmt = result;
+        } else {
+            debug(2) << "Func " << op->name << " is scheduled async, but there "
+                     << "is no independent stage to run it alongside\n";
+        }
+    }
+
+public:
+    RunAsyncStages(const map<string, Function> &e) : env(e), device_loop_depth(0) {}
+};
+
+}
+
+Stmt run_async_stages_concurrently(Stmt s, const map<string, Function> &env) {
+    return RunAsyncStages(env).mutate(s);
+}
+
+}
+}
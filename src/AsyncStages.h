@@ -0,0 +1,29 @@
+#ifndef HALIDE_ASYNC_STAGES_H
+#define HALIDE_ASYNC_STAGES_H
+
+/** \file
+ * Defines the lowering pass that runs independent stages
+ * concurrently.
+ */
+
+#include <map>
+
+#include "IR.h"
+
+namespace Halide {
+namespace Internal {
+
+class Function;
+
+/** For each Func scheduled with Func::async, look for the next
+ * stage produced after it at the same loop level. If that stage
+ * doesn't touch any buffer the async Func writes (and vice versa),
+ * run the two productions concurrently as the two iterations of a
+ * parallel loop. Chains of async Funcs nest, so several independent
+ * stages can all run at once. */
+Stmt run_async_stages_concurrently(Stmt s, const std::map<std::string, Function> &env);
+
+}
+}
+
+#endif
@@ -246,7 +246,7 @@ string CodeGen_C::print_name(const string &name) {
     return oss.str();
 }
 
-void CodeGen_C::compile_header(const string &name, const vector<Argument> &args) {
+void CodeGen_C::compile_header(const string &name, const vector<Argument> &args, bool async_wrapper) {
     stream << "#ifndef HALIDE_" << name << '\n'
            << "#define HALIDE_" << name << '\n';
 
@@ -282,6 +282,18 @@ void CodeGen_C::compile_header(const string &name, const vector<Argument> &args)
     stream << "#endif\n";
     stream << "int " << name << "_argv(void **args) HALIDE_FUNCTION_ATTRS;\n";
 
+    // And the one that runs the _argv call on the thread pool and
+    // reports back via a callback (see halide_do_async). Only object
+    // files compiled by the LLVM backend define it.
+    if (async_wrapper) {
+        stream << "#ifdef __cplusplus\n";
+        stream << "extern \"C\"\n";
+        stream << "#endif\n";
+        stream << "void " << name << "_async(void **args, "
+               << "void (*done)(void *user_context, int result, void *done_arg), "
+               << "void *done_arg) HALIDE_FUNCTION_ATTRS;\n";
+    }
+
     stream << "#endif\n";
 }
 
@@ -315,6 +327,16 @@ class ExternCallPrototypes : public IRGraphVisitor {
         }
     }
 
+    void visit(const Allocate *op) {
+        IRGraphVisitor::visit(op);
+
+        // Custom free functions have the same signature as halide_free.
+        if (!op->free_function.empty() && !emitted.count(op->free_function)) {
+            stream << "extern \"C\" void " << op->free_function << "(void *, void *);\n";
+            emitted.insert(op->free_function);
+        }
+    }
+
 public:
     ostream &stream;
     ExternCallPrototypes(ostream &s) : stream(s) {
@@ -858,6 +880,15 @@ void CodeGen_C::visit(const Call *op) {
             string a0 = print_expr(op->args[0]);
             string a1 = print_expr(op->args[1]);
             rhs << "((buffer_t *)(" << a0 << "))->min[" << a1 << "]";
+        } else if (op->name == Call::extract_buffer_stride) {
+            internal_assert(op->args.size() == 2);
+            string a0 = print_expr(op->args[0]);
+            string a1 = print_expr(op->args[1]);
+            rhs << "((buffer_t *)(" << a0 << "))->stride[" << a1 << "]";
+        } else if (op->name == Call::extract_buffer_host) {
+            internal_assert(op->args.size() == 1);
+            string a0 = print_expr(op->args[0]);
+            rhs << "((buffer_t *)(" << a0 << "))->host";
         } else if (op->name == Call::set_host_dirty) {
             internal_assert(op->args.size() == 2);
             string a0 = print_expr(op->args[0]);
@@ -1095,6 +1126,9 @@ void CodeGen_C::visit(const For *op) {
     if (op->for_type == ForType::Parallel) {
         do_indent();
         stream << "#pragma omp parallel for\n";
+    } else if (op->for_type == ForType::GuidedParallel) {
+        do_indent();
+        stream << "#pragma omp parallel for schedule(guided)\n";
     } else {
         internal_assert(op->for_type == ForType::Serial)
             << "Can only emit serial or parallel for loops to C\n";
@@ -1140,7 +1174,14 @@ void CodeGen_C::visit(const Allocate *op) {
                        << op->name << " is constant but exceeds 2^31 - 1.\n";
         } else {
             size_id = print_expr(Expr(static_cast<int32_t>(constant_size)));
-            if (stack_bytes <= 1024 * 8) {
+            // Allocations that ask for the stack get it up to the
+            // same size the LLVM backends put in a fixed stack
+            // slot. Bigger ones, and ones sized at runtime, go on the
+            // heap, as there's no portable way to check them against
+            // the stack size in C.
+            if (allocation_goes_on_stack(stack_bytes, op->memory_type) &&
+                (op->memory_type == MemoryType::Stack ||
+                 stack_bytes <= max_stack_allocation_bytes / 2)) {
                 on_stack = true;
             }
         }
@@ -1193,7 +1234,16 @@ void CodeGen_C::visit(const Allocate *op) {
     do_indent();
     stream << print_type(op->type) << ' ';
 
-    if (on_stack) {
+    if (op->new_expr.defined()) {
+        // Someone else allocated the memory for us.
+        stream << "*"
+               << print_name(op->name)
+               << " = ("
+               << print_type(op->type)
+               << " *)(" << print_expr(op->new_expr) << ");\n";
+        heap_allocations.push(op->name, 0);
+        free_functions.push(op->name, op->free_function.empty() ? "halide_free" : op->free_function);
+    } else if (on_stack) {
         stream << print_name(op->name)
                << "[" << size_id << "];\n";
     } else {
@@ -1207,6 +1257,7 @@ void CodeGen_C::visit(const Allocate *op) {
                << print_type(op->type)
                << ")*" << size_id << ");\n";
         heap_allocations.push(op->name, 0);
+        free_functions.push(op->name, "halide_free");
     }
 
     op->body.accept(this);
@@ -1220,11 +1271,12 @@ void CodeGen_C::visit(const Allocate *op) {
 void CodeGen_C::visit(const Free *op) {
     if (heap_allocations.contains(op->name)) {
         do_indent();
-        stream << "halide_free("
+        stream << free_functions.get(op->name) << "("
                << (have_user_context ? "__user_context_, " : "NULL, ")
                << print_name(op->name)
                << ");\n";
         heap_allocations.pop(op->name);
+        free_functions.pop(op->name);
     }
     allocations.pop(op->name);
 }
@@ -38,8 +38,10 @@ public:
                  const std::vector<Buffer> &images_to_embed);
 
     /** Emit a header file defining a halide pipeline with the given
-     * type signature */
-    void compile_header(const std::string &name, const std::vector<Argument> &args);
+     * type signature. If async_wrapper is true, it also declares the
+     * name_async entry point that the LLVM backend generates. */
+    void compile_header(const std::string &name, const std::vector<Argument> &args,
+                        bool async_wrapper = false);
 
     static void test();
 
@@ -84,6 +86,9 @@ protected:
     /** Track which allocations actually went on the heap. */
     Scope<int> heap_allocations;
 
+    /** The function that frees each heap allocation. */
+    Scope<std::string> free_functions;
+
     /** True if there is a void * __user_context parameter in the arguments. */
     bool have_user_context;
 
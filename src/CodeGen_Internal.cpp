@@ -191,38 +191,6 @@ llvm::Type *llvm_type_of(LLVMContext *c, Halide::Type t) {
     }
 }
 
-bool constant_allocation_size(const std::vector<Expr> &extents, const std::string &name, int32_t &size) {
-    int64_t result = 1;
-
-    for (size_t i = 0; i < extents.size(); i++) {
-        if (const IntImm *int_size = extents[i].as<IntImm>()) {
-            // Check if the individual dimension is > 2^31 - 1. Not
-            // currently necessary because it's an int32_t, which is
-            // always smaller than 2^31 - 1. If we ever upgrade the
-            // type of IntImm but not the maximum allocation size, we
-            // should re-enable this.
-            /*
-            if ((int64_t)int_size->value > (((int64_t)(1)<<31) - 1)) {
-                user_error
-                    << "Dimension " << i << " for allocation " << name << " has size " <<
-                    int_size->value << " which is greater than 2^31 - 1.";
-            }
-            */
-            result *= int_size->value;
-            if (result > (static_cast<int64_t>(1)<<31) - 1) {
-                user_error
-                    << "Total size for allocation " << name
-                    << " is constant but exceeds 2^31 - 1.\n";
-            }
-        } else {
-            return false;
-        }
-    }
-
-    size = static_cast<int32_t>(result);
-    return true;
-}
-
 // Returns true if the given function name is one of the Halide runtime
 // functions that takes a user_context pointer as its first parameter.
 bool function_takes_user_context(const std::string &name) {
@@ -246,6 +214,15 @@ bool function_takes_user_context(const std::string &name) {
         "halide_trace",
         "halide_memoization_cache_lookup",
         "halide_memoization_cache_store",
+        "halide_memoization_cache_release",
+        "halide_scratch_arena_acquire",
+        "halide_scratch_arena_release",
+        "halide_scratch_alloc",
+        "halide_scratch_free",
+        "halide_memory_tracker_alloc",
+        "halide_memory_tracker_free",
+        "halide_malloc_with_hints",
+        "halide_free_with_hints",
         "halide_cuda_run",
         "halide_opencl_run",
         "halide_opengl_run",
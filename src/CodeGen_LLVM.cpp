@@ -457,6 +457,42 @@ void CodeGen_LLVM::compile(Stmt stmt, string name,
     builder->CreateRet(result);
     internal_assert(verifyFunction(*wrapper) == false);
 
+    // And a wrapper that queues a call to the argv wrapper on the
+    // thread pool and returns immediately.
+    llvm::Function *do_async = module->getFunction("halide_do_async");
+    if (do_async) {
+        llvm::FunctionType *do_async_t = do_async->getFunctionType();
+        llvm::Type *done_t = do_async_t->getParamType(3);
+        func_t = FunctionType::get(void_t, vec<llvm::Type *>(i8->getPointerTo()->getPointerTo(),
+                                                             done_t, i8->getPointerTo()), false);
+        llvm::Function *async_wrapper =
+            llvm::Function::Create(func_t, llvm::Function::ExternalLinkage, name + "_async", module);
+        block = BasicBlock::Create(*context, "entry", async_wrapper);
+        builder->SetInsertPoint(block);
+
+        llvm::Function::arg_iterator async_arg = async_wrapper->arg_begin();
+        Value *async_args = async_arg++;
+        Value *done = async_arg++;
+        Value *done_arg = async_arg++;
+
+        // The user context, if there is one, is also needed to pick
+        // the thread pool and to pass to the callback.
+        Value *user_context = ConstantPointerNull::get(i8->getPointerTo());
+        for (size_t i = 0; i < args.size(); i++) {
+            if (args[i].name == "__user_context") {
+                Value *ptr = builder->CreateConstGEP1_32(async_args, (int)i);
+                ptr = builder->CreateLoad(ptr);
+                ptr = builder->CreatePointerCast(ptr, i8->getPointerTo()->getPointerTo());
+                user_context = builder->CreateLoad(ptr);
+            }
+        }
+
+        Value *argv_fn = builder->CreatePointerCast(wrapper, do_async_t->getParamType(1));
+        builder->CreateCall(do_async, vec<Value *>(user_context, argv_fn, async_args, done, done_arg));
+        builder->CreateRetVoid();
+        internal_assert(verifyFunction(*async_wrapper) == false);
+    }
+
     // Finally, verify the module is ok
     internal_assert(verifyModule(*module) == false);
     debug(2) << "Done generating llvm bitcode\n";
@@ -1909,6 +1945,18 @@ void CodeGen_LLVM::visit(const Call *op) {
             Value *min = buffer_min(buffer, idx->value);
             Value *max_plus_one = builder->CreateNSWAdd(min, extent);
             value = builder->CreateNSWSub(max_plus_one, ConstantInt::get(i32, 1));
+        } else if (op->name == Call::extract_buffer_stride) {
+            internal_assert(op->args.size() == 2);
+            const IntImm *idx = op->args[1].as<IntImm>();
+            internal_assert(idx);
+            Value *buffer = codegen(op->args[0]);
+            buffer = builder->CreatePointerCast(buffer, buffer_t_type->getPointerTo());
+            value = buffer_stride(buffer, idx->value);
+        } else if (op->name == Call::extract_buffer_host) {
+            internal_assert(op->args.size() == 1);
+            Value *buffer = codegen(op->args[0]);
+            buffer = builder->CreatePointerCast(buffer, buffer_t_type->getPointerTo());
+            value = buffer_host(buffer);
         } else if (op->name == Call::rewrite_buffer) {
             int dims = ((int)(op->args.size())-2)/3;
             internal_assert((int)(op->args.size()) == dims*3 + 2);
@@ -2545,7 +2593,7 @@ void CodeGen_LLVM::visit(const For *op) {
 
         // Pop the loop variable from the scope
         sym_pop(op->name);
-    } else if (op->for_type == ForType::Parallel) {
+    } else if (is_parallel(op->for_type)) {
 
         debug(3) << "Entering parallel for loop over " << op->name << "\n";
 
@@ -2608,8 +2656,10 @@ void CodeGen_LLVM::visit(const For *op) {
 
         // Move the builder back to the main function and call do_par_for
         builder->SetInsertPoint(call_site);
-        llvm::Function *do_par_for = module->getFunction("halide_do_par_for");
-        internal_assert(do_par_for) << "Could not find halide_do_par_for in initial module\n";
+        string do_par_for_name = (op->for_type == ForType::GuidedParallel ?
+                                  "halide_do_guided_par_for" : "halide_do_par_for");
+        llvm::Function *do_par_for = module->getFunction(do_par_for_name);
+        internal_assert(do_par_for) << "Could not find " << do_par_for_name << " in initial module\n";
         do_par_for->setDoesNotAlias(5);
         //do_par_for->setDoesNotCapture(5);
         ptr = builder->CreatePointerCast(ptr, i8->getPointerTo());
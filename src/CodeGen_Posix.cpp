@@ -19,6 +19,19 @@ using std::make_pair;
 
 using namespace llvm;
 
+namespace {
+
+// Whether new_expr calls a runtime allocator that returns NULL when
+// it runs out of memory.
+bool allocator_can_fail(Expr new_expr) {
+    const Call *call = new_expr.as<Call>();
+    return call && call->call_type == Call::Extern &&
+        (call->name == "halide_scratch_alloc" ||
+         call->name == "halide_malloc_with_hints");
+}
+
+}
+
 CodeGen_Posix::CodeGen_Posix(Target t) :
   CodeGen_LLVM(t) {
 }
@@ -50,7 +63,44 @@ Value *CodeGen_Posix::codegen_allocation_size(const std::string &name, Type type
 }
 
 CodeGen_Posix::Allocation CodeGen_Posix::create_allocation(const std::string &name, Type type,
-                                                           const std::vector<Expr> &extents, Expr condition) {
+                                                           const std::vector<Expr> &extents, Expr condition,
+                                                           Expr new_expr, std::string free_function,
+                                                           MemoryType memory_type) {
+
+    if (new_expr.defined()) {
+        // The memory was allocated elsewhere (e.g. by the runtime),
+        // and we're just told where it is.
+        Allocation allocation;
+        allocation.constant_bytes = 0;
+        allocation.stack_bytes = 0;
+        allocation.free_function = free_function.empty() ? "halide_free" : free_function;
+        allocation.on_heap = NULL;
+        allocation.saved_stack = NULL;
+
+        debug(4) << "Using custom allocation " << new_expr << " for " << name << "\n";
+        Value *ptr = codegen(new_expr);
+        ptr = builder->CreatePointerCast(ptr, i8->getPointerTo());
+        if (!is_one(condition)) {
+            ptr = builder->CreateSelect(codegen(condition), ptr,
+                                        ConstantPointerNull::get(i8->getPointerTo()));
+        }
+        allocation.ptr = ptr;
+
+        if (allocator_can_fail(new_expr)) {
+            // Assert that the allocation worked, as for halide_malloc
+            // below. Empty allocations may come back NULL.
+            Expr empty = !condition;
+            for (size_t i = 0; i < extents.size(); i++) {
+                empty = empty || extents[i] <= 0;
+            }
+            Value *check = builder->CreateIsNotNull(ptr);
+            check = builder->CreateOr(check, codegen(empty));
+            create_assertion(check, "Out of memory (malloc returned NULL)");
+        }
+
+        allocations.push(name, allocation);
+        return allocation;
+    }
 
     Value *llvm_size = NULL;
     int64_t stack_bytes = 0;
@@ -61,7 +111,7 @@ CodeGen_Posix::Allocation CodeGen_Posix::create_allocation(const std::string &na
 
         if (stack_bytes > ((int64_t(1) << 31) - 1)) {
             user_error << "Total size for allocation " << name << " is constant but exceeds 2^31 - 1.";
-        } else if (stack_bytes <= 1024 * 16) {
+        } else if (allocation_goes_on_stack(stack_bytes, memory_type)) {
             // Round up to nearest multiple of 32.
             stack_bytes = ((stack_bytes + 31)/32)*32;
         } else {
@@ -83,7 +133,10 @@ CodeGen_Posix::Allocation CodeGen_Posix::create_allocation(const std::string &na
     Allocation allocation;
     allocation.constant_bytes = constant_bytes;
     allocation.stack_bytes = stack_bytes;
+    allocation.free_function = "halide_free";
     allocation.ptr = NULL;
+    allocation.on_heap = NULL;
+    allocation.saved_stack = NULL;
     if (stack_bytes != 0) {
         // Try to find a free stack allocation we can use.
         vector<Allocation>::iterator free = free_stack_allocs.end();
@@ -115,6 +168,63 @@ CodeGen_Posix::Allocation CodeGen_Posix::create_allocation(const std::string &na
             allocation.ptr = create_alloca_at_entry(i32x8, stack_bytes/32, name);
             allocation.stack_bytes = stack_bytes;
         }
+    } else if (memory_type == MemoryType::Stack) {
+        // Put it on the stack if it fits under the limit the runtime
+        // gives for the thread we're on, and on the heap otherwise.
+        llvm::Function *limit_fn = module->getFunction("halide_get_stack_allocation_limit");
+        internal_assert(limit_fn) << "Could not find halide_get_stack_allocation_limit in module\n";
+        llvm::Function *malloc_fn = module->getFunction("halide_malloc");
+        internal_assert(malloc_fn) << "Could not find halide_malloc in module\n";
+        malloc_fn->setDoesNotAlias(0);
+
+        // The limit is measured from where the stack is now, so it
+        // already counts the function's other allocations still on
+        // it.
+        Value *limit = builder->CreateCall(limit_fn);
+        limit = builder->CreateIntCast(limit, llvm_size->getType(), true);
+        Value *fits = builder->CreateICmpSLE(llvm_size, limit);
+
+        llvm::Function *stacksave = Intrinsic::getDeclaration(module, Intrinsic::stacksave);
+        Value *saved_stack = builder->CreateCall(stacksave);
+
+        BasicBlock *stack_bb = BasicBlock::Create(*context, name + " on stack", function);
+        BasicBlock *heap_bb = BasicBlock::Create(*context, name + " on heap", function);
+        BasicBlock *after_bb = BasicBlock::Create(*context, name + " allocated", function);
+        builder->CreateCondBr(fits, stack_bb, heap_bb);
+
+        debug(4) << "Allocating " << name << " on the stack if it fits, and on the heap otherwise\n";
+        builder->SetInsertPoint(stack_bb);
+        AllocaInst *stack_ptr = builder->CreateAlloca(i8, llvm_size, name);
+        stack_ptr->setAlignment(32);
+        builder->CreateBr(after_bb);
+
+        builder->SetInsertPoint(heap_bb);
+        llvm::Function::arg_iterator arg_iter = malloc_fn->arg_begin();
+        ++arg_iter;  // skip the user context *
+        Value *args[2] = { get_user_context(),
+                           builder->CreateIntCast(llvm_size, arg_iter->getType(), false) };
+        Value *heap_ptr = builder->CreateCall(malloc_fn, args);
+        builder->CreateBr(after_bb);
+
+        builder->SetInsertPoint(after_bb);
+        PHINode *ptr = builder->CreatePHI(i8->getPointerTo(), 2);
+        ptr->addIncoming(stack_ptr, stack_bb);
+        ptr->addIncoming(heap_ptr, heap_bb);
+        PHINode *on_heap = builder->CreatePHI(i1, 2);
+        on_heap->addIncoming(ConstantInt::getFalse(*context), stack_bb);
+        on_heap->addIncoming(ConstantInt::getTrue(*context), heap_bb);
+
+        allocation.ptr = ptr;
+        allocation.on_heap = on_heap;
+        allocation.saved_stack = saved_stack;
+        dynamic_stack_allocs.push_back(make_pair(saved_stack, false));
+
+        // Assert that the allocation worked.
+        Value *check = builder->CreateIsNotNull(ptr);
+        Value *zero_size = builder->CreateIsNull(llvm_size);
+        check = builder->CreateOr(check, zero_size);
+
+        create_assertion(check, "Out of memory (malloc returned NULL)");
     } else {
         // call malloc
         llvm::Function *malloc_fn = module->getFunction("halide_malloc");
@@ -157,18 +267,57 @@ void CodeGen_Posix::free_allocation(const std::string &name) {
 
     internal_assert(alloc.ptr);
 
-    CallInst *call_inst = dyn_cast<CallInst>(alloc.ptr);
-    llvm::Function *allocated_in = call_inst ? call_inst->getParent()->getParent() : NULL;
+    Instruction *inst = dyn_cast<Instruction>(alloc.ptr);
+    llvm::Function *allocated_in = inst ? inst->getParent()->getParent() : NULL;
     llvm::Function *current_func = builder->GetInsertBlock()->getParent();
 
     if (alloc.stack_bytes) {
         // Remember this allocation so it can be re-used by a later allocation.
         free_stack_allocs.push_back(alloc);
+    } else if (alloc.on_heap) {
+        if (allocated_in == current_func) {
+            // Free it if it went on the heap.
+            llvm::Function *free_fn = module->getFunction("halide_free");
+            internal_assert(free_fn) << "Could not find halide_free in module.\n";
+            BasicBlock *free_bb = BasicBlock::Create(*context, name + " free", function);
+            BasicBlock *after_bb = BasicBlock::Create(*context, name + " freed", function);
+            builder->CreateCondBr(alloc.on_heap, free_bb, after_bb);
+            builder->SetInsertPoint(free_bb);
+            Value *args[2] = { get_user_context(), alloc.ptr };
+            builder->CreateCall(free_fn, args);
+            builder->CreateBr(after_bb);
+            builder->SetInsertPoint(after_bb);
+
+            // Pop it off the stack, along with any allocations made
+            // after it that were freed first. If an older one is
+            // still live, this one is popped when that one is.
+            Value *restore_to = NULL;
+            for (size_t i = 0; i < dynamic_stack_allocs.size(); i++) {
+                if (dynamic_stack_allocs[i].first == alloc.saved_stack) {
+                    dynamic_stack_allocs[i].second = true;
+                }
+            }
+            while (!dynamic_stack_allocs.empty() && dynamic_stack_allocs.back().second) {
+                restore_to = dynamic_stack_allocs.back().first;
+                dynamic_stack_allocs.pop_back();
+            }
+            if (restore_to) {
+                llvm::Function *stackrestore = Intrinsic::getDeclaration(module, Intrinsic::stackrestore);
+                builder->CreateCall(stackrestore, restore_to);
+            }
+        }
     } else if (allocated_in == current_func) { // Skip over allocations from outside this function.
         // Call free
-        llvm::Function *free_fn = module->getFunction("halide_free");
-        internal_assert(free_fn) << "Could not find halide_free in module.\n";
-        debug(4) << "Creating call to halide_free\n";
+        llvm::Function *free_fn = module->getFunction(alloc.free_function);
+        if (!free_fn) {
+            // Custom free functions take the same arguments as halide_free.
+            llvm::Function *halide_free_fn = module->getFunction("halide_free");
+            internal_assert(halide_free_fn) << "Could not find halide_free in module.\n";
+            free_fn = llvm::Function::Create(halide_free_fn->getFunctionType(),
+                                             llvm::Function::ExternalLinkage,
+                                             alloc.free_function, module);
+        }
+        debug(4) << "Creating call to " << alloc.free_function << "\n";
         Value *args[2] = { get_user_context(), alloc.ptr };
         builder->CreateCall(free_fn, args);
     }
@@ -184,7 +333,9 @@ void CodeGen_Posix::visit(const Allocate *alloc) {
     }
 
     Allocation allocation = create_allocation(alloc->name, alloc->type,
-                                              alloc->extents, alloc->condition);
+                                              alloc->extents, alloc->condition,
+                                              alloc->new_expr, alloc->free_function,
+                                              alloc->memory_type);
     sym_push(alloc->name + ".host", allocation.ptr);
 
     codegen(alloc->body);
@@ -202,6 +353,7 @@ void CodeGen_Posix::visit(const Free *stmt) {
 void CodeGen_Posix::prepare_for_early_exit() {
     // We've jumped to a code path that will be called just before
     // bailing out. Free everything outstanding.
+    vector<pair<Value *, bool> > stashed_dynamic_stack_allocs = dynamic_stack_allocs;
     vector<string> names;
     for (Scope<Allocation>::iterator iter = allocations.begin();
          iter != allocations.end(); ++iter) {
@@ -226,6 +378,7 @@ void CodeGen_Posix::prepare_for_early_exit() {
     }
 
     free_stack_allocs.clear();
+    dynamic_stack_allocs.swap(stashed_dynamic_stack_allocs);
 }
 
 }}
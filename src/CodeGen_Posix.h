@@ -24,7 +24,9 @@ protected:
 
     /** Posix implementation of Allocate. Small constant-sized allocations go
      * on the stack. The rest go on the heap by calling "halide_malloc"
-     * and "halide_free" in the standard library. */
+     * and "halide_free" in the standard library, unless the Allocate
+     * node asks for the stack, in which case they go on the stack if
+     * they fit under halide_get_stack_allocation_limit. */
     // @{
     void visit(const Allocate *);
     void visit(const Free *);
@@ -41,6 +43,16 @@ protected:
         /** How many bytes of stack space used. 0 implies it was a
          * heap allocation. */
         int stack_bytes;
+
+        /** The runtime function that releases a heap allocation
+         * (halide_free unless the Allocate node said otherwise). */
+        std::string free_function;
+
+        /** For allocations sized at runtime that asked for the stack,
+         * an i1 saying whether they ended up on the heap, and the
+         * stack pointer saved before the alloca. NULL otherwise. */
+        llvm::Value *on_heap;
+        llvm::Value *saved_stack;
     };
 
     /** The allocations currently in scope. The stack gets pushed when
@@ -57,6 +69,12 @@ private:
      * they aren't being used. */
     std::vector<Allocation> free_stack_allocs;
 
+    /** The stack pointers saved before each dynamically-sized stack
+     * allocation still on the stack, oldest first, and whether it has
+     * been freed. The stack can only be unwound past allocations
+     * that have all been freed. */
+    std::vector<std::pair<llvm::Value *, bool> > dynamic_stack_allocs;
+
     /** Generates code for computing the size of an allocation from a
      * list of its extents and its size. Fires a runtime assert
      * (halide_error) if the size overflows 2^31 -1, the maximum
@@ -74,16 +92,29 @@ private:
      * 'allocations' map, and adds an entry to the symbol table called
      * name.host that provides the base pointer.
      *
+     * If memory_type is MemoryType::Heap the allocation always goes on
+     * the heap. If it is MemoryType::Stack, allocations too big for
+     * a fixed stack slot are made with a dynamic alloca when they fit
+     * under halide_get_stack_allocation_limit, and with halide_malloc
+     * otherwise.
+     *
+     * If new_expr is defined, no memory is allocated, and the
+     * allocation instead uses the pointer new_expr evaluates to,
+     * which is later released with free_function.
+     *
      * When the allocation can be freed call 'free_allocation', and
      * when it goes out of scope call 'destroy_allocation'. */
     Allocation create_allocation(const std::string &name, Type type,
                                  const std::vector<Expr> &extents,
-                                 Expr condition);
+                                 Expr condition, Expr new_expr = Expr(),
+                                 std::string free_function = std::string(),
+                                 MemoryType memory_type = MemoryType::Auto);
 
     /** Free the memory backing an allocation and pop it from the
      * symbol table and the allocations map. For heap allocations it
-     * calls halide_free in the runtime, for stack allocations it
-     * marks the block as free so it can be reused. */
+     * calls halide_free (or the allocation's custom free function)
+     * in the runtime, for stack allocations it marks the block as
+     * free so it can be reused. */
     void free_allocation(const std::string &name);
 };
 
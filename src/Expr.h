@@ -246,6 +246,60 @@ struct DeviceAPI {
 };
 #endif
 
+/** Where a buffer is stored. Auto puts small buffers of constant size
+ * on the stack and everything else on the heap. Heap always uses
+ * halide_malloc. Stack puts buffers of any size on the stack, as long
+ * as they fit (see halide_get_stack_allocation_limit); those that
+ * don't go on the heap instead. Used by schedules, and in the
+ * Allocate IR node. */
+#if __cplusplus > 199711L // C++11 strongly typed enum
+enum class MemoryType {
+    Auto,
+    Heap,
+    Stack
+};
+#else
+struct MemoryType {
+    enum Values {
+        Auto,
+        Heap,
+        Stack
+    };
+    int val;
+    MemoryType() : val(Auto) { }
+    MemoryType(int val) : val(val) { }
+    operator int() const { return val; }
+};
+#endif
+
+/** How the iterations of a parallel loop are handed out to threads
+ * at runtime. Static gives each thread an even share up front, and
+ * idle threads steal single iterations from the others. Guided
+ * (a form of guided self-scheduling) has threads claim chunks of their share
+ * at a time, starting large and shrinking as the share runs out,
+ * which costs less per iteration for loops with many cheap
+ * iterations while still balancing uneven ones. Each thread's chunk
+ * is 1/num_threads of what's left of its own share, rather than of
+ * the whole loop as in textbook guided self-scheduling, so threads
+ * don't all contend on one counter. */
+#if __cplusplus > 199711L // C++11 strongly typed enum
+enum class ParallelChunking {
+    Static,
+    Guided
+};
+#else
+struct ParallelChunking {
+    enum Values {
+        Static,
+        Guided
+    };
+    int val;
+    ParallelChunking() : val(Static) { }
+    ParallelChunking(Values val) : val(val) { }
+    operator int() const { return val; }
+};
+#endif
+
 namespace Internal {
 
 /** An enum describing a type of loop traversal. Used in schedules,
@@ -255,7 +309,8 @@ enum class ForType {
     Serial,
     Parallel,
     Vectorized,
-    Unrolled
+    Unrolled,
+    GuidedParallel
 };
 #else
 struct ForType {
@@ -263,7 +318,8 @@ struct ForType {
         Serial,
         Parallel,
         Vectorized,
-        Unrolled
+        Unrolled,
+        GuidedParallel
     };
     int val;
     ForType() : val(Serial) { }
@@ -272,6 +328,13 @@ struct ForType {
 };
 #endif
 
+/** Check whether a loop type runs its iterations on the thread
+ * pool. GuidedParallel loops are Parallel loops that hand out their
+ * iterations with ParallelChunking::Guided. */
+inline bool is_parallel(ForType t) {
+    return t == ForType::Parallel || t == ForType::GuidedParallel;
+}
+
 
 /** A reference-counted handle to a statement node. */
 struct Stmt : public IRHandle {
@@ -2,6 +2,10 @@
 #include <iostream>
 #include <string.h>
 #include <fstream>
+#if __cplusplus > 199711L || _MSC_VER >= 1800
+#include <mutex>
+#include <condition_variable>
+#endif
 
 #ifdef _MSC_VER
 #include <intrin.h>
@@ -373,7 +377,7 @@ void Stage::set_dim_type(VarOrRVar var, ForType t) {
 
             // If it's an rvar and the for type is parallel, we need to
             // validate that this doesn't introduce a race condition.
-            if (!dims[i].pure && var.is_rvar && (t == ForType::Vectorized || t == ForType::Parallel)) {
+            if (!dims[i].pure && var.is_rvar && (t == ForType::Vectorized || is_parallel(t))) {
                 user_assert(schedule.allow_race_conditions())
                     << "In schedule for " << stage_name
                     << ", marking var " << var.name()
@@ -669,6 +673,15 @@ Stage &Stage::parallel(VarOrRVar var) {
     return *this;
 }
 
+Stage &Stage::parallel(VarOrRVar var, ParallelChunking chunking) {
+    if (chunking == ParallelChunking::Guided) {
+        set_dim_type(var, ForType::GuidedParallel);
+    } else {
+        set_dim_type(var, ForType::Parallel);
+    }
+    return *this;
+}
+
 Stage &Stage::vectorize(VarOrRVar var) {
     set_dim_type(var, ForType::Vectorized);
     return *this;
@@ -691,6 +704,12 @@ Stage &Stage::parallel(VarOrRVar var, Expr factor) {
     return *this;
 }
 
+Stage &Stage::parallel(VarOrRVar var, Expr factor, ParallelChunking chunking) {
+    parallel(var, factor);
+    parallel(var, chunking);
+    return *this;
+}
+
 Stage &Stage::vectorize(VarOrRVar var, int factor) {
     if (var.is_rvar) {
         RVar tmp;
@@ -1017,9 +1036,34 @@ Func &Func::allow_race_conditions() {
     return *this;
 }
 
-Func &Func::memoize() {
+Func &Func::memoize(const std::string &partition, int64_t budget) {
+    user_assert(budget >= 0) << "Memoization budget for Func " << name() << " must not be negative.\n";
+    user_assert(budget == 0 || !partition.empty())
+        << "Func " << name() << " has a memoization budget but no partition. "
+        << "Use halide_memoization_cache_set_size to size the default partition.\n";
     invalidate_cache();
     func.schedule().memoized() = true;
+    func.schedule().memoize_partition() = partition;
+    func.schedule().memoize_budget() = budget;
+    return *this;
+}
+
+Func &Func::allocation_hints(int hints) {
+    user_assert(hints >= 0) << "Allocation hints for Func " << name() << " must not be negative.\n";
+    invalidate_cache();
+    func.schedule().allocation_hints() = hints;
+    return *this;
+}
+
+Func &Func::store_in(MemoryType memory_type) {
+    invalidate_cache();
+    func.schedule().memory_type() = memory_type;
+    return *this;
+}
+
+Func &Func::async() {
+    invalidate_cache();
+    func.schedule().async() = true;
     return *this;
 }
 
@@ -1058,6 +1102,18 @@ Func &Func::parallel(VarOrRVar var, Expr factor) {
     return *this;
 }
 
+Func &Func::parallel(VarOrRVar var, ParallelChunking chunking) {
+    invalidate_cache();
+    Stage(func.schedule(), name()).parallel(var, chunking);
+    return *this;
+}
+
+Func &Func::parallel(VarOrRVar var, Expr factor, ParallelChunking chunking) {
+    invalidate_cache();
+    Stage(func.schedule(), name()).parallel(var, factor, chunking);
+    return *this;
+}
+
 Func &Func::vectorize(VarOrRVar var, int factor) {
     invalidate_cache();
     Stage(func.schedule(), name()).vectorize(var, factor);
@@ -1808,6 +1864,7 @@ public:
     vector<Argument> arg_types;
     vector<const void *> arg_values;
     vector<pair<int, Internal::Parameter> > image_param_args;
+    vector<int> scalar_param_args;
     vector<pair<int, Buffer> > image_args;
 
     InferArguments(const string &o, bool include_buffers = true)
@@ -1911,6 +1968,7 @@ private:
                 arg_values.push_back(NULL);
             }
         } else {
+            scalar_param_args.push_back((int)arg_values.size());
             arg_values.push_back(p.get_scalar_address());
         }
     }
@@ -2083,16 +2141,24 @@ void Func::compile_to_object(const string &filename, vector<Argument> args, cons
     compile_to_object(filename, args, "", target);
 }
 
-void Func::compile_to_header(const string &filename, vector<Argument> args, const string &fn_name, const Target &target) {
+namespace {
+void write_header(const Func &f, const string &filename, vector<Argument> args,
+                  const string &fn_name, const Target &target, bool async_wrapper) {
     args = add_user_context_arg(args, target);
 
-    for (int i = 0; i < outputs(); i++) {
-        args.push_back(output_buffers()[i]);
+    for (int i = 0; i < f.outputs(); i++) {
+        args.push_back(f.output_buffers()[i]);
     }
 
     ofstream header(filename.c_str());
     CodeGen_C cg(header);
-    cg.compile_header(fn_name.empty() ? name() : fn_name, args);
+    cg.compile_header(fn_name.empty() ? f.name() : fn_name, args, async_wrapper);
+}
+}
+
+void Func::compile_to_header(const string &filename, vector<Argument> args, const string &fn_name, const Target &target) {
+    // The header may go with C source, which has no _async wrapper.
+    write_header(*this, filename, args, fn_name, target, false);
 }
 
 void Func::compile_to_c(const string &filename, vector<Argument> args,
@@ -2236,7 +2302,7 @@ void Func::compile_to_simplified_lowered_stmt(const std::string &filename,
 
 void Func::compile_to_file(const string &filename_prefix, vector<Argument> args,
                            const Target &target) {
-    compile_to_header(filename_prefix + ".h", args, filename_prefix, target);
+    write_header(*this, filename_prefix + ".h", args, filename_prefix, target, true);
     compile_to_object(filename_prefix + ".o", args, filename_prefix, target);
 }
 
@@ -2292,6 +2358,10 @@ void Func::set_custom_do_par_for(int (*cust_do_par_for)(void *, int (*)(void *,
     jit_handlers.custom_do_par_for = cust_do_par_for;
 }
 
+void Func::set_custom_get_thread_pool(struct halide_thread_pool *(*cust_get_thread_pool)(void *)) {
+    jit_handlers.custom_get_thread_pool = cust_get_thread_pool;
+}
+
 void Func::set_custom_do_task(int (*cust_do_task)(void *, int (*)(void *, int, uint8_t *), int, uint8_t *)) {
     jit_handlers.custom_do_task = cust_do_task;
 }
@@ -2410,9 +2480,105 @@ struct JITFuncCallContext {
     }
 };
 
+struct AsyncRealizationContents {
+    mutable RefCount ref_count;
+
+    // Keep the compiled code and all the buffers alive until the run
+    // finishes.
+    JITModule module;
+    std::vector<Buffer> outputs, inputs;
+    std::vector<const void *> args;
+    // The values of the scalar params when the run was queued. The
+    // scalar args point here rather than at the Params.
+    std::vector<uint64_t> scalar_values;
+
+    ErrorBuffer error_buffer;
+    JITUserContext jit_context;
+    // The pipeline's user context argument points here.
+    void *jit_context_ptr;
+
+    int exit_status;
+    bool reported;
+    volatile bool finished;
+    #if __cplusplus > 199711L || _MSC_VER >= 1800
+    std::mutex mutex;
+    std::condition_variable finished_cond;
+    #endif
+
+    AsyncRealizationContents(const JITHandlers &handlers)
+        : jit_context_ptr(&jit_context), exit_status(0), reported(false), finished(false) {
+        void *user_context = NULL;
+        JITHandlers local_handlers = handlers;
+        if (local_handlers.custom_error == NULL) {
+            local_handlers.custom_error = Internal::ErrorBuffer::handler;
+            user_context = &error_buffer;
+        }
+        JITSharedRuntime::init_jit_user_context(jit_context, user_context, local_handlers);
+    }
+
+    // Called by the runtime, on whichever thread ran the pipeline.
+    static void done(void *user_context, int result, void *arg) {
+        AsyncRealizationContents *c = (AsyncRealizationContents *)arg;
+        #if __cplusplus > 199711L || _MSC_VER >= 1800
+        std::lock_guard<std::mutex> lock(c->mutex);
+        c->exit_status = result;
+        c->finished = true;
+        c->finished_cond.notify_all();
+        #else
+        // realize_async refuses to queue anything without C++11
+        // threads, so this never runs concurrently with wait().
+        c->exit_status = result;
+        c->finished = true;
+        #endif
+    }
+
+    void wait() {
+        #if __cplusplus > 199711L || _MSC_VER >= 1800
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!finished) {
+            finished_cond.wait(lock);
+        }
+        #else
+        internal_assert(finished) << "Waiting for an async realization that can't have been queued\n";
+        #endif
+    }
+};
+
+template<>
+EXPORT RefCount &ref_count<AsyncRealizationContents>(const AsyncRealizationContents *c) {return c->ref_count;}
+
+template<>
+EXPORT void destroy<AsyncRealizationContents>(const AsyncRealizationContents *c) {
+    // The runtime still refers to it until the run finishes.
+    const_cast<AsyncRealizationContents *>(c)->wait();
+    delete c;
+}
+
 }  // namespace Internal
 
-void Func::realize(Realization dst, const Target &target) {
+AsyncRealization::AsyncRealization(Internal::AsyncRealizationContents *c) : contents(c) {
+}
+
+bool AsyncRealization::finished() const {
+    user_assert(contents.defined()) << "Can't check an AsyncRealization that was never started.\n";
+    return contents.ptr->finished;
+}
+
+Realization AsyncRealization::wait() {
+    user_assert(contents.defined()) << "Can't wait for an AsyncRealization that was never started.\n";
+    contents.ptr->wait();
+    if (contents.ptr->exit_status && !contents.ptr->reported) {
+        contents.ptr->reported = true;
+        std::string output = contents.ptr->error_buffer.str();
+        if (!output.empty()) {
+            // Only report the errors if no custom error handler was installed
+            halide_runtime_error << output;
+        }
+    }
+    return Realization(contents.ptr->outputs);
+}
+
+void Func::prepare_to_realize(Realization dst, const Target &target) {
     if (!compiled_module.argv_function()) {
         compile_jit(target);
     }
@@ -2437,8 +2603,6 @@ void Func::realize(Realization dst, const Target &target) {
             << "\" has type " << func.output_types()[i] << ".\n";
     }
 
-    JITFuncCallContext jit_context(jit_handlers, jit_user_context);
-
     // Update the address of the buffers we're realizing into
     for (size_t i = 0; i < dst.size(); i++) {
         arg_values[arg_values.size()-dst.size()+i] = dst[i].raw_buffer();
@@ -2465,6 +2629,12 @@ void Func::realize(Realization dst, const Target &target) {
         internal_assert(arg_values[i])
             << "An argument to a jitted function is null\n";
     }
+}
+
+void Func::realize(Realization dst, const Target &target) {
+    prepare_to_realize(dst, target);
+
+    JITFuncCallContext jit_context(jit_handlers, jit_user_context);
 
     // Always add a custom error handler to capture any error messages.
     // (If there is a user-set error handler, it will be called as well.)
@@ -2476,6 +2646,58 @@ void Func::realize(Realization dst, const Target &target) {
     jit_context.finalize(exit_status);
 }
 
+AsyncRealization Func::realize_async(std::vector<int32_t> sizes, const Target &target) {
+    user_assert(defined()) << "Can't realize undefined Func.\n";
+    vector<Buffer> outputs(func.outputs());
+    for (size_t i = 0; i < outputs.size(); i++) {
+        outputs[i] = Buffer(func.output_types()[i], sizes);
+    }
+    return realize_async(Realization(outputs), target);
+}
+
+AsyncRealization Func::realize_async(Buffer dst, const Target &target) {
+    return realize_async(Realization(vec<Buffer>(dst)), target);
+}
+
+AsyncRealization Func::realize_async(Realization dst, const Target &target) {
+    #if !(__cplusplus > 199711L || _MSC_VER >= 1800)
+    user_error << "Func::realize_async requires Halide to be built with C++11 threads\n";
+    #endif
+
+    prepare_to_realize(dst, target);
+
+    Internal::AsyncRealizationContents *c = new Internal::AsyncRealizationContents(jit_handlers);
+    AsyncRealization result(c);
+    c->module = compiled_module;
+    c->outputs = dst.as_vector();
+    for (size_t i = 0; i < image_param_args.size(); i++) {
+        c->inputs.push_back(image_param_args[i].second.get_buffer());
+    }
+
+    // Each run needs its own user context, so it can't use the one
+    // in jit_user_context. The other scalar params may change as
+    // soon as we return, so the run gets copies of their current
+    // values.
+    c->args = arg_values;
+    c->scalar_values.resize(scalar_param_args.size());
+    for (size_t i = 0; i < scalar_param_args.size(); i++) {
+        int idx = scalar_param_args[i];
+        if (c->args[idx] == jit_user_context.get_scalar_address()) {
+            c->args[idx] = &c->jit_context_ptr;
+        } else {
+            c->scalar_values[i] = *(const uint64_t *)arg_values[idx];
+            c->args[idx] = &c->scalar_values[i];
+        }
+    }
+
+    Internal::debug(2) << "Queueing jitted function\n";
+    JITSharedRuntime::do_async(&c->jit_context,
+                               (int (*)(void **))compiled_module.argv_function(),
+                               (void **)&(c->args[0]),
+                               &Internal::AsyncRealizationContents::done, c);
+    return result;
+}
+
 void Func::infer_input_bounds(Buffer dst) {
     infer_input_bounds(Realization(vec<Buffer>(dst)));
 }
@@ -2664,6 +2886,7 @@ void *Func::compile_jit(const Target &target_arg) {
         arg_values.push_back(NULL); // A spot to put the address of this output buffer
     }
     image_param_args = infer_args.image_param_args;
+    scalar_param_args = infer_args.scalar_param_args;
 
     Internal::debug(2) << "Inferred argument list:\n";
     for (size_t i = 0; i < infer_args.arg_types.size(); i++) {
@@ -66,6 +66,8 @@ public:
     EXPORT Stage &vectorize(VarOrRVar var);
     EXPORT Stage &unroll(VarOrRVar var);
     EXPORT Stage &parallel(VarOrRVar var, Expr task_size);
+    EXPORT Stage &parallel(VarOrRVar var, ParallelChunking chunking);
+    EXPORT Stage &parallel(VarOrRVar var, Expr task_size, ParallelChunking chunking);
     EXPORT Stage &vectorize(VarOrRVar var, int factor);
     EXPORT Stage &unroll(VarOrRVar var, int factor);
     EXPORT Stage &tile(VarOrRVar x, VarOrRVar y,
@@ -371,6 +373,28 @@ struct Outputs {
     }
 };
 
+namespace Internal {
+struct AsyncRealizationContents;
+}
+
+/** A handle on a run of a pipeline started by Func::realize_async. The
+ * pipeline runs on the runtime's thread pool while the calling thread
+ * gets on with other things. Dropping the last handle on a run that
+ * hasn't finished waits for it. */
+class AsyncRealization {
+    Internal::IntrusivePtr<Internal::AsyncRealizationContents> contents;
+public:
+    AsyncRealization() {}
+    EXPORT AsyncRealization(Internal::AsyncRealizationContents *c);
+
+    /** Check whether the run has finished, without blocking. */
+    EXPORT bool finished() const;
+
+    /** Block until the run has finished, then return the buffers it
+     * was realized into. Runtime errors are reported the same way as
+     * for Func::realize. */
+    EXPORT Realization wait();
+};
 
 /** A halide function. This class represents one stage in a Halide
  * pipeline, and is the unit by which we schedule things. By default
@@ -402,6 +426,10 @@ class Func {
     /** Lower the func if it hasn't been already. */
     void lower(const Target &t);
 
+    /** Compile the func if necessary, and point arg_values at the
+     * given output buffers and the current ImageParam buffers. */
+    void prepare_to_realize(Realization dst, const Target &target);
+
     /** A JIT-compiled version of this function that we save so that
      * we don't have to rejit every time we want to evaluated it. */
     Internal::JITModule compiled_module;
@@ -427,6 +455,10 @@ class Func {
      * still be valid though. */
     std::vector<std::pair<int, Internal::Parameter> > image_param_args;
 
+    /** The indices of the arg_values that point at scalar params,
+     * including the jit_user_context. */
+    std::vector<int> scalar_param_args;
+
     /** The user context that's used when jitting. This is not settable
      * by user code, but is reserved for internal use.
      * Note that this is an Internal::Parameter (rather than a Param<void*>)
@@ -525,6 +557,26 @@ public:
     }
     // @}
 
+    /** Like realize, but returns as soon as the pipeline has been
+     * queued on the runtime's thread pool (see halide_do_async). No
+     * extra threads are started; the pipeline runs on a pool worker
+     * once the workers have no parallel loops left to help with. The
+     * values of any Params are copied when the run is queued, so they
+     * can be changed as soon as this returns. ImageParams can be
+     * rebound too, but the run reads the contents of the buffers they
+     * were bound to while it executes, so don't write to those until
+     * the returned handle reports that it has finished. Several runs
+     * may be in flight at once, but they must write to different
+     * buffers. Requires Halide to be built with C++11 threads. */
+    // @{
+    EXPORT AsyncRealization realize_async(std::vector<int32_t> sizes,
+                                          const Target &target = get_jit_target_from_environment());
+    EXPORT AsyncRealization realize_async(Realization dst,
+                                          const Target &target = get_jit_target_from_environment());
+    EXPORT AsyncRealization realize_async(Buffer dst,
+                                          const Target &target = get_jit_target_from_environment());
+    // @}
+
     /** For a given size of output, or a given output buffer,
      * determine the bounds required of all unbound ImageParams
      * referenced. Communicates the result by allocating new buffers
@@ -786,6 +838,20 @@ public:
         int (*custom_do_par_for)(void *, int (*)(void *, int, uint8_t *), int,
                                  int, uint8_t *));
 
+    /** Set a function that picks the thread pool this pipeline's
+     * parallel loops run on. It is called with the user context on
+     * every parallel loop launch, and should return a pool made with
+     * JITSharedRuntime::create_thread_pool, or NULL for the default
+     * pool. Running latency-sensitive and batch pipelines on separate
+     * pools keeps them from competing for the same threads.
+     *
+     * If you are statically compiling, you can also just define your
+     * own version of halide_get_thread_pool (see HalideRuntime.h),
+     * and it will clobber Halide's version.
+     */
+    EXPORT void set_custom_get_thread_pool(
+        struct halide_thread_pool *(*custom_get_thread_pool)(void *));
+
     /** Set custom routines to call when tracing is enabled. Call this
      * on the output Func of your pipeline. This then sets custom
      * routines for the entire pipeline, not just calls to this
@@ -996,6 +1062,15 @@ public:
      * manually. */
     EXPORT Func &parallel(VarOrRVar var, Expr task_size);
 
+    /** Mark a dimension to be traversed in parallel, and choose how
+     * its iterations are handed out to threads at runtime. Guided
+     * chunking suits loops with many cheap or unevenly expensive
+     * iterations. See \ref ParallelChunking. */
+    // @{
+    EXPORT Func &parallel(VarOrRVar var, ParallelChunking chunking);
+    EXPORT Func &parallel(VarOrRVar var, Expr task_size, ParallelChunking chunking);
+    // @}
+
     /** Mark a dimension to be computed all-at-once as a single
      * vector. The dimension should have constant extent -
      * e.g. because it is the inner dimension following a split by a
@@ -1530,8 +1605,59 @@ public:
     /** Use the halide_memoization_cache_... interface to store a
      *  computed version of this function across invocations of the
      *  Func.
+     *
+     *  Results can be kept in a named partition of the cache, which
+     *  evicts only its own results to stay within its own budget in
+     *  bytes, so that they don't compete for space with the results
+     *  of other Funcs. Funcs memoized into the same partition share
+     *  its budget. A budget of zero leaves the partition at the size
+     *  it was last given, or the default cache size if none (see
+     *  halide_memoization_cache_set_partition_size).
+     */
+    EXPORT Func &memoize(const std::string &partition = std::string(), int64_t budget = 0);
+
+    /** Ask for this function's buffer to be backed by memory placed
+     * as the hints say: a combination of halide_allocation_hint_t
+     * flags, for huge pages (fewer TLB misses when walking a large
+     * buffer), pages interleaved across NUMA nodes (for a buffer
+     * read by all threads), or pages on the allocating thread's
+     * node. Only buffers of at least 2MB on the heap are affected
+     * (see halide_malloc_with_hints). Buffers allocated with hints
+     * don't come from halide_malloc, so they bypass any custom
+     * allocator. Without this (or with halide_allocation_hint_none),
+     * the buffer comes from halide_malloc as usual.
+     */
+    EXPORT Func &allocation_hints(int hints);
+
+    /** Say whether this function's buffer should go on the stack or
+     * the heap. By default (MemoryType::Auto), only buffers of
+     * constant size up to 16KB go on the stack. MemoryType::Stack
+     * puts larger buffers, and buffers whose size isn't known until
+     * runtime, on the stack too, which saves calling halide_malloc
+     * each time the buffer is made. Those are checked against what
+     * the runtime thinks is left of the thread's stack (see
+     * halide_get_stack_allocation_limit), and go on the heap if they
+     * don't fit. C code only puts them on the stack if they are of
+     * constant size up to 16KB. MemoryType::Heap never uses the
+     * stack.
+     */
+    EXPORT Func &store_in(MemoryType memory_type);
+
+    /** Allow this function to be computed concurrently with the stage
+     * computed after it at the same loop level, when that stage
+     * doesn't depend on it. For example, if f and g are both
+     * compute_root and used only by h, then with f.async() f and g
+     * are computed at the same time on the thread pool before h
+     * runs. This helps fill the machine when the individual stages
+     * don't have enough parallelism of their own. Several async
+     * functions in a row may all run at once. Has no effect if the
+     * next stage uses this function, on stages run on a GPU, or on
+     * functions that are inlined, memoized, or traced (including by
+     * HL_TRACE). It also has no effect if the next stage is memoized
+     * or traced, as trace events and cache accesses are expected in
+     * program order.
      */
-    EXPORT Func &memoize();
+    EXPORT Func &async();
 
 
     /** Allocate storage for this function within f's loop over
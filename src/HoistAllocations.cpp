@@ -0,0 +1,202 @@
+#include <map>
+
+#include "HoistAllocations.h"
+#include "IRMutator.h"
+#include "IRVisitor.h"
+#include "IROperator.h"
+#include "AllocationSize.h"
+#include "ExprUsesVar.h"
+#include "Substitute.h"
+#include "Simplify.h"
+#include "Scope.h"
+#include "Debug.h"
+
+namespace Halide {
+namespace Internal {
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace {
+
+// Allocations known to be bigger than this stay in their loop, so
+// that they aren't kept alive for the parts of each iteration that
+// don't need them.
+const int64_t max_hoisted_bytes = 64 * 1024 * 1024;
+
+// Whether an expression reads memory, which might be written by the
+// loop it's in.
+class ReadsMemory : public IRVisitor {
+public:
+    bool result;
+    ReadsMemory() : result(false) {}
+
+private:
+    using IRVisitor::visit;
+
+    void visit(const Load *op) {
+        result = true;
+    }
+
+    void visit(const Call *op) {
+        if (op->call_type != Call::Intrinsic) {
+            result = true;
+        }
+        IRVisitor::visit(op);
+    }
+};
+
+bool reads_memory(Expr e) {
+    ReadsMemory r;
+    e.accept(&r);
+    return r.result;
+}
+
+// Whether the body of an allocation makes a buffer_t for it, to copy
+// it to or from a device. The halide_device_free for that has to
+// happen in the same scope as the buffer_t, so the allocation can't
+// move away from it.
+bool uses_device_buffer(const Allocate *op) {
+    Scope<int> buffer;
+    buffer.push(op->name + ".buffer", 0);
+    ExprUsesVars<int> uses(buffer);
+    op->body.accept(&uses);
+    return uses.result;
+}
+
+struct LiftedAllocation {
+    const Allocate *op;
+    vector<Expr> extents;
+    Expr condition;
+};
+
+// Pull the allocations out of the body of a serial loop that can be
+// made once for the whole loop. Lets in the loop body that the size
+// depends on are substituted in.
+class LiftAllocations : public IRMutator {
+public:
+    vector<LiftedAllocation> lifted;
+
+    LiftAllocations(const string &v) : loop_var(v) {}
+
+private:
+    string loop_var;
+
+    // The lets bound inside the loop body so far.
+    Scope<Expr> lets;
+
+    using IRMutator::visit;
+
+    // Substitute lets from inside the loop body into e, until it
+    // refers only to things defined outside of it.
+    Expr outside_loop(Expr e) {
+        while (expr_uses_vars(e, lets)) {
+            map<string, Expr> replacements;
+            for (Scope<Expr>::iterator iter = lets.begin(); iter != lets.end(); ++iter) {
+                replacements[iter.name()] = iter.value();
+            }
+            e = substitute(replacements, e);
+        }
+        return e;
+    }
+
+    // Allocations in inner loops have already been moved out as far
+    // as they can go, and allocations in branches might not be
+    // needed at all.
+    void visit(const For *op) {
+        stmt = op;
+    }
+
+    void visit(const IfThenElse *op) {
+        stmt = op;
+    }
+
+    void visit(const LetStmt *op) {
+        lets.push(op->name, op->value);
+        Stmt body = mutate(op->body);
+        lets.pop(op->name);
+        if (body.same_as(op->body)) {
+            stmt = op;
+        } else {
+            stmt = LetStmt::make(op->name, op->value, body);
+        }
+    }
+
+    void visit(const Allocate *op) {
+        if (op->new_expr.defined() || uses_device_buffer(op)) {
+            IRMutator::visit(op);
+            return;
+        }
+
+        LiftedAllocation a;
+        a.op = op;
+        a.condition = outside_loop(op->condition);
+        bool invariant = !expr_uses_var(a.condition, loop_var) && !reads_memory(a.condition);
+        for (size_t i = 0; i < op->extents.size(); i++) {
+            Expr extent = simplify(outside_loop(op->extents[i]));
+            invariant = invariant && !expr_uses_var(extent, loop_var) && !reads_memory(extent);
+            a.extents.push_back(extent);
+        }
+        int64_t constant_size;
+        allocation_size_in_bytes(op->type, a.extents, &constant_size);
+
+        // Stack allocations have nothing to save.
+        if (!invariant ||
+            allocation_goes_on_stack(constant_size, op->memory_type) ||
+            constant_size > max_hoisted_bytes) {
+            IRMutator::visit(op);
+            return;
+        }
+
+        debug(3) << "Hoisting allocation of " << op->name << " out of loop over " << loop_var << "\n";
+        lifted.push_back(a);
+        stmt = mutate(op->body);
+    }
+};
+
+class HoistLoopInvariantAllocations : public IRMutator {
+    using IRMutator::visit;
+
+    void visit(const For *op) {
+        if (op->device_api != DeviceAPI::Parent && op->device_api != DeviceAPI::Host) {
+            // Leave device code alone.
+            stmt = op;
+            return;
+        }
+
+        // Inner loops first, so that their allocations can keep
+        // moving out past this one.
+        IRMutator::visit(op);
+        if (op->for_type != ForType::Serial) {
+            // Each task of a parallel loop needs buffers of its own.
+            return;
+        }
+        op = stmt.as<For>();
+        internal_assert(op);
+
+        LiftAllocations lift(op->name);
+        Stmt body = lift.mutate(op->body);
+        if (lift.lifted.empty()) {
+            return;
+        }
+
+        stmt = For::make(op->name, op->min, op->extent, op->for_type, op->device_api, body);
+        for (size_t i = lift.lifted.size(); i > 0; i--) {
+            const LiftedAllocation &a = lift.lifted[i-1];
+            // The sizes might not make sense if the loop doesn't run.
+            Expr condition = a.condition && (op->extent > 0);
+            stmt = Allocate::make(a.op->name, a.op->type, a.extents, condition, stmt,
+                                  Expr(), std::string(), a.op->memory_type);
+        }
+    }
+};
+
+}
+
+Stmt hoist_loop_invariant_allocations(Stmt s) {
+    return HoistLoopInvariantAllocations().mutate(s);
+}
+
+}
+}
@@ -0,0 +1,27 @@
+#ifndef HALIDE_HOIST_ALLOCATIONS_H
+#define HALIDE_HOIST_ALLOCATIONS_H
+
+/** \file
+ * Defines the lowering pass that moves allocations whose size doesn't
+ * change from one iteration of a serial loop to the next out of the
+ * loop.
+ */
+
+#include "IR.h"
+
+namespace Halide {
+namespace Internal {
+
+/** Move heap allocations with loop-invariant sizes out of serial
+ * loops, as far out as they can go, so that one buffer is allocated
+ * once and reused by every iteration instead of being allocated and
+ * freed each time around. Allocations that go on the stack, are in
+ * parallel loops or device code, are copied to or from a device, or
+ * are known to be very large are left where they are. Run before
+ * inject_early_frees. */
+Stmt hoist_loop_invariant_allocations(Stmt s);
+
+}
+}
+
+#endif
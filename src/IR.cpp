@@ -398,7 +398,8 @@ Stmt Provide::make(std::string name, const std::vector<Expr> &values, const std:
 }
 
 Stmt Allocate::make(std::string name, Type type, const std::vector<Expr> &extents,
-                 Expr condition, Stmt body) {
+                    Expr condition, Stmt body,
+                    Expr new_expr, std::string free_function, MemoryType memory_type) {
     for (size_t i = 0; i < extents.size(); i++) {
         internal_assert(extents[i].defined()) << "Allocate of undefined extent\n";
         internal_assert(extents[i].type().is_scalar() == 1) << "Allocate of vector extent\n";
@@ -406,12 +407,17 @@ Stmt Allocate::make(std::string name, Type type, const std::vector<Expr> &extent
     internal_assert(body.defined()) << "Allocate of undefined\n";
     internal_assert(condition.defined()) << "Allocate with undefined condition\n";
     internal_assert(condition.type().is_bool()) << "Allocate condition is not boolean\n";
+    internal_assert(!new_expr.defined() || new_expr.type() == Handle())
+        << "Allocate with non-handle new_expr\n";
 
     Allocate *node = new Allocate;
     node->name = name;
     node->type = type;
     node->extents = extents;
     node->condition = condition;
+    node->new_expr = new_expr;
+    node->free_function = free_function;
+    node->memory_type = memory_type;
     node->body = body;
     return node;
 }
@@ -577,6 +583,8 @@ Call::ConstString Call::create_buffer_t = "create_buffer_t";
 Call::ConstString Call::copy_buffer_t = "copy_buffer_t";
 Call::ConstString Call::extract_buffer_min = "extract_buffer_min";
 Call::ConstString Call::extract_buffer_max = "extract_buffer_max";
+Call::ConstString Call::extract_buffer_stride = "extract_buffer_stride";
+Call::ConstString Call::extract_buffer_host = "extract_buffer_host";
 Call::ConstString Call::set_host_dirty = "set_host_dirty";
 Call::ConstString Call::set_dev_dirty = "set_dev_dirty";
 Call::ConstString Call::popcount = "popcount";
@@ -267,16 +267,28 @@ struct Provide : public StmtNode<Provide> {
  * size. The buffer lives for at most the duration of the body
  * statement, within which it is freed. It is an error for an allocate
  * node not to contain a free node of the same buffer. Allocation only
- * occurs if the condition evaluates to true. */
+ * occurs if the condition evaluates to true.
+ *
+ * If new_expr is defined, no memory is allocated. Instead the buffer
+ * uses the host pointer new_expr evaluates to, and is released by
+ * calling free_function(user_context, pointer) rather than
+ * halide_free. This lets the runtime hand out memory it owns
+ * (e.g. entries in the memoization cache). Otherwise memory_type
+ * says whether the buffer goes on the stack or the heap. */
 struct Allocate : public StmtNode<Allocate> {
     std::string name;
     Type type;
     std::vector<Expr> extents;
     Expr condition;
+    Expr new_expr;
+    std::string free_function;
+    MemoryType memory_type;
     Stmt body;
 
     EXPORT static Stmt make(std::string name, Type type, const std::vector<Expr> &extents,
-                            Expr condition, Stmt body);
+                            Expr condition, Stmt body,
+                            Expr new_expr = Expr(), std::string free_function = std::string(),
+                            MemoryType memory_type = MemoryType::Auto);
 };
 
 /** Free the resources associated with the given buffer. */
@@ -376,6 +388,8 @@ struct Call : public ExprNode<Call> {
         copy_buffer_t,
         extract_buffer_min,
         extract_buffer_max,
+        extract_buffer_stride,
+        extract_buffer_host,
         set_host_dirty,
         set_dev_dirty,
         popcount,
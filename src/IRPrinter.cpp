@@ -119,6 +119,9 @@ ostream &operator<<(ostream &out, const ForType &type) {
     case ForType::Parallel:
         out << "parallel";
         break;
+    case ForType::GuidedParallel:
+        out << "guided_parallel";
+        break;
     case ForType::Unrolled:
         out << "unrolled";
         break;
@@ -495,10 +498,20 @@ void IRPrinter::visit(const Allocate *op) {
         print(op->extents[i]);
     }
     stream << "]";
+    if (op->memory_type == MemoryType::Heap) {
+        stream << " in Heap";
+    } else if (op->memory_type == MemoryType::Stack) {
+        stream << " in Stack";
+    }
     if (!is_one(op->condition)) {
         stream << " if ";
         print(op->condition);
     }
+    if (op->new_expr.defined()) {
+        stream << " custom_new ";
+        print(op->new_expr);
+        stream << " custom_delete " << op->free_function;
+    }
     stream << "\n";
     print(op->body);
 }
@@ -419,12 +419,131 @@ void JITModule::memoization_cache_set_size(int64_t size) const {
     }
 }
 
+void JITModule::memoization_cache_set_policy(int policy) const {
+    if (jit_module.defined()) {
+        std::map<std::string, Symbol>::const_iterator f =
+            exports().find("halide_memoization_cache_set_policy");
+        if (f != exports().end()) {
+            return (reinterpret_bits<void (*)(int)>(f->second.address))(policy);
+        }
+    }
+}
+
+int JITModule::memoization_cache_set_persistent_file(const char *path, int64_t max_bytes) const {
+    if (jit_module.defined()) {
+        std::map<std::string, Symbol>::const_iterator f =
+            exports().find("halide_memoization_cache_set_persistent_file");
+        if (f != exports().end()) {
+            typedef int (*set_persistent_file_fn)(void *, const char *, int64_t);
+            return (reinterpret_bits<set_persistent_file_fn>(f->second.address))(NULL, path, max_bytes);
+        }
+    }
+    return -1;
+}
+
+int JITModule::memoization_cache_get_stats(halide_memoization_cache_stats *stats,
+                                           halide_memoization_cache_func_stats *funcs,
+                                           int max_funcs) const {
+    if (jit_module.defined()) {
+        std::map<std::string, Symbol>::const_iterator f =
+            exports().find("halide_memoization_cache_get_stats");
+        if (f != exports().end()) {
+            typedef int (*get_stats_fn)(halide_memoization_cache_stats *,
+                                        halide_memoization_cache_func_stats *, int);
+            return (reinterpret_bits<get_stats_fn>(f->second.address))(stats, funcs, max_funcs);
+        }
+    }
+    return 0;
+}
+
+void JITModule::memory_pool_set_size(int64_t size) const {
+    if (jit_module.defined()) {
+        std::map<std::string, Symbol>::const_iterator f =
+            exports().find("halide_memory_pool_set_size");
+        if (f != exports().end()) {
+            return (reinterpret_bits<void (*)(int64_t)>(f->second.address))(size);
+        }
+    }
+}
+
+void JITModule::memory_pool_get_stats(halide_memory_pool_stats *stats) const {
+    if (jit_module.defined()) {
+        std::map<std::string, Symbol>::const_iterator f =
+            exports().find("halide_memory_pool_get_stats");
+        if (f != exports().end()) {
+            return (reinterpret_bits<void (*)(halide_memory_pool_stats *)>(f->second.address))(stats);
+        }
+    }
+}
+
+int JITModule::memory_tracker_get_stats(halide_memory_tracker_stats *stats,
+                                        halide_memory_tracker_func_stats *funcs,
+                                        int max_funcs) const {
+    if (jit_module.defined()) {
+        std::map<std::string, Symbol>::const_iterator f =
+            exports().find("halide_memory_tracker_get_stats");
+        if (f != exports().end()) {
+            typedef int (*get_stats_fn)(halide_memory_tracker_stats *,
+                                        halide_memory_tracker_func_stats *, int);
+            return (reinterpret_bits<get_stats_fn>(f->second.address))(stats, funcs, max_funcs);
+        }
+    }
+    return 0;
+}
+
+void JITModule::memory_tracker_reset_stats() const {
+    if (jit_module.defined()) {
+        std::map<std::string, Symbol>::const_iterator f =
+            exports().find("halide_memory_tracker_reset_stats");
+        if (f != exports().end()) {
+            return (reinterpret_bits<void (*)()>(f->second.address))();
+        }
+    }
+}
+
+void JITModule::set_trace_file(int fd) const {
+    if (jit_module.defined()) {
+        std::map<std::string, Symbol>::const_iterator f =
+            exports().find("halide_set_trace_file");
+        if (f != exports().end()) {
+            return (reinterpret_bits<void (*)(int)>(f->second.address))(fd);
+        }
+    }
+}
+
+struct halide_thread_pool *JITModule::create_thread_pool(const std::string &name, int num_threads, int priority) const {
+    if (jit_module.defined()) {
+        std::map<std::string, Symbol>::const_iterator f =
+            exports().find("halide_create_thread_pool");
+        if (f != exports().end()) {
+            return (reinterpret_bits<struct halide_thread_pool *(*)(const char *, int, int)>(f->second.address))(name.c_str(), num_threads, priority);
+        }
+    }
+    return NULL;
+}
+
+void JITModule::do_async(void *user_context, int (*f)(void **), void **args,
+                         void (*done)(void *, int, void *), void *done_arg) const {
+    internal_assert(jit_module.defined());
+    std::map<std::string, Symbol>::const_iterator fn =
+        exports().find("halide_do_async");
+    internal_assert(fn != exports().end()) << "Could not find halide_do_async in the shared runtime\n";
+    typedef void (*do_async_fn)(void *, int (*)(void **), void **,
+                                void (*)(void *, int, void *), void *);
+    (reinterpret_bits<do_async_fn>(fn->second.address))(user_context, f, args, done, done_arg);
+}
+
 namespace {
 
 JITHandlers runtime_internal_handlers;
 JITHandlers default_handlers;
 JITHandlers active_handlers;
 int64_t default_cache_size;
+int default_cache_policy;
+std::string default_cache_file;
+int64_t default_cache_file_size;
+int64_t default_memory_pool_size;
+int default_trace_fd;
 
 void merge_handlers(JITHandlers &base, const JITHandlers &addins) {
     if (addins.custom_print) {
@@ -442,12 +561,18 @@ void merge_handlers(JITHandlers &base, const JITHandlers &addins) {
     if (addins.custom_do_par_for) {
         base.custom_do_par_for = addins.custom_do_par_for;
     }
+    if (addins.custom_do_guided_par_for) {
+        base.custom_do_guided_par_for = addins.custom_do_guided_par_for;
+    }
     if (addins.custom_error) {
         base.custom_error = addins.custom_error;
     }
     if (addins.custom_trace) {
         base.custom_trace = addins.custom_trace;
     }
+    if (addins.custom_get_thread_pool) {
+        base.custom_get_thread_pool = addins.custom_get_thread_pool;
+    }
 }
 
 void print_handler(void *context, const char *msg) {
@@ -502,6 +627,30 @@ int do_par_for_handler(void *context, halide_task f,
     }
 }
 
+int do_guided_par_for_handler(void *context, halide_task f,
+                              int min, int size, uint8_t *closure) {
+    const JITHandlers &handlers =
+        context ? ((JITUserContext *)context)->handlers : active_handlers;
+    if (handlers.custom_do_guided_par_for != runtime_internal_handlers.custom_do_guided_par_for ||
+        handlers.custom_do_par_for == runtime_internal_handlers.custom_do_par_for) {
+        return (*handlers.custom_do_guided_par_for)(context, f, min, size, closure);
+    } else {
+        // A custom do_par_for, but not a custom guided one. It gets
+        // the guided loops too.
+        return (*handlers.custom_do_par_for)(context, f, min, size, closure);
+    }
+}
+
+struct halide_thread_pool *get_thread_pool_handler(void *context) {
+    if (context) {
+        JITUserContext *jit_user_context = (JITUserContext *)context;
+
+        return (*jit_user_context->handlers.custom_get_thread_pool)(context);
+    } else {
+        return (*active_handlers.custom_get_thread_pool)(context);
+    }
+}
+
 void error_handler_handler(void *context, const char *msg) {
     if (context) {
         JITUserContext *jit_user_context = (JITUserContext *)context;
@@ -622,18 +771,38 @@ JITModule &make_module(CodeGen_LLVM *cg, const Target &target_arg, RuntimeKind r
             runtime_internal_handlers.custom_do_par_for =
                 hook_function(shared_runtimes(MainShared).exports(), "halide_set_custom_do_par_for", do_par_for_handler);
 
+            runtime_internal_handlers.custom_do_guided_par_for =
+                hook_function(shared_runtimes(MainShared).exports(), "halide_set_custom_do_guided_par_for",
+                              do_guided_par_for_handler);
+
             runtime_internal_handlers.custom_error =
                 hook_function(shared_runtimes(MainShared).exports(), "halide_set_error_handler", error_handler_handler);
 
             runtime_internal_handlers.custom_trace =
                 hook_function(shared_runtimes(MainShared).exports(), "halide_set_custom_trace", trace_handler);
 
+            runtime_internal_handlers.custom_get_thread_pool =
+                hook_function(shared_runtimes(MainShared).exports(), "halide_set_custom_get_thread_pool", get_thread_pool_handler);
+
             active_handlers = runtime_internal_handlers;
             merge_handlers(active_handlers, default_handlers);
 
             if (default_cache_size != 0) {
                 shared_runtimes(MainShared).memoization_cache_set_size(default_cache_size);
             }
+            if (default_cache_policy != 0) {
+                shared_runtimes(MainShared).memoization_cache_set_policy(default_cache_policy);
+            }
+            if (!default_cache_file.empty()) {
+                shared_runtimes(MainShared).memoization_cache_set_persistent_file(default_cache_file.c_str(),
+                                                                                  default_cache_file_size);
+            }
+            if (default_memory_pool_size != 0) {
+                shared_runtimes(MainShared).memory_pool_set_size(default_memory_pool_size);
+            }
+            if (default_trace_fd != 0) {
+                shared_runtimes(MainShared).set_trace_file(default_trace_fd);
+            }
 
             shared_runtimes(runtime_kind).jit_module.ptr->name = "MainShared";
         } else {
@@ -730,6 +899,114 @@ void JITSharedRuntime::memoization_cache_set_size(int64_t size) {
     }
 }
 
+void JITSharedRuntime::memoization_cache_set_policy(int policy) {
+    #if __cplusplus > 199711L || _MSC_VER >= 1800
+    std::lock_guard<std::mutex> lock(shared_runtimes_mutex);
+    #endif
+
+    default_cache_policy = policy;
+    if (shared_runtimes(MainShared).jit_module.defined()) {
+        shared_runtimes(MainShared).memoization_cache_set_policy(policy);
+    }
+}
+
+int JITSharedRuntime::memoization_cache_set_persistent_file(const char *path, int64_t max_bytes) {
+    #if __cplusplus > 199711L || _MSC_VER >= 1800
+    std::lock_guard<std::mutex> lock(shared_runtimes_mutex);
+    #endif
+
+    default_cache_file = path ? path : "";
+    default_cache_file_size = max_bytes;
+    if (shared_runtimes(MainShared).jit_module.defined()) {
+        return shared_runtimes(MainShared).memoization_cache_set_persistent_file(path, max_bytes);
+    }
+    return 0;
+}
+
+int JITSharedRuntime::memoization_cache_get_stats(halide_memoization_cache_stats *stats,
+                                                  halide_memoization_cache_func_stats *funcs,
+                                                  int max_funcs) {
+    #if __cplusplus > 199711L || _MSC_VER >= 1800
+    std::lock_guard<std::mutex> lock(shared_runtimes_mutex);
+    #endif
+
+    return shared_runtimes(MainShared).memoization_cache_get_stats(stats, funcs, max_funcs);
+}
+
+void JITSharedRuntime::memory_pool_set_size(int64_t size) {
+    #if __cplusplus > 199711L || _MSC_VER >= 1800
+    std::lock_guard<std::mutex> lock(shared_runtimes_mutex);
+    #endif
+
+    default_memory_pool_size = size;
+    if (shared_runtimes(MainShared).jit_module.defined()) {
+        shared_runtimes(MainShared).memory_pool_set_size(size);
+    }
+}
+
+void JITSharedRuntime::memory_pool_get_stats(halide_memory_pool_stats *stats) {
+    #if __cplusplus > 199711L || _MSC_VER >= 1800
+    std::lock_guard<std::mutex> lock(shared_runtimes_mutex);
+    #endif
+
+    shared_runtimes(MainShared).memory_pool_get_stats(stats);
+}
+
+int JITSharedRuntime::memory_tracker_get_stats(halide_memory_tracker_stats *stats,
+                                               halide_memory_tracker_func_stats *funcs,
+                                               int max_funcs) {
+    #if __cplusplus > 199711L || _MSC_VER >= 1800
+    std::lock_guard<std::mutex> lock(shared_runtimes_mutex);
+    #endif
+
+    return shared_runtimes(MainShared).memory_tracker_get_stats(stats, funcs, max_funcs);
+}
+
+void JITSharedRuntime::memory_tracker_reset_stats() {
+    #if __cplusplus > 199711L || _MSC_VER >= 1800
+    std::lock_guard<std::mutex> lock(shared_runtimes_mutex);
+    #endif
+
+    shared_runtimes(MainShared).memory_tracker_reset_stats();
+}
+
+void JITSharedRuntime::set_trace_file(int fd) {
+    #if __cplusplus > 199711L || _MSC_VER >= 1800
+    std::lock_guard<std::mutex> lock(shared_runtimes_mutex);
+    #endif
+
+    default_trace_fd = fd;
+    if (shared_runtimes(MainShared).jit_module.defined()) {
+        shared_runtimes(MainShared).set_trace_file(fd);
+    }
+}
+
+struct halide_thread_pool *JITSharedRuntime::create_thread_pool(const std::string &name, int num_threads, int priority) {
+    #if __cplusplus > 199711L || _MSC_VER >= 1800
+    std::lock_guard<std::mutex> lock(shared_runtimes_mutex);
+    #endif
+
+    user_assert(shared_runtimes(MainShared).jit_module.defined())
+        << "Can't create thread pool " << name << " before the shared runtime exists. "
+        << "Compile a Func for JIT (e.g. with Func::compile_jit) first.\n";
+    return shared_runtimes(MainShared).create_thread_pool(name, num_threads, priority);
+}
+
+void JITSharedRuntime::do_async(void *user_context, int (*f)(void **), void **args,
+                                void (*done)(void *, int, void *), void *done_arg) {
+    JITModule runtime;
+    {
+        #if __cplusplus > 199711L || _MSC_VER >= 1800
+        std::lock_guard<std::mutex> lock(shared_runtimes_mutex);
+        #endif
+        runtime = shared_runtimes(MainShared);
+    }
+
+    // The call may run the pipeline before returning, so don't hold
+    // the lock for it.
+    runtime.do_async(user_context, f, args, done, done_arg);
+}
+
 
 }
 }
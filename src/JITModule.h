@@ -83,6 +83,21 @@ struct JITModule {
     EXPORT int copy_to_host(struct buffer_t *buf) const;
     EXPORT int device_free(struct buffer_t *buf) const;
     EXPORT void memoization_cache_set_size(int64_t size) const;
+    EXPORT void memoization_cache_set_policy(int policy) const;
+    EXPORT int memoization_cache_set_persistent_file(const char *path, int64_t max_bytes) const;
+    EXPORT int memoization_cache_get_stats(halide_memoization_cache_stats *stats,
+                                           halide_memoization_cache_func_stats *funcs,
+                                           int max_funcs) const;
+    EXPORT void memory_pool_set_size(int64_t size) const;
+    EXPORT void memory_pool_get_stats(halide_memory_pool_stats *stats) const;
+    EXPORT int memory_tracker_get_stats(halide_memory_tracker_stats *stats,
+                                        halide_memory_tracker_func_stats *funcs,
+                                        int max_funcs) const;
+    EXPORT void memory_tracker_reset_stats() const;
+    EXPORT void set_trace_file(int fd) const;
+    EXPORT struct halide_thread_pool *create_thread_pool(const std::string &name, int num_threads, int priority) const;
+    EXPORT void do_async(void *user_context, int (*f)(void **), void **args,
+                         void (*done)(void *, int, void *), void *done_arg) const;
 };
 
 typedef int (*halide_task)(void *user_context, int, uint8_t *);
@@ -93,11 +108,17 @@ struct JITHandlers {
     void (*custom_free)(void *, void *);
     int (*custom_do_task)(void *, halide_task, int, uint8_t *);
     int (*custom_do_par_for)(void *, halide_task, int, int, uint8_t *);
+    /** Used for loops with ParallelChunking::Guided. Only worth
+     * setting along with custom_do_par_for; if that's set and this
+     * isn't, guided loops go to custom_do_par_for too. */
+    int (*custom_do_guided_par_for)(void *, halide_task, int, int, uint8_t *);
     void (*custom_error)(void *, const char *);
     int32_t (*custom_trace)(void *, const halide_trace_event *);
+    struct halide_thread_pool *(*custom_get_thread_pool)(void *);
     JITHandlers() : custom_print(NULL), custom_malloc(NULL), custom_free(NULL),
                     custom_do_task(NULL), custom_do_par_for(NULL),
-                    custom_error(NULL), custom_trace(NULL) {
+                    custom_do_guided_par_for(NULL), custom_error(NULL), custom_trace(NULL),
+                    custom_get_thread_pool(NULL) {
     }
 };
 
@@ -119,6 +140,79 @@ public:
      */
     EXPORT static void memoization_cache_set_size(int64_t size);
 
+    /** Set the order in which memoization caching evicts results, as
+     * a halide_memoization_cache_policy_t (see HalideRuntime.h). If
+     * you are compiling statically, call
+     * halide_memoization_cache_set_policy() instead.
+     */
+    EXPORT static void memoization_cache_set_policy(int policy);
+
+    /** Back memoization caching with a file that outlives the
+     * process (see halide_memoization_cache_set_persistent_file). If
+     * no Func has been compiled for JIT yet, the file is opened when
+     * the first one is, and any failure to open it is only reported
+     * through the error handler. Pass NULL to stop using a file. If
+     * you are compiling statically, call
+     * halide_memoization_cache_set_persistent_file() instead.
+     */
+    EXPORT static int memoization_cache_set_persistent_file(const char *path, int64_t max_bytes);
+
+    /** Read the stats of the memoization cache used by JIT-compiled
+     * pipelines (see halide_memoization_cache_get_stats). Returns
+     * zero, and leaves stats untouched, if no Func has been compiled
+     * for JIT yet.
+     */
+    EXPORT static int memoization_cache_get_stats(halide_memoization_cache_stats *stats,
+                                                  halide_memoization_cache_func_stats *funcs = NULL,
+                                                  int max_funcs = 0);
+
+    /** Set the most memory the JIT runtime's default allocator keeps
+     * for reuse across pipeline runs (see
+     * halide_memory_pool_set_size). Zero turns pooling off. If you
+     * are compiling statically, call halide_memory_pool_set_size()
+     * instead.
+     */
+    EXPORT static void memory_pool_set_size(int64_t size);
+
+    /** Read the stats of the JIT runtime's memory pool (see
+     * halide_memory_pool_get_stats). Leaves stats untouched if no
+     * Func has been compiled for JIT yet.
+     */
+    EXPORT static void memory_pool_get_stats(halide_memory_pool_stats *stats);
+
+    /** Read the memory used by JIT-compiled pipelines built with the
+     * track_memory target feature (see
+     * halide_memory_tracker_get_stats). Returns zero, and leaves
+     * stats untouched, if no Func has been compiled for JIT yet.
+     */
+    EXPORT static int memory_tracker_get_stats(halide_memory_tracker_stats *stats,
+                                               halide_memory_tracker_func_stats *funcs = NULL,
+                                               int max_funcs = 0);
+
+    /** Start the memory tracker's peaks over (see
+     * halide_memory_tracker_reset_stats). */
+    EXPORT static void memory_tracker_reset_stats();
+
+    /** Send the binary trace events of JIT-compiled pipelines to the
+     * given file descriptor (see halide_set_trace_file). If no Func
+     * has been compiled for JIT yet, the file is used once the shared
+     * runtime is created. */
+    EXPORT static void set_trace_file(int fd);
+
+    /** Create a named thread pool in the shared runtime (see
+     * halide_create_thread_pool), for use with
+     * Func::set_custom_get_thread_pool. It is an error to call this
+     * before any Func has been compiled for JIT, as the shared runtime
+     * doesn't exist until then. Returns NULL on platforms without
+     * Halide-owned thread pools. Pools are destroyed by release_all.
+     */
+    EXPORT static struct halide_thread_pool *create_thread_pool(const std::string &name, int num_threads, int priority = 0);
+
+    /** Queue a call to f(args) on the shared runtime's thread pool
+     * (see halide_do_async). Used by Func::realize_async. */
+    EXPORT static void do_async(void *user_context, int (*f)(void **), void **args,
+                                void (*done)(void *, int, void *), void *done_arg);
+
     EXPORT static void release_all();
 };
 }
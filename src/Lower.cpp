@@ -43,6 +43,12 @@
 #include "InjectHostDevBufferCopies.h"
 #include "Memoization.h"
 #include "VaryingAttributes.h"
+#include "AsyncStages.h"
+#include "ScratchArenas.h"
+#include "AllocationHints.h"
+#include "MemoryPlanning.h"
+#include "HoistAllocations.h"
+#include "MemoryTracking.h"
 
 namespace Halide {
 namespace Internal {
@@ -931,7 +937,7 @@ private:
         internal_assert(first_dot != string::npos && last_dot != string::npos);
         string func = f->name.substr(0, first_dot);
         string var = f->name.substr(last_dot + 1);
-        Site s = {f->for_type == ForType::Parallel ||
+        Site s = {is_parallel(f->for_type) ||
                   f->for_type == ForType::Vectorized,
                   LoopLevel(func, var)};
         sites.push_back(s);
@@ -1868,6 +1874,10 @@ Stmt lower(Function f, const Target &t, const vector<IRMutator *> &custom_passes
     s = storage_flattening(s, order.back(), env);
     debug(2) << "Lowering after storage flattening:\n" << s << "\n\n";
 
+    debug(1) << "Rewriting memoized allocations...\n";
+    s = rewrite_memoized_allocations(s, env);
+    debug(2) << "Lowering after rewriting memoized allocations:\n" << s << "\n\n";
+
     if (t.has_gpu_feature() || t.has_feature(Target::OpenGL)) {
         debug(1) << "Injecting host <-> dev buffer copies...\n";
         s = inject_host_dev_buffer_copies(s, t);
@@ -1913,16 +1923,44 @@ Stmt lower(Function f, const Target &t, const vector<IRMutator *> &custom_passes
     s = remove_trivial_for_loops(s);
     debug(2) << "Lowering after specializing branched loops:\n" << s << "\n\n";
 
+    debug(1) << "Hoisting loop invariant allocations...\n";
+    s = hoist_loop_invariant_allocations(s);
+    debug(2) << "Lowering after hoisting loop invariant allocations:\n" << s << "\n\n";
+
     debug(1) << "Injecting early frees...\n";
     s = inject_early_frees(s);
     debug(2) << "Lowering after injecting early frees:\n" << s << "\n\n";
 
+    debug(1) << "Planning memory...\n";
+    s = plan_memory(s, env, t);
+    debug(2) << "Lowering after planning memory:\n" << s << "\n\n";
+
     if (t.has_gpu_feature()) {
         debug(1) << "Injecting device frees...\n";
         s = inject_dev_frees(s);
         debug(2) << "Lowering after injecting device frees:\n" << s << "\n\n";
     }
 
+    debug(1) << "Injecting allocation hints...\n";
+    s = inject_allocation_hints(s, env, t);
+    debug(2) << "Lowering after injecting allocation hints:\n" << s << "\n\n";
+
+    debug(1) << "Running async stages concurrently...\n";
+    s = run_async_stages_concurrently(s, env);
+    debug(2) << "Lowering after running async stages concurrently:\n" << s << "\n\n";
+
+    if (t.has_feature(Target::ScratchArenas)) {
+        debug(1) << "Allocating from scratch arenas inside parallel loops...\n";
+        s = use_scratch_arenas(s, t);
+        debug(2) << "Lowering after allocating from scratch arenas:\n" << s << "\n\n";
+    }
+
+    if (t.has_feature(Target::TrackMemory)) {
+        debug(1) << "Tracking memory usage...\n";
+        s = track_memory_usage(s, env);
+        debug(2) << "Lowering after tracking memory usage:\n" << s << "\n\n";
+    }
+
     debug(1) << "Simplifying...\n";
     s = common_subexpression_elimination(s);
 
@@ -2,11 +2,15 @@
 #include "Error.h"
 #include "IRMutator.h"
 #include "IROperator.h"
+#include "IRPrinter.h"
 #include "Param.h"
+#include "Substitute.h"
 #include "Util.h"
 #include "Var.h"
 
 #include <map>
+#include <set>
+#include <sstream>
 
 namespace Halide {
 namespace Internal {
@@ -186,8 +190,99 @@ public:
     std::map<DependencyKey, DependencyInfo> dependency_info;
 };
 
+// Summarizes the definitions of a memoized Func and everything it
+// calls, so that results cached by one build of a pipeline aren't
+// used by another build that computes something different (e.g. when
+// loaded from a persistent cache).
+class DefinitionFingerprint : public IRGraphVisitor {
+public:
+    std::ostringstream text;
+
+    void visit_function(const Function &function) {
+        if (!visited.insert(function.name()).second) {
+            return;
+        }
+        text << "func " << function.name() << "(";
+        for (size_t i = 0; i < function.args().size(); i++) {
+            text << function.args()[i] << ",";
+        }
+        text << ")";
+        for (size_t i = 0; i < function.output_types().size(); i++) {
+            text << " " << function.output_types()[i];
+        }
+        text << "\n";
+        if (function.has_pure_definition()) {
+            visit_exprs(function.values());
+        }
+        const std::vector<UpdateDefinition> &updates = function.updates();
+        for (size_t i = 0; i < updates.size(); i++) {
+            text << "update\n";
+            visit_exprs(updates[i].args);
+            visit_exprs(updates[i].values);
+            if (updates[i].domain.defined()) {
+                const std::vector<ReductionVariable> &rvars = updates[i].domain.domain();
+                for (size_t j = 0; j < rvars.size(); j++) {
+                    text << rvars[j].var << " " << rvars[j].min << " " << rvars[j].extent << "\n";
+                    rvars[j].min.accept(this);
+                    rvars[j].extent.accept(this);
+                }
+            }
+        }
+        if (function.has_extern_definition()) {
+            text << "extern " << function.extern_function_name() << "\n";
+            const std::vector<ExternFuncArgument> &extern_args = function.extern_arguments();
+            for (size_t i = 0; i < extern_args.size(); i++) {
+                if (extern_args[i].is_func()) {
+                    text << "func arg " << Function(extern_args[i].func).name() << "\n";
+                    visit_function(extern_args[i].func);
+                } else if (extern_args[i].is_expr()) {
+                    text << extern_args[i].expr << "\n";
+                    extern_args[i].expr.accept(this);
+                } else if (extern_args[i].is_buffer()) {
+                    text << "buffer arg " << extern_args[i].buffer.name() << "\n";
+                } else if (extern_args[i].is_image_param()) {
+                    text << "image param arg " << extern_args[i].image_param.name() << "\n";
+                }
+            }
+        }
+    }
+
+    // A 64-bit FNV-1a hash of the definitions visited.
+    uint64_t hash() const {
+        std::string s = text.str();
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < s.size(); i++) {
+            h ^= (uint8_t)s[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+private:
+    std::set<std::string> visited;
+
+    void visit_exprs(const std::vector<Expr> &exprs) {
+        for (size_t i = 0; i < exprs.size(); i++) {
+            text << exprs[i] << "\n";
+            exprs[i].accept(this);
+        }
+    }
+
+    using IRGraphVisitor::visit;
+
+    void visit(const Call *call) {
+        IRGraphVisitor::visit(call);
+        if (call->call_type == Call::Halide) {
+            visit_function(call->func);
+        }
+    }
+};
+
 class KeyInfo {
     FindParameterDependencies dependencies;
+    uint64_t fingerprint;
+    std::string partition;
+    int64_t budget;
     Expr key_size_expr;
     const std::string &top_level_name;
     const std::string &function_name;
@@ -213,6 +308,15 @@ class KeyInfo {
         return (size_t)(1 << i);
     }
 
+    // The partition budget as an Int(64). IntImm only holds 32 bits.
+    Expr budget_expr() {
+        if (budget <= 0x7fffffff) {
+            return cast<int64_t>((int32_t)budget);
+        }
+        Expr hi = cast<int64_t>((int32_t)(budget >> 16));
+        return hi * 65536 + cast<int64_t>((int32_t)(budget & 0xffff));
+    }
+
     Stmt call_copy_memory(const std::string &key_name, const std::string &value, Expr index) {
         Expr dest = Call::make(Handle(), Call::address_of,
                                     vec(Load::make(UInt(8), key_name, index, Buffer(), Parameter())),
@@ -226,15 +330,20 @@ class KeyInfo {
 
 public:
   KeyInfo(const Function &function, const std::string &name)
-        : top_level_name(name), function_name(function.name())
+        : partition(function.schedule().memoize_partition()),
+          budget(function.schedule().memoize_budget()),
+          top_level_name(name), function_name(function.name())
     {
         dependencies.visit_function(function);
+        DefinitionFingerprint definition;
+        definition.visit_function(function);
+        fingerprint = definition.hash();
         std::map<FindParameterDependencies::DependencyKey,
                  FindParameterDependencies::DependencyInfo>::const_iterator iter;
         size_t size_so_far = 0;
 
         size_so_far = 4 + (int32_t)((top_level_name.size() + 3) & ~3);
-        size_so_far += 4 + function_name.size();
+        size_so_far += 4 + function_name.size() + 8;
 
         size_t needed_alignment = parameters_alignment();
         if (needed_alignment > 1) {
@@ -286,7 +395,15 @@ public:
         writes.push_back(call_copy_memory(key_name, function_name, index));
         index += name_size;
 
-        alignment += 4 + function_name.size();
+        // The fingerprint of the Func's definition, a byte at a time
+        // as it isn't aligned.
+        for (int i = 0; i < 8; i++) {
+            uint8_t byte = (uint8_t)(fingerprint >> (8 * i));
+            writes.push_back(Store::make(key_name, Cast::make(UInt(8), byte), index));
+            index = index + 1;
+        }
+
+        alignment += 4 + function_name.size() + 8;
         size_t needed_alignment = parameters_alignment();
         if (needed_alignment > 1) {
             while (alignment % needed_alignment) {
@@ -314,10 +431,11 @@ public:
         return blocks;
     }
 
-    // Returns a bool expression, which either evaluates to true,
-    // in which case the Allocation named by storage will be computed,
-    // or false, in which case it will be assumed the buffer was populated
-    // by the code in this call.
+    // Returns an int expression, which evaluates to 1 on a miss, in
+    // which case the Allocation named by storage will be computed,
+    // 0 on a hit, in which case the buffer now points at the cached
+    // result, or -1 if the runtime couldn't allocate memory for the
+    // buffer.
     Expr generate_lookup(std::string key_allocation_name, std::string computed_bounds_name,
                          int32_t tuple_count, std::string storage_base_name) {
         std::vector<Expr> args;
@@ -336,13 +454,18 @@ public:
             }
         }
         args.push_back(Call::make(type_of<buffer_t **>(), Call::make_struct, buffers, Call::Intrinsic));
+        args.push_back(StringImm::make(partition));
+        args.push_back(budget_expr());
 
-        return Call::make(Bool(1), "halide_memoization_cache_lookup", args, Call::Extern);
+        return Call::make(Int(32), "halide_memoization_cache_lookup", args, Call::Extern);
     }
 
-    // Returns a statement which will store the result of a computation under this key
+    // Returns a statement which will store the result of a computation
+    // under this key, along with how long it took to compute, in the
+    // Func's cache partition.
     Stmt store_computation(std::string key_allocation_name, std::string computed_bounds_name,
-                           int32_t tuple_count, std::string storage_base_name) {
+                           int32_t tuple_count, std::string storage_base_name,
+                           Expr compute_time) {
         std::vector<Expr> args;
         args.push_back(Call::make(type_of<uint8_t *>(), Call::address_of,
                                   vec(Load::make(type_of<uint8_t>(), key_allocation_name, Expr(0), Buffer(), Parameter())),
@@ -359,6 +482,9 @@ public:
             }
         }
         args.push_back(Call::make(type_of<buffer_t **>(), Call::make_struct, buffers, Call::Intrinsic));
+        args.push_back(compute_time);
+        args.push_back(StringImm::make(partition));
+        args.push_back(budget_expr());
 
         // This is actually a void call. How to indicate that? Look at Extern_ stuff.
         return Evaluate::make(Call::make(Bool(), "halide_memoization_cache_store", args, Call::Extern));
@@ -404,20 +530,34 @@ private:
             KeyInfo key_info(f, top_level_name);
 
             std::string cache_key_name = op->name + ".cache_key";
+            std::string cache_result_name = op->name + ".cache_result";
             std::string cache_miss_name = op->name + ".cache_miss";
             std::string computed_bounds_name = op->name + ".computed_bounds.buffer";
+            std::string compute_start_name = op->name + ".compute_start";
+
+            // Time the computation on a miss, so that the cache can
+            // weigh how expensive the result is to recompute against
+            // how much space it takes.
+            Expr now = Call::make(Int(64), "halide_current_time_ns", std::vector<Expr>(), Call::Extern);
+            Stmt record_start = Store::make(compute_start_name, now, 0);
+            Expr compute_time = now - Load::make(Int(64), compute_start_name, 0, Buffer(), Parameter());
 
             Expr cache_miss = Variable::make(Bool(), cache_miss_name);
-            Stmt mutated_produce = IfThenElse::make(cache_miss, produce);
+            Stmt mutated_produce = IfThenElse::make(cache_miss, Block::make(record_start, produce));
             Stmt mutated_update =
                 update.defined() ? IfThenElse::make(cache_miss, update) :
                                        update;
             Stmt cache_store_back =
-              IfThenElse::make(cache_miss, key_info.store_computation(cache_key_name, computed_bounds_name, f.outputs(), op->name));
+              IfThenElse::make(cache_miss, key_info.store_computation(cache_key_name, computed_bounds_name, f.outputs(), op->name, compute_time));
             Stmt mutated_consume = Block::make(cache_store_back, consume);
 
             Stmt mutated_pipeline = Pipeline::make(op->name, mutated_produce, mutated_update, mutated_consume);
-            Stmt cache_lookup = LetStmt::make(cache_miss_name, key_info.generate_lookup(cache_key_name, computed_bounds_name, f.outputs(), op->name), mutated_pipeline);
+            Expr cache_result = Variable::make(Int(32), cache_result_name);
+            Stmt cache_lookup = LetStmt::make(cache_miss_name, cache_result == 1, mutated_pipeline);
+            std::string error_msg = "Out of memory looking up " + op->name + " in the memoization cache";
+            cache_lookup = Block::make(AssertStmt::make(cache_result >= 0, error_msg), cache_lookup);
+            cache_lookup = LetStmt::make(cache_result_name, key_info.generate_lookup(cache_key_name, computed_bounds_name, f.outputs(), op->name), cache_lookup);
+            cache_lookup = Allocate::make(compute_start_name, Int(64), vec(Expr(1)), const_true(), cache_lookup);
 
             std::vector<Expr> computed_bounds_args;
             Expr null_handle = Call::make(Handle(), Call::null_handle, std::vector<Expr>(), Call::Intrinsic);
@@ -454,5 +594,144 @@ Stmt inject_memoization(Stmt s, const std::map<std::string, Function> &env,
     return injector.mutate(s);
 }
 
+namespace {
+
+// Make the storage of memoized Funcs point at memory owned by the
+// cache, so that a hit doesn't need to copy anything. A hit may be
+// on a cached result that covers more than the region needed, in
+// which case the runtime describes that result in the buffer, so
+// accesses must use the mins and strides from the buffer rather than
+// the ones the storage was laid out with.
+class RewriteMemoizedAllocations : public IRMutator {
+public:
+    RewriteMemoizedAllocations(const std::map<std::string, Function> &env) {
+        for (std::map<std::string, Function>::const_iterator iter = env.begin();
+             iter != env.end(); ++iter) {
+            const Function &f = iter->second;
+            if (!f.schedule().memoized()) continue;
+            if (f.outputs() == 1) {
+                storage_to_func[f.name()] = f.name();
+            } else {
+                for (int i = 0; i < f.outputs(); i++) {
+                    storage_to_func[f.name() + "." + int_to_string(i)] = f.name();
+                }
+            }
+        }
+    }
+
+private:
+    // Maps the name of each memoized Func's allocation(s) to the Func.
+    std::map<std::string, std::string> storage_to_func;
+
+    // The allocations of each memoized Func whose cache lookup
+    // hasn't been reached yet.
+    std::map<std::string, std::vector<const Allocate *> > pending;
+
+    // Strides known to be one. A cached result is only used if it's
+    // dense in the same dimension, so these don't need to be read
+    // from the buffer.
+    std::set<std::string> unit_strides;
+
+    // Make accesses to an allocation in s use the mins and strides
+    // in its buffer.
+    Stmt use_buffer_layout(const Allocate *alloc, Stmt s) {
+        Expr buffer = Variable::make(Handle(), alloc->name + ".buffer");
+        std::vector<std::pair<std::string, Expr> > lets;
+        for (size_t i = 0; i < alloc->extents.size(); i++) {
+            std::string dim = int_to_string(i);
+            std::string min_name = alloc->name + ".min." + dim;
+            Expr min = Call::make(Int(32), Call::extract_buffer_min,
+                                  vec<Expr>(buffer, (int)i), Call::Intrinsic);
+            lets.push_back(std::make_pair(min_name, min));
+            std::string stride_name = alloc->name + ".stride." + dim;
+            if (!unit_strides.count(stride_name)) {
+                Expr stride = Call::make(Int(32), Call::extract_buffer_stride,
+                                         vec<Expr>(buffer, (int)i), Call::Intrinsic);
+                lets.push_back(std::make_pair(stride_name, stride));
+            }
+        }
+        for (size_t i = 0; i < lets.size(); i++) {
+            std::string cached_name = lets[i].first + ".cached";
+            s = substitute(lets[i].first, Variable::make(Int(32), cached_name), s);
+            s = LetStmt::make(cached_name, lets[i].second, s);
+        }
+        return s;
+    }
+
+    using IRMutator::visit;
+
+    void visit(const Allocate *op) {
+        std::map<std::string, std::string>::const_iterator iter = storage_to_func.find(op->name);
+        if (iter == storage_to_func.end() || op->new_expr.defined()) {
+            IRMutator::visit(op);
+            return;
+        }
+
+        // Drop the allocation. It gets reinstated around the cache
+        // lookup, getting its memory from the cache.
+        std::vector<const Allocate *> &allocs = pending[iter->second];
+        allocs.push_back(op);
+        size_t count = allocs.size();
+        Stmt body = mutate(op->body);
+        if (pending[iter->second].size() == count) {
+            // Didn't find the lookup. Leave the allocation alone.
+            pending[iter->second].pop_back();
+            IRMutator::visit(op);
+        } else {
+            stmt = body;
+        }
+    }
+
+    void visit(const LetStmt *op) {
+        if (is_one(op->value)) {
+            unit_strides.insert(op->name);
+        }
+        if (ends_with(op->name, ".buffer")) {
+            std::string storage = op->name.substr(0, op->name.size() - 7);
+            std::map<std::string, std::string>::const_iterator iter = storage_to_func.find(storage);
+            const Call *call = op->value.as<Call>();
+            if (iter != storage_to_func.end() && !pending[iter->second].empty() &&
+                call && call->name == Call::create_buffer_t) {
+                // The runtime fills in the host pointer.
+                std::vector<Expr> args = call->args;
+                args[0] = Call::make(Handle(), Call::null_handle, std::vector<Expr>(), Call::Intrinsic);
+                Expr value = Call::make(call->type, call->name, args, call->call_type);
+                stmt = LetStmt::make(op->name, value, mutate(op->body));
+                return;
+            }
+        } else if (ends_with(op->name, ".cache_miss")) {
+            std::string func = op->name.substr(0, op->name.size() - 11);
+            std::map<std::string, std::vector<const Allocate *> >::iterator iter = pending.find(func);
+            if (iter != pending.end() && !iter->second.empty()) {
+                std::vector<const Allocate *> allocs;
+                allocs.swap(iter->second);
+                Stmt body = mutate(op->body);
+                for (size_t i = allocs.size(); i > 0; i--) {
+                    const Allocate *alloc = allocs[i-1];
+                    Expr buffer = Variable::make(Handle(), alloc->name + ".buffer");
+                    Expr host = Call::make(Handle(), Call::extract_buffer_host,
+                                           vec(buffer), Call::Intrinsic);
+                    body = Allocate::make(alloc->name, alloc->type, alloc->extents,
+                                          alloc->condition, body,
+                                          host, "halide_memoization_cache_release",
+                                          alloc->memory_type);
+                }
+                for (size_t i = 0; i < allocs.size(); i++) {
+                    body = use_buffer_layout(allocs[i], body);
+                }
+                stmt = LetStmt::make(op->name, op->value, body);
+                return;
+            }
+        }
+        IRMutator::visit(op);
+    }
+};
+
+}
+
+Stmt rewrite_memoized_allocations(Stmt s, const std::map<std::string, Function> &env) {
+    return RewriteMemoizedAllocations(env).mutate(s);
+}
+
 }
 }
@@ -23,6 +23,14 @@ namespace Internal {
 Stmt inject_memoization(Stmt s, const std::map<std::string, Function> &env,
                         const std::string &name);
 
+/** Replace the allocations backing memoized Funcs with memory handed
+ * out by the cache lookup, released with
+ * halide_memoization_cache_release. On a cache hit the Func's buffer
+ * then points directly at the cached data instead of a copy of
+ * it. Should be run after storage flattening.
+ */
+Stmt rewrite_memoized_allocations(Stmt s, const std::map<std::string, Function> &env);
+
 }
 }
 
@@ -0,0 +1,335 @@
+#include <set>
+
+#include "MemoryPlanning.h"
+#include "IRVisitor.h"
+#include "IRMutator.h"
+#include "IROperator.h"
+#include "AllocationSize.h"
+#include "ExprUsesVar.h"
+#include "Scope.h"
+#include "Debug.h"
+
+namespace Halide {
+namespace Internal {
+
+using std::map;
+using std::set;
+using std::string;
+using std::vector;
+
+namespace {
+
+struct BufferLifetime {
+    string name;
+    // The size in bytes, as a 64-bit expression.
+    Expr size;
+    // The first and last uses, in the order the visitor below
+    // reaches them. Uses inside a loop count as uses over the whole
+    // loop. -1 if unused.
+    int first_use, last_use;
+    // Names bound by lets and loops around the allocation, and the
+    // other buffers it's allocated inside of.
+    set<string> defined;
+    set<string> enclosing;
+    // Whether something other than loads and stores uses the buffer,
+    // e.g. an extern stage or a device copy through its buffer_t.
+    bool escapes;
+};
+
+class FindBufferLifetimes : public IRVisitor {
+public:
+    vector<BufferLifetime> buffers;
+
+    FindBufferLifetimes(const map<string, Function> &env) : position(0), loop_depth(0) {
+        for (map<string, Function>::const_iterator iter = env.begin();
+             iter != env.end(); ++iter) {
+            const Function &f = iter->second;
+            // Funcs that ask for their own placement get their own
+            // memory.
+            if (f.schedule().allocation_hints() >= 0) continue;
+            if (f.outputs() == 1) {
+                plannable.insert(f.name());
+            } else {
+                for (int i = 0; i < f.outputs(); i++) {
+                    plannable.insert(f.name() + "." + int_to_string(i));
+                }
+            }
+        }
+    }
+
+private:
+    set<string> plannable;
+
+    // Which entry of buffers each buffer in scope is.
+    map<string, int> index;
+
+    int position;
+    int loop_depth;
+    // Where the outermost loop started, and the buffers used in it.
+    int loop_start;
+    set<int> used_in_loop;
+
+    vector<string> defined;
+    vector<string> enclosing;
+
+    using IRVisitor::visit;
+
+    void use(const string &name) {
+        map<string, int>::iterator iter = index.find(name);
+        if (iter == index.end()) return;
+        position++;
+        if (loop_depth > 0) {
+            used_in_loop.insert(iter->second);
+        } else {
+            BufferLifetime &b = buffers[iter->second];
+            if (b.first_use < 0) b.first_use = position;
+            b.last_use = position;
+        }
+    }
+
+    void visit(const Load *op) {
+        use(op->name);
+        IRVisitor::visit(op);
+    }
+
+    void visit(const Store *op) {
+        use(op->name);
+        IRVisitor::visit(op);
+    }
+
+    void visit(const Call *op) {
+        use(op->name);
+        IRVisitor::visit(op);
+    }
+
+    void visit(const Variable *op) {
+        string name;
+        if (ends_with(op->name, ".buffer")) {
+            name = op->name.substr(0, op->name.size() - 7);
+        } else if (ends_with(op->name, ".host")) {
+            name = op->name.substr(0, op->name.size() - 5);
+        } else {
+            return;
+        }
+        map<string, int>::iterator iter = index.find(name);
+        if (iter != index.end()) {
+            buffers[iter->second].escapes = true;
+        }
+    }
+
+    void visit(const LetStmt *op) {
+        op->value.accept(this);
+        defined.push_back(op->name);
+        op->body.accept(this);
+        defined.pop_back();
+    }
+
+    void visit(const For *op) {
+        op->min.accept(this);
+        op->extent.accept(this);
+        if (loop_depth == 0) {
+            position++;
+            loop_start = position;
+            used_in_loop.clear();
+        }
+        loop_depth++;
+        defined.push_back(op->name);
+        op->body.accept(this);
+        defined.pop_back();
+        loop_depth--;
+        if (loop_depth == 0) {
+            position++;
+            for (set<int>::iterator iter = used_in_loop.begin(); iter != used_in_loop.end(); ++iter) {
+                BufferLifetime &b = buffers[*iter];
+                if (b.first_use < 0) b.first_use = loop_start;
+                b.last_use = position;
+            }
+        }
+    }
+
+    void visit(const Allocate *op) {
+        for (size_t i = 0; i < op->extents.size(); i++) {
+            op->extents[i].accept(this);
+        }
+        op->condition.accept(this);
+
+        bool candidate = loop_depth == 0 && !op->new_expr.defined() &&
+            op->memory_type != MemoryType::Stack && plannable.count(op->name);
+
+        // Stack allocations reuse each other's memory there already.
+        int64_t constant_size;
+        Expr size = allocation_size_in_bytes(op->type, op->extents, &constant_size);
+        if (allocation_goes_on_stack(constant_size, op->memory_type)) {
+            candidate = false;
+        }
+
+        if (!candidate) {
+            IRVisitor::visit(op);
+            return;
+        }
+
+        BufferLifetime b;
+        b.name = op->name;
+        b.size = select(op->condition, size, make_const(Int(64), 0));
+        b.first_use = b.last_use = -1;
+        b.defined.insert(defined.begin(), defined.end());
+        b.enclosing.insert(enclosing.begin(), enclosing.end());
+        b.escapes = false;
+        index[op->name] = (int)buffers.size();
+        buffers.push_back(b);
+
+        enclosing.push_back(op->name);
+        op->body.accept(this);
+        enclosing.pop_back();
+        index.erase(op->name);
+    }
+};
+
+struct Slab {
+    string name;
+    // Indices into the buffers, in the order they're used.
+    vector<int> members;
+    int last_use;
+};
+
+// Whether buffer b can be carved out of a slab allocated where
+// buffer a is, i.e. whether b's allocation is inside a's and its size
+// can be computed outside of a.
+bool can_share(const BufferLifetime &a, const BufferLifetime &b) {
+    if (!b.enclosing.count(a.name)) return false;
+    Scope<int> bound_between;
+    for (set<string>::const_iterator iter = b.defined.begin(); iter != b.defined.end(); ++iter) {
+        if (!a.defined.count(*iter)) {
+            bound_between.push(*iter, 0);
+        }
+    }
+    return !expr_uses_vars(b.size, bound_between);
+}
+
+class UseSlabs : public IRMutator {
+public:
+    UseSlabs(const vector<BufferLifetime> &b, const vector<Slab> &s, const Target &t) :
+        buffers(b), slabs(s), no_asserts(t.has_feature(Target::NoAsserts)) {
+        for (size_t i = 0; i < slabs.size(); i++) {
+            const Slab &slab = slabs[i];
+            first_member[buffers[slab.members[0]].name] = (int)i;
+            last_member[buffers[slab.members.back()].name] = (int)i;
+            for (size_t j = 0; j < slab.members.size(); j++) {
+                member_of[buffers[slab.members[j]].name] = (int)i;
+            }
+        }
+    }
+
+private:
+    const vector<BufferLifetime> &buffers;
+    const vector<Slab> &slabs;
+    bool no_asserts;
+
+    map<string, int> first_member, last_member, member_of;
+
+    using IRMutator::visit;
+
+    void visit(const Allocate *op) {
+        map<string, int>::const_iterator iter = member_of.find(op->name);
+        if (iter == member_of.end()) {
+            IRMutator::visit(op);
+            return;
+        }
+        const Slab &slab = slabs[iter->second];
+
+        // The memory belongs to the slab, so freeing the buffer on its
+        // own does nothing.
+        Stmt body = mutate(op->body);
+        Expr ptr = Call::make(Handle(), Call::address_of,
+                              vec(Load::make(UInt(8), slab.name, 0, Buffer(), Parameter())),
+                              Call::Intrinsic);
+        stmt = Allocate::make(op->name, op->type, op->extents, op->condition, body,
+                              ptr, "halide_memory_plan_free", op->memory_type);
+
+        if (first_member.count(op->name)) {
+            string size_name = slab.name + ".size";
+            Expr size = buffers[slab.members[0]].size;
+            for (size_t i = 1; i < slab.members.size(); i++) {
+                size = max(size, buffers[slab.members[i]].size);
+            }
+            Expr size_var = Variable::make(Int(64), size_name);
+            stmt = Allocate::make(slab.name, UInt(8), vec(cast<int32_t>(size_var)), const_true(), stmt);
+            if (!no_asserts) {
+                // Covers the check each member would have had if
+                // allocated on its own.
+                stmt = Block::make(allocation_size_check(slab.name, size_var), stmt);
+            }
+            stmt = LetStmt::make(size_name, size, stmt);
+        }
+    }
+
+    void visit(const Free *op) {
+        map<string, int>::const_iterator iter = last_member.find(op->name);
+        if (iter == last_member.end()) {
+            stmt = op;
+        } else {
+            stmt = Block::make(op, Free::make(slabs[iter->second].name));
+        }
+    }
+};
+
+}
+
+Stmt plan_memory(Stmt s, const map<string, Function> &env, const Target &t) {
+    // Async stages run at the same time as the stage after them, so
+    // the order of the statement isn't the order things happen in.
+    for (map<string, Function>::const_iterator iter = env.begin();
+         iter != env.end(); ++iter) {
+        if (iter->second.schedule().async()) {
+            return s;
+        }
+    }
+
+    FindBufferLifetimes lifetimes(env);
+    s.accept(&lifetimes);
+    const vector<BufferLifetime> &buffers = lifetimes.buffers;
+
+    // Buffers are reached in the order they're allocated. Put each in
+    // the first slab whose buffers are all dead by the time it's
+    // first used.
+    vector<Slab> slabs;
+    for (size_t i = 0; i < buffers.size(); i++) {
+        const BufferLifetime &b = buffers[i];
+        if (b.escapes || b.first_use < 0) continue;
+        size_t j = 0;
+        for (; j < slabs.size(); j++) {
+            if (slabs[j].last_use < b.first_use &&
+                can_share(buffers[slabs[j].members[0]], b)) {
+                break;
+            }
+        }
+        if (j == slabs.size()) {
+            Slab slab;
+            slab.name = b.name + ".slab";
+            slabs.push_back(slab);
+        }
+        slabs[j].members.push_back((int)i);
+        slabs[j].last_use = b.last_use;
+    }
+
+    // Slabs with just one buffer save nothing.
+    vector<Slab> shared;
+    for (size_t i = 0; i < slabs.size(); i++) {
+        if (slabs[i].members.size() > 1) {
+            debug(3) << "Buffers sharing " << slabs[i].name << ":";
+            for (size_t j = 0; j < slabs[i].members.size(); j++) {
+                debug(3) << " " << buffers[slabs[i].members[j]].name;
+            }
+            debug(3) << "\n";
+            shared.push_back(slabs[i]);
+        }
+    }
+    if (shared.empty()) {
+        return s;
+    }
+
+    return UseSlabs(buffers, shared, t).mutate(s);
+}
+
+}
+}
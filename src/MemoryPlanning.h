@@ -0,0 +1,37 @@
+#ifndef HALIDE_MEMORY_PLANNING_H
+#define HALIDE_MEMORY_PLANNING_H
+
+/** \file
+ * Defines the lowering pass that lets intermediate buffers with
+ * disjoint lifetimes share memory.
+ */
+
+#include <map>
+
+#include "IR.h"
+#include "Function.h"
+#include "Target.h"
+
+namespace Halide {
+namespace Internal {
+
+/** Find the heap allocations made outside of all loops (e.g. those of
+ * compute_root Funcs), work out when each one is first and last used,
+ * and carve buffers whose lifetimes don't overlap out of a shared
+ * slab of memory, like a register allocator packs values into
+ * registers. Each slab is as big as the biggest buffer in it, is
+ * allocated where its first buffer was, and is freed after the last
+ * use of its last buffer. Run after inject_early_frees.
+ *
+ * With the track_memory target feature, each buffer in a slab is
+ * still reported to the memory tracker at its full size, and the slab
+ * itself isn't reported, as it belongs to no Func. So each Func's
+ * numbers stay those of its own buffer, but buffers sharing a slab
+ * are counted once each, and the tracker's totals can be more than
+ * the memory actually allocated. */
+Stmt plan_memory(Stmt s, const std::map<std::string, Function> &env, const Target &t);
+
+}
+}
+
+#endif
@@ -0,0 +1,129 @@
+#include <set>
+
+#include "MemoryTracking.h"
+#include "IRMutator.h"
+#include "IROperator.h"
+#include "AllocationSize.h"
+#include "Debug.h"
+
+namespace Halide {
+namespace Internal {
+
+using std::map;
+using std::set;
+using std::string;
+
+namespace {
+
+// A 64-bit constant. make_const only takes 32-bit values.
+Expr make_int64(int64_t x) {
+    if (x == (int)x) {
+        return make_const(Int(64), (int)x);
+    }
+    Expr hi = make_const(Int(64), (int)(x >> 32));
+    Expr mid = make_const(Int(64), (int)((x >> 16) & 0xffff));
+    Expr lo = make_const(Int(64), (int)(x & 0xffff));
+    Expr scale = make_const(Int(64), 0x10000);
+    return (hi * scale + mid) * scale + lo;
+}
+
+class TrackMemory : public IRMutator {
+public:
+    TrackMemory(const map<string, Function> &env) : instances(1), in_device_code(false) {
+        for (map<string, Function>::const_iterator iter = env.begin();
+             iter != env.end(); ++iter) {
+            const Function &f = iter->second;
+            if (f.outputs() == 1) {
+                func_of[f.name()] = f.name();
+            } else {
+                for (int i = 0; i < f.outputs(); i++) {
+                    func_of[f.name() + "." + int_to_string(i)] = f.name();
+                }
+            }
+        }
+    }
+
+private:
+    // The Func each buffer belongs to.
+    map<string, string> func_of;
+
+    // How many instances of an allocation made here can be live at
+    // once: the product of the extents of the enclosing parallel
+    // loops, or -1 if one of them isn't constant.
+    int64_t instances;
+    bool in_device_code;
+
+    set<string> tracked;
+
+    using IRMutator::visit;
+
+    void visit(const For *op) {
+        int64_t old_instances = instances;
+        bool old_in_device_code = in_device_code;
+        if (op->device_api != DeviceAPI::Host && op->device_api != DeviceAPI::Parent) {
+            in_device_code = true;
+        }
+        if (is_parallel(op->for_type) && instances > 0) {
+            const IntImm *extent = op->extent.as<IntImm>();
+            if (extent && extent->value >= 0) {
+                instances *= extent->value;
+            } else {
+                instances = -1;
+            }
+        }
+        IRMutator::visit(op);
+        instances = old_instances;
+        in_device_code = old_in_device_code;
+    }
+
+    void visit(const Allocate *op) {
+        map<string, string>::const_iterator func = func_of.find(op->name);
+        if (func == func_of.end() || in_device_code || op->memory_type == MemoryType::Stack) {
+            IRMutator::visit(op);
+            return;
+        }
+
+        int64_t constant_size;
+        Expr size = allocation_size_in_bytes(op->type, op->extents, &constant_size);
+        if (allocation_goes_on_stack(constant_size, op->memory_type)) {
+            IRMutator::visit(op);
+            return;
+        }
+
+        Stmt body = mutate(op->body);
+
+        int64_t static_bound = -1;
+        if (constant_size >= 0 && instances > 0 && instances <= (int64_t(1) << 31)) {
+            static_bound = constant_size * instances;
+            debug(1) << "Func " << func->second << " uses at most "
+                     << static_bound << " bytes for its buffer " << op->name << "\n";
+        }
+
+        tracked.insert(op->name);
+        Expr call = Call::make(Handle(), "halide_memory_tracker_alloc",
+                               vec<Expr>(func->second, select(op->condition, size, make_const(Int(64), 0)),
+                                         make_int64(static_bound)),
+                               Call::Extern);
+        stmt = Allocate::make(op->name, op->type, op->extents, op->condition, body,
+                              op->new_expr, op->free_function, op->memory_type);
+        stmt = Allocate::make(op->name + ".memory_tracker", UInt(8), vec(Expr(1)), const_true(), stmt,
+                              call, "halide_memory_tracker_free");
+    }
+
+    void visit(const Free *op) {
+        if (tracked.count(op->name)) {
+            stmt = Block::make(op, Free::make(op->name + ".memory_tracker"));
+        } else {
+            stmt = op;
+        }
+    }
+};
+
+}
+
+Stmt track_memory_usage(Stmt s, const map<string, Function> &env) {
+    return TrackMemory(env).mutate(s);
+}
+
+}
+}
@@ -0,0 +1,31 @@
+#ifndef HALIDE_MEMORY_TRACKING_H
+#define HALIDE_MEMORY_TRACKING_H
+
+/** \file
+ * Defines the lowering pass that reports each Func's heap allocations
+ * to the runtime's memory tracker.
+ */
+
+#include <map>
+
+#include "IR.h"
+#include "Function.h"
+
+namespace Halide {
+namespace Internal {
+
+/** Bracket each heap allocation of a Func's buffer with calls to
+ * halide_memory_tracker_alloc and halide_memory_tracker_free, so that
+ * the runtime can report the current and peak bytes each Func uses.
+ * The calls are made through an Allocate node of their own, so that
+ * early exits free them too. When a buffer's size is constant, and so
+ * is the number of iterations of each parallel loop it's allocated
+ * inside, the most memory the Func can use at once is passed along,
+ * and printed at debug level 1. Buffers that share memory (see
+ * plan_memory) are each counted in full. */
+Stmt track_memory_usage(Stmt s, const std::map<std::string, Function> &env);
+
+}
+}
+
+#endif
@@ -234,7 +234,7 @@ private:
 
     void visit(const For *op) {
         current_loop_level++;
-        if (op->for_type == ForType::Parallel && level >= 1) {
+        if (is_parallel(op->for_type) && level >= 1) {
             std::cerr << "Warning: The Halide profiler does not yet support "
                       << "parallel schedules. Not profiling inside the loop over "
                       << op->name << "\n";
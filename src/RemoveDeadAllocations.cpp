@@ -53,7 +53,8 @@ class RemoveDeadAllocations : public IRMutator {
         } else if (body.same_as(op->body)) {
             stmt = op;
         } else {
-            stmt = Allocate::make(op->name, op->type, op->extents, op->condition, body);
+            stmt = Allocate::make(op->name, op->type, op->extents, op->condition, body,
+                                  op->new_expr, op->free_function, op->memory_type);
         }
     }
 
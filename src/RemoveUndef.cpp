@@ -361,7 +361,8 @@ private:
             condition.same_as(op->condition)) {
             stmt = op;
         } else {
-            stmt = Allocate::make(op->name, op->type, new_extents, condition, body);
+            stmt = Allocate::make(op->name, op->type, new_extents, condition, body,
+                                  op->new_expr, op->free_function, op->memory_type);
         }
     }
 
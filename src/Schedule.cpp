@@ -19,10 +19,15 @@ struct ScheduleContents {
     std::vector<Specialization> specializations;
     ReductionDomain reduction_domain;
     bool memoized;
+    std::string memoize_partition;
+    int64_t memoize_budget;
+    int allocation_hints;
+    MemoryType memory_type;
+    bool async;
     bool touched;
     bool allow_race_conditions;
 
-    ScheduleContents() : memoized(false), touched(false), allow_race_conditions(false) {};
+    ScheduleContents() : memoized(false), memoize_budget(0), allocation_hints(-1), memory_type(MemoryType::Auto), async(false), touched(false), allow_race_conditions(false) {};
 };
 
 
@@ -46,6 +51,46 @@ bool Schedule::memoized() const {
     return contents.ptr->memoized;
 }
 
+std::string &Schedule::memoize_partition() {
+    return contents.ptr->memoize_partition;
+}
+
+const std::string &Schedule::memoize_partition() const {
+    return contents.ptr->memoize_partition;
+}
+
+int64_t &Schedule::memoize_budget() {
+    return contents.ptr->memoize_budget;
+}
+
+int64_t Schedule::memoize_budget() const {
+    return contents.ptr->memoize_budget;
+}
+
+int &Schedule::allocation_hints() {
+    return contents.ptr->allocation_hints;
+}
+
+int Schedule::allocation_hints() const {
+    return contents.ptr->allocation_hints;
+}
+
+MemoryType &Schedule::memory_type() {
+    return contents.ptr->memory_type;
+}
+
+MemoryType Schedule::memory_type() const {
+    return contents.ptr->memory_type;
+}
+
+bool &Schedule::async() {
+    return contents.ptr->async;
+}
+
+bool Schedule::async() const {
+    return contents.ptr->async;
+}
+
 bool &Schedule::touched() {
     return contents.ptr->touched;
 }
@@ -122,6 +122,37 @@ public:
     bool memoized() const;
     // @}
 
+    /** The memoization cache partition results of this function are
+     * kept in, and the most memory it should use in bytes. An empty
+     * name is the default partition, and a budget of zero leaves the
+     * partition's size unchanged. */
+    // @{
+    std::string &memoize_partition();
+    const std::string &memoize_partition() const;
+    int64_t &memoize_budget();
+    int64_t memoize_budget() const;
+    // @}
+
+    /** The halide_allocation_hint_t flags to allocate this
+     * function's buffer with, or -1 to decide by its size. */
+    // @{
+    int &allocation_hints();
+    int allocation_hints() const;
+    // @}
+
+    /** Whether this function's buffer goes on the stack or the heap. */
+    // @{
+    MemoryType &memory_type();
+    MemoryType memory_type() const;
+    // @}
+
+    /** This flag is set to true if the function may be computed
+     * concurrently with the stage computed after it. */
+    // @{
+    bool &async();
+    bool async() const;
+    // @}
+
     /** This flag is set to true if the dims list has been manipulated
      * by the user (or if a ScheduleHandle was created that could have
      * been used to manipulate it). It controls the warning that
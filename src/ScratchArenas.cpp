@@ -0,0 +1,99 @@
+#include "ScratchArenas.h"
+#include "IRMutator.h"
+#include "IROperator.h"
+#include "AllocationSize.h"
+#include "Debug.h"
+
+namespace Halide {
+namespace Internal {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+class UseScratchArenas : public IRMutator {
+public:
+    UseScratchArenas(const Target &t) : no_asserts(t.has_feature(Target::NoAsserts)), arena_used(false) {}
+
+private:
+    bool no_asserts;
+
+    // The arena of the innermost enclosing parallel loop, if any,
+    // and whether anything has been allocated from it.
+    string arena;
+    bool arena_used;
+
+    using IRMutator::visit;
+
+    void visit(const For *op) {
+        if (!is_parallel(op->for_type)) {
+            IRMutator::visit(op);
+            return;
+        }
+
+        string old_arena = arena;
+        bool old_arena_used = arena_used;
+        arena = op->name + ".scratch_arena";
+        arena_used = false;
+        Stmt body = mutate(op->body);
+        if (arena_used) {
+            // The arena is itself an allocation, so that it's handed
+            // back on early exits too.
+            Expr acquire = Call::make(Handle(), "halide_scratch_arena_acquire",
+                                      vector<Expr>(), Call::Extern);
+            body = Allocate::make(arena, UInt(8), vec(Expr(1)), const_true(), body,
+                                  acquire, "halide_scratch_arena_release");
+        }
+        arena = old_arena;
+        arena_used = old_arena_used;
+
+        if (body.same_as(op->body)) {
+            stmt = op;
+        } else {
+            stmt = For::make(op->name, op->min, op->extent, op->for_type, op->device_api, body);
+        }
+    }
+
+    void visit(const Allocate *op) {
+        if (arena.empty() || op->new_expr.defined() || op->memory_type == MemoryType::Stack) {
+            IRMutator::visit(op);
+            return;
+        }
+
+        int64_t constant_size;
+        Expr size = allocation_size_in_bytes(op->type, op->extents, &constant_size);
+        if (allocation_goes_on_stack(constant_size, op->memory_type)) {
+            IRMutator::visit(op);
+            return;
+        }
+
+        arena_used = true;
+        Stmt body = mutate(op->body);
+
+        debug(3) << "Allocating " << op->name << " from scratch arena " << arena << "\n";
+        string size_name = op->name + ".scratch_size";
+        Expr size_var = Variable::make(Int(64), size_name);
+        Expr handle = Call::make(Handle(), Call::address_of,
+                                 vec(Load::make(UInt(8), arena, 0, Buffer(), Parameter())),
+                                 Call::Intrinsic);
+        Expr alloc_size = select(op->condition, cast<int32_t>(size_var), 0);
+        Expr new_expr = Call::make(Handle(), "halide_scratch_alloc",
+                                   vec(handle, alloc_size), Call::Extern);
+        Stmt s = Allocate::make(op->name, op->type, op->extents, op->condition, body,
+                                new_expr, "halide_scratch_free", op->memory_type);
+        if (!no_asserts) {
+            s = Block::make(allocation_size_check(op->name, size_var), s);
+        }
+        stmt = LetStmt::make(size_name, size, s);
+    }
+};
+
+}
+
+Stmt use_scratch_arenas(Stmt s, const Target &t) {
+    return UseScratchArenas(t).mutate(s);
+}
+
+}
+}
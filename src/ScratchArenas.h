@@ -0,0 +1,26 @@
+#ifndef HALIDE_SCRATCH_ARENAS_H
+#define HALIDE_SCRATCH_ARENAS_H
+
+/** \file
+ * Defines the lowering pass that carves allocations inside parallel
+ * loops out of per-task scratch arenas.
+ */
+
+#include "IR.h"
+#include "Target.h"
+
+namespace Halide {
+namespace Internal {
+
+/** Give each iteration of a parallel loop that contains heap
+ * allocations a scratch arena from the runtime, and allocate from it
+ * instead of calling halide_malloc and halide_free. The runtime keeps
+ * a few arenas around for reuse, so a task that allocates the same
+ * buffers as a previous one usually just bumps a pointer. Allocations
+ * small and constant enough to go on the stack are left alone. */
+Stmt use_scratch_arenas(Stmt s, const Target &t);
+
+}
+}
+
+#endif
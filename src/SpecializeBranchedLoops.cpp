@@ -1103,7 +1103,8 @@ private:
             extents[i] = args[i];
         };
 
-        return Allocate::make(op->name, op->type, extents, simplify(args[i], true, bounds_info), args[i+1]);
+        return Allocate::make(op->name, op->type, extents, simplify(args[i], true, bounds_info), args[i+1],
+                              op->new_expr, op->free_function, op->memory_type);
     }
 
     void visit(const Allocate *op) {
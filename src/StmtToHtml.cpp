@@ -386,6 +386,8 @@ public:
             stream << keyword("for");
         } else if (op->for_type == ForType::Parallel) {
             stream << keyword("parallel");
+        } else if (op->for_type == ForType::GuidedParallel) {
+            stream << keyword("guided_parallel");
         } else if (op->for_type == ForType::Vectorized) {
             stream << keyword("vectorized");
         } else if (op->for_type == ForType::Unrolled) {
@@ -456,6 +458,11 @@ public:
             stream << " " << keyword("if") << " ";
             print(op->condition);
         }
+        if (op->new_expr.defined()) {
+            stream << " " << keyword("custom_new") << " ";
+            print(op->new_expr);
+            stream << " " << keyword("custom_delete") << " " << op->free_function;
+        }
 
         stream << open_div("AllocateBody");
         print(op->body);
@@ -183,7 +183,7 @@ Target parse_target_string(const std::string &target) {
                    << "and os is linux, windows, osx, nacl, ios, or android. "
                    << "If arch or os are omitted, they default to the host. "
                    << "Features include sse41, avx, avx2, armv7s, cuda, "
-                   << "opencl, no_asserts, no_bounds_query, and debug.\n"
+                   << "opencl, no_asserts, no_bounds_query, scratch_arenas, track_memory, and debug.\n"
                    << "HL_TARGET can also begin with \"host\", which sets the "
                    << "host's architecture, os, and feature set, with the "
                    << "exception of the GPU runtimes, which default to off.\n"
@@ -288,6 +288,10 @@ bool Target::merge_string(const std::string &target) {
             set_feature(Target::UserContext);
         } else if (tok == "no_asserts") {
             set_feature(Target::NoAsserts);
+        } else if (tok == "scratch_arenas") {
+            set_feature(Target::ScratchArenas);
+        } else if (tok == "track_memory") {
+            set_feature(Target::TrackMemory);
         } else if (tok == "no_bounds_query") {
             set_feature(Target::NoBoundsQuery);
         } else if (tok == "cl_doubles") {
@@ -356,7 +360,9 @@ std::string Target::to_string() const {
       "cuda", "cuda_capability_30", "cuda_capability_32", "cuda_capability_35", "cuda_capability_50",
       "opencl", "cl_doubles",
       "opengl",
-      "user_context"
+      "user_context",
+      "scratch_arenas",
+      "track_memory"
   };
   internal_assert(sizeof(feature_names) / sizeof(feature_names[0]) == FeatureEnd);
   string result = string(arch_names[arch])
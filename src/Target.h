@@ -59,6 +59,10 @@ struct Target {
 
         UserContext,  ///< Generated code takes a user_context pointer as first argument
 
+        ScratchArenas,  ///< Allocate buffers inside parallel loops from per-task scratch arenas
+
+        TrackMemory,  ///< Report each Func's heap allocations to the runtime's memory tracker
+
         FeatureEnd
         // NOTE: Changes to this enum must be reflected in the definition of
         // to_string()!
@@ -489,7 +489,8 @@ class VectorizeLoops : public IRMutator {
             internal_allocations.push(op->name, 0);
             Stmt body = mutate(op->body);
             internal_allocations.pop(op->name);
-            stmt = Allocate::make(op->name, op->type, new_extents, op->condition, body);
+            stmt = Allocate::make(op->name, op->type, new_extents, op->condition, body,
+                                  op->new_expr, op->free_function, op->memory_type);
         }
 
         Stmt scalarize(Stmt s) {
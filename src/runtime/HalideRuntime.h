@@ -99,11 +99,193 @@ extern int halide_do_par_for(void *user_context,
 extern void halide_shutdown_thread_pool();
 //@}
 
+/** Like halide_do_par_for, but hands out the tasks in shrinking
+ * chunks. Each thread starts with an even share of the loop, as with
+ * halide_do_par_for, and claims 1/num_threads of what's left of its
+ * share at a time, so chunks start large and shrink to single tasks.
+ * (Classic guided self-scheduling instead takes 1/num_threads of
+ * what's left of the whole loop.) Idle threads steal from the others
+ * as usual. Called for loops scheduled with
+ * ParallelChunking::Guided. Falls back to halide_do_par_for if a
+ * custom one is installed, or on platforms where the thread pool
+ * already schedules tasks dynamically. */
+extern int halide_do_guided_par_for(void *user_context,
+                                    int (*f)(void *ctx, int, uint8_t *),
+                                    int min, int size, uint8_t *closure);
+
+/** Queue a call to f(args) to run on the thread pool chosen by
+ * halide_get_thread_pool(user_context), and return without waiting
+ * for it. f is usually a pipeline's _argv entry point. Once f
+ * returns, done is called on the same thread with the user context,
+ * f's result, and done_arg. args (and everything it points to) must
+ * stay valid until then. Queued calls only start when the pool's
+ * workers have no parallel loops left to help with, and no extra
+ * threads are created for them. On OS X and iOS the call is handed
+ * to Grand Central Dispatch. If the pool has no workers (one thread,
+ * or Windows), the call runs immediately on the calling thread. See the
+ * _async variant of ahead-of-time compiled pipelines and
+ * Func::realize_async. */
+extern void halide_do_async(void *user_context, int (*f)(void **args), void **args,
+                            void (*done)(void *user_context, int result, void *done_arg),
+                            void *done_arg);
+
 /** Set the number of threads used by Halide's thread pool. No effect
- * on OS X or iOS. If changed after the first use of a parallel Halide
- * routine, shuts down and then reinitializes the thread pool. */
+ * on OS X or iOS. There is no upper limit. If changed after the first
+ * use of a parallel Halide routine, the thread pool grows or shrinks
+ * in place; parallel loops already running are unaffected. Passing
+ * zero selects the default (HL_NUM_THREADS, or the number of
+ * cores). Calls made from the pool's own worker threads (i.e. from
+ * inside a parallel task) are an error, and leave the pool as it
+ * is. If threads can't be started, the pool makes do with fewer. */
 extern void halide_set_num_threads(int n);
 
+/** Ways Halide's thread pool can place its worker threads. */
+typedef enum halide_thread_affinity_t {
+    halide_thread_affinity_none = 0,  //!< Let the OS schedule workers anywhere (the default)
+    halide_thread_affinity_cores = 1, //!< Pin each worker to its own core
+    halide_thread_affinity_nodes = 2  //!< Pin each worker to the NUMA node of its core
+} halide_thread_affinity_t;
+
+/** Set how Halide's thread pool places its worker threads. Worker i
+ * is associated with core i+1 (modulo the core count), and the tasks
+ * of a parallel loop are dealt out to workers in contiguous chunks,
+ * so in either pinned mode neighboring loop iterations run on the
+ * same NUMA node. Workers that run out of tasks steal from workers on
+ * their own node first. Only has an effect on Linux and Android. If
+ * never called, Halide checks the environment variable
+ * HL_THREAD_AFFINITY, which may be "none", "cores", or "nodes". May
+ * be called at any time; running workers re-pin themselves the next
+ * time they look for work. */
+extern void halide_set_thread_affinity(halide_thread_affinity_t mode);
+
+/** Set how long idle threads in Halide's thread pool poll for new
+ * work before blocking. An idle thread first re-reads the work queue
+ * spin_count times in a tight loop, then yield_count more times with
+ * a sched_yield in between, and only then sleeps on a condition
+ * variable. Waking a sleeping thread costs tens of microseconds, so
+ * pipelines with many short parallel stages benefit from a larger
+ * budget, at the cost of burning cores while idle. Zero for both
+ * means always block. If never called, Halide checks the environment
+ * variables HL_SPIN_COUNT and HL_YIELD_COUNT. Only has an effect on
+ * Linux, Android, and NaCl. */
+extern void halide_set_thread_pool_spin_budget(int spin_count, int yield_count);
+
+/** Counts of how waits in Halide's thread pool ended. Workers wait
+ * for new jobs; owners (threads that called halide_do_par_for) wait
+ * for the last tasks of their job to finish. */
+struct halide_thread_pool_wait_counters {
+    uint64_t worker_spin_wakeups;   //!< Work arrived during the spin phase
+    uint64_t worker_yield_wakeups;  //!< Work arrived during the yield phase
+    uint64_t worker_blocks;         //!< Budget exhausted; slept on a condition variable
+    uint64_t owner_spin_wakeups;
+    uint64_t owner_yield_wakeups;
+    uint64_t owner_blocks;
+};
+
+/** Read or reset the thread pool's wait counters. All zero on
+ * platforms where halide_set_thread_pool_spin_budget has no effect. */
+//@{
+extern void halide_get_thread_pool_wait_counters(struct halide_thread_pool_wait_counters *counters);
+extern void halide_reset_thread_pool_wait_counters();
+//@}
+
+/** Set the stack size, in bytes, of thread pool workers started after
+ * the call. Workers that already exist keep their stacks, so call it
+ * before the first parallel pipeline runs. Posix workers get 8MB by
+ * default, Windows ones the size in the executable's header. Has no
+ * effect with Grand Central Dispatch or without threads. */
+extern void halide_set_worker_stack_size(size_t size);
+
+/** The most stack, in bytes, that a buffer of a Func scheduled with
+ * store_in(MemoryType::Stack) may take up if allocated now on the
+ * calling thread. Buffers that would go over it go on the heap
+ * instead. Half of what's left of the thread's stack below the
+ * caller, to leave room for everything else. With the posix thread
+ * pool, only its workers' stacks are known, so on other threads this
+ * is zero; Windows and Grand Central Dispatch know every thread's
+ * stack. Replace it if your threads' stacks are known some other
+ * way. */
+extern int32_t halide_get_stack_allocation_limit();
+
+/** An opaque handle to a thread pool separate from the default
+ * one. Pipelines that run on their own pool don't compete with other
+ * pipelines for threads, and a job on one pool can't be stalled by
+ * long tasks from a job on another. */
+struct halide_thread_pool;
+
+/** Create a named thread pool with num_threads threads (including the
+ * calling thread), or the default thread count if num_threads is
+ * zero. Its workers are started lazily on first use. If priority is
+ * non-zero, the workers set it as their nice value when they start,
+ * so a lower-priority pool can be used for background work. Returns
+ * NULL on failure, and on platforms without Halide-owned thread pools
+ * (OS X, iOS, Windows). */
+extern struct halide_thread_pool *halide_create_thread_pool(const char *name, int num_threads, int priority);
+
+/** Look up a pool made by halide_create_thread_pool by its name, or
+ * return NULL if there isn't one. */
+extern struct halide_thread_pool *halide_find_thread_pool(const char *name);
+
+/** Stop a named pool's workers and free it. No pipeline may be using
+ * the pool at the time. halide_shutdown_thread_pool also destroys all
+ * named pools. */
+extern void halide_destroy_thread_pool(struct halide_thread_pool *pool);
+
+/** Like halide_set_num_threads, but for the given pool. NULL means
+ * the default pool. */
+extern void halide_set_thread_pool_num_threads(struct halide_thread_pool *pool, int n);
+
+/** Halide calls this from halide_do_par_for to pick the pool to run
+ * parallel loops on. Implement this yourself, or use
+ * halide_set_custom_get_thread_pool, to use a different pool per
+ * user_context. The default implementation returns NULL, which
+ * selects the default pool. See Func::set_custom_get_thread_pool. */
+//@{
+extern struct halide_thread_pool *halide_get_thread_pool(void *user_context);
+extern struct halide_thread_pool *(*halide_set_custom_get_thread_pool(struct halide_thread_pool *(*f)(void *)))(void *);
+//@}
+
+/** Per-worker telemetry for a thread pool. Times are in nanoseconds
+ * as measured by halide_current_time_ns. */
+struct halide_thread_pool_worker_stats {
+    uint64_t tasks;               //!< Parallel loop iterations run
+    uint64_t async_calls;         //!< Pipelines started by halide_do_async run
+    uint64_t working_ns;          //!< Time spent running tasks and async calls
+    uint64_t sleeping_ns;         //!< Time spent blocked waiting for work
+    uint64_t mutex_wait_ns;       //!< Time spent waiting for the queue mutex before sleeping
+    uint64_t b_team_transitions;  //!< Times the worker was sent to the B team to sleep
+};
+
+/** Telemetry for the threads that call halide_do_par_for on a thread
+ * pool (the job owners). */
+struct halide_thread_pool_stats {
+    int num_threads;              //!< Current size of the pool, or zero if not started
+    uint64_t jobs;                //!< Parallel loops run on the pool
+    uint64_t owner_tasks;         //!< Iterations run by the owners themselves, including other jobs' iterations run while waiting
+    uint64_t owner_working_ns;    //!< Time owners spent running their own iterations
+    uint64_t owner_wait_ns;       //!< Time owners spent waiting for workers to finish
+};
+
+/** Turn collection of thread pool stats on or off. It is off by
+ * default, in which case it costs a branch per wait or batch of
+ * tasks. If never called, Halide checks the environment variable
+ * HL_THREAD_POOL_STATS when a pool starts. */
+extern void halide_enable_thread_pool_stats(int enabled);
+
+/** Read the stats of a thread pool (NULL means the default pool). The
+ * pool totals are copied to stats if it is non-NULL, and the stats of
+ * up to max_workers workers to the workers array. Workers that have
+ * been removed by shrinking the pool keep their entries. Returns the
+ * number of workers that have stats. Always returns zero on platforms
+ * without Halide-owned thread pools (OS X, iOS, Windows). */
+extern int halide_get_thread_pool_stats(struct halide_thread_pool *pool,
+                                        struct halide_thread_pool_stats *stats,
+                                        struct halide_thread_pool_worker_stats *workers,
+                                        int max_workers);
+
+/** Zero the stats of a thread pool (NULL means the default pool). */
+extern void halide_reset_thread_pool_stats(struct halide_thread_pool *pool);
+
 /** Define halide_malloc and halide_free to replace the default memory
  * allocator.  See Func::set_custom_allocator. (Specifically note that
  * halide_malloc must return a 32-byte aligned pointer, and it must be
@@ -115,6 +297,131 @@ extern void *halide_malloc(void *user_context, size_t x);
 extern void halide_free(void *user_context, void *ptr);
 //@}
 
+/** Hints for how the memory of a large allocation should be backed.
+ *  They can be combined. See Func::allocation_hints. */
+typedef enum halide_allocation_hint_t {
+    halide_allocation_hint_none = 0,
+    halide_allocation_hint_huge_pages = 1,      //!< Back with transparent huge pages, to save TLB misses
+    halide_allocation_hint_numa_interleave = 2, //!< Spread pages across all NUMA nodes
+    halide_allocation_hint_numa_local = 4       //!< Put pages on the NUMA node of the allocating thread
+} halide_allocation_hint_t;
+
+/** Used by generated code to allocate buffers with hints (a
+ *  combination of halide_allocation_hint_t flags). Allocations of at
+ *  least 2MB with hints are mapped directly from the OS, and so don't
+ *  go through halide_malloc or a custom allocator. The rest, and any
+ *  that can't be mapped, come from halide_malloc. NUMA placement
+ *  needs libnuma at runtime; without it, pages end up on the node of
+ *  the thread that first touches them. Memory from
+ *  halide_malloc_with_hints must be freed with halide_free_with_hints.
+ */
+//@{
+extern void *halide_malloc_with_hints(void *user_context, int32_t size, int32_t hints);
+extern void halide_free_with_hints(void *user_context, void *ptr);
+//@}
+
+/** The free function generated code uses for buffers carved out of
+ *  memory shared with other buffers whose lifetimes don't overlap.
+ *  The shared memory is freed as a whole once all of them are done
+ *  with it, so this does nothing. */
+extern void halide_memory_plan_free(void *user_context, void *ptr);
+
+/** Set the most memory, in bytes, that the default halide_free keeps
+ *  for the default halide_malloc to reuse. Pipelines that are run
+ *  many times allocate the same intermediate buffers on every run, and
+ *  reusing them saves the cost of going to the system allocator each
+ *  time. Requests are rounded up to one of four sizes per power of
+ *  two, up to 256MB, and each size is pooled separately. Freed blocks
+ *  are mostly reused by the thread that freed them. Zero, the default,
+ *  turns pooling off. Shrinking the pool below what it holds frees
+ *  everything in it. Has no effect on custom allocators set with
+ *  halide_set_custom_malloc.
+ */
+extern void halide_memory_pool_set_size(int64_t size);
+
+/** Free all memory held by the pool for reuse, e.g. after running a
+ *  pipeline that won't be run again soon. Pooling stays on. */
+extern void halide_memory_pool_trim(void *user_context);
+
+/** Totals for the memory pool, counted while pooling is on. */
+struct halide_memory_pool_stats {
+    uint64_t allocations;         //!< Allocations of pooled sizes
+    uint64_t pool_hits;           //!< Allocations that reused a pooled block
+    uint64_t frees;               //!< Frees of blocks of pooled sizes
+    uint64_t pooled_frees;        //!< Frees that kept the block for reuse
+    int64_t bytes_pooled;         //!< Bytes currently held for reuse
+    int64_t max_bytes;            //!< The limit set by halide_memory_pool_set_size
+};
+
+/** Get the memory pool stats. */
+extern void halide_memory_pool_get_stats(struct halide_memory_pool_stats *stats);
+
+/** Zero the memory pool stats. */
+extern void halide_memory_pool_reset_stats();
+
+/** Used by code compiled with the scratch_arenas target feature to
+ *  allocate buffers inside parallel loops. Each task of a parallel
+ *  loop acquires an arena, allocates from it with halide_scratch_alloc
+ *  and halide_scratch_free, and releases it when done. Arenas are
+ *  kept for reuse and grow to fit what their tasks needed, so after
+ *  the first few tasks, allocating is just bumping a pointer.
+ *  Allocations that don't fit in the arena come from halide_malloc.
+ *  halide_scratch_alloc returns NULL if size is zero or memory can't
+ *  be allocated.
+ */
+//@{
+extern void *halide_scratch_arena_acquire(void *user_context);
+extern void halide_scratch_arena_release(void *user_context, void *arena);
+extern void *halide_scratch_alloc(void *user_context, void *arena, int32_t size);
+extern void halide_scratch_free(void *user_context, void *ptr);
+//@}
+
+/** Used by code compiled with the track_memory target feature to
+ *  account for the heap memory each Func uses. A call to
+ *  halide_memory_tracker_alloc is made after each of a Func's heap
+ *  allocations, with its size in bytes and the compiler's upper bound
+ *  on the bytes the Func can have allocated at once (-1 if the bounds
+ *  weren't constant), and the value it returns is passed to
+ *  halide_memory_tracker_free when the allocation is freed. Sizes are
+ *  those of the buffers, even when the memory comes from elsewhere
+ *  (e.g. a slab shared with other Funcs, or a scratch arena).
+ */
+//@{
+extern void *halide_memory_tracker_alloc(void *user_context, const char *func_name,
+                                         int64_t size, int64_t static_bound);
+extern void halide_memory_tracker_free(void *user_context, void *ptr);
+//@}
+
+/** Heap memory used by all Funcs compiled with track_memory. */
+struct halide_memory_tracker_stats {
+    int64_t current_bytes;        //!< Bytes allocated and not yet freed
+    int64_t peak_bytes;           //!< The most current_bytes has been
+    int num_funcs;                //!< Funcs that have allocated memory
+};
+
+/** Heap memory used by the buffers of one Func. */
+struct halide_memory_tracker_func_stats {
+    const char *name;             //!< Valid for the life of the process
+    int64_t current_bytes;
+    int64_t peak_bytes;
+    uint64_t num_allocations;
+    int64_t static_bound_bytes;   //!< The compiler's upper bound on peak_bytes, or -1 if unknown
+};
+
+/** Read the memory tracker stats. The totals are copied to stats if
+ *  it is non-NULL, and the stats of up to max_funcs Funcs to the
+ *  funcs array, in the order they first allocated memory. Returns the
+ *  number of Funcs that have stats. Call it after a pipeline runs to
+ *  see how much memory it needed. */
+extern int halide_memory_tracker_get_stats(struct halide_memory_tracker_stats *stats,
+                                           struct halide_memory_tracker_func_stats *funcs,
+                                           int max_funcs);
+
+/** Start the peaks over from the memory in use now, and zero the
+ *  allocation counts, e.g. before running a pipeline to measure it on
+ *  its own. */
+extern void halide_memory_tracker_reset_stats();
+
 /** Called when debug_to_file is used inside %Halide code.  See
  * Func::debug_to_file for how this is called
  *
@@ -185,7 +492,12 @@ extern int32_t halide_trace(void *user_context, const halide_trace_event *event)
  * Halide checks the for existence of an environment variable called
  * HL_TRACE_FILE and opens that file. If HL_TRACE_FILE is not defined,
  * it outputs trace information to stdout in a human-readable
- * format. */
+ * format.
+ *
+ * Binary trace events are collected in memory and written out in
+ * large batches, from a thread of their own when the thread pool can
+ * start one. Events already traced are written out to the old file
+ * before this switches to the new one. */
 extern void halide_set_trace_file(int fd);
 
 /** Halide calls this to retrieve the file descriptor to write binary
@@ -196,8 +508,11 @@ extern void halide_set_trace_file(int fd);
  * information to stdout. */
 extern int halide_get_trace_file(void *user_context);
 
-/** If tracing is writing to a file. This call closes that file
- * (flushing the trace). Returns zero on success. */
+/** Write out any binary trace events that are still in memory. If
+ * tracing is writing to a file that Halide opened, this call also
+ * closes that file. It is called when the runtime is unloaded, but if
+ * you set the trace file yourself, call this before reading it back
+ * or closing it. Returns zero on success. */
 extern int halide_shutdown_trace();
 
 /** All Halide GPU or device backend implementations much provide an interface
@@ -246,41 +561,156 @@ extern void halide_set_gpu_device(int n);
 extern int halide_get_gpu_device(void *user_context);
 
 /** Set the soft maximum amount of memory, in bytes, that the LRU
- *  cache will use to memoize Func results.  This is not a strict
+ *  cache will use to memoize Func results. See
+ *  halide_memoization_cache_get_stats for how much it is using, and
+ *  how often results are found in it. This is not a strict
  *  maximum in that concurrency and simultaneous use of memoized
  *  reults larger than the cache size can both cause it to
- *  temporariliy be larger than the size specified here.
+ *  temporariliy be larger than the size specified here. This sizes
+ *  the default partition, which holds the results of Funcs memoized
+ *  without a partition name.
  */
 extern void halide_memoization_cache_set_size(int64_t size);
 
+/** Set the soft maximum amount of memory, in bytes, that the named
+ *  partition of the memoization cache will use. Each partition evicts
+ *  only its own results, so results in one partition can't be pushed
+ *  out by those in another. Partitions are created by name as needed;
+ *  one that is never sized gets the default size. There can be at
+ *  most seven named partitions, after which results go in the
+ *  default partition. A size of zero restores the default size.
+ */
+extern void halide_memoization_cache_set_partition_size(void *user_context, const char *partition, int64_t size);
+
+/** The order in which the memoization cache evicts results when it
+ *  is over its size. */
+typedef enum halide_memoization_cache_policy_t {
+    /** Evict the least recently used result first. The default. */
+    halide_memoization_cache_lru = 0,
+    /** GreedyDual-Size: evict the result that took the least time to
+     *  compute per unit of cache it occupies, with results that
+     *  haven't been used in a while gradually losing their
+     *  advantage. Good when memoized results vary a lot in how
+     *  expensive they are to recompute. Evicting is linear in the
+     *  number of entries in the cache. */
+    halide_memoization_cache_greedy_dual_size = 1
+} halide_memoization_cache_policy_t;
+
+/** Set the eviction policy used by the memoization cache. */
+extern void halide_memoization_cache_set_policy(halide_memoization_cache_policy_t policy);
+
+/** Back the memoization cache with the file at path, so that results
+ *  outlive the process. Results stored in the cache are appended to
+ *  the file, and a lookup that misses in memory looks for the result
+ *  there before the pipeline computes it. The file is created if
+ *  needed and grown to max_bytes; once it is full, new results are
+ *  no longer added to it. Delete the file to start over. Only one
+ *  process at a time can add results to a file; any others using it
+ *  only read from it. Results are keyed by the same bytes as in
+ *  memory, which include a fingerprint of the memoized Func's
+ *  definition, so results from a different build of a pipeline are
+ *  never used. Pass NULL to stop using a file. Returns zero on
+ *  success. Not supported on Windows or Native Client.
+ */
+extern int halide_memoization_cache_set_persistent_file(void *user_context, const char *path, int64_t max_bytes);
+
 /** Given a cache key for a memoized result, currently constructed
  *  from the Func name and top-level Func name plus the arguments of
  *  the computation, determine if the result is in the cache and
  *  return it if so. (The internals of the cache key should be
- *  considered opaque by this function.) If this routine returns true,
- *  it is a cache miss. Otherwise, it will return false and the
- *  buffers passed in will be filled, via copying, with memoized
- *  data. The last argument is a list if buffer_t pointers which
- *  represents the outputs of the memoized Func. If the Func does not
- *  return a Tuple, there will only be one buffer_t in the list. The
- *  tuple_count parameters determines the length of the list.
+ *  considered opaque by this function.) The host pointers of the
+ *  buffers passed in are always set by this call, and must each be
+ *  passed to halide_memoization_cache_release when no longer needed.
+ *  If this routine returns 1, it is a cache miss, and the host
+ *  pointers point at newly allocated memory to compute the result
+ *  into. If it returns 0, it is a hit, and the host pointers point
+ *  directly at the memoized data, which must not be modified. The
+ *  data may be a result that covers more than the bounds asked for,
+ *  in which case the mins, extents and strides of the buffers are
+ *  changed to describe it. It returns -1 if memory could not be
+ *  allocated. The tuple_buffers argument
+ *  is a list if buffer_t pointers which represents the outputs of
+ *  the memoized Func. If the Func does not return a Tuple, there
+ *  will only be one buffer_t in the list. The tuple_count parameters
+ *  determines the length of the list. The partition the result
+ *  belongs in and its size (zero to leave it alone) are the same as
+ *  passed to halide_memoization_cache_store, and are used if the
+ *  result is loaded from the persistent file.
  */
-extern bool halide_memoization_cache_lookup(void *user_context, const uint8_t *cache_key, int32_t size,
-                                            buffer_t *realized_bounds, int32_t tuple_count, buffer_t **tuple_buffers);
+extern int halide_memoization_cache_lookup(void *user_context, const uint8_t *cache_key, int32_t size,
+                                           buffer_t *realized_bounds, int32_t tuple_count, buffer_t **tuple_buffers,
+                                           const char *partition, int64_t partition_size);
 
 /** Given a cache key for a memoized result, currently constructed
  *  from the Func name and top-level Func name plus the arguments of
  *  the computation, store the result in the cache for futre access by
  *  halide_memoization_cache_lookup. (The internals of the cache key
- *  should be considered opaque by this function.) Data is copied out
- *  from the inputs and inputs are unmodified. The last argument is a
+ *  should be considered opaque by this function.) The buffers must
+ *  have been set up by a halide_memoization_cache_lookup that
+ *  missed; the cache takes ownership of their host memory rather than
+ *  copying it. They must still be released with
+ *  halide_memoization_cache_release. The tuple_buffers argument is a
  *  list if buffer_t pointers which represents the outputs of the
  *  memoized Func. If the Func does not return a Tuple, there will
  *  only be one buffer_t in the list. The tuple_count parameters
- *  determines the length of the list.
+ *  determines the length of the list. The compute_time_ns argument
+ *  is how long the result took to compute, which the
+ *  halide_memoization_cache_greedy_dual_size policy uses to decide
+ *  what to evict. The result goes in the named partition, or the
+ *  default one if partition is NULL or empty. If partition_size is
+ *  nonzero, it becomes the partition's size, as with
+ *  halide_memoization_cache_set_partition_size.
  */
 extern void halide_memoization_cache_store(void *user_context, const uint8_t *cache_key, int32_t size,
-                                           buffer_t *realized_bounds, int32_t tuple_count, buffer_t **tuple_buffers);
+                                           buffer_t *realized_bounds, int32_t tuple_count, buffer_t **tuple_buffers,
+                                           int64_t compute_time_ns, const char *partition, int64_t partition_size);
+
+/** Release a host pointer set by halide_memoization_cache_lookup. If
+ *  it was never stored in the cache it is freed. Otherwise the memory
+ *  belongs to a cache entry, which is only freed once it has been
+ *  evicted and every pipeline using it has released it. Does nothing
+ *  if host is NULL.
+ */
+extern void halide_memoization_cache_release(void *user_context, void *host);
+
+/** Totals for the memoization cache. */
+struct halide_memoization_cache_stats {
+    uint64_t hits;                //!< Lookups that found the result in the cache
+    uint64_t misses;              //!< Lookups that didn't
+    uint64_t stores;              //!< Results added to the cache
+    uint64_t evictions;           //!< Results evicted to keep under max_bytes
+    int64_t bytes_resident;       //!< Bytes of results currently in the cache
+    int64_t max_bytes;            //!< The default partition's limit, set by halide_memoization_cache_set_size
+    uint64_t persistent_hits;     //!< Misses answered from the persistent file
+    int num_entries;              //!< Results currently in the cache
+    int num_funcs;                //!< Distinct Funcs that have stored results
+};
+
+/** Memoization cache stats for the results of one Func, as named in
+ *  the cache key. Results the Func computed while its cache entry was
+ *  present (e.g. by racing with another thread) count as misses. */
+struct halide_memoization_cache_func_stats {
+    const char *name;             //!< Valid until halide_memoization_cache_cleanup
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    int64_t bytes_resident;
+    int num_entries;
+};
+
+/** Read the memoization cache stats. The totals are copied to stats
+ *  if it is non-NULL, and the stats of up to max_funcs Funcs to the
+ *  funcs array, in the order they first stored a result. Returns the
+ *  number of Funcs that have stats. Stats are always collected; it
+ *  costs a few increments made while already holding the cache's
+ *  locks. This takes every lock in the cache, so it shouldn't be
+ *  called at a high rate. */
+extern int halide_memoization_cache_get_stats(struct halide_memoization_cache_stats *stats,
+                                              struct halide_memoization_cache_func_stats *funcs,
+                                              int max_funcs);
+
+/** Zero the memoization cache stats. Entries stay in the cache. */
+extern void halide_memoization_cache_reset_stats();
 
 /** Free all memory and resources associated with the memoization cache.
  * Must be called at a time when no other threads are accessing the cache.
@@ -2,12 +2,39 @@
 #include "HalideRuntime.h"
 #include "scoped_mutex_lock.h"
 
-// This is temporary code. In particular, the hash table is stupid and
-// currently thread safety is accomplished via large granularity spin
-// locks. It is mainly intended to prove the programming model and
-// runtime interface for memoization. We'll improve the implementation
-// later. In the meantime, on some platforms it can be replaced by a
-// platform specific LRU cache such as libcache from Apple.
+extern "C" {
+
+extern int halide_map_file(void *user_context, const char *path, size_t min_size,
+                           void **data, size_t *size, bool *writable);
+extern void halide_unmap_file(void *user_context, int fd, void *data, size_t size);
+
+}
+
+// The cache is a hash table split into shards, each with its own lock
+// and its own LRU list, so that lookups and stores from different
+// threads rarely contend. The size limit is global: when it's
+// exceeded, entries are evicted from whichever shard has the least
+// recently used entry, going by a use stamp taken from a global
+// clock. Alternatively, entries can be evicted by GreedyDual-Size,
+// which weighs how long each entry took to compute against how much
+// space it takes, so that cheap but large results go before
+// expensive but small ones. On some platforms it can be replaced by
+// a platform specific LRU cache such as libcache from Apple.
+//
+// Cached data is never copied. On a miss, lookup allocates the
+// buffers the pipeline computes into, and store adopts them as the
+// entry's data. On a hit, lookup points the pipeline's buffers at the
+// entry's data. A lookup hits on an entry whose bounds contain the
+// ones asked for, not just on one that matches them exactly, so that
+// e.g. tiles of a consumer can share one large realization of a
+// memoized Func. Either way the pipeline calls
+// halide_memoization_cache_release on each buffer when it's done with
+// it. Entries are reference counted so that one evicted while a
+// pipeline is still using it is only freed on the last release.
+//
+// Optionally, stored results are also appended to a memory-mapped
+// file, so that a process started later with the same file can load
+// them instead of recomputing them. See the persistent store below.
 
 namespace Halide { namespace Runtime { namespace Internal {
 
@@ -69,25 +96,6 @@ WEAK size_t full_extent(const buffer_t &buf) {
     return result;
 }
 
-WEAK void copy_from_to(void *user_context, const buffer_t &from, buffer_t &to) {
-    size_t buffer_size = full_extent(from);
-    halide_assert(user_context, from.elem_size == to.elem_size);
-    for (int i = 0; i < 4; i++) {
-        halide_assert(user_context, from.extent[i] == to.extent[i]);
-        halide_assert(user_context, from.stride[i] == to.stride[i]);
-    }
-    memcpy(to.host, from.host, buffer_size * from.elem_size);
-}
-
-WEAK buffer_t copy_of_buffer(void *user_context, const buffer_t &buf) {
-    buffer_t result = buf;
-    size_t buffer_size = full_extent(result);
-    // TODO: ERROR RETURN
-    result.host = (uint8_t *)halide_malloc(user_context, buffer_size * result.elem_size);
-    copy_from_to(user_context, buf, result);
-    return result;
-}
-
 WEAK bool keys_equal(const uint8_t *key1, const uint8_t *key2, size_t key_size) {
     return memcmp(key1, key2, key_size) == 0;
 }
@@ -105,38 +113,111 @@ WEAK bool bounds_equal(const buffer_t &buf1, const buffer_t &buf2) {
     return true;
 }
 
+// Whether inner covers a subset of the region outer does, and could
+// be accessed through outer's layout: the element sizes must be the
+// same, and outer must be dense wherever inner is, as that stride is
+// baked into the code that accesses it.
+WEAK bool bounds_contain(const buffer_t &outer, const buffer_t &inner) {
+    if (outer.elem_size != inner.elem_size)
+        return false;
+    for (size_t i = 0; i < 4; i++) {
+        if (outer.min[i] > inner.min[i] ||
+            outer.min[i] + outer.extent[i] < inner.min[i] + inner.extent[i] ||
+            (inner.stride[i] == 1 && outer.stride[i] != 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct CacheEntry;
+
+const uint64_t kCostScale = 1024;
+
+// Stats for one memoized Func, accumulated from its entries as they
+// leave the cache. The records are only freed by
+// halide_memoization_cache_cleanup.
+struct FuncStats {
+    FuncStats *next;
+    char *name;
+    int index;
+    uint64_t hits, misses, evictions;
+};
+
+// Every block of memory handed out by lookup starts with one of
+// these, so that release can find the entry that owns it. It's
+// padded to keep the data as aligned as halide_malloc makes it.
+struct CacheBlockHeader {
+    CacheEntry *entry;
+    uint8_t padding[32 - sizeof(CacheEntry *)];
+};
+
+WEAK CacheBlockHeader *get_block_header(void *host) {
+    return ((CacheBlockHeader *)host) - 1;
+}
+
 struct CacheEntry {
     CacheEntry *next;
     CacheEntry *more_recent;
     CacheEntry *less_recent;
+    uint64_t last_use;
     size_t key_size;
     uint8_t *key;
     uint32_t hash;
     uint32_t tuple_count;
+    // The number of buffers pipelines haven't released yet.
+    uint32_t in_use_count;
+    // Whether the entry has been removed from the cache, so it
+    // should be destroyed once it's no longer in use.
+    bool evicted;
+    // How expensive the entry is to recompute relative to its size,
+    // and its resulting GreedyDual-Size priority. See choose_victim.
+    uint64_t cost_per_size;
+    uint64_t priority;
+    // The index of the partition the entry is in.
+    int partition;
+    // The Func the entry is for, and how many times it has been hit
+    // and computed while in the cache.
+    FuncStats *func;
+    uint64_t hits, misses;
     buffer_t computed_bounds;
     buffer_t buf[1];
     // ADDITIONAL buffer_t STRUCTS HERE
 
-    void init(const uint8_t *cache_key, size_t cache_key_size,
+    bool init(const uint8_t *cache_key, size_t cache_key_size,
               uint32_t key_hash, const buffer_t &computed_buf,
-              int32_t tuples, buffer_t **tuple_buffers);
+              int32_t tuples, buffer_t **tuple_buffers,
+              int64_t compute_time_ns);
     void destroy();
     buffer_t &buffer(int32_t i);
 
 };
 
-WEAK void CacheEntry::init(const uint8_t *cache_key, size_t cache_key_size,
+// Adopts the tuple buffers' host allocations, which must have come
+// from a lookup miss, as the entry's data.
+WEAK bool CacheEntry::init(const uint8_t *cache_key, size_t cache_key_size,
                            uint32_t key_hash, const buffer_t &computed_buf,
-                           int32_t tuples, buffer_t **tuple_buffers) {
+                           int32_t tuples, buffer_t **tuple_buffers,
+                           int64_t compute_time_ns) {
     next = NULL;
     more_recent = NULL;
     less_recent = NULL;
+    last_use = 0;
     key_size = cache_key_size;
     hash = key_hash;
     tuple_count = tuples;
+    in_use_count = 0;
+    evicted = false;
+    priority = 0;
+    partition = 0;
+    func = NULL;
+    hits = 0;
+    misses = 1;
 
-    // TODO: ERROR RETURN
     key = (uint8_t *)halide_malloc(NULL, key_size);
+    if (key == NULL) {
+        return false;
+    }
     computed_bounds = computed_buf;
     computed_bounds.host = NULL;
     computed_bounds.dev = 0;
@@ -144,16 +225,30 @@ WEAK void CacheEntry::init(const uint8_t *cache_key, size_t cache_key_size,
         key[i] = cache_key[i];
     }
     for (int32_t i = 0; i < tuple_count; i++) {
-        buffer_t *buf = tuple_buffers[i];
-        buffer(i) = copy_of_buffer(NULL, *buf);
+        buffer(i) = *tuple_buffers[i];
+        // The pipeline still owns any device allocation.
+        buffer(i).dev = 0;
+        buffer(i).host_dirty = false;
+        buffer(i).dev_dirty = false;
+    }
+
+    // Priorities are fixed point, with kCostScale units per
+    // nanosecond per byte, so that cheap entries don't all round
+    // down to zero.
+    uint64_t size = 0;
+    for (int32_t i = 0; i < tuple_count; i++) {
+        size += full_extent(buffer(i)) * buffer(i).elem_size;
     }
+    if (size == 0) size = 1;
+    if (compute_time_ns < 0) compute_time_ns = 0;
+    cost_per_size = ((uint64_t)compute_time_ns * kCostScale) / size;
+    return true;
 }
 
 WEAK void CacheEntry::destroy() {
     halide_free(NULL, key);
     for (int32_t i = 0; i < tuple_count; i++) {
-        halide_device_free(NULL, &buffer(i));
-        halide_free(NULL, buffer(i).host);
+        halide_free(NULL, get_block_header(buffer(i).host));
     }
 }
 
@@ -170,34 +265,233 @@ WEAK uint32_t djb_hash(const uint8_t *key, size_t key_size)  {
     return h;
 }
 
-WEAK halide_mutex memoization_lock;
+const size_t kNumShards = 16;
+const size_t kShardTableSize = 64;
+const int kMaxPartitions = 8;
+
+struct CacheShard {
+    halide_mutex lock;
+    CacheEntry *entries[kShardTableSize];
+    // An LRU list per partition.
+    CacheEntry *most_recently_used[kMaxPartitions];
+    CacheEntry *least_recently_used[kMaxPartitions];
+    // Counted under the lock, so that tracking them doesn't add
+    // contention.
+    uint64_t hits, misses, stores;
+    // Keep neighboring shards' locks off each other's cache lines.
+    uint8_t padding[64 - (2 * kMaxPartitions * sizeof(CacheEntry *) + 3 * sizeof(uint64_t)) % 64];
+};
 
-const size_t kHashTableSize = 256;
+WEAK CacheShard cache_shards[kNumShards];
 
-WEAK CacheEntry *cache_entries[kHashTableSize];
+const uint64_t kDefaultCacheSize = 1 << 20;
 
-WEAK CacheEntry *most_recently_used = NULL;
-WEAK CacheEntry *least_recently_used = NULL;
+// The cache is divided into partitions, each with its own size
+// limit, so that the results of some Funcs can't evict those of
+// others. Every shard keeps a separate LRU list per partition, and a
+// partition over its limit only evicts its own entries. Partition 0
+// is the default one, sized by halide_memoization_cache_set_size.
+struct CachePartition {
+    // NULL for the default partition.
+    char *name;
+    int64_t max_size;
+    volatile int64_t current_size;
+    // Serializes pruning, so that two threads over the limit at the
+    // same time don't both evict enough to make room.
+    halide_mutex prune_lock;
+    // The GreedyDual-Size inflation value: the priority of the last
+    // entry evicted. An entry's priority is this plus its cost per
+    // size whenever it's used, so entries that haven't been used in
+    // a while eventually fall below even expensive entries that
+    // have.
+    volatile uint64_t inflation;
+};
 
-const uint64_t kDefaultCacheSize = 1 << 20;
-WEAK int64_t max_cache_size = kDefaultCacheSize;
-WEAK int64_t current_cache_size = 0;
+WEAK CachePartition cache_partitions[kMaxPartitions] = {{NULL, kDefaultCacheSize}};
+// Partitions are only added, while holding partitions_lock, and
+// removed by halide_memoization_cache_cleanup.
+WEAK volatile int num_cache_partitions = 1;
+WEAK halide_mutex partitions_lock;
+
+WEAK halide_memoization_cache_policy_t cache_policy = halide_memoization_cache_lru;
+
+// Protects func_stats and the fields of the records in it. Never
+// acquired while holding a shard's lock.
+WEAK halide_mutex stats_lock;
+WEAK FuncStats *func_stats = NULL;
+WEAK int num_func_stats = 0;
+WEAK volatile uint64_t cache_evictions = 0;
+
+// Stamped on entries when they're used, to compare recency across
+// shards. It only ticks when an entry is stored, so that hits don't
+// all write to the same cache line. Within a shard the LRU list
+// gives the exact order.
+WEAK volatile uint64_t cache_use_clock = 0;
+
+// djb_hash puts most of the difference between similar keys in the
+// low bits, so mix them up before picking a shard.
+WEAK uint32_t mix_hash(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+WEAK CacheShard &shard_for(uint32_t h) {
+    return cache_shards[mix_hash(h) % kNumShards];
+}
+
+WEAK uint32_t index_in_shard(uint32_t h) {
+    return h % kShardTableSize;
+}
+
+// Find the name of the Func a key is for. Keys are built by
+// KeyInfo::generate_key in Memoization.cpp: a 4-byte length and the
+// name of the pipeline, padded to a multiple of 4 bytes, then a
+// 4-byte length and the name of the Func, then an 8-byte fingerprint
+// of the Func's definition, then the parameters.
+WEAK bool func_name_from_key(const uint8_t *key, size_t key_size,
+                             const uint8_t **name, int32_t *name_size) {
+    int32_t len = 0;
+    if (key_size < 4) return false;
+    memcpy(&len, key, 4);
+    if (len < 0 || (size_t)len > key_size) return false;
+    size_t offset = 4 + (((size_t)len + 3) & ~(size_t)3);
+    if (offset + 4 > key_size) return false;
+    memcpy(&len, key + offset, 4);
+    offset += 4;
+    if (len < 0 || offset + len > key_size) return false;
+    *name = key + offset;
+    *name_size = len;
+    return true;
+}
+
+// Find or make the stats record for the Func a key is for. Returns
+// NULL if the key doesn't look like one Halide made, or if out of
+// memory. Must hold stats_lock.
+WEAK FuncStats *find_func_stats(const uint8_t *key, size_t key_size) {
+    const uint8_t *name;
+    int32_t name_size;
+    if (!func_name_from_key(key, key_size, &name, &name_size)) {
+        return NULL;
+    }
+    FuncStats **tail = &func_stats;
+    while (*tail != NULL) {
+        FuncStats *f = *tail;
+        if (strncmp(f->name, (const char *)name, name_size) == 0 &&
+            f->name[name_size] == 0) {
+            return f;
+        }
+        tail = &f->next;
+    }
+    FuncStats *f = (FuncStats *)halide_malloc(NULL, sizeof(FuncStats));
+    if (f == NULL) return NULL;
+    f->name = (char *)halide_malloc(NULL, name_size + 1);
+    if (f->name == NULL) {
+        halide_free(NULL, f);
+        return NULL;
+    }
+    memcpy(f->name, name, name_size);
+    f->name[name_size] = 0;
+    f->next = NULL;
+    f->index = num_func_stats++;
+    f->hits = f->misses = f->evictions = 0;
+    *tail = f;
+    return f;
+}
+
+// Fold the counts of an entry that's leaving the cache into its
+// Func's stats. Must not hold any shard's lock.
+WEAK void retire_entry_stats(CacheEntry *entry, bool evicted) {
+    if (entry->func == NULL) return;
+    ScopedMutexLock lock(&stats_lock);
+    entry->func->hits += entry->hits;
+    entry->func->misses += entry->misses;
+    if (evicted) {
+        entry->func->evictions++;
+    }
+}
+
+// The number of bytes of data an entry holds.
+WEAK size_t entry_size(CacheEntry *entry) {
+    size_t result = 0;
+    for (uint32_t i = 0; i < entry->tuple_count; i++) {
+        result += full_extent(entry->buffer(i)) * entry->buffer(i).elem_size;
+    }
+    return result;
+}
+
+// Move an entry to the front of its shard's LRU list for its
+// partition. Must hold the shard's lock.
+WEAK void touch_entry(CacheShard &shard, CacheEntry *entry) {
+    int p = entry->partition;
+    entry->last_use = cache_use_clock;
+    entry->priority = cache_partitions[p].inflation + entry->cost_per_size;
+    if (entry == shard.most_recently_used[p]) {
+        return;
+    }
+    if (entry->more_recent != NULL) {
+        // It's already in the list somewhere. Unlink it.
+        if (entry->less_recent != NULL) {
+            entry->less_recent->more_recent = entry->more_recent;
+        } else {
+            halide_assert(NULL, shard.least_recently_used[p] == entry);
+            shard.least_recently_used[p] = entry->more_recent;
+        }
+        entry->more_recent->less_recent = entry->less_recent;
+    }
+    entry->more_recent = NULL;
+    entry->less_recent = shard.most_recently_used[p];
+    if (shard.most_recently_used[p] != NULL) {
+        shard.most_recently_used[p]->more_recent = entry;
+    }
+    shard.most_recently_used[p] = entry;
+    if (shard.least_recently_used[p] == NULL) {
+        shard.least_recently_used[p] = entry;
+    }
+}
+
+// Remove an entry from its shard's table and LRU list. Must hold the
+// shard's lock.
+WEAK void unlink_entry(CacheShard &shard, CacheEntry *entry) {
+    int p = entry->partition;
+    uint32_t index = index_in_shard(entry->hash);
+    CacheEntry *prev = shard.entries[index];
+    if (prev == entry) {
+        shard.entries[index] = entry->next;
+    } else {
+        while (prev != NULL && prev->next != entry) {
+            prev = prev->next;
+        }
+        halide_assert(NULL, prev != NULL);
+        prev->next = entry->next;
+    }
+    if (entry->less_recent != NULL) {
+        entry->less_recent->more_recent = entry->more_recent;
+    } else {
+        shard.least_recently_used[p] = entry->more_recent;
+    }
+    if (entry->more_recent != NULL) {
+        entry->more_recent->less_recent = entry->less_recent;
+    } else {
+        shard.most_recently_used[p] = entry->less_recent;
+    }
+}
 
 #if CACHE_DEBUGGING
-WEAK void validate_cache() {
-    print(NULL) << "validating cache, "
-                << "current size " << current_cache_size
-                << " of maximum " << max_cache_size << "\n";
+WEAK void validate_shard(CacheShard &shard) {
     int entries_in_hash_table = 0;
-    for (int i = 0; i < kHashTableSize; i++) {
-        CacheEntry *entry = cache_entries[i];
+    for (size_t i = 0; i < kShardTableSize; i++) {
+        CacheEntry *entry = shard.entries[i];
         while (entry != NULL) {
             entries_in_hash_table++;
-            if (entry->more_recent == NULL && entry != most_recently_used) {
+            if (entry->more_recent == NULL && entry != shard.most_recently_used[entry->partition]) {
                 halide_print(NULL, "cache invalid case 1\n");
                 __builtin_trap();
             }
-            if (entry->less_recent == NULL && entry != least_recently_used) {
+            if (entry->less_recent == NULL && entry != shard.least_recently_used[entry->partition]) {
                 halide_print(NULL, "cache invalid case 2\n");
                 __builtin_trap();
             }
@@ -205,18 +499,20 @@ WEAK void validate_cache() {
         }
     }
     int entries_from_mru = 0;
-    CacheEntry *mru_chain = most_recently_used;
-    while (mru_chain != NULL) {
-        entries_from_mru++;
-        mru_chain = mru_chain->less_recent;
-    }
     int entries_from_lru = 0;
-    CacheEntry *lru_chain = least_recently_used;
-    while (lru_chain != NULL) {
-        entries_from_lru++;
-        lru_chain = lru_chain->more_recent;
+    for (int p = 0; p < kMaxPartitions; p++) {
+        CacheEntry *mru_chain = shard.most_recently_used[p];
+        while (mru_chain != NULL) {
+            entries_from_mru++;
+            mru_chain = mru_chain->less_recent;
+        }
+        CacheEntry *lru_chain = shard.least_recently_used[p];
+        while (lru_chain != NULL) {
+            entries_from_lru++;
+            lru_chain = lru_chain->more_recent;
+        }
     }
-    print(NULL) << "hash entries " << entries_in_hash_table
+    debug(NULL) << "hash entries " << entries_in_hash_table
                 << ", mru entries " << entries_from_mru
                 << ", lru entries " << entries_from_lru << "\n";
     if (entries_in_hash_table != entries_from_mru) {
@@ -230,43 +526,623 @@ WEAK void validate_cache() {
 }
 #endif
 
-WEAK void prune_cache() {
+// The entry of a partition in a shard with the lowest
+// GreedyDual-Size priority, breaking ties by recency. Must hold the
+// shard's lock.
+WEAK CacheEntry *lowest_priority_entry(CacheShard &shard, int p) {
+    CacheEntry *result = NULL;
+    for (CacheEntry *entry = shard.least_recently_used[p]; entry != NULL; entry = entry->more_recent) {
+        if (result == NULL || entry->priority < result->priority) {
+            result = entry;
+        }
+    }
+    return result;
+}
+
+// Pick the next entry of a partition to evict, and remove it from
+// its shard. Must hold the partition's prune_lock but no shard's
+// lock. Returns NULL if the partition is empty.
+WEAK CacheEntry *choose_victim(int p, bool *in_use) {
+    CachePartition &partition = cache_partitions[p];
+    CacheShard *victim = NULL;
+    uint64_t best = 0;
+    if (cache_policy == halide_memoization_cache_greedy_dual_size) {
+        // Scans every entry in the partition, but only when it's
+        // over its size limit.
+        for (size_t i = 0; i < kNumShards; i++) {
+            ScopedMutexLock lock(&cache_shards[i].lock);
+            CacheEntry *entry = lowest_priority_entry(cache_shards[i], p);
+            if (entry != NULL && (victim == NULL || entry->priority < best)) {
+                victim = cache_shards + i;
+                best = entry->priority;
+            }
+        }
+    } else {
+        // Find the shard with the oldest entry. Reading the stamps
+        // without the locks is fine; we recheck under the lock.
+        for (size_t i = 0; i < kNumShards; i++) {
+            CacheEntry *lru = cache_shards[i].least_recently_used[p];
+            if (lru != NULL && (victim == NULL || lru->last_use < best)) {
+                victim = cache_shards + i;
+                best = lru->last_use;
+            }
+        }
+    }
+    if (victim == NULL) {
+        return NULL;
+    }
+
+    ScopedMutexLock lock(&victim->lock);
+    CacheEntry *entry;
+    if (cache_policy == halide_memoization_cache_greedy_dual_size) {
+        entry = lowest_priority_entry(*victim, p);
+        if (entry != NULL && entry->priority > partition.inflation) {
+            partition.inflation = entry->priority;
+        }
+    } else {
+        entry = victim->least_recently_used[p];
+    }
+    if (entry != NULL) {
+        unlink_entry(*victim, entry);
+        // If a pipeline is still using it, the last release
+        // destroys it.
+        entry->evicted = true;
+        *in_use = entry->in_use_count > 0;
 #if CACHE_DEBUGGING
-    validate_cache();
+        validate_shard(*victim);
 #endif
-    while (current_cache_size > max_cache_size &&
-           least_recently_used != NULL) {
-        CacheEntry *lru_entry = least_recently_used;
-        uint32_t h = lru_entry->hash;
-        uint32_t index = h % kHashTableSize;
-
-        CacheEntry *entry = cache_entries[index];
-        if (entry == lru_entry) {
-            cache_entries[index] = lru_entry->next;
-        } else {
-            while (entry != NULL && entry->next != lru_entry) {
-                entry = entry->next;
+    }
+    return entry;
+}
+
+// Evict entries from a partition until it fits in its size limit,
+// in the order given by cache_policy. Must not hold any shard's
+// lock.
+WEAK void prune_cache(int p) {
+    CachePartition &partition = cache_partitions[p];
+    if (partition.current_size <= partition.max_size) {
+        return;
+    }
+    ScopedMutexLock prune(&partition.prune_lock);
+    while (partition.current_size > partition.max_size) {
+        bool in_use = false;
+        CacheEntry *entry = choose_victim(p, &in_use);
+        if (entry == NULL) {
+            // Another thread could have emptied the shard we picked
+            // before we locked it, so only stop if the whole
+            // partition is empty.
+            bool empty = true;
+            for (size_t i = 0; empty && i < kNumShards; i++) {
+                empty = cache_shards[i].least_recently_used[p] == NULL;
+            }
+            if (empty) break;
+            continue;
+        }
+        __sync_fetch_and_sub(&partition.current_size, (int64_t)entry_size(entry));
+        __sync_fetch_and_add(&cache_evictions, 1);
+        retire_entry_stats(entry, true);
+        if (!in_use) {
+            entry->destroy();
+            halide_free(NULL, entry);
+        }
+    }
+}
+
+// Find the partition with the given name, adding it if it doesn't
+// exist yet. If size is positive, it becomes the partition's limit.
+// An empty or NULL name is the default partition, as is any name
+// beyond the first kMaxPartitions - 1. Must not hold any shard's
+// lock.
+WEAK int find_partition(void *user_context, const char *name, int64_t size) {
+    if (name == NULL || name[0] == 0) {
+        return 0;
+    }
+    ScopedMutexLock lock(&partitions_lock);
+    int p = 1;
+    while (p < num_cache_partitions && strcmp(cache_partitions[p].name, name) != 0) {
+        p++;
+    }
+    if (p == num_cache_partitions) {
+        if (p == kMaxPartitions) {
+            debug(user_context) << "Too many memoization cache partitions. Using the default one for "
+                                << name << "\n";
+            return 0;
+        }
+        size_t len = strlen(name);
+        char *copy = (char *)halide_malloc(NULL, len + 1);
+        if (copy == NULL) {
+            return 0;
+        }
+        memcpy(copy, name, len + 1);
+        CachePartition &partition = cache_partitions[p];
+        partition.name = copy;
+        partition.max_size = kDefaultCacheSize;
+        partition.current_size = 0;
+        partition.inflation = 0;
+        __sync_synchronize();
+        num_cache_partitions = p + 1;
+    }
+    if (size > 0) {
+        cache_partitions[p].max_size = size;
+    }
+    return p;
+}
+
+// Find an entry with the given key and bounds. If allow_superset is
+// set and there's no such entry, find one with the given key whose
+// bounds contain the given ones instead. Must hold the shard's lock.
+WEAK CacheEntry *find_entry(CacheShard &shard, uint32_t h, const uint8_t *cache_key, int32_t size,
+                            buffer_t *computed_bounds, int32_t tuple_count, buffer_t **tuple_buffers,
+                            bool allow_superset = false) {
+    CacheEntry *superset = NULL;
+    CacheEntry *entry = shard.entries[index_in_shard(h)];
+    while (entry != NULL) {
+        if (entry->hash == h && entry->key_size == (size_t)size &&
+            keys_equal(entry->key, cache_key, size) &&
+            entry->tuple_count == (uint32_t)tuple_count) {
+
+            bool all_bounds_equal = bounds_equal(entry->computed_bounds, *computed_bounds);
+
+            {
+                for (int32_t i = 0; all_bounds_equal && i < tuple_count; i++) {
+                    buffer_t *buf = tuple_buffers[i];
+                    all_bounds_equal = bounds_equal(entry->buffer(i), *buf);
+                }
+            }
+
+            if (all_bounds_equal) {
+                return entry;
+            }
+
+            if (allow_superset && superset == NULL) {
+                bool all_bounds_contained = bounds_contain(entry->computed_bounds, *computed_bounds);
+                for (int32_t i = 0; all_bounds_contained && i < tuple_count; i++) {
+                    all_bounds_contained = bounds_contain(entry->buffer(i), *tuple_buffers[i]);
+                }
+                if (all_bounds_contained) {
+                    superset = entry;
+                }
+            }
+        }
+        entry = entry->next;
+    }
+    return superset;
+}
+
+// The persistent store is a log of records in a memory-mapped file,
+// appended to as results are stored. On a miss, the log is looked up
+// in an index by hash before the pipeline computes the result, and a
+// matching record is copied into the cache as if it had just been
+// computed. Only one
+// process at a time can append to a file; others can only read it.
+// Records are never removed, so once the file is full nothing more is
+// added to it. Keys include a fingerprint of the Func's definition,
+// so a different build of a pipeline never matches old records.
+
+const uint32_t kPersistentMagic = 0x4d454d48;
+// Bump this whenever the layout of the file changes.
+const uint32_t kPersistentVersion = 1;
+const size_t kPersistentAlignment = 32;
+
+struct PersistentHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    // The end of the last complete record. Only advanced once a
+    // record has been written, so readers never see a partial one.
+    volatile uint64_t used;
+    uint8_t padding[kPersistentAlignment - 2 * sizeof(uint32_t) - 2 * sizeof(uint64_t)];
+};
+
+// The parts of a buffer_t that don't vary between processes.
+struct PersistentBounds {
+    int32_t min[4];
+    int32_t extent[4];
+    int32_t stride[4];
+    int32_t elem_size;
+};
+
+// Followed by tuple_count PersistentBounds, the key, and then the
+// data of each buffer, each starting on a multiple of
+// kPersistentAlignment.
+struct PersistentRecord {
+    uint64_t size;
+    int64_t compute_time_ns;
+    uint32_t hash;
+    int32_t key_size;
+    int32_t tuple_count;
+    PersistentBounds computed_bounds;
+};
+
+// A mapping of the file. Loads copy out of it without holding
+// persistent_lock, so it's only unmapped once the last of them is
+// done with it, as for cache entries.
+struct PersistentMapping {
+    uint8_t *data;
+    size_t size;
+    int fd;
+    // The copies in flight, plus one while the file is open. Guarded
+    // by persistent_lock.
+    int refs;
+};
+
+// An open-addressed hash table of the records in the log, so that a
+// lookup doesn't walk the whole file. Records appended by other
+// processes are added the next time it's searched.
+struct PersistentIndexSlot {
+    // The offset of the record in the file, or 0 if the slot is
+    // empty.
+    uint64_t offset;
+    uint32_t hash;
+};
+
+WEAK halide_mutex persistent_lock;
+WEAK PersistentMapping *persistent_mapping = NULL;
+WEAK uint8_t *persistent_data = NULL;
+WEAK size_t persistent_size = 0;
+WEAK bool persistent_writable = false;
+WEAK volatile uint64_t persistent_hits = 0;
+WEAK PersistentIndexSlot *persistent_index = NULL;
+WEAK size_t persistent_index_capacity = 0;
+WEAK size_t persistent_index_count = 0;
+// The end of the records added to the index so far.
+WEAK uint64_t persistent_indexed = 0;
+
+WEAK size_t persistent_align(size_t x) {
+    return (x + kPersistentAlignment - 1) & ~(kPersistentAlignment - 1);
+}
+
+WEAK PersistentHeader *persistent_header() {
+    return (PersistentHeader *)persistent_data;
+}
+
+WEAK void to_persistent_bounds(const buffer_t &buf, PersistentBounds *bounds) {
+    for (int i = 0; i < 4; i++) {
+        bounds->min[i] = buf.min[i];
+        bounds->extent[i] = buf.extent[i];
+        bounds->stride[i] = buf.stride[i];
+    }
+    bounds->elem_size = buf.elem_size;
+}
+
+WEAK bool persistent_bounds_equal(const PersistentBounds &bounds, const buffer_t &buf) {
+    PersistentBounds other;
+    to_persistent_bounds(buf, &other);
+    return memcmp(&bounds, &other, sizeof(PersistentBounds)) == 0;
+}
+
+// Where the key and each buffer's data start within a record, and
+// how big it is overall.
+WEAK size_t persistent_key_offset(int32_t tuple_count) {
+    return sizeof(PersistentRecord) + tuple_count * sizeof(PersistentBounds);
+}
+
+WEAK size_t persistent_data_offset(int32_t key_size, int32_t tuple_count) {
+    return persistent_align(persistent_key_offset(tuple_count) + key_size);
+}
+
+// Must hold persistent_lock.
+WEAK void clear_persistent_index() {
+    if (persistent_index != NULL) {
+        halide_free(NULL, persistent_index);
+    }
+    persistent_index = NULL;
+    persistent_index_capacity = 0;
+    persistent_index_count = 0;
+    persistent_indexed = 0;
+}
+
+WEAK void insert_persistent_index_slot(PersistentIndexSlot *index, size_t capacity,
+                                       uint32_t h, uint64_t offset) {
+    size_t i = mix_hash(h) & (capacity - 1);
+    while (index[i].offset != 0) {
+        i = (i + 1) & (capacity - 1);
+    }
+    index[i].offset = offset;
+    index[i].hash = h;
+}
+
+// Add a record to the index, growing it to keep it at most half
+// full. Returns false if there's no memory for that. Must hold
+// persistent_lock.
+WEAK bool add_to_persistent_index(uint32_t h, uint64_t offset) {
+    if ((persistent_index_count + 1) * 2 > persistent_index_capacity) {
+        size_t capacity = persistent_index_capacity == 0 ? 64 : persistent_index_capacity * 2;
+        size_t bytes = capacity * sizeof(PersistentIndexSlot);
+        PersistentIndexSlot *index = (PersistentIndexSlot *)halide_malloc(NULL, bytes);
+        if (index == NULL) {
+            return false;
+        }
+        memset(index, 0, bytes);
+        for (size_t i = 0; i < persistent_index_capacity; i++) {
+            if (persistent_index[i].offset != 0) {
+                insert_persistent_index_slot(index, capacity, persistent_index[i].hash,
+                                             persistent_index[i].offset);
+            }
+        }
+        if (persistent_index != NULL) {
+            halide_free(NULL, persistent_index);
+        }
+        persistent_index = index;
+        persistent_index_capacity = capacity;
+    }
+    insert_persistent_index_slot(persistent_index, persistent_index_capacity, h, offset);
+    persistent_index_count++;
+    return true;
+}
+
+// Add the records published since the index was last brought up to
+// date, by this process or another one, to it. Returns the end of
+// the log. Must hold persistent_lock.
+WEAK uint64_t update_persistent_index() {
+    uint64_t used = persistent_header()->used;
+    // Don't read a record before the write of used that published it.
+    __sync_synchronize();
+    if (used > persistent_size) {
+        return 0;
+    }
+    if (used < persistent_indexed) {
+        // Another process started the file over.
+        clear_persistent_index();
+    }
+    if (persistent_indexed == 0) {
+        persistent_indexed = persistent_align(sizeof(PersistentHeader));
+    }
+    while (persistent_indexed + sizeof(PersistentRecord) <= used) {
+        PersistentRecord *record = (PersistentRecord *)(persistent_data + persistent_indexed);
+        if (record->size == 0 || record->size > used - persistent_indexed) {
+            // Corrupt. Ignore the rest of the log.
+            break;
+        }
+        if (!add_to_persistent_index(record->hash, persistent_indexed)) {
+            // Records not yet indexed are just misses.
+            break;
+        }
+        persistent_indexed += record->size;
+    }
+    return used;
+}
+
+// Find a record with the given key and bounds, and return it. Must
+// hold persistent_lock.
+WEAK PersistentRecord *find_persistent_record(uint32_t h, const uint8_t *cache_key, int32_t size,
+                                              buffer_t *computed_bounds, int32_t tuple_count,
+                                              buffer_t **tuple_buffers) {
+    uint64_t used = update_persistent_index();
+    if (persistent_index == NULL) {
+        return NULL;
+    }
+    size_t i = mix_hash(h) & (persistent_index_capacity - 1);
+    for (; persistent_index[i].offset != 0; i = (i + 1) & (persistent_index_capacity - 1)) {
+        if (persistent_index[i].hash != h || persistent_index[i].offset >= used) {
+            continue;
+        }
+        PersistentRecord *record = (PersistentRecord *)(persistent_data + persistent_index[i].offset);
+        if (record->key_size == size &&
+            record->tuple_count == tuple_count &&
+            persistent_bounds_equal(record->computed_bounds, *computed_bounds) &&
+            keys_equal((uint8_t *)record + persistent_key_offset(tuple_count), cache_key, size)) {
+            PersistentBounds *bounds = (PersistentBounds *)(record + 1);
+            bool all_bounds_equal = true;
+            for (int32_t j = 0; all_bounds_equal && j < tuple_count; j++) {
+                all_bounds_equal = persistent_bounds_equal(bounds[j], *tuple_buffers[j]);
+            }
+            if (all_bounds_equal) {
+                return record;
             }
-            halide_assert(NULL, entry != NULL);
-            entry->next = lru_entry->next;
         }
-        least_recently_used = lru_entry->more_recent;
-        if (least_recently_used != NULL) {
-            least_recently_used->less_recent = NULL;
+    }
+    return NULL;
+}
+
+// Must hold persistent_lock.
+WEAK void release_persistent_mapping(PersistentMapping *mapping) {
+    mapping->refs--;
+    if (mapping->refs == 0) {
+        halide_unmap_file(NULL, mapping->fd, mapping->data, mapping->size);
+        halide_free(NULL, mapping);
+    }
+}
+
+// Copy the data of a record with the given key and bounds into the
+// tuple buffers. Returns the time the result originally took to
+// compute, or -1 if there's no such record.
+WEAK int64_t load_persistent_record(uint32_t h, const uint8_t *cache_key, int32_t size,
+                                    buffer_t *computed_bounds, int32_t tuple_count,
+                                    buffer_t **tuple_buffers) {
+    PersistentMapping *mapping;
+    const uint8_t *src;
+    int64_t compute_time_ns;
+    {
+        ScopedMutexLock lock(&persistent_lock);
+        if (persistent_data == NULL) {
+            return -1;
         }
-        if (most_recently_used == lru_entry) {
-            most_recently_used = NULL;
+        PersistentRecord *record = find_persistent_record(h, cache_key, size, computed_bounds,
+                                                          tuple_count, tuple_buffers);
+        if (record == NULL) {
+            return -1;
         }
-        for (int32_t i = 0; i < lru_entry->tuple_count; i++) {
-            current_cache_size -= full_extent(lru_entry->buffer(i));
+        mapping = persistent_mapping;
+        mapping->refs++;
+        src = (const uint8_t *)record + persistent_data_offset(size, tuple_count);
+        compute_time_ns = record->compute_time_ns;
+    }
+
+    // Published records never change, so the copy doesn't need the
+    // lock, just the mapping.
+    for (int32_t i = 0; i < tuple_count; i++) {
+        size_t bytes = full_extent(*tuple_buffers[i]) * tuple_buffers[i]->elem_size;
+        memcpy(tuple_buffers[i]->host, src, bytes);
+        src += persistent_align(bytes);
+    }
+
+    {
+        ScopedMutexLock lock(&persistent_lock);
+        release_persistent_mapping(mapping);
+    }
+    __sync_fetch_and_add(&persistent_hits, 1);
+    return compute_time_ns < 0 ? 0 : compute_time_ns;
+}
+
+// Append a result to the log, if it's open for writing and there's
+// room.
+WEAK void append_persistent_record(uint32_t h, const uint8_t *cache_key, int32_t size,
+                                   buffer_t *computed_bounds, int32_t tuple_count,
+                                   buffer_t **tuple_buffers, int64_t compute_time_ns) {
+    ScopedMutexLock lock(&persistent_lock);
+    if (persistent_data == NULL || !persistent_writable) {
+        return;
+    }
+
+    size_t record_size = persistent_data_offset(size, tuple_count);
+    for (int32_t i = 0; i < tuple_count; i++) {
+        record_size += persistent_align(full_extent(*tuple_buffers[i]) * tuple_buffers[i]->elem_size);
+    }
+    PersistentHeader *header = persistent_header();
+    uint64_t used = header->used;
+    if (used + record_size > persistent_size) {
+        return;
+    }
+    // It may already be there, if this process missed in the cache
+    // after evicting the result.
+    if (find_persistent_record(h, cache_key, size, computed_bounds, tuple_count, tuple_buffers)) {
+        return;
+    }
+
+    uint8_t *dst = persistent_data + used;
+    PersistentRecord *record = (PersistentRecord *)dst;
+    record->size = record_size;
+    record->compute_time_ns = compute_time_ns;
+    record->hash = h;
+    record->key_size = size;
+    record->tuple_count = tuple_count;
+    to_persistent_bounds(*computed_bounds, &record->computed_bounds);
+    PersistentBounds *bounds = (PersistentBounds *)(record + 1);
+    for (int32_t i = 0; i < tuple_count; i++) {
+        to_persistent_bounds(*tuple_buffers[i], &bounds[i]);
+    }
+    memcpy(dst + persistent_key_offset(tuple_count), cache_key, size);
+    dst += persistent_data_offset(size, tuple_count);
+    for (int32_t i = 0; i < tuple_count; i++) {
+        size_t bytes = full_extent(*tuple_buffers[i]) * tuple_buffers[i]->elem_size;
+        memcpy(dst, tuple_buffers[i]->host, bytes);
+        dst += persistent_align(bytes);
+    }
+
+    // Publish the record.
+    __sync_synchronize();
+    header->used = used + record_size;
+    update_persistent_index();
+}
+
+// Must hold persistent_lock.
+WEAK void close_persistent_file() {
+    if (persistent_mapping != NULL) {
+        release_persistent_mapping(persistent_mapping);
+    }
+    persistent_mapping = NULL;
+    persistent_data = NULL;
+    persistent_size = 0;
+    persistent_writable = false;
+    clear_persistent_index();
+}
+
+// Adopt the tuple buffers, which must have come from a lookup miss,
+// as a new entry. Returns false if the entry wasn't added, e.g.
+// because another thread stored the same result first, in which case
+// the buffers are left unowned. Must not hold any lock.
+WEAK bool store_entry(const uint8_t *cache_key, int32_t size, uint32_t h,
+                      buffer_t *computed_bounds, int32_t tuple_count, buffer_t **tuple_buffers,
+                      int64_t compute_time_ns, int partition) {
+    CacheShard &shard = shard_for(h);
+
+    {
+        ScopedMutexLock lock(&shard.lock);
+        CacheEntry *existing = find_entry(shard, h, cache_key, size, computed_bounds, tuple_count, tuple_buffers);
+        if (existing != NULL) {
+            // Leave the buffers unowned. They get freed when
+            // released.
+            existing->misses++;
+            return false;
         }
+    }
 
-        lru_entry->destroy();
-        halide_free(NULL, lru_entry);
+    uint64_t added_size = 0;
+    {
+        for (int32_t i = 0; i < tuple_count; i++) {
+            buffer_t *buf = tuple_buffers[i];
+            added_size += full_extent(*buf) * buf->elem_size;
+        }
     }
+
+    // The size of buffer_t for pointer math is apparently slightly
+    // larger than sizeof(buffer_t) on 32-bit windows. There's some
+    // padding between elements when they're in an array that isn't
+    // captured by sizeof. This is presumably because clang evaluates
+    // sizeof at initial module construction, and the math below turns
+    // into a getelementptr llvm instruction. There must be a mismatch
+    // in struct padding settings between the two.
+    size_t extra_buffer_t_size = (size_t)(((buffer_t *)0) + 1);
+
+    void *entry_storage = halide_malloc(NULL, sizeof(CacheEntry) + extra_buffer_t_size * (tuple_count - 1));
+    if (entry_storage == NULL) {
+        // Caching is best effort.
+        return false;
+    }
+
+    CacheEntry *new_entry = (CacheEntry *)entry_storage;
+    if (!new_entry->init(cache_key, size, h, *computed_bounds, tuple_count, tuple_buffers, compute_time_ns)) {
+        halide_free(NULL, new_entry);
+        return false;
+    }
+    new_entry->partition = partition;
+
+    {
+        ScopedMutexLock lock(&stats_lock);
+        new_entry->func = find_func_stats(cache_key, size);
+    }
+
+    {
+        ScopedMutexLock lock(&shard.lock);
+
+        // Another thread may have stored the same thing in the
+        // meantime. Checking and inserting under the same lock means
+        // nothing gets evicted to make room for a duplicate.
+        CacheEntry *existing = find_entry(shard, h, cache_key, size, computed_bounds, tuple_count, tuple_buffers);
+        if (existing != NULL) {
+            existing->misses++;
+            halide_free(NULL, new_entry->key);
+            halide_free(NULL, new_entry);
+            return false;
+        }
+
+        // The pipeline releases each of its buffers once it's done with
+        // them, same as on a hit.
+        new_entry->in_use_count = tuple_count;
+        for (int32_t i = 0; i < tuple_count; i++) {
+            get_block_header(tuple_buffers[i]->host)->entry = new_entry;
+        }
+
+        shard.stores++;
+        __sync_fetch_and_add(&cache_use_clock, 1);
+        uint32_t index = index_in_shard(h);
+        new_entry->next = shard.entries[index];
+        shard.entries[index] = new_entry;
+        touch_entry(shard, new_entry);
+        __sync_fetch_and_add(&cache_partitions[partition].current_size, (int64_t)added_size);
+
 #if CACHE_DEBUGGING
-    validate_cache();
+        validate_shard(shard);
 #endif
+    }
+
+    // The new entry is the most recently used, so it's only evicted
+    // here if it doesn't fit in the partition on its own, or if its
+    // priority says it's the cheapest thing to recompute. Either way
+    // the pipeline still holds it, so it stays valid until released.
+    prune_cache(partition);
+    return true;
 }
 
 }}} // namespace Halide::Runtime::Internal
@@ -278,18 +1154,104 @@ WEAK void halide_memoization_cache_set_size(int64_t size) {
         size = kDefaultCacheSize;
     }
 
-    ScopedMutexLock lock(&memoization_lock);
+    cache_partitions[0].max_size = size;
+    prune_cache(0);
+}
 
-    max_cache_size = size;
-    prune_cache();
+WEAK void halide_memoization_cache_set_partition_size(void *user_context, const char *partition, int64_t size) {
+    if (partition == NULL || partition[0] == 0) {
+        halide_memoization_cache_set_size(size);
+        return;
+    }
+    if (size == 0) {
+        size = kDefaultCacheSize;
+    }
+
+    // If there are too many partitions, this is the default one, and
+    // its size is left alone.
+    int p = find_partition(user_context, partition, size);
+    prune_cache(p);
 }
 
-WEAK bool halide_memoization_cache_lookup(void *user_context, const uint8_t *cache_key, int32_t size,
-                                          buffer_t *computed_bounds, int32_t tuple_count, buffer_t **tuple_buffers) {
-    uint32_t h = djb_hash(cache_key, size);
-    uint32_t index = h % kHashTableSize;
+WEAK void halide_memoization_cache_set_policy(halide_memoization_cache_policy_t policy) {
+    // Don't change the policy in the middle of pruning any partition.
+    for (int p = 0; p < kMaxPartitions; p++) {
+        halide_mutex_lock(&cache_partitions[p].prune_lock);
+    }
+    cache_policy = policy;
+    for (int p = kMaxPartitions - 1; p >= 0; p--) {
+        halide_mutex_unlock(&cache_partitions[p].prune_lock);
+    }
+}
+
+WEAK int halide_memoization_cache_set_persistent_file(void *user_context, const char *path, int64_t max_bytes) {
+    ScopedMutexLock lock(&persistent_lock);
+    close_persistent_file();
+    if (path == NULL) {
+        return 0;
+    }
+
+    void *data = NULL;
+    size_t mapped_size = 0;
+    bool writable = false;
+    size_t min_size = max_bytes > 0 ? (size_t)max_bytes : 0;
+    size_t header_size = persistent_align(sizeof(PersistentHeader));
+    if (min_size < header_size) {
+        min_size = header_size;
+    }
+    int fd = halide_map_file(user_context, path, min_size, &data, &mapped_size, &writable);
+    if (fd < 0) {
+        error(user_context) << "Could not map memoization cache file " << path << "\n";
+        return -1;
+    }
+
+    PersistentHeader *header = (PersistentHeader *)data;
+    bool valid = (mapped_size >= header_size &&
+                  header->magic == kPersistentMagic &&
+                  header->version == kPersistentVersion &&
+                  header->used >= header_size &&
+                  header->used <= mapped_size);
+    if (!valid) {
+        if (!writable) {
+            // In use by another process with an incompatible runtime.
+            halide_unmap_file(user_context, fd, data, mapped_size);
+            error(user_context) << "Memoization cache file " << path
+                                << " is in use and was written by an incompatible runtime\n";
+            return -1;
+        }
+        // New, or from an incompatible runtime. Start over.
+        header->magic = kPersistentMagic;
+        header->version = kPersistentVersion;
+        header->used = header_size;
+    }
+    if (writable) {
+        header->capacity = mapped_size;
+    }
+
+    PersistentMapping *mapping = (PersistentMapping *)halide_malloc(user_context, sizeof(PersistentMapping));
+    if (mapping == NULL) {
+        halide_unmap_file(user_context, fd, data, mapped_size);
+        error(user_context) << "Out of memory opening memoization cache file " << path << "\n";
+        return -1;
+    }
+    mapping->data = (uint8_t *)data;
+    mapping->size = mapped_size;
+    mapping->fd = fd;
+    mapping->refs = 1;
+
+    persistent_mapping = mapping;
+    persistent_data = mapping->data;
+    persistent_size = mapped_size;
+    persistent_writable = writable;
+    update_persistent_index();
+    return 0;
+}
 
-    ScopedMutexLock lock(&memoization_lock);
+WEAK int halide_memoization_cache_lookup(void *user_context, const uint8_t *cache_key, int32_t size,
+                                         buffer_t *computed_bounds, int32_t tuple_count, buffer_t **tuple_buffers,
+                                         const char *partition, int64_t partition_size) {
+    uint32_t h = djb_hash(cache_key, size);
+    CacheShard &shard = shard_for(h);
 
 #if CACHE_DEBUGGING
     debug_print_key(user_context, "halide_memoization_cache_lookup", cache_key, size);
@@ -302,69 +1264,76 @@ WEAK bool halide_memoization_cache_lookup(void *user_context, const uint8_t *cac
             debug_print_buffer(user_context, "Allocation bounds", *buf);
         }
     }
-    validate_cache();
 #endif
 
-    CacheEntry *entry = cache_entries[index];
-    while (entry != NULL) {
-        if (entry->hash == h && entry->key_size == size &&
-            keys_equal(entry->key, cache_key, size) &&
-            bounds_equal(entry->computed_bounds, *computed_bounds) &&
-            entry->tuple_count == tuple_count) {
+    {
+        ScopedMutexLock lock(&shard.lock);
 
-            bool all_bounds_equal = true;
+#if CACHE_DEBUGGING
+        validate_shard(shard);
+#endif
 
-            {
-                for (int32_t i = 0; all_bounds_equal && i < tuple_count; i++) {
-                    buffer_t *buf = tuple_buffers[i];
-                    all_bounds_equal = bounds_equal(entry->buffer(i), *buf);
+        CacheEntry *entry = find_entry(shard, h, cache_key, size, computed_bounds, tuple_count, tuple_buffers, true);
+        if (entry != NULL) {
+            touch_entry(shard, entry);
+            shard.hits++;
+            entry->hits++;
+            entry->in_use_count += tuple_count;
+            for (int32_t i = 0; i < tuple_count; i++) {
+                // The entry may cover more than was asked for, so
+                // describe all of it. The pipeline accesses the
+                // buffer using its mins and strides.
+                buffer_t *buf = tuple_buffers[i];
+                buffer_t &cached = entry->buffer(i);
+                buf->host = cached.host;
+                for (int j = 0; j < 4; j++) {
+                    buf->min[j] = cached.min[j];
+                    buf->extent[j] = cached.extent[j];
+                    buf->stride[j] = cached.stride[j];
                 }
             }
+            return 0;
+        }
+        shard.misses++;
+    }
 
-            if (all_bounds_equal) {
-                if (entry != most_recently_used) {
-                    halide_assert(user_context, entry->more_recent != NULL);
-                    if (entry->less_recent != NULL) {
-                        entry->less_recent->more_recent = entry->more_recent;
-                    } else {
-                        halide_assert(user_context, least_recently_used == entry);
-                        least_recently_used = entry->more_recent;
-                    }
-                    halide_assert(user_context, entry->more_recent != NULL);
-                    entry->more_recent->less_recent = entry->less_recent;
-
-                    entry->more_recent = NULL;
-                    entry->less_recent = most_recently_used;
-                    if (most_recently_used != NULL) {
-                        most_recently_used->more_recent = entry;
-                    }
-                    most_recently_used = entry;
-                }
-
-                for (int32_t i = 0; i < tuple_count; i++) {
-                    buffer_t *buf = tuple_buffers[i];
-                    copy_from_to(user_context, entry->buffer(i), *buf);
-                }
-
-                return false;
+    // A miss. Allocate the buffers for the pipeline to compute into,
+    // so that store can keep them without copying.
+    for (int32_t i = 0; i < tuple_count; i++) {
+        buffer_t *buf = tuple_buffers[i];
+        size_t buffer_size = full_extent(*buf) * buf->elem_size;
+        CacheBlockHeader *header =
+            (CacheBlockHeader *)halide_malloc(user_context, sizeof(CacheBlockHeader) + buffer_size);
+        if (header == NULL) {
+            for (int32_t j = 0; j < i; j++) {
+                halide_free(user_context, get_block_header(tuple_buffers[j]->host));
+                tuple_buffers[j]->host = NULL;
             }
+            return -1;
         }
-        entry = entry->next;
+        header->entry = NULL;
+        buf->host = (uint8_t *)(header + 1);
     }
 
-#if CACHE_DEBUGGING
-    validate_cache();
-#endif
+    if (persistent_data != NULL) {
+        int64_t compute_time_ns = load_persistent_record(h, cache_key, size, computed_bounds,
+                                                         tuple_count, tuple_buffers);
+        if (compute_time_ns >= 0) {
+            // Even if it can't be added to the cache, the buffers
+            // hold the result.
+            int p = find_partition(user_context, partition, partition_size);
+            store_entry(cache_key, size, h, computed_bounds, tuple_count, tuple_buffers, compute_time_ns, p);
+            return 0;
+        }
+    }
 
-    return true;
+    return 1;
 }
 
 WEAK void halide_memoization_cache_store(void *user_context, const uint8_t *cache_key, int32_t size,
-                                         buffer_t *computed_bounds, int32_t tuple_count, buffer_t **tuple_buffers) {
+                                         buffer_t *computed_bounds, int32_t tuple_count, buffer_t **tuple_buffers,
+                                         int64_t compute_time_ns, const char *partition, int64_t partition_size) {
     uint32_t h = djb_hash(cache_key, size);
-    uint32_t index = h % kHashTableSize;
-
-    ScopedMutexLock lock(&memoization_lock);
 
 #if CACHE_DEBUGGING
     debug_print_key(user_context, "halide_memoization_cache_store", cache_key, size);
@@ -377,90 +1346,175 @@ WEAK void halide_memoization_cache_store(void *user_context, const uint8_t *cach
             debug_print_buffer(user_context, "Allocation bounds", *buf);
         }
     }
-    validate_cache();
 #endif
 
-    CacheEntry *entry = cache_entries[index];
-    while (entry != NULL) {
-        if (entry->hash == h && entry->key_size == size &&
-            keys_equal(entry->key, cache_key, size) &&
-            bounds_equal(entry->computed_bounds, *computed_bounds) &&
-            entry->tuple_count == tuple_count) {
+    int p = find_partition(user_context, partition, partition_size);
+    if (store_entry(cache_key, size, h, computed_bounds, tuple_count, tuple_buffers, compute_time_ns, p) &&
+        persistent_data != NULL) {
+        // The pipeline hasn't released the buffers yet, so the entry
+        // can't have been destroyed.
+        append_persistent_record(h, cache_key, size, computed_bounds, tuple_count, tuple_buffers, compute_time_ns);
+    }
+}
 
-            bool all_bounds_equal = true;
+WEAK void halide_memoization_cache_release(void *user_context, void *host) {
+    if (host == NULL) {
+        return;
+    }
 
-            {
-                for (int32_t i = 0; all_bounds_equal && i < tuple_count; i++) {
-                    buffer_t *buf = tuple_buffers[i];
-                    all_bounds_equal = bounds_equal(entry->buffer(i), *buf);
-                }
-            }
-            if (all_bounds_equal) {
-                return;
-            }
-        }
-        entry = entry->next;
+    CacheBlockHeader *header = get_block_header(host);
+    CacheEntry *entry = header->entry;
+    if (entry == NULL) {
+        // Never stored in the cache.
+        halide_free(user_context, header);
+        return;
     }
 
-    uint64_t added_size = 0;
+    bool destroy = false;
     {
-        for (int32_t i = 0; i < tuple_count; i++) {
-            buffer_t *buf = tuple_buffers[i];
-            added_size += full_extent(*buf);
-        }
+        ScopedMutexLock lock(&shard_for(entry->hash).lock);
+        halide_assert(user_context, entry->in_use_count > 0);
+        entry->in_use_count--;
+        destroy = entry->evicted && entry->in_use_count == 0;
     }
-    current_cache_size += added_size;
-    prune_cache();
 
-    // The size of buffer_t for pointer math is apparently slightly
-    // larger than sizeof(buffer_t) on 32-bit windows. There's some
-    // padding between elements when they're in an array that isn't
-    // captured by sizeof. This is presumably because clang evaluates
-    // sizeof at initial module construction, and the math below turns
-    // into a getelementptr llvm instruction. There must be a mismatch
-    // in struct padding settings between the two.
-    size_t extra_buffer_t_size = (size_t)(((buffer_t *)0) + 1);
-
-    void *entry_storage = halide_malloc(NULL, sizeof(CacheEntry) + extra_buffer_t_size * (tuple_count - 1));
+    if (destroy) {
+        entry->destroy();
+        halide_free(NULL, entry);
+    }
+}
 
-    CacheEntry *new_entry = (CacheEntry *)entry_storage;
-    new_entry->init(cache_key, size, h, *computed_bounds, tuple_count, tuple_buffers);
+WEAK int halide_memoization_cache_get_stats(halide_memoization_cache_stats *stats,
+                                            halide_memoization_cache_func_stats *funcs,
+                                            int max_funcs) {
+    if (stats != NULL) {
+        memset(stats, 0, sizeof(*stats));
+        stats->max_bytes = cache_partitions[0].max_size;
+    }
 
-    new_entry->next = cache_entries[index];
-    new_entry->less_recent = most_recently_used;
-    if (most_recently_used != NULL) {
-        most_recently_used->more_recent = new_entry;
+    // Holding stats_lock keeps entries' stats from being retired
+    // while we count them.
+    ScopedMutexLock stats_guard(&stats_lock);
+    int num_funcs = num_func_stats;
+    if (funcs != NULL) {
+        for (FuncStats *f = func_stats; f != NULL; f = f->next) {
+            if (f->index >= max_funcs) continue;
+            halide_memoization_cache_func_stats &out = funcs[f->index];
+            out.name = f->name;
+            out.hits = f->hits;
+            out.misses = f->misses;
+            out.evictions = f->evictions;
+            out.bytes_resident = 0;
+            out.num_entries = 0;
+        }
     }
-    most_recently_used = new_entry;
-    if (least_recently_used == NULL) {
-        least_recently_used = new_entry;
+
+    for (size_t s = 0; s < kNumShards; s++) {
+        CacheShard &shard = cache_shards[s];
+        ScopedMutexLock lock(&shard.lock);
+        if (stats != NULL) {
+            stats->hits += shard.hits;
+            stats->misses += shard.misses;
+            stats->stores += shard.stores;
+        }
+        for (int p = 0; p < kMaxPartitions; p++) {
+            for (CacheEntry *entry = shard.least_recently_used[p]; entry != NULL; entry = entry->more_recent) {
+                size_t bytes = entry_size(entry);
+                if (stats != NULL) {
+                    stats->bytes_resident += bytes;
+                    stats->num_entries++;
+                }
+                if (funcs != NULL && entry->func != NULL && entry->func->index < max_funcs) {
+                    halide_memoization_cache_func_stats &out = funcs[entry->func->index];
+                    out.hits += entry->hits;
+                    out.misses += entry->misses;
+                    out.bytes_resident += bytes;
+                    out.num_entries++;
+                }
+            }
+        }
     }
-    cache_entries[index] = new_entry;
 
-#if CACHE_DEBUGGING
-    validate_cache();
-#endif
+    if (stats != NULL) {
+        stats->evictions = cache_evictions;
+        stats->persistent_hits = persistent_hits;
+        stats->num_funcs = num_funcs;
+    }
+    return num_funcs;
 }
 
-#if 0
-WEAK void halide_memoization_cache_release(void *user_context, const uint8_t *cache_key, int32_t size, buffer_t *computed_bounds, int32_t tuple_count, buffer_t **) {
+WEAK void halide_memoization_cache_reset_stats() {
+    cache_evictions = 0;
+    persistent_hits = 0;
+    ScopedMutexLock stats_guard(&stats_lock);
+    for (FuncStats *f = func_stats; f != NULL; f = f->next) {
+        f->hits = f->misses = f->evictions = 0;
+    }
+    for (size_t s = 0; s < kNumShards; s++) {
+        CacheShard &shard = cache_shards[s];
+        ScopedMutexLock lock(&shard.lock);
+        shard.hits = shard.misses = shard.stores = 0;
+        for (int p = 0; p < kMaxPartitions; p++) {
+            for (CacheEntry *entry = shard.least_recently_used[p]; entry != NULL; entry = entry->more_recent) {
+                entry->hits = entry->misses = 0;
+            }
+        }
+    }
 }
-#endif
-
 
 WEAK void halide_memoization_cache_cleanup() {
-    for (int i = 0; i < kHashTableSize; i++) {
-        CacheEntry *entry = cache_entries[i];
-        cache_entries[i] = NULL;
-        while (entry != NULL) {
-            CacheEntry *next = entry->next;
-            entry->destroy();
-            halide_free(NULL, entry);
-            entry = next;
+    for (size_t s = 0; s < kNumShards; s++) {
+        CacheShard &shard = cache_shards[s];
+        for (size_t i = 0; i < kShardTableSize; i++) {
+            CacheEntry *entry = shard.entries[i];
+            shard.entries[i] = NULL;
+            while (entry != NULL) {
+                CacheEntry *next = entry->next;
+                if (entry->in_use_count > 0) {
+                    // Leave it for the last release to destroy.
+                    entry->evicted = true;
+                    entry->func = NULL;
+                } else {
+                    entry->destroy();
+                    halide_free(NULL, entry);
+                }
+                entry = next;
+            }
+        }
+        for (int p = 0; p < kMaxPartitions; p++) {
+            shard.most_recently_used[p] = NULL;
+            shard.least_recently_used[p] = NULL;
         }
+        shard.hits = shard.misses = shard.stores = 0;
+        halide_mutex_cleanup(&shard.lock);
+    }
+    // The default partition keeps its size limit, but the named
+    // partitions are forgotten.
+    for (int p = 0; p < kMaxPartitions; p++) {
+        CachePartition &partition = cache_partitions[p];
+        if (p > 0) {
+            halide_free(NULL, partition.name);
+            partition.name = NULL;
+            partition.max_size = kDefaultCacheSize;
+        }
+        partition.current_size = 0;
+        partition.inflation = 0;
+        halide_mutex_cleanup(&partition.prune_lock);
+    }
+    num_cache_partitions = 1;
+    cache_evictions = 0;
+    while (func_stats != NULL) {
+        FuncStats *next = func_stats->next;
+        halide_free(NULL, func_stats->name);
+        halide_free(NULL, func_stats);
+        func_stats = next;
     }
-    current_cache_size = 0;
-    halide_mutex_cleanup(&memoization_lock);
+    num_func_stats = 0;
+    persistent_hits = 0;
+    close_persistent_file();
+    halide_mutex_cleanup(&persistent_lock);
+    halide_mutex_cleanup(&stats_lock);
+    halide_mutex_cleanup(&partitions_lock);
 }
 
 namespace {
@@ -0,0 +1,26 @@
+#include "runtime_internal.h"
+
+#include "HalideRuntime.h"
+
+// For platforms without posix file mapping. Mapping a file always
+// fails, so features that need it turn themselves off. Mapping memory
+// fails too, so allocations with hints come from halide_malloc.
+
+extern "C" {
+
+WEAK int halide_map_file(void *user_context, const char *path, size_t min_size,
+                         void **data, size_t *size, bool *writable) {
+    return -1;
+}
+
+WEAK void halide_unmap_file(void *user_context, int fd, void *data, size_t size) {
+}
+
+WEAK void *halide_map_memory(void *user_context, size_t size, int hints) {
+    return NULL;
+}
+
+WEAK void halide_unmap_memory(void *user_context, void *addr, size_t size, int hints) {
+}
+
+}
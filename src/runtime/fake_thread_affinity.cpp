@@ -0,0 +1,31 @@
+#include "runtime_internal.h"
+
+#include "HalideRuntime.h"
+
+// For platforms where threads can't be pinned. Everything is on one
+// node, and pinning silently does nothing. Stacks are of unknown
+// size.
+
+extern "C" {
+
+WEAK int halide_host_numa_node_of_cpu(int cpu) {
+    return 0;
+}
+
+WEAK int halide_pin_current_thread(int cpu, halide_thread_affinity_t mode) {
+    return 0;
+}
+
+WEAK int halide_current_thread_cpu() {
+    return -1;
+}
+
+WEAK int halide_current_thread_stack(uint8_t **base, size_t *size) {
+    return -1;
+}
+
+WEAK int halide_set_current_thread_nice(int nice) {
+    return 0;
+}
+
+}
@@ -30,6 +30,12 @@ WEAK int default_do_par_for(void *user_context, halide_task f,
 WEAK int (*halide_custom_do_task)(void *user_context, halide_task, int, uint8_t *) = default_do_task;
 WEAK int (*halide_custom_do_par_for)(void *, halide_task, int, int, uint8_t *) = default_do_par_for;
 
+WEAK int default_do_guided_par_for(void *user_context, halide_task f,
+                                   int min, int size, uint8_t *closure) {
+    return (*halide_custom_do_par_for)(user_context, f, min, size, closure);
+}
+WEAK int (*halide_custom_do_guided_par_for)(void *, halide_task, int, int, uint8_t *) = default_do_guided_par_for;
+
 }}} // namespace Halide::Runtime::Internal
 
 extern "C" {
@@ -43,12 +49,98 @@ WEAK void halide_mutex_lock(halide_mutex *mutex) {
 WEAK void halide_mutex_unlock(halide_mutex *mutex) {
 }
 
+// There's only ever one thread, so nothing can release a semaphore
+// while it's being waited on.
+WEAK void halide_semaphore_release(halide_semaphore *) {
+}
+
+WEAK void halide_semaphore_acquire(halide_semaphore *) {
+}
+
+WEAK bool halide_semaphore_acquire_timeout(halide_semaphore *, int) {
+    return false;
+}
+
+WEAK halide_thread *halide_spawn_thread(void (*)(void *), void *) {
+    return NULL;
+}
+
+WEAK void halide_join_thread(halide_thread *) {
+}
+
 WEAK void halide_shutdown_thread_pool() {
 }
 
 WEAK void halide_set_num_threads(int) {
 }
 
+WEAK void halide_set_thread_affinity(halide_thread_affinity_t) {
+}
+
+WEAK void halide_set_thread_pool_spin_budget(int, int) {
+}
+
+// Everything runs on the calling thread.
+WEAK void halide_set_worker_stack_size(size_t) {
+}
+
+// The calling thread's stack is of unknown size, and may already be
+// mostly used, so nothing more goes on it.
+WEAK int32_t halide_get_stack_allocation_limit() {
+    return 0;
+}
+
+WEAK void halide_get_thread_pool_wait_counters(halide_thread_pool_wait_counters *counters) {
+    memset(counters, 0, sizeof(*counters));
+}
+
+WEAK void halide_reset_thread_pool_wait_counters() {
+}
+
+WEAK void halide_enable_thread_pool_stats(int enabled) {
+}
+
+WEAK int halide_get_thread_pool_stats(halide_thread_pool *pool, halide_thread_pool_stats *stats,
+                                      halide_thread_pool_worker_stats *workers, int max_workers) {
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    return 0;
+}
+
+WEAK void halide_reset_thread_pool_stats(halide_thread_pool *pool) {
+}
+
+WEAK void halide_do_async(void *user_context, int (*f)(void **), void **args,
+                          void (*done)(void *, int, void *), void *done_arg) {
+    int result = f(args);
+    if (done) {
+        done(user_context, result, done_arg);
+    }
+}
+
+WEAK halide_thread_pool *halide_create_thread_pool(const char *name, int num_threads, int priority) {
+    return NULL;
+}
+
+WEAK halide_thread_pool *halide_find_thread_pool(const char *name) {
+    return NULL;
+}
+
+WEAK void halide_destroy_thread_pool(halide_thread_pool *pool) {
+}
+
+WEAK void halide_set_thread_pool_num_threads(halide_thread_pool *pool, int n) {
+}
+
+WEAK halide_thread_pool *halide_get_thread_pool(void *user_context) {
+    return NULL;
+}
+
+WEAK halide_thread_pool *(*halide_set_custom_get_thread_pool(halide_thread_pool *(*f)(void *)))(void *) {
+    return NULL;
+}
+
 WEAK int (*halide_set_custom_do_task(int (*f)(void *, halide_task, int, uint8_t *)))
            (void *, halide_task, int, uint8_t *) {
     int (*result)(void *, halide_task, int, uint8_t *) = halide_custom_do_task;
@@ -74,4 +166,22 @@ WEAK int halide_do_par_for(void *user_context, int (*f)(void *, int, uint8_t *),
     return (*halide_custom_do_par_for)(user_context, f, min, size, closure);
 }
 
+WEAK int (*halide_set_custom_do_guided_par_for(int (*f)(void *, halide_task, int, int, uint8_t *)))
+          (void *, halide_task, int, int, uint8_t *) {
+    int (*result)(void *, halide_task, int, int, uint8_t *) = halide_custom_do_guided_par_for;
+    halide_custom_do_guided_par_for = f;
+    return result;
+}
+
+WEAK int halide_do_guided_par_for(void *user_context, int (*f)(void *, int, uint8_t *),
+                                  int min, int size, uint8_t *closure) {
+    if (halide_custom_do_guided_par_for == default_do_guided_par_for &&
+        halide_custom_do_par_for != default_do_par_for) {
+        // Someone else is managing the threads, and doesn't
+        // distinguish guided loops.
+        return (*halide_custom_do_par_for)(user_context, f, min, size, closure);
+    }
+    return (*halide_custom_do_guided_par_for)(user_context, f, min, size, closure);
+}
+
 }
@@ -18,15 +18,24 @@ extern dispatch_queue_t dispatch_get_global_queue(
 extern void dispatch_apply_f(size_t iterations, dispatch_queue_t queue,
                              void *context, void (*work)(void *, size_t));
 
+extern void dispatch_async_f(dispatch_queue_t queue, void *context, void (*work)(void *));
+
 typedef struct dispatch_semaphore_s *dispatch_semaphore_t;
 typedef uint64_t dispatch_time_t;
+#define DISPATCH_TIME_NOW (0ull)
 #define DISPATCH_TIME_FOREVER (~0ull)
+extern dispatch_time_t dispatch_time(dispatch_time_t when, int64_t delta);
 
 extern dispatch_semaphore_t dispatch_semaphore_create(long value);
 extern long dispatch_semaphore_wait(dispatch_semaphore_t dsema, dispatch_time_t timeout);
 extern long dispatch_semaphore_signal(dispatch_semaphore_t dsema);
 extern void dispatch_release(void *object);
 
+typedef struct _opaque_pthread_t *pthread_t;
+extern pthread_t pthread_self();
+extern void *pthread_get_stackaddr_np(pthread_t thread);
+extern size_t pthread_get_stacksize_np(pthread_t thread);
+
 WEAK int halide_do_task(void *user_context, halide_task f, int idx,
                         uint8_t *closure);
 
@@ -78,9 +87,34 @@ WEAK int default_do_par_for(void *user_context, halide_task f,
     return job.exit_status;
 }
 
+struct halide_gcd_async_job {
+    int (*f)(void **);
+    void **args;
+    void *user_context;
+    void (*done)(void *, int, void *);
+    void *done_arg;
+};
+
+WEAK void halide_do_gcd_async(void *job) {
+    halide_gcd_async_job *j = (halide_gcd_async_job *)job;
+    int result = j->f(j->args);
+    if (j->done) {
+        j->done(j->user_context, result, j->done_arg);
+    }
+    free(j);
+}
+
 WEAK int (*halide_custom_do_task)(void *user_context, halide_task, int, uint8_t *) = default_do_task;
 WEAK int (*halide_custom_do_par_for)(void *, halide_task, int, int, uint8_t *) = default_do_par_for;
 
+// Grand Central Dispatch already hands out iterations as threads
+// become free.
+WEAK int default_do_guided_par_for(void *user_context, halide_task f,
+                                   int min, int size, uint8_t *closure) {
+    return (*halide_custom_do_par_for)(user_context, f, min, size, closure);
+}
+WEAK int (*halide_custom_do_guided_par_for)(void *, halide_task, int, int, uint8_t *) = default_do_guided_par_for;
+
 }}} // namespace Halide::Runtime::Internal
 
 extern "C" {
@@ -104,12 +138,169 @@ WEAK void halide_mutex_unlock(halide_mutex *mutex_arg) {
     dispatch_semaphore_signal(mutex->semaphore);
 }
 
+namespace {
+struct gcd_semaphore {
+    dispatch_once_t once;
+    dispatch_semaphore_t semaphore;
+};
+
+WEAK void init_semaphore(void *sem_arg) {
+    gcd_semaphore *sem = (gcd_semaphore *)sem_arg;
+    sem->semaphore = dispatch_semaphore_create(0);
+}
+}
+
+WEAK void halide_semaphore_release(halide_semaphore *s) {
+    gcd_semaphore *sem = (gcd_semaphore *)s;
+    dispatch_once_f(&sem->once, sem, init_semaphore);
+    dispatch_semaphore_signal(sem->semaphore);
+}
+
+WEAK void halide_semaphore_acquire(halide_semaphore *s) {
+    gcd_semaphore *sem = (gcd_semaphore *)s;
+    dispatch_once_f(&sem->once, sem, init_semaphore);
+    dispatch_semaphore_wait(sem->semaphore, DISPATCH_TIME_FOREVER);
+}
+
+WEAK bool halide_semaphore_acquire_timeout(halide_semaphore *s, int timeout_ms) {
+    gcd_semaphore *sem = (gcd_semaphore *)s;
+    dispatch_once_f(&sem->once, sem, init_semaphore);
+    dispatch_time_t deadline = dispatch_time(DISPATCH_TIME_NOW, (int64_t)timeout_ms * 1000000);
+    return dispatch_semaphore_wait(sem->semaphore, deadline) == 0;
+}
+
+namespace {
+struct spawned_thread {
+    void (*f)(void *);
+    void *closure;
+    // Signaled once f returns.
+    dispatch_semaphore_t done;
+};
+
+WEAK void spawned_thread_main(void *arg) {
+    spawned_thread *t = (spawned_thread *)arg;
+    t->f(t->closure);
+    dispatch_semaphore_signal(t->done);
+}
+}
+
+// Grand Central Dispatch grows its pool when a job blocks, so a
+// long-running job doesn't starve the parallel loops.
+WEAK halide_thread *halide_spawn_thread(void (*f)(void *), void *closure) {
+    spawned_thread *t = (spawned_thread *)malloc(sizeof(spawned_thread));
+    if (t == NULL) return NULL;
+    t->f = f;
+    t->closure = closure;
+    t->done = dispatch_semaphore_create(0);
+    if (t->done == NULL) {
+        free(t);
+        return NULL;
+    }
+    dispatch_async_f(dispatch_get_global_queue(0, 0), t, spawned_thread_main);
+    return (halide_thread *)t;
+}
+
+WEAK void halide_join_thread(halide_thread *thread) {
+    spawned_thread *t = (spawned_thread *)thread;
+    dispatch_semaphore_wait(t->done, DISPATCH_TIME_FOREVER);
+    dispatch_release(t->done);
+    free(t);
+}
+
 WEAK void halide_shutdown_thread_pool() {
 }
 
 WEAK void halide_set_num_threads(int) {
 }
 
+WEAK void halide_set_thread_affinity(halide_thread_affinity_t) {
+}
+
+WEAK void halide_set_thread_pool_spin_budget(int, int) {
+}
+
+// Grand Central Dispatch owns its threads, and gives them 512KB stacks.
+WEAK void halide_set_worker_stack_size(size_t) {
+}
+
+WEAK int32_t halide_get_stack_allocation_limit() {
+    // Darwin knows every thread's stack, main thread included. It
+    // grows down from the address it gives.
+    pthread_t self = pthread_self();
+    uintptr_t hi = (uintptr_t)pthread_get_stackaddr_np(self);
+    uintptr_t lo = hi - pthread_get_stacksize_np(self);
+    uintptr_t sp = (uintptr_t)__builtin_frame_address(0);
+    size_t left = (lo < sp && sp <= hi) ? sp - lo : 0;
+    // Leave half of what's left for everything else, including
+    // later allocations made under the same limit.
+    left /= 2;
+    if (left > 0x7fffffff) {
+        left = 0x7fffffff;
+    }
+    return (int32_t)left;
+}
+
+WEAK void halide_get_thread_pool_wait_counters(halide_thread_pool_wait_counters *counters) {
+    memset(counters, 0, sizeof(*counters));
+}
+
+WEAK void halide_reset_thread_pool_wait_counters() {
+}
+
+WEAK void halide_enable_thread_pool_stats(int enabled) {
+}
+
+WEAK int halide_get_thread_pool_stats(halide_thread_pool *pool, halide_thread_pool_stats *stats,
+                                      halide_thread_pool_worker_stats *workers, int max_workers) {
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    return 0;
+}
+
+WEAK void halide_reset_thread_pool_stats(halide_thread_pool *pool) {
+}
+
+WEAK void halide_do_async(void *user_context, int (*f)(void **), void **args,
+                          void (*done)(void *, int, void *), void *done_arg) {
+    halide_gcd_async_job *job = (halide_gcd_async_job *)malloc(sizeof(halide_gcd_async_job));
+    if (!job) {
+        int result = f(args);
+        if (done) {
+            done(user_context, result, done_arg);
+        }
+        return;
+    }
+    job->f = f;
+    job->args = args;
+    job->user_context = user_context;
+    job->done = done;
+    job->done_arg = done_arg;
+    dispatch_async_f(dispatch_get_global_queue(0, 0), job, &halide_do_gcd_async);
+}
+
+WEAK halide_thread_pool *halide_create_thread_pool(const char *name, int num_threads, int priority) {
+    return NULL;
+}
+
+WEAK halide_thread_pool *halide_find_thread_pool(const char *name) {
+    return NULL;
+}
+
+WEAK void halide_destroy_thread_pool(halide_thread_pool *pool) {
+}
+
+WEAK void halide_set_thread_pool_num_threads(halide_thread_pool *pool, int n) {
+}
+
+WEAK halide_thread_pool *halide_get_thread_pool(void *user_context) {
+    return NULL;
+}
+
+WEAK halide_thread_pool *(*halide_set_custom_get_thread_pool(halide_thread_pool *(*f)(void *)))(void *) {
+    return NULL;
+}
+
 WEAK int (*halide_set_custom_do_task(int (*f)(void *, halide_task, int, uint8_t *)))
           (void *, halide_task, int, uint8_t *) {
     int (*result)(void *, halide_task, int, uint8_t *) = halide_custom_do_task;
@@ -134,4 +325,22 @@ WEAK int halide_do_par_for(void *user_context, int (*f)(void *, int, uint8_t *),
     return (*halide_custom_do_par_for)(user_context, f, min, size, closure);
 }
 
+WEAK int (*halide_set_custom_do_guided_par_for(int (*f)(void *, halide_task, int, int, uint8_t *)))
+          (void *, halide_task, int, int, uint8_t *) {
+    int (*result)(void *, halide_task, int, int, uint8_t *) = halide_custom_do_guided_par_for;
+    halide_custom_do_guided_par_for = f;
+    return result;
+}
+
+WEAK int halide_do_guided_par_for(void *user_context, int (*f)(void *, int, uint8_t *),
+                                  int min, int size, uint8_t *closure) {
+    if (halide_custom_do_guided_par_for == default_do_guided_par_for &&
+        halide_custom_do_par_for != default_do_par_for) {
+        // Someone else is managing the threads, and doesn't
+        // distinguish guided loops.
+        return (*halide_custom_do_par_for)(user_context, f, min, size, closure);
+    }
+    return (*halide_custom_do_guided_par_for)(user_context, f, min, size, closure);
+}
+
 }
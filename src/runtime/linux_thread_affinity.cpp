@@ -0,0 +1,150 @@
+#include "runtime_internal.h"
+
+#include "HalideRuntime.h"
+
+extern "C" {
+
+extern int sched_setaffinity(int pid, size_t cpusetsize, const void *mask);
+extern ssize_t read(int fd, void *buf, size_t count);
+extern int setpriority(int which, int who, int prio);
+extern int sched_getcpu();
+typedef struct {
+    // 128 bytes is enough for an attr on 64-bit and 32-bit systems
+    uint64_t _private[16];
+} pthread_attr_t;
+extern long pthread_self();
+extern int pthread_getattr_np(long thread, pthread_attr_t *attr);
+extern int pthread_attr_getstack(const pthread_attr_t *attr, void **stackaddr, size_t *stacksize);
+extern int pthread_attr_destroy(pthread_attr_t *attr);
+
+extern int halide_host_cpu_count();
+
+} // extern "C"
+
+namespace Halide { namespace Runtime { namespace Internal {
+
+// The NUMA node of each cpu, read from sysfs on first use. Never
+// freed, so it's safe to read from any thread once set.
+WEAK int *halide_cpu_nodes = NULL;
+WEAK int halide_num_cpus = 0;
+WEAK volatile int halide_cpu_nodes_lock = 0;
+
+// Parse a sysfs cpu list like "0-7,16-23" and mark each cpu in it
+// as belonging to the given node.
+WEAK void parse_cpu_list(const char *str, int node) {
+    const char *p = str;
+    while (*p >= '0' && *p <= '9') {
+        int lo = 0;
+        while (*p >= '0' && *p <= '9') {
+            lo = lo * 10 + (*p++ - '0');
+        }
+        int hi = lo;
+        if (*p == '-') {
+            p++;
+            hi = 0;
+            while (*p >= '0' && *p <= '9') {
+                hi = hi * 10 + (*p++ - '0');
+            }
+        }
+        for (int cpu = lo; cpu <= hi && cpu < halide_num_cpus; cpu++) {
+            halide_cpu_nodes[cpu] = node;
+        }
+        if (*p == ',') p++;
+    }
+}
+
+WEAK void init_cpu_nodes() {
+    if (halide_cpu_nodes) return;
+
+    while (__sync_lock_test_and_set(&halide_cpu_nodes_lock, 1)) { }
+    if (!halide_cpu_nodes) {
+        int num_cpus = halide_host_cpu_count();
+        if (num_cpus < 1) num_cpus = 1;
+        int *nodes = (int *)malloc(num_cpus * sizeof(int));
+        memset(nodes, 0, num_cpus * sizeof(int));
+        halide_num_cpus = num_cpus;
+        halide_cpu_nodes = nodes;
+
+        // Machines without NUMA have no node directories, and every
+        // cpu stays on node zero.
+        for (int node = 0; node < num_cpus; node++) {
+            char path[64];
+            char *dst = halide_string_to_string(path, path + sizeof(path), "/sys/devices/system/node/node");
+            dst = halide_int64_to_string(dst, path + sizeof(path), node, 1);
+            halide_string_to_string(dst, path + sizeof(path), "/cpulist");
+            int fd = open(path, 0, 0);
+            if (fd < 0) break;
+            char buf[1024];
+            ssize_t bytes = read(fd, buf, sizeof(buf) - 1);
+            close(fd);
+            if (bytes <= 0) break;
+            buf[bytes] = 0;
+            parse_cpu_list(buf, node);
+        }
+        __sync_synchronize();
+    }
+    __sync_lock_release(&halide_cpu_nodes_lock);
+}
+
+}}} // namespace Halide::Runtime::Internal
+
+extern "C" {
+
+WEAK int halide_host_numa_node_of_cpu(int cpu) {
+    init_cpu_nodes();
+    if (cpu < 0) return 0;
+    return halide_cpu_nodes[cpu % halide_num_cpus];
+}
+
+WEAK int halide_pin_current_thread(int cpu, halide_thread_affinity_t mode) {
+    init_cpu_nodes();
+    int words = (halide_num_cpus + 63) / 64;
+    uint64_t *mask = (uint64_t *)malloc(words * sizeof(uint64_t));
+    memset(mask, 0, words * sizeof(uint64_t));
+    cpu = cpu % halide_num_cpus;
+    for (int i = 0; i < halide_num_cpus; i++) {
+        bool use;
+        if (mode == halide_thread_affinity_cores) {
+            use = (i == cpu);
+        } else if (mode == halide_thread_affinity_nodes) {
+            use = (halide_cpu_nodes[i] == halide_cpu_nodes[cpu]);
+        } else {
+            // Unpinned. Allow every cpu.
+            use = true;
+        }
+        if (use) {
+            mask[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+    }
+    int result = sched_setaffinity(0, words * sizeof(uint64_t), mask);
+    free(mask);
+    return result;
+}
+
+WEAK int halide_current_thread_cpu() {
+    return sched_getcpu();
+}
+
+// The lowest address of the calling thread's stack, above any guard
+// page, and its size. Slow on the main thread, whose stack glibc
+// finds by reading /proc/self/maps, so the thread pool only asks on
+// its workers.
+WEAK int halide_current_thread_stack(uint8_t **base, size_t *size) {
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+        return -1;
+    }
+    void *addr = NULL;
+    int err = pthread_attr_getstack(&attr, &addr, size);
+    pthread_attr_destroy(&attr);
+    *base = (uint8_t *)addr;
+    return err == 0 && addr != NULL ? 0 : -1;
+}
+
+// On Linux, the nice value is a property of the thread, not the
+// process, so this only affects the calling thread.
+WEAK int halide_set_current_thread_nice(int nice) {
+    return setpriority(0, 0, nice);
+}
+
+}
@@ -0,0 +1,148 @@
+#include "runtime_internal.h"
+
+#include "HalideRuntime.h"
+#include "scoped_mutex_lock.h"
+
+// Memory accounting for code compiled with the track_memory target
+// feature. Each heap allocation a pipeline makes is bracketed by
+// halide_memory_tracker_alloc and halide_memory_tracker_free, which
+// add its size to the current and peak bytes of the Func it belongs
+// to and to the totals. The records are found by name on a list that
+// only ever grows, so once a Func has a record, counting its
+// allocations takes no lock.
+
+namespace Halide { namespace Runtime { namespace Internal {
+
+struct FuncMemoryRecord {
+    FuncMemoryRecord *next;
+    char *name;
+    int index;
+    volatile int64_t current_bytes, peak_bytes;
+    volatile uint64_t num_allocations;
+    volatile int64_t static_bound_bytes;
+};
+
+// What halide_memory_tracker_alloc hands back, so that the free knows
+// what to take off which record.
+struct MemoryTrackerToken {
+    FuncMemoryRecord *func;
+    int64_t size;
+};
+
+// Protects appending to func_memory_records. Readers walk the list
+// without it.
+WEAK halide_mutex memory_records_lock;
+WEAK FuncMemoryRecord *volatile func_memory_records = NULL;
+WEAK volatile int num_func_memory_records = 0;
+WEAK volatile int64_t total_current_bytes = 0;
+WEAK volatile int64_t total_peak_bytes = 0;
+
+WEAK void raise_peak(volatile int64_t *peak, int64_t value) {
+    int64_t old_peak = *peak;
+    while (value > old_peak) {
+        int64_t seen = __sync_val_compare_and_swap(peak, old_peak, value);
+        if (seen == old_peak) break;
+        old_peak = seen;
+    }
+}
+
+WEAK FuncMemoryRecord *find_func_memory_record(const char *name) {
+    for (FuncMemoryRecord *f = func_memory_records; f != NULL; f = f->next) {
+        if (strcmp(f->name, name) == 0) {
+            return f;
+        }
+    }
+
+    ScopedMutexLock lock(&memory_records_lock);
+    // Someone may have added it while we didn't hold the lock.
+    FuncMemoryRecord *volatile *tail = &func_memory_records;
+    while (*tail != NULL) {
+        if (strcmp((*tail)->name, name) == 0) {
+            return *tail;
+        }
+        tail = &(*tail)->next;
+    }
+    FuncMemoryRecord *f = (FuncMemoryRecord *)malloc(sizeof(FuncMemoryRecord));
+    if (f == NULL) return NULL;
+    size_t len = strlen(name);
+    f->name = (char *)malloc(len + 1);
+    if (f->name == NULL) {
+        free(f);
+        return NULL;
+    }
+    memcpy(f->name, name, len + 1);
+    f->next = NULL;
+    f->index = num_func_memory_records;
+    f->current_bytes = f->peak_bytes = 0;
+    f->num_allocations = 0;
+    f->static_bound_bytes = -1;
+    // Finish the record before readers can see it.
+    __sync_synchronize();
+    *tail = f;
+    num_func_memory_records++;
+    return f;
+}
+
+}}} // namespace Halide::Runtime::Internal
+
+extern "C" {
+
+WEAK void *halide_memory_tracker_alloc(void *user_context, const char *func_name,
+                                       int64_t size, int64_t static_bound) {
+    FuncMemoryRecord *f = find_func_memory_record(func_name);
+    MemoryTrackerToken *token = (MemoryTrackerToken *)malloc(sizeof(MemoryTrackerToken));
+    if (f == NULL || token == NULL) {
+        // Not worth failing the pipeline over; the allocation just
+        // isn't counted.
+        free(token);
+        return NULL;
+    }
+    token->func = f;
+    token->size = size;
+    f->static_bound_bytes = static_bound;
+    __sync_fetch_and_add(&f->num_allocations, 1);
+    raise_peak(&f->peak_bytes, __sync_add_and_fetch(&f->current_bytes, size));
+    raise_peak(&total_peak_bytes, __sync_add_and_fetch(&total_current_bytes, size));
+    return token;
+}
+
+WEAK void halide_memory_tracker_free(void *user_context, void *ptr) {
+    MemoryTrackerToken *token = (MemoryTrackerToken *)ptr;
+    if (token == NULL) return;
+    __sync_fetch_and_sub(&token->func->current_bytes, token->size);
+    __sync_fetch_and_sub(&total_current_bytes, token->size);
+    free(token);
+}
+
+WEAK int halide_memory_tracker_get_stats(halide_memory_tracker_stats *stats,
+                                         halide_memory_tracker_func_stats *funcs,
+                                         int max_funcs) {
+    int num_funcs = num_func_memory_records;
+    if (stats != NULL) {
+        stats->current_bytes = total_current_bytes;
+        stats->peak_bytes = total_peak_bytes;
+        stats->num_funcs = num_funcs;
+    }
+    if (funcs != NULL) {
+        for (FuncMemoryRecord *f = func_memory_records; f != NULL; f = f->next) {
+            if (f->index >= max_funcs || f->index >= num_funcs) continue;
+            halide_memory_tracker_func_stats &out = funcs[f->index];
+            out.name = f->name;
+            out.current_bytes = f->current_bytes;
+            out.peak_bytes = f->peak_bytes;
+            out.num_allocations = f->num_allocations;
+            out.static_bound_bytes = f->static_bound_bytes;
+        }
+    }
+    return num_funcs;
+}
+
+WEAK void halide_memory_tracker_reset_stats() {
+    for (FuncMemoryRecord *f = func_memory_records; f != NULL; f = f->next) {
+        f->peak_bytes = f->current_bytes;
+        f->num_allocations = 0;
+    }
+    total_peak_bytes = total_current_bytes;
+}
+
+}
@@ -1,30 +1,183 @@
 #include "runtime_internal.h"
 
+#include "HalideRuntime.h"
+#include "scoped_spin_lock.h"
+
 extern "C" {
 
 extern void *malloc(size_t);
 extern void free(void *);
 
+extern void *halide_map_memory(void *user_context, size_t size, int hints);
+extern void halide_unmap_memory(void *user_context, void *addr, size_t size, int hints);
+
 }
 
 namespace Halide { namespace Runtime { namespace Internal {
 
+// Sits just before each block handed out by default_malloc. The
+// original pointer comes last, so that it's still the word before
+// the block.
+struct BlockHeader {
+    // The size class the block was rounded up to, or -1 if it isn't
+    // pooled.
+    int32_t size_class;
+    uint32_t size;
+    void *orig;
+};
+
+// Pooled sizes are rounded up to one of four sizes per power of two,
+// so at most a quarter of a pooled block goes unused. Larger
+// allocations aren't pooled.
+const int kMinSizeClassBits = 6;
+const int kMaxSizeClassBits = 28;
+const int kNumSizeClasses = 1 + 4 * (kMaxSizeClassBits - kMinSizeClassBits);
+
+// Freed blocks are kept on free lists in one of several stripes,
+// chosen by the calling thread, so that threads don't contend on a
+// single lock and blocks mostly get reused by the thread that freed
+// them. A block on a free list stores the next one in its first word.
+const int kNumPoolStripes = 16;
+
+struct PoolStripe {
+    volatile int lock;
+    void *free_blocks[kNumSizeClasses];
+    // Counted under the lock.
+    uint64_t allocations, hits, frees, pooled_frees;
+    // Keep neighboring stripes' locks off each other's cache lines.
+    uint8_t padding[64];
+};
+
+WEAK PoolStripe pool_stripes[kNumPoolStripes];
+
+// Pooling is off while the size is zero.
+WEAK volatile int64_t pool_max_size = 0;
+WEAK volatile int64_t pool_current_size = 0;
+
+// Returns the size class for an allocation of x bytes, and the size
+// it rounds up to, or -1 if allocations of that size aren't pooled.
+WEAK int size_class_for(size_t x, size_t *class_size) {
+    if (x <= ((size_t)1 << kMinSizeClassBits)) {
+        *class_size = (size_t)1 << kMinSizeClassBits;
+        return 0;
+    }
+    // x - 1 is in [2^b, 2^(b+1)).
+    int b = 63 - __builtin_clzll((uint64_t)(x - 1));
+    if (b >= kMaxSizeClassBits) {
+        return -1;
+    }
+    size_t step = (size_t)1 << (b - 2);
+    size_t s = ((x - 1) - ((size_t)1 << b)) / step;
+    *class_size = ((size_t)1 << b) + (s + 1) * step;
+    return 1 + 4 * (b - kMinSizeClassBits) + (int)s;
+}
+
+WEAK PoolStripe &pool_stripe_for_current_thread() {
+    // Threads don't share stacks, so the address of a local picks a
+    // stripe that the thread mostly has to itself. This avoids
+    // thread-local storage, which not every JIT supports.
+    int local;
+    uint32_t h = (uint32_t)((uintptr_t)&local >> 16) * 2654435761u;
+    return pool_stripes[(h >> 16) % kNumPoolStripes];
+}
+
+// Free every block held by the pool.
+WEAK void trim_pool() {
+    for (int i = 0; i < kNumPoolStripes; i++) {
+        PoolStripe &stripe = pool_stripes[i];
+        void *lists[kNumSizeClasses];
+        {
+            ScopedSpinLock lock(&stripe.lock);
+            for (int c = 0; c < kNumSizeClasses; c++) {
+                lists[c] = stripe.free_blocks[c];
+                stripe.free_blocks[c] = NULL;
+            }
+        }
+        for (int c = 0; c < kNumSizeClasses; c++) {
+            void *block = lists[c];
+            while (block != NULL) {
+                void *next = *(void **)block;
+                BlockHeader *header = (BlockHeader *)block - 1;
+                __sync_fetch_and_sub(&pool_current_size, (int64_t)header->size);
+                free(header->orig);
+                block = next;
+            }
+        }
+    }
+}
+
 WEAK void *default_malloc(void *user_context, size_t x) {
-    void *orig = malloc(x+40);
+    int size_class = -1;
+    if (pool_max_size > 0) {
+        size_t class_size;
+        size_class = size_class_for(x, &class_size);
+        if (size_class >= 0) {
+            PoolStripe &stripe = pool_stripe_for_current_thread();
+            ScopedSpinLock lock(&stripe.lock);
+            stripe.allocations++;
+            void *block = stripe.free_blocks[size_class];
+            if (block != NULL) {
+                stripe.free_blocks[size_class] = *(void **)block;
+                stripe.hits++;
+                __sync_fetch_and_sub(&pool_current_size, (int64_t)class_size);
+                return block;
+            }
+            x = class_size;
+        }
+    }
+
+    void *orig = malloc(x+56);
     if (orig == NULL) {
         // Will result in a failed assertion and a call to halide_error
         return NULL;
     }
-    // Round up to next multiple of 32. Should add at least 8 bytes so we can fit the original pointer.
-    void *ptr = (void *)((((size_t)orig + 32) >> 5) << 5);
-    ((void **)ptr)[-1] = orig;
+    // Round up to next multiple of 32, leaving room for the header.
+    void *ptr = (void *)((((size_t)orig + sizeof(BlockHeader) + 31) >> 5) << 5);
+    BlockHeader *header = (BlockHeader *)ptr - 1;
+    header->size_class = size_class;
+    header->size = (uint32_t)x;
+    header->orig = orig;
     return ptr;
 }
 
 WEAK void default_free(void *user_context, void *ptr) {
-    free(((void**)ptr)[-1]);
+    BlockHeader *header = (BlockHeader *)ptr - 1;
+    if (header->size_class >= 0 && pool_max_size > 0) {
+        PoolStripe &stripe = pool_stripe_for_current_thread();
+        ScopedSpinLock lock(&stripe.lock);
+        stripe.frees++;
+        // The limit is soft; racing frees can both get in under it.
+        if (pool_current_size + header->size <= pool_max_size) {
+            __sync_fetch_and_add(&pool_current_size, (int64_t)header->size);
+            *(void **)ptr = stripe.free_blocks[header->size_class];
+            stripe.free_blocks[header->size_class] = ptr;
+            stripe.pooled_frees++;
+            return;
+        }
+    }
+    free(header->orig);
 }
 
+// Starts each mapping made by halide_malloc_with_hints. Blocks that
+// come from halide_malloc have no header, so that they're the same as
+// any other, and halide_free_with_hints tells the two apart by looking
+// for the block in the list of mappings. Mapped blocks are big, so
+// there are never many of them.
+struct MappedBlock {
+    MappedBlock *next;
+    size_t length;
+    int32_t hints;
+};
+
+const size_t kMappedHeaderSize = 32;
+
+// Smaller allocations aren't worth a mapping of their own, and
+// wouldn't fill a huge page.
+const size_t kMinMappedSize = 2 * 1024 * 1024;
+
+WEAK MappedBlock *mapped_blocks = NULL;
+WEAK volatile int mapped_blocks_lock = 0;
+
 WEAK void *(*custom_malloc)(void *, size_t) = default_malloc;
 WEAK void (*custom_free)(void *, void *) = default_free;
 
@@ -52,4 +205,94 @@ WEAK void halide_free(void *user_context, void *ptr) {
     custom_free(user_context, ptr);
 }
 
+WEAK void *halide_malloc_with_hints(void *user_context, int32_t size, int32_t hints) {
+    if (size <= 0) {
+        return NULL;
+    }
+    if (hints != halide_allocation_hint_none && (size_t)size >= kMinMappedSize) {
+        // Leave room for the header, and to read a little beyond the
+        // end. Mappings are page aligned, so the block is 32-byte
+        // aligned.
+        size_t length = (kMappedHeaderSize + (size_t)size + 32 + 4095) & ~(size_t)4095;
+        MappedBlock *block = (MappedBlock *)halide_map_memory(user_context, length, hints);
+        if (block != NULL) {
+            block->length = length;
+            block->hints = hints;
+            ScopedSpinLock lock(&mapped_blocks_lock);
+            block->next = mapped_blocks;
+            mapped_blocks = block;
+            return (uint8_t *)block + kMappedHeaderSize;
+        }
+    }
+    return halide_malloc(user_context, (size_t)size);
+}
+
+WEAK void halide_free_with_hints(void *user_context, void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    MappedBlock *block = (MappedBlock *)((uint8_t *)ptr - kMappedHeaderSize);
+    bool mapped = false;
+    {
+        ScopedSpinLock lock(&mapped_blocks_lock);
+        for (MappedBlock **b = &mapped_blocks; *b != NULL; b = &(*b)->next) {
+            if (*b == block) {
+                *b = block->next;
+                mapped = true;
+                break;
+            }
+        }
+    }
+    if (mapped) {
+        halide_unmap_memory(user_context, block, block->length, block->hints);
+    } else {
+        halide_free(user_context, ptr);
+    }
+}
+
+WEAK void halide_memory_plan_free(void *user_context, void *ptr) {
+}
+
+WEAK void halide_memory_pool_set_size(int64_t size) {
+    pool_max_size = size > 0 ? size : 0;
+    if (pool_current_size > pool_max_size) {
+        trim_pool();
+    }
+}
+
+WEAK void halide_memory_pool_trim(void *user_context) {
+    trim_pool();
+}
+
+WEAK void halide_memory_pool_get_stats(halide_memory_pool_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < kNumPoolStripes; i++) {
+        PoolStripe &stripe = pool_stripes[i];
+        ScopedSpinLock lock(&stripe.lock);
+        stats->allocations += stripe.allocations;
+        stats->pool_hits += stripe.hits;
+        stats->frees += stripe.frees;
+        stats->pooled_frees += stripe.pooled_frees;
+    }
+    stats->bytes_pooled = pool_current_size;
+    stats->max_bytes = pool_max_size;
+}
+
+WEAK void halide_memory_pool_reset_stats() {
+    for (int i = 0; i < kNumPoolStripes; i++) {
+        PoolStripe &stripe = pool_stripes[i];
+        ScopedSpinLock lock(&stripe.lock);
+        stripe.allocations = stripe.hits = stripe.frees = stripe.pooled_frees = 0;
+    }
+}
+
+namespace {
+
+__attribute__((destructor))
+WEAK void halide_memory_pool_cleanup() {
+    trim_pool();
+}
+
+}
+
 }
@@ -0,0 +1,181 @@
+#include "runtime_internal.h"
+
+#include "HalideRuntime.h"
+#include "scoped_spin_lock.h"
+
+// Maps files shared between processes, e.g. for the persistent
+// memoization cache. Only one process at a time gets to write to a
+// file; the rest get a read-only view of it. Also maps memory
+// directly for allocations with hints (see halide_malloc_with_hints).
+
+extern "C" {
+
+extern void *fopen(const char *path, const char *mode);
+extern int fclose(void *file);
+extern long lseek(int fd, long offset, int whence);
+extern int ftruncate(int fd, long length);
+extern int flock(int fd, int operation);
+extern void *mmap(void *addr, size_t length, int prot, int flags, int fd, long offset);
+extern int munmap(void *addr, size_t length);
+extern int madvise(void *addr, size_t length, int advice);
+
+// Weak, so that binaries not linked against libdl still link, and
+// just don't get NUMA placement.
+extern void *dlopen(const char *, int) __attribute__((weak));
+extern void *dlsym(void *, const char *) __attribute__((weak));
+
+#define O_RDWR 2
+#define SEEK_END 2
+#define PROT_READ 1
+#define PROT_WRITE 2
+#define MAP_SHARED 1
+#define MAP_PRIVATE 2
+#define MADV_HUGEPAGE 14
+#define RTLD_LAZY 1
+#define LOCK_EX 2
+#define LOCK_NB 4
+
+}
+
+namespace Halide { namespace Runtime { namespace Internal {
+
+// The parts of libnuma used for NUMA placement, loaded the first time
+// they're asked for. They stay NULL if libnuma isn't there.
+struct LibNuma {
+    bool loaded;
+    void *(*alloc_interleaved)(size_t);
+    void *(*alloc_local)(size_t);
+};
+
+WEAK LibNuma libnuma;
+WEAK volatile int libnuma_lock = 0;
+
+WEAK void load_libnuma() {
+    ScopedSpinLock lock(&libnuma_lock);
+    if (libnuma.loaded) {
+        return;
+    }
+    libnuma.loaded = true;
+    if (!dlopen || !dlsym) {
+        return;
+    }
+    void *lib = dlopen("libnuma.so.1", RTLD_LAZY);
+    if (lib == NULL) {
+        return;
+    }
+    int (*available)() = (int (*)())dlsym(lib, "numa_available");
+    if (available == NULL || available() < 0) {
+        return;
+    }
+    void *(*alloc_interleaved)(size_t) = (void *(*)(size_t))dlsym(lib, "numa_alloc_interleaved");
+    void *(*alloc_local)(size_t) = (void *(*)(size_t))dlsym(lib, "numa_alloc_local");
+    if (alloc_interleaved && alloc_local) {
+        libnuma.alloc_local = alloc_local;
+        libnuma.alloc_interleaved = alloc_interleaved;
+    }
+}
+
+}}} // namespace Halide::Runtime::Internal
+
+extern "C" {
+
+// Map the file at path, creating it if it doesn't exist. If no other
+// process has it mapped writable, it is grown to at least min_size
+// bytes and mapped writable. Otherwise the existing contents are
+// mapped read-only. Returns a descriptor to pass to halide_unmap_file,
+// or -1 on failure.
+WEAK int halide_map_file(void *user_context, const char *path, size_t min_size,
+                         void **data, size_t *size, bool *writable) {
+    int fd = open(path, O_RDWR, 0);
+    if (fd < 0) {
+        // O_CREAT differs between platforms, so let stdio create it.
+        void *f = fopen(path, "ab");
+        if (f == NULL) {
+            return -1;
+        }
+        fclose(f);
+        fd = open(path, O_RDWR, 0);
+        if (fd < 0) {
+            return -1;
+        }
+    }
+
+    long file_size = lseek(fd, 0, SEEK_END);
+    if (file_size < 0) {
+        close(fd);
+        return -1;
+    }
+
+    // The lock is held for as long as the descriptor is open.
+    *writable = flock(fd, LOCK_EX | LOCK_NB) == 0;
+    if (*writable && (size_t)file_size < min_size) {
+        if (ftruncate(fd, (long)min_size) != 0) {
+            close(fd);
+            return -1;
+        }
+        file_size = (long)min_size;
+    }
+    if (file_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    int prot = *writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    void *addr = mmap(NULL, (size_t)file_size, prot, MAP_SHARED, fd, 0);
+    if (addr == (void *)-1) {
+        close(fd);
+        return -1;
+    }
+    *data = addr;
+    *size = (size_t)file_size;
+    return fd;
+}
+
+WEAK void halide_unmap_file(void *user_context, int fd, void *data, size_t size) {
+    munmap(data, size);
+    close(fd);
+}
+
+// Map size bytes of zeroed memory, placed as the hints (a combination
+// of halide_allocation_hint_t flags) ask. NUMA placement needs
+// libnuma; without it, pages go wherever they're first touched.
+// Transparent huge pages are only asked for on Linux; elsewhere the
+// advice is ignored. Returns NULL on failure.
+WEAK void *halide_map_memory(void *user_context, size_t size, int hints) {
+    void *addr = NULL;
+    if (hints & (halide_allocation_hint_numa_interleave | halide_allocation_hint_numa_local)) {
+        load_libnuma();
+        if (libnuma.alloc_interleaved != NULL) {
+            if (hints & halide_allocation_hint_numa_interleave) {
+                addr = libnuma.alloc_interleaved(size);
+            } else {
+                addr = libnuma.alloc_local(size);
+            }
+        }
+    }
+    if (addr == NULL) {
+        // MAP_ANONYMOUS differs between platforms, so map /dev/zero.
+        int fd = open("/dev/zero", O_RDWR, 0);
+        if (fd < 0) {
+            return NULL;
+        }
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (addr == (void *)-1) {
+            return NULL;
+        }
+    }
+    if (hints & halide_allocation_hint_huge_pages) {
+        madvise(addr, size, MADV_HUGEPAGE);
+    }
+    return addr;
+}
+
+// Unmap memory from halide_map_memory. Takes the same size and hints.
+WEAK void halide_unmap_memory(void *user_context, void *addr, size_t size, int hints) {
+    // libnuma's allocations are plain mmaps too, and numa_free just
+    // unmaps them.
+    munmap(addr, size);
+}
+
+}
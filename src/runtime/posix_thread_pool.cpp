@@ -18,12 +18,8 @@ extern "C" {
 extern long sysconf(int);
 
 typedef struct {
-    uint32_t flags;
-    void * stack_base;
-    size_t stack_size;
-    size_t guard_size;
-    int32_t sched_policy;
-    int32_t sched_priority;
+    // 128 bytes is enough for an attr on 64-bit and 32-bit systems
+    uint64_t _private[16];
 } pthread_attr_t;
 typedef long pthread_t;
 typedef struct {
@@ -39,19 +35,40 @@ typedef long pthread_mutexattr_t;
 extern int pthread_create(pthread_t *thread, pthread_attr_t const * attr,
                           void *(*start_routine)(void *), void * arg);
 extern int pthread_join(pthread_t thread, void **retval);
+extern int pthread_detach(pthread_t thread);
+extern pthread_t pthread_self();
+extern int pthread_attr_init(pthread_attr_t *attr);
+extern int pthread_attr_setstacksize(pthread_attr_t *attr, size_t stacksize);
+extern int pthread_attr_destroy(pthread_attr_t *attr);
 extern int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr);
 extern int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+struct posix_timespec {
+    long tv_sec, tv_nsec;
+};
+extern int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                                  const posix_timespec *abstime);
+struct posix_timeval {
+    long tv_sec, tv_usec;
+};
+extern int gettimeofday(posix_timeval *tv, void *tz);
 extern int pthread_cond_broadcast(pthread_cond_t *cond);
 extern int pthread_cond_destroy(pthread_cond_t *cond);
 extern int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr);
 extern int pthread_mutex_lock(pthread_mutex_t *mutex);
 extern int pthread_mutex_unlock(pthread_mutex_t *mutex);
 extern int pthread_mutex_destroy(pthread_mutex_t *mutex);
+extern int sched_yield();
 
 extern char *getenv(const char *);
 extern int atoi(const char *);
 
 extern int halide_host_cpu_count();
+extern int halide_host_numa_node_of_cpu(int cpu);
+extern int halide_pin_current_thread(int cpu, halide_thread_affinity_t mode);
+extern int halide_current_thread_cpu();
+extern int halide_current_thread_stack(uint8_t **base, size_t *size);
+extern int halide_set_current_thread_nice(int nice);
+extern int64_t halide_current_time_ns(void *user_context);
 
 WEAK int halide_do_task(void *user_context, halide_task f, int idx,
                         uint8_t *closure);
@@ -60,38 +77,236 @@ WEAK int halide_do_task(void *user_context, halide_task f, int idx,
 
 namespace Halide { namespace Runtime { namespace Internal {
 
-WEAK int halide_num_threads;
-WEAK bool halide_thread_pool_initialized = false;
+// How workers are pinned to cores. Bumping the epoch tells running
+// workers to re-pin themselves.
+WEAK halide_thread_affinity_t halide_thread_affinity = halide_thread_affinity_none;
+WEAK bool halide_thread_affinity_set = false;
+WEAK volatile int halide_thread_affinity_epoch = 0;
+
+// How long idle threads poll before blocking on a condition
+// variable. First they spin re-reading what they're waiting on, then
+// they poll with a sched_yield between reads. Blocking costs a
+// futex wake-up per thread on the other side, which dominates short
+// parallel loops, but spinning burns cores that may have other uses.
+WEAK int halide_thread_pool_spin_count = 1024;
+WEAK int halide_thread_pool_yield_count = 16;
+WEAK bool halide_thread_pool_spin_budget_set = false;
+
+// The stack size workers are created with. The main thread usually
+// gets 8MB, and so do workers by default, so that code can assume the
+// same stack wherever it runs.
+WEAK size_t halide_worker_stack_size = 8 * 1024 * 1024;
+
+// How each wait ended.
+WEAK halide_thread_pool_wait_counters halide_wait_counters;
+
+// Whether to collect halide_thread_pool_stats. When off, each place
+// that would record something costs one load and branch.
+WEAK bool halide_thread_pool_stats_enabled = false;
+WEAK bool halide_thread_pool_stats_set = false;
+
+// The current time if stats are being collected, and zero otherwise.
+WEAK int64_t stats_clock() {
+    return halide_thread_pool_stats_enabled ? halide_current_time_ns(NULL) : 0;
+}
+
+// Each job's index range is split into one sub-range per thread. A
+// thread claims indices from the front of its own sub-range, and when
+// that runs dry it steals the back half of someone else's. Both ends
+// of a sub-range are packed into a single 64-bit word so that claims
+// and steals are each one compare-and-swap, and no lock is taken on
+// the task path.
+struct work_range {
+    volatile uint64_t bounds;
+    // The NUMA node of the thread this sub-range belongs to, or -1 if
+    // threads aren't pinned or it hasn't turned up yet.
+    volatile int node;
+    // Keep each sub-range on its own cache line so that threads
+    // claiming from their own sub-range don't contend.
+    uint8_t padding[64 - sizeof(uint64_t) - sizeof(int)];
+};
+
+WEAK uint64_t pack_range(int min, int max) {
+    return ((uint64_t)(uint32_t)max << 32) | (uint64_t)(uint32_t)min;
+}
+
+WEAK int range_min(uint64_t bounds) {
+    return (int32_t)(uint32_t)bounds;
+}
+
+WEAK int range_max(uint64_t bounds) {
+    return (int32_t)(uint32_t)(bounds >> 32);
+}
+
+// Claim indices from the front of a sub-range: one at a time if
+// divisor is zero, and otherwise 1/divisor of what's left (at least
+// one). Returns false if the sub-range is empty.
+WEAK bool claim_front(work_range *r, int divisor, int *min, int *max) {
+    while (true) {
+        uint64_t old = r->bounds;
+        int next = range_min(old), end = range_max(old);
+        if (next >= end) {
+            return false;
+        }
+        int chunk = 1;
+        if (divisor) {
+            chunk = (end - next) / divisor;
+            if (chunk < 1) chunk = 1;
+        }
+        if (__sync_bool_compare_and_swap(&r->bounds, old, pack_range(next + chunk, end))) {
+            *min = next;
+            *max = next + chunk;
+            return true;
+        }
+    }
+}
+
+// Steal the back half (rounded up) of a sub-range. Returns false if
+// the sub-range is empty.
+WEAK bool steal_back(work_range *r, int *min, int *max) {
+    while (true) {
+        uint64_t old = r->bounds;
+        int next = range_min(old), end = range_max(old);
+        if (next >= end) {
+            return false;
+        }
+        int split = end - (end - next + 1) / 2;
+        if (__sync_bool_compare_and_swap(&r->bounds, old, pack_range(next, split))) {
+            *min = split;
+            *max = end;
+            return true;
+        }
+    }
+}
+
+// Claim the last index of a sub-range. Unlike a steal, this never
+// leaves anything for the caller to put back. Returns false if the
+// sub-range is empty.
+WEAK bool claim_back(work_range *r, int *idx) {
+    while (true) {
+        uint64_t old = r->bounds;
+        int next = range_min(old), end = range_max(old);
+        if (next >= end) {
+            return false;
+        }
+        if (__sync_bool_compare_and_swap(&r->bounds, old, pack_range(next, end - 1))) {
+            *idx = end - 1;
+            return true;
+        }
+    }
+}
 
 struct work {
-    work *next_job;
     int (*f)(void *, int, uint8_t *);
     void *user_context;
-    int next, max;
     uint8_t *closure;
-    int active_workers;
     int exit_status;
-    bool running() { return next < max || active_workers > 0; }
+
+    // One sub-range per thread. Sub-range zero belongs to the thread
+    // that called do_par_for. Sub-range i+1 belongs to pool worker i.
+    work_range *ranges;
+    int num_ranges;
+
+    // Small jobs instead have a single range that every thread claims
+    // tasks from, and there's no stealing.
+    bool shared;
+
+    // Zero to claim tasks one at a time. Otherwise threads claim
+    // 1/chunk_divisor of what's left in their own sub-range at once.
+    // This is a per-thread variant of guided self-scheduling, which
+    // would take 1/num_threads of what's left of the whole loop:
+    // chunks still start large and shrink to single tasks, without
+    // all threads contending on one range.
+    int chunk_divisor;
 };
 
-// The work queue and thread pool is weak, so one big work queue is shared by all halide functions
-#define MAX_THREADS 64
+// Jobs with at most this many tasks take the small-job path in
+// do_par_for: one shared range, and no waking of sleeping workers
+// unless the ones already awake can't take all the tasks.
+#define MAX_SMALL_JOB_TASKS 16
+
+// Jobs in flight are published in a fixed table of slots. A thread
+// looking for work takes a reference on a slot before reading the job
+// pointer out of it, and the owner of the job does not return (and so
+// does not pop the job off its stack) until it has unpublished the
+// job and the reference count has dropped to zero.
+#define MAX_JOBS 256
+struct job_slot {
+    // The job, or NULL if nothing is published here.
+    work * volatile job;
+
+    // The number of pool workers currently inside the job.
+    volatile int refs;
+
+    // Nonzero while the slot is owned by a do_par_for call.
+    volatile int in_use;
+
+    // Nonzero while the owner is blocked on wakeup_owners waiting for
+    // refs to reach zero.
+    volatile int owner_sleeping;
+
+    uint8_t padding[64 - sizeof(work *) - 3 * sizeof(int)];
+};
+
+// A call queued by halide_do_async.
+struct async_work {
+    int (*f)(void **);
+    void **args;
+    void *user_context;
+    void (*done)(void *, int, void *);
+    void *done_arg;
+    async_work *next;
+};
+
+// A thread pool and its work queue. The default one is weak, so one
+// big work queue is shared by all halide functions. Further named
+// pools can be created for pipelines that shouldn't compete with the
+// rest for threads.
 struct halide_work_queue_t {
-    // all fields are protected by this mutex.
+    // The number of threads, including the thread that calls
+    // do_par_for. Zero means use the default.
+    int num_threads;
+    bool initialized;
+
+    // Named pools are kept in a linked list. The default pool has no
+    // name, and isn't in the list.
+    char name[64];
+    halide_work_queue_t *next;
+
+    // The nice value for this pool's workers, or zero to leave it
+    // alone.
+    int priority;
+
+    // Protects the sleeping and waking of threads below. Never held
+    // while claiming or running tasks.
     pthread_mutex_t mutex;
 
-    // Singly linked list for job stack
-    work *jobs;
+    // Published jobs.
+    job_slot jobs[MAX_JOBS];
+
+    // One more than the highest slot index ever used. Workers only
+    // scan this far.
+    volatile int num_slots;
+
+    // The number of jobs currently published.
+    volatile int num_jobs;
+
+    // Incremented whenever new tasks become available. A worker that
+    // scanned for work and found none only goes to sleep if this
+    // hasn't changed since it started scanning.
+    volatile int epoch;
+
+    // The number of workers blocked on wakeup_a_team or wakeup_b_team.
+    volatile int sleepers;
 
     // Worker threads are divided into an 'A' team and a 'B' team. The
     // B team sleeps on the wakeup_b_team condition variable. The A
-    // team does work. Threads transition to the B team if they wake
-    // up and find that a_team_size > target_a_team_size.  Threads
-    // move into the A team whenever they wake up and find that
-    // a_team_size < target_a_team_size.
+    // team does work. Threads transition to the B team if they run
+    // out of work and find that a_team_size > target_a_team_size.
+    // Threads move into the A team whenever they wake up.
     int a_team_size, target_a_team_size;
 
-    // Broadcast when a job completes.
+    // Broadcast when the last worker leaves a job whose owner is asleep.
     pthread_cond_t wakeup_owners;
 
     // Broadcast whenever items are added to the work queue.
@@ -101,11 +316,42 @@ struct halide_work_queue_t {
     // more threads are required than are currently in the A team.
     pthread_cond_t wakeup_b_team;
 
-    // Keep track of threads so they can be joined at shutdown
-    pthread_t threads[MAX_THREADS];
+    // Keep track of threads so they can be joined at shutdown or
+    // when the pool shrinks. Pool worker i is threads[i]. Grown on
+    // demand.
+    pthread_t *threads;
+    int threads_capacity;
+
+    // The number of pool workers currently running. Always
+    // num_threads - 1 once the pool is initialized, as the
+    // thread calling do_par_for makes up the last one.
+    int num_workers;
+
+    // The number of entries of threads that haven't been joined
+    // yet. Larger than num_workers while a shrink waits for the
+    // workers it let go.
+    int num_unjoined;
+
+    // Serializes resizing the pool against other resizes and
+    // shutdown. Held while joining workers, so it can't be the main
+    // mutex.
+    pthread_mutex_t resize_mutex;
+
+    // Calls queued by halide_do_async, oldest first. Protected by
+    // the mutex. num_async may be read without it as a hint.
+    async_work *async_head, *async_tail;
+    volatile int num_async;
+
+    // Telemetry. Each worker's entry is only written by that worker,
+    // and entries outlive the worker until shutdown, so a pool that
+    // shrinks and regrows keeps its counts. The owner fields of
+    // stats are updated atomically, as any thread can be an owner.
+    halide_thread_pool_worker_stats **worker_stats;
+    int worker_stats_capacity, num_worker_stats;
+    halide_thread_pool_stats stats;
 
     // Global flag indicating
-    bool shutdown;
+    volatile bool shutdown;
 
     bool running() {
         return !shutdown;
@@ -114,176 +360,837 @@ struct halide_work_queue_t {
 };
 WEAK halide_work_queue_t halide_work_queue;
 
+// The list of named pools, and a mutex to protect it.
+WEAK halide_work_queue_t *halide_named_thread_pools = NULL;
+WEAK halide_mutex halide_named_thread_pools_lock;
+
+// The stacks of the pools' workers, so that
+// halide_get_stack_allocation_limit can tell how much of the calling
+// thread's stack is left if it's one of them. Each worker's entry
+// lives on its own stack, and is on the list while it runs.
+struct worker_stack {
+    uintptr_t lo, hi;
+    worker_stack *next;
+};
+WEAK worker_stack *halide_worker_stacks = NULL;
+WEAK halide_mutex halide_worker_stacks_lock;
+
+// What a worker thread needs to know about itself.
+struct worker_arg {
+    halide_work_queue_t *queue;
+    int id;
+    halide_thread_pool_worker_stats *stats;
+};
+
 WEAK int default_do_task(void *user_context, halide_task f, int idx,
                         uint8_t *closure) {
     return f(user_context, idx, closure);
 }
 
-WEAK void *halide_worker_thread(void *void_arg) {
-    work *owned_job = (work *)void_arg;
-
-    // Grab the lock
-    pthread_mutex_lock(&halide_work_queue.mutex);
-
-    // If I'm a job owner, then I was the thread that called
-    // do_par_for, and I should only stay in this function until my
-    // job is complete. If I'm a lowly worker thread, I should stay in
-    // this function as long as the work queue is running.
-    while (owned_job != NULL ? owned_job->running()
-           : halide_work_queue.running()) {
-
-        if (halide_work_queue.jobs == NULL) {
-            if (owned_job) {
-                // There are no jobs pending. Wait for the last worker
-                // to signal that the job is finished.
-                pthread_cond_wait(&halide_work_queue.wakeup_owners, &halide_work_queue.mutex);
-            } else if (halide_work_queue.a_team_size <= halide_work_queue.target_a_team_size) {
-                // There are no jobs pending. Wait until more jobs are enqueued.
-                pthread_cond_wait(&halide_work_queue.wakeup_a_team, &halide_work_queue.mutex);
-            } else {
-                // There are no jobs pending, and there are too many
-                // threads in the A team. Transition to the B team
-                // until the wakeup_b_team condition is fired.
-                halide_work_queue.a_team_size--;
-                pthread_cond_wait(&halide_work_queue.wakeup_b_team, &halide_work_queue.mutex);
-                halide_work_queue.a_team_size++;
-            }
-        } else {
-            // Grab the next job.
-            work *job = halide_work_queue.jobs;
+enum wait_result {
+    woke_spinning,
+    woke_yielding,
+    must_block
+};
 
-            // Claim a task from it.
-            work myjob = *job;
-            job->next++;
+// Poll *addr until it is not equal to value (or, if until_zero, until
+// it is zero), within the spin and yield budget. Returns must_block
+// if it never happened.
+WEAK wait_result spin_wait(volatile int *addr, int value, bool until_zero) {
+    for (int i = 0; i < halide_thread_pool_spin_count; i++) {
+        int v = *addr;
+        if (until_zero ? v == 0 : v != value) {
+            return woke_spinning;
+        }
+    }
+    for (int i = 0; i < halide_thread_pool_yield_count; i++) {
+        sched_yield();
+        int v = *addr;
+        if (until_zero ? v == 0 : v != value) {
+            return woke_yielding;
+        }
+    }
+    return must_block;
+}
 
-            // If there were no more tasks pending for this job,
-            // remove it from the stack.
-            if (job->next == job->max) {
-                halide_work_queue.jobs = job->next_job;
+// Tell sleeping workers that there are new tasks to pick up.
+WEAK void wake_workers(halide_work_queue_t *queue, bool wake_b_team) {
+    __sync_fetch_and_add(&queue->epoch, 1);
+    if (queue->sleepers) {
+        pthread_mutex_lock(&queue->mutex);
+        pthread_cond_broadcast(&queue->wakeup_a_team);
+        if (wake_b_team) {
+            pthread_cond_broadcast(&queue->wakeup_b_team);
+        }
+        pthread_mutex_unlock(&queue->mutex);
+    }
+}
+
+// Try to steal from the sub-ranges of a job other than our own. When
+// we know which NUMA node we're on, sub-ranges belonging to threads
+// on the same node are tried first, so that neighboring indices tend
+// to stay on one node.
+WEAK bool steal(work *job, int me, int *min, int *max) {
+    int my_node = job->ranges[me].node;
+    for (int pass = my_node >= 0 ? 0 : 1; pass < 2; pass++) {
+        for (int i = 1; i < job->num_ranges; i++) {
+            int victim = me + i;
+            if (victim >= job->num_ranges) victim -= job->num_ranges;
+            if (pass == 0 && job->ranges[victim].node != my_node) {
+                continue;
+            }
+            if (steal_back(job->ranges + victim, min, max)) {
+                return true;
             }
+        }
+    }
+    return false;
+}
 
-            // Increment the active_worker count so that other threads
-            // are aware that this job is still in progress even
-            // though there are no outstanding tasks for it.
-            job->active_workers++;
+// Run tasks from a job using the given sub-range, stealing from the
+// other sub-ranges when it runs dry, until there is nothing left to
+// claim. node is the NUMA node the calling thread is on, or -1 if
+// unknown. Returns the number of tasks run.
+WEAK int run_tasks(halide_work_queue_t *queue, work *job, int me, int node) {
+    work_range *mine = job->shared ? job->ranges : job->ranges + me;
+    if (!job->shared && mine->node != node) {
+        mine->node = node;
+    }
+    int ran = 0;
+    while (true) {
+        int min = 0, max = 0;
+        if (!claim_front(mine, job->chunk_divisor, &min, &max)) {
+            if (job->shared || !steal(job, me, &min, &max)) {
+                return ran;
+            }
+            if (max - min > 1) {
+                // Our sub-range is empty, and nobody else modifies an
+                // empty sub-range, so we can just overwrite it. The
+                // rest of the stolen chunk is now up for grabs again.
+                mine->bounds = pack_range(min + 1, max);
+                wake_workers(queue, false);
+            }
+            max = min + 1;
+        }
 
-            // Release the lock and do the task.
-            pthread_mutex_unlock(&halide_work_queue.mutex);
-            int result = halide_do_task(myjob.user_context, myjob.f, myjob.next,
-                                        myjob.closure);
-            pthread_mutex_lock(&halide_work_queue.mutex);
+        for (int idx = min; idx < max; idx++) {
+            int result = halide_do_task(job->user_context, job->f, idx, job->closure);
 
             // If this task failed, set the exit status on the job.
             if (result) {
                 job->exit_status = result;
             }
+        }
+        ran += max - min;
+    }
+}
 
-            // We are no longer active on this job
-            job->active_workers--;
+// Run tasks from a job by taking them one at a time from the backs of
+// its sub-ranges. This is for threads that have no sub-range of their
+// own in the job, namely a thread outside the pool that is waiting on
+// a job of its own. Returns the number of tasks run.
+WEAK int run_tasks_from_others(halide_work_queue_t *queue, work *job) {
+    int ran = 0;
+    bool found = true;
+    while (found) {
+        found = false;
+        for (int i = 0; i < job->num_ranges; i++) {
+            int idx = 0;
+            if (!claim_back(job->ranges + i, &idx)) continue;
+            found = true;
+            int result = halide_do_task(job->user_context, job->f, idx, job->closure);
+            if (result) {
+                job->exit_status = result;
+            }
+            ran++;
+        }
+    }
+    return ran;
+}
 
-            // If the job is done and I'm not the owner of it, wake up
-            // the owner.
-            if (!job->running() && job != owned_job) {
-                pthread_cond_broadcast(&halide_work_queue.wakeup_owners);
+WEAK void release_slot(halide_work_queue_t *queue, job_slot *slot) {
+    if (__sync_sub_and_fetch(&slot->refs, 1) == 0 && slot->owner_sleeping) {
+        pthread_mutex_lock(&queue->mutex);
+        pthread_cond_broadcast(&queue->wakeup_owners);
+        pthread_mutex_unlock(&queue->mutex);
+    }
+}
+
+// Scan the published jobs for something to do. A negative me means
+// the calling thread has no sub-range of its own in the jobs. If stats
+// is non-NULL, the tasks run are added to it before each job is let
+// go of, so that they are all counted by the time its owner returns.
+// Returns the number of tasks run.
+WEAK int find_work(halide_work_queue_t *queue, int me, int node,
+                   halide_thread_pool_worker_stats *stats) {
+    int ran = 0;
+    // Scan from the most recently claimed slots down, so that nested
+    // jobs are preferred, as with the old job stack.
+    for (int i = queue->num_slots - 1; i >= 0; i--) {
+        job_slot *slot = queue->jobs + i;
+        if (!slot->job) continue;
+        __sync_fetch_and_add(&slot->refs, 1);
+        work *job = slot->job;
+        int tasks = 0;
+        if (job && me < 0 && !job->shared) {
+            tasks = run_tasks_from_others(queue, job);
+        } else if (job && (job->shared || me < job->num_ranges)) {
+            tasks = run_tasks(queue, job, me, node);
+        }
+        if (tasks && stats && halide_thread_pool_stats_enabled) {
+            stats->tasks += tasks;
+        }
+        ran += tasks;
+        release_slot(queue, slot);
+    }
+    return ran;
+}
+
+// Take the oldest call queued by halide_do_async and run it. Returns
+// true if there was one.
+WEAK bool run_async(halide_work_queue_t *queue) {
+    if (!queue->num_async) return false;
+
+    pthread_mutex_lock(&queue->mutex);
+    async_work *w = queue->async_head;
+    if (w) {
+        queue->async_head = w->next;
+        if (!queue->async_head) {
+            queue->async_tail = NULL;
+        }
+        queue->num_async--;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    if (!w) return false;
+
+    int result = w->f(w->args);
+    if (w->done) {
+        w->done(w->user_context, result, w->done_arg);
+    }
+    free(w);
+    return true;
+}
+
+WEAK void *halide_worker_thread(void *void_arg) {
+    worker_arg *arg = (worker_arg *)void_arg;
+    halide_work_queue_t *queue = arg->queue;
+    // Which sub-range of each job belongs to this thread.
+    int me = arg->id + 1;
+    halide_thread_pool_worker_stats *stats = arg->stats;
+    free(arg);
+
+    worker_stack stack;
+    uint8_t *stack_base;
+    size_t stack_size;
+    bool stack_known = halide_current_thread_stack(&stack_base, &stack_size) == 0;
+    if (stack_known) {
+        stack.lo = (uintptr_t)stack_base;
+        stack.hi = stack.lo + stack_size;
+        halide_mutex_lock(&halide_worker_stacks_lock);
+        stack.next = halide_worker_stacks;
+        halide_worker_stacks = &stack;
+        halide_mutex_unlock(&halide_worker_stacks_lock);
+    }
+
+    if (queue->priority) {
+        halide_set_current_thread_nice(queue->priority);
+    }
+
+    // Sub-range i is associated with core i, so that the contiguous
+    // chunks of loop indices that sub-ranges start with are spread
+    // over the cores in order. Once pinned, we note the node of that
+    // core in each job we take part in, for the benefit of thieves.
+    int affinity_epoch = 0;
+    bool pinned = false;
+    int node = -1;
+
+    // Workers beyond the current thread count quit, which is how the
+    // pool shrinks.
+    while (queue->running() && me < queue->num_threads) {
+        if (affinity_epoch != halide_thread_affinity_epoch ||
+            (!pinned && halide_thread_affinity != halide_thread_affinity_none)) {
+            affinity_epoch = halide_thread_affinity_epoch;
+            pinned = halide_thread_affinity != halide_thread_affinity_none;
+            halide_pin_current_thread(me, halide_thread_affinity);
+            node = pinned ? halide_host_numa_node_of_cpu(me) : -1;
+        }
+
+        int epoch = queue->epoch;
+        __sync_synchronize();
+
+        int64_t start = stats_clock();
+        int tasks = find_work(queue, me, node, stats);
+        if (tasks) {
+            if (start) {
+                stats->working_ns += stats_clock() - start;
             }
+            continue;
         }
+
+        // Only start a new pipeline once there's nothing left to do
+        // for the ones already running.
+        start = stats_clock();
+        if (run_async(queue)) {
+            if (start) {
+                stats->async_calls++;
+                stats->working_ns += stats_clock() - start;
+            }
+            continue;
+        }
+
+        // Nothing to do. Wait for something new to be published,
+        // briefly by polling and then by going to sleep.
+        wait_result waited = spin_wait(&queue->epoch, epoch, false);
+        if (waited == woke_spinning) {
+            __sync_fetch_and_add(&halide_wait_counters.worker_spin_wakeups, 1);
+            continue;
+        } else if (waited == woke_yielding) {
+            __sync_fetch_and_add(&halide_wait_counters.worker_yield_wakeups, 1);
+            continue;
+        }
+        __sync_fetch_and_add(&halide_wait_counters.worker_blocks, 1);
+
+        start = stats_clock();
+        pthread_mutex_lock(&queue->mutex);
+        if (start) {
+            int64_t locked = stats_clock();
+            stats->mutex_wait_ns += locked - start;
+            start = locked;
+        }
+        __sync_fetch_and_add(&queue->sleepers, 1);
+        // Only go to sleep if nothing was published since we started
+        // scanning. Publishers bump the epoch before checking for
+        // sleepers, so one of us is guaranteed to see the other.
+        if (epoch == queue->epoch && queue->running() &&
+            me < queue->num_threads) {
+            if (queue->a_team_size <= queue->target_a_team_size) {
+                // There are no jobs pending. Wait until more jobs are enqueued.
+                pthread_cond_wait(&queue->wakeup_a_team, &queue->mutex);
+            } else {
+                // There are no jobs pending, and there are too many
+                // threads in the A team. Transition to the B team
+                // until the wakeup_b_team condition is fired.
+                queue->a_team_size--;
+                if (start) {
+                    stats->b_team_transitions++;
+                }
+                pthread_cond_wait(&queue->wakeup_b_team, &queue->mutex);
+                queue->a_team_size++;
+            }
+            if (start) {
+                stats->sleeping_ns += stats_clock() - start;
+            }
+        }
+        __sync_fetch_and_sub(&queue->sleepers, 1);
+        pthread_mutex_unlock(&queue->mutex);
+    }
+
+    if (stack_known) {
+        halide_mutex_lock(&halide_worker_stacks_lock);
+        worker_stack **prev = &halide_worker_stacks;
+        while (*prev != &stack) {
+            prev = &(*prev)->next;
+        }
+        *prev = stack.next;
+        halide_mutex_unlock(&halide_worker_stacks_lock);
     }
-    pthread_mutex_unlock(&halide_work_queue.mutex);
+
+    pthread_mutex_lock(&queue->mutex);
+    queue->a_team_size--;
+    pthread_mutex_unlock(&queue->mutex);
     return NULL;
 }
 
-WEAK int default_do_par_for(void *user_context, halide_task f,
-                            int min, int size, uint8_t *closure) {
-    // Grab the lock. If it hasn't been initialized yet, then the
-    // field will be zero-initialized because it's a static
-    // global. pthreads helpfully interprets zero-valued mutex objects
-    // as uninitialized and initializes them for you (see PTHREAD_MUTEX_INITIALIZER).
-    pthread_mutex_lock(&halide_work_queue.mutex);
-
-    if (!halide_thread_pool_initialized) {
-        halide_work_queue.shutdown = false;
-        pthread_cond_init(&halide_work_queue.wakeup_owners, NULL);
-        pthread_cond_init(&halide_work_queue.wakeup_a_team, NULL);
-        pthread_cond_init(&halide_work_queue.wakeup_b_team, NULL);
-        halide_work_queue.jobs = NULL;
-
-        if (!halide_num_threads) {
-            char *threads_str = getenv("HL_NUM_THREADS");
-            if (!threads_str) {
-                // Legacy name for HL_NUM_THREADS
-                threads_str = getenv("HL_NUMTHREADS");
+WEAK int default_num_threads() {
+    int n;
+    char *threads_str = getenv("HL_NUM_THREADS");
+    if (!threads_str) {
+        // Legacy name for HL_NUM_THREADS
+        threads_str = getenv("HL_NUMTHREADS");
+    }
+    if (threads_str) {
+        n = atoi(threads_str);
+    } else {
+        n = halide_host_cpu_count();
+        // halide_printf(user_context, "HL_NUM_THREADS not defined. Defaulting to %d threads.\n", n);
+    }
+    return n < 1 ? 1 : n;
+}
+
+// Start pool workers until there are enough for num_threads threads
+// in total. If we run out of memory or threads, the pool makes do
+// with the workers it has. Must be called with the mutex held.
+WEAK void grow_thread_pool(halide_work_queue_t *queue) {
+    int target = queue->num_threads - 1;
+    if (target > queue->threads_capacity) {
+        int capacity = queue->threads_capacity * 2;
+        if (capacity < target) capacity = target;
+        pthread_t *threads = (pthread_t *)malloc(capacity * sizeof(pthread_t));
+        if (threads) {
+            if (queue->threads) {
+                memcpy(threads, queue->threads,
+                       queue->num_unjoined * sizeof(pthread_t));
+                free(queue->threads);
             }
-            if (threads_str) {
-                halide_num_threads = atoi(threads_str);
-            } else {
-                halide_num_threads = halide_host_cpu_count();
-                // halide_printf(user_context, "HL_NUM_THREADS not defined. Defaulting to %d threads.\n", halide_num_threads);
+            queue->threads = threads;
+            queue->threads_capacity = capacity;
+        } else {
+            target = queue->threads_capacity;
+        }
+    }
+    if (target > queue->worker_stats_capacity) {
+        int capacity = queue->threads_capacity;
+        halide_thread_pool_worker_stats **worker_stats =
+            (halide_thread_pool_worker_stats **)malloc(capacity * sizeof(halide_thread_pool_worker_stats *));
+        if (worker_stats) {
+            if (queue->worker_stats) {
+                memcpy(worker_stats, queue->worker_stats,
+                       queue->num_worker_stats * sizeof(halide_thread_pool_worker_stats *));
+                free(queue->worker_stats);
             }
+            queue->worker_stats = worker_stats;
+            queue->worker_stats_capacity = capacity;
+        } else {
+            target = queue->worker_stats_capacity;
         }
-        if (halide_num_threads > MAX_THREADS) {
-            halide_num_threads = MAX_THREADS;
-        } else if (halide_num_threads < 1) {
-            halide_num_threads = 1;
+    }
+    while (queue->num_worker_stats < target) {
+        halide_thread_pool_worker_stats *stats =
+            (halide_thread_pool_worker_stats *)malloc(sizeof(halide_thread_pool_worker_stats));
+        if (!stats) {
+            target = queue->num_worker_stats;
+            break;
         }
-        for (int i = 0; i < halide_num_threads-1; i++) {
-            //fprintf(stderr, "Creating thread %d\n", i);
-            pthread_create(halide_work_queue.threads + i, NULL, halide_worker_thread, NULL);
+        memset(stats, 0, sizeof(halide_thread_pool_worker_stats));
+        queue->worker_stats[queue->num_worker_stats++] = stats;
+    }
+    for (int i = queue->num_workers; i < target; i++) {
+        //fprintf(stderr, "Creating thread %d\n", i);
+        worker_arg *arg = (worker_arg *)malloc(sizeof(worker_arg));
+        if (!arg) {
+            target = i;
+            break;
+        }
+        arg->queue = queue;
+        arg->id = i;
+        arg->stats = queue->worker_stats[i];
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, halide_worker_stack_size);
+        int err = pthread_create(queue->threads + i, &attr, halide_worker_thread, arg);
+        pthread_attr_destroy(&attr);
+        if (err) {
+            free(arg);
+            target = i;
+            break;
         }
         // Everyone starts on the a team.
-        halide_work_queue.a_team_size = halide_num_threads;
+        queue->a_team_size++;
+    }
+    queue->num_workers = target;
+    queue->num_unjoined = target;
+    if (queue->num_threads > target + 1) {
+        queue->num_threads = target + 1;
+        if (queue->target_a_team_size > queue->num_threads) {
+            queue->target_a_team_size = queue->num_threads;
+        }
+    }
+}
 
-        halide_thread_pool_initialized = true;
+// The NUMA node the calling thread is running on if workers are
+// being pinned, and -1 otherwise.
+WEAK int current_node() {
+    if (halide_thread_affinity == halide_thread_affinity_none) {
+        return -1;
     }
+    int cpu = halide_current_thread_cpu();
+    return cpu < 0 ? -1 : halide_host_numa_node_of_cpu(cpu);
+}
+
+// The sub-range that belongs to the calling thread if it is one of
+// the pool's workers, including ones a shrink has let go but not yet
+// joined, and -1 otherwise.
+WEAK int worker_sub_range(halide_work_queue_t *queue) {
+    pthread_t self = pthread_self();
+    pthread_mutex_lock(&queue->mutex);
+    int me = -1;
+    for (int i = 0; i < queue->num_unjoined && me < 0; i++) {
+        if (queue->threads[i] == self) {
+            me = i + 1;
+        }
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return me;
+}
+
+WEAK bool on_worker_thread(halide_work_queue_t *queue) {
+    return worker_sub_range(queue) >= 0;
+}
+
+// Start the pool's workers if that hasn't happened yet.
+WEAK void init_queue(halide_work_queue_t *queue) {
+    if (!queue->initialized) {
+        // Grab the lock. If it hasn't been initialized yet, then the
+        // field will be zero-initialized because it's a static
+        // global. pthreads helpfully interprets zero-valued mutex objects
+        // as uninitialized and initializes them for you (see PTHREAD_MUTEX_INITIALIZER).
+        pthread_mutex_lock(&queue->mutex);
+
+        if (!queue->initialized) {
+            queue->shutdown = false;
+            pthread_cond_init(&queue->wakeup_owners, NULL);
+            pthread_cond_init(&queue->wakeup_a_team, NULL);
+            pthread_cond_init(&queue->wakeup_b_team, NULL);
+            memset(queue->jobs, 0, sizeof(queue->jobs));
+            queue->num_slots = 0;
+            queue->num_jobs = 0;
+            queue->sleepers = 0;
+            queue->async_head = NULL;
+            queue->async_tail = NULL;
+            queue->num_async = 0;
+
+            if (queue->num_threads < 1) {
+                queue->num_threads = default_num_threads();
+            }
+
+            if (!halide_thread_pool_spin_budget_set) {
+                char *spin_str = getenv("HL_SPIN_COUNT");
+                if (spin_str) {
+                    halide_thread_pool_spin_count = atoi(spin_str);
+                }
+                char *yield_str = getenv("HL_YIELD_COUNT");
+                if (yield_str) {
+                    halide_thread_pool_yield_count = atoi(yield_str);
+                }
+            }
+
+            if (!halide_thread_pool_stats_set) {
+                char *stats_str = getenv("HL_THREAD_POOL_STATS");
+                halide_thread_pool_stats_enabled = stats_str && atoi(stats_str);
+            }
+
+            if (!halide_thread_affinity_set) {
+                char *affinity_str = getenv("HL_THREAD_AFFINITY");
+                if (affinity_str && !strcmp(affinity_str, "cores")) {
+                    halide_thread_affinity = halide_thread_affinity_cores;
+                } else if (affinity_str && !strcmp(affinity_str, "nodes")) {
+                    halide_thread_affinity = halide_thread_affinity_nodes;
+                }
+            }
+            // The calling thread counts as a member of the A team.
+            queue->a_team_size = 1;
+            queue->target_a_team_size = queue->num_threads;
+            queue->num_workers = 0;
+            grow_thread_pool(queue);
+
+            __sync_synchronize();
+            queue->initialized = true;
+        }
+
+        pthread_mutex_unlock(&queue->mutex);
+    }
+}
+
+WEAK int do_par_for_on_queue(halide_work_queue_t *queue, void *user_context, halide_task f,
+                             int min, int size, uint8_t *closure, bool guided) {
+    init_queue(queue);
 
     // Make the job.
     work job;
     job.f = f;               // The job should call this function. It takes an index and a closure.
     job.user_context = user_context;
-    job.next = min;          // Start at this index.
-    job.max  = min + size;   // Keep going until one less than this index.
     job.closure = closure;   // Use this closure.
     job.exit_status = 0;     // The job hasn't failed yet
-    job.active_workers = 0;  // Nobody is working on this yet
 
-    if (!halide_work_queue.jobs && size < halide_num_threads) {
+    // Small jobs are typically inner loops run many times over, so
+    // the fixed cost dominates. Everyone claims single tasks from
+    // one range, rather than setting up and scanning a sub-range per
+    // thread.
+    bool small = size <= MAX_SMALL_JOB_TASKS;
+    int node = -1;
+    work_range small_range;
+    if (small) {
+        small_range.bounds = pack_range(min, min + size);
+        small_range.node = -1;
+        job.ranges = &small_range;
+        job.num_ranges = 1;
+        job.chunk_divisor = 0;
+        job.shared = true;
+    } else {
+        // Deal out the indices as one contiguous sub-range per thread.
+        job.num_ranges = queue->num_threads;
+        job.chunk_divisor = guided ? job.num_ranges : 0;
+        job.shared = false;
+        job.ranges = (work_range *)__builtin_alloca(job.num_ranges * sizeof(work_range));
+        for (int i = 0; i < job.num_ranges; i++) {
+            int lo = min + (int)(((int64_t)size * i) / job.num_ranges);
+            int hi = min + (int)(((int64_t)size * (i + 1)) / job.num_ranges);
+            job.ranges[i].bounds = pack_range(lo, hi);
+            job.ranges[i].node = -1;
+        }
+        // Workers record their nodes as they join in.
+        node = current_node();
+        job.ranges[0].node = node;
+    }
+
+    // Find a free slot to publish the job in.
+    job_slot *slot = NULL;
+    for (int i = 0; i < MAX_JOBS; i++) {
+        job_slot *s = queue->jobs + i;
+        if (!s->in_use && __sync_bool_compare_and_swap(&s->in_use, 0, 1)) {
+            slot = s;
+            int n = queue->num_slots;
+            while (n <= i && !__sync_bool_compare_and_swap(&queue->num_slots, n, i + 1)) {
+                n = queue->num_slots;
+            }
+            break;
+        }
+    }
+
+    if (!slot) {
+        // Every slot is taken (absurdly deep nesting). Just do the
+        // whole job on this thread.
+        for (int x = min; x < min + size; x++) {
+            int result = halide_do_task(user_context, f, x, closure);
+            if (result) {
+                return result;
+            }
+        }
+        return 0;
+    }
+
+    int num_jobs = __sync_add_and_fetch(&queue->num_jobs, 1);
+    int target_a_team_size = queue->num_threads;
+    if (num_jobs == 1 && size < queue->num_threads) {
         // If there's no nested parallelism happening and there are
         // fewer tasks to do than threads, then set the target A team
         // size so that some threads will put themselves to sleep
         // until a larger job arrives.
-        halide_work_queue.target_a_team_size = size;
-    } else {
-        halide_work_queue.target_a_team_size = halide_num_threads;
+        target_a_team_size = size;
+    }
+    if (queue->target_a_team_size != target_a_team_size) {
+        queue->target_a_team_size = target_a_team_size;
     }
 
-    // If there are more tasks than threads in the A team, we should
-    // wake up everyone.
-    bool wake_b_team = size > halide_work_queue.a_team_size;
-
-    // Push the job onto the stack.
-    job.next_job = halide_work_queue.jobs;
-    halide_work_queue.jobs = &job;
-
-    pthread_mutex_unlock(&halide_work_queue.mutex);
+    // Publish the job and wake up our A team. If there are more tasks
+    // than threads in the A team, we need the B team too.
+    slot->job = &job;
+    if (small && queue->num_workers - queue->sleepers >= size - 1) {
+        // There are enough workers awake to take the other tasks, so
+        // skip the mutex and just tell them there's new work. One
+        // that's on its way to sleep will see the epoch change and
+        // look again.
+        __sync_fetch_and_add(&queue->epoch, 1);
+    } else {
+        wake_workers(queue, size > queue->a_team_size);
+    }
 
-    // Wake up our A team.
-    pthread_cond_broadcast(&halide_work_queue.wakeup_a_team);
+    // Do some work myself.
+    int64_t start = stats_clock();
+    int tasks = run_tasks(queue, &job, 0, node);
+    int64_t finished_claiming = stats_clock();
+
+    // There's nothing left to claim. Unpublish the job so that no new
+    // workers enter it, then wait for the ones still inside to
+    // finish, helping with anything they stole and haven't got to
+    // yet, and then with any other jobs, as a worker would.
+    slot->job = NULL;
+    __sync_synchronize();
+    bool know_sub_range = false;
+    int me = -1;
+    while (slot->refs) {
+        int helped = run_tasks(queue, &job, 0, node);
+        if (!helped) {
+            if (!know_sub_range) {
+                // Only pay for the lookup if there's waiting to do.
+                me = worker_sub_range(queue);
+                if (small) {
+                    node = current_node();
+                }
+                know_sub_range = true;
+            }
+            helped = find_work(queue, me, node, NULL);
+        }
+        tasks += helped;
+        if (helped) continue;
+        wait_result waited = spin_wait(&slot->refs, 0, true);
+        if (waited == woke_spinning) {
+            __sync_fetch_and_add(&halide_wait_counters.owner_spin_wakeups, 1);
+            continue;
+        } else if (waited == woke_yielding) {
+            __sync_fetch_and_add(&halide_wait_counters.owner_yield_wakeups, 1);
+            continue;
+        }
+        __sync_fetch_and_add(&halide_wait_counters.owner_blocks, 1);
+        pthread_mutex_lock(&queue->mutex);
+        slot->owner_sleeping = 1;
+        __sync_synchronize();
+        while (slot->refs) {
+            pthread_cond_wait(&queue->wakeup_owners, &queue->mutex);
+        }
+        slot->owner_sleeping = 0;
+        pthread_mutex_unlock(&queue->mutex);
+    }
 
-    if (wake_b_team) {
-        // We need the B team too.
-        pthread_cond_broadcast(&halide_work_queue.wakeup_b_team);
+    if (start && finished_claiming) {
+        __sync_fetch_and_add(&queue->stats.jobs, 1);
+        __sync_fetch_and_add(&queue->stats.owner_tasks, tasks);
+        __sync_fetch_and_add(&queue->stats.owner_working_ns, finished_claiming - start);
+        __sync_fetch_and_add(&queue->stats.owner_wait_ns, stats_clock() - finished_claiming);
     }
 
-    // Do some work myself.
-    halide_worker_thread((void *)(&job));
+    __sync_fetch_and_sub(&queue->num_jobs, 1);
+    __sync_synchronize();
+    slot->in_use = 0;
 
     // Return zero if the job succeeded, otherwise return the exit
     // status of one of the failing jobs (whichever one failed last).
     return job.exit_status;
 }
 
+WEAK void shutdown_queue(halide_work_queue_t *queue) {
+    if (!queue->initialized) return;
+
+    // Anything still queued gets run here rather than dropped, so
+    // that every done callback fires.
+    while (run_async(queue)) {
+    }
+
+    pthread_mutex_lock(&queue->resize_mutex);
+
+    // Wake everyone up and tell them the party's over and it's time
+    // to go home
+    pthread_mutex_lock(&queue->mutex);
+    queue->shutdown = true;
+    pthread_cond_broadcast(&queue->wakeup_owners);
+    pthread_cond_broadcast(&queue->wakeup_a_team);
+    pthread_cond_broadcast(&queue->wakeup_b_team);
+    pthread_mutex_unlock(&queue->mutex);
+
+    // Wait until they leave
+    for (int i = 0; i < queue->num_workers; i++) {
+        //fprintf(stderr, "Waiting for thread %d to exit\n", i);
+        void *retval;
+        pthread_join(queue->threads[i], &retval);
+    }
+    free(queue->threads);
+    queue->threads = NULL;
+    queue->threads_capacity = 0;
+    queue->num_workers = 0;
+    queue->num_unjoined = 0;
+    for (int i = 0; i < queue->num_worker_stats; i++) {
+        free(queue->worker_stats[i]);
+    }
+    free(queue->worker_stats);
+    queue->worker_stats = NULL;
+    queue->worker_stats_capacity = 0;
+    queue->num_worker_stats = 0;
+    memset(&queue->stats, 0, sizeof(queue->stats));
+
+    //fprintf(stderr, "All threads have quit. Destroying mutex and condition variable.\n");
+    // Tidy up
+    pthread_mutex_destroy(&queue->mutex);
+    // Reinitialize in case we call another do_par_for
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_destroy(&queue->wakeup_owners);
+    pthread_cond_destroy(&queue->wakeup_a_team);
+    pthread_cond_destroy(&queue->wakeup_b_team);
+    queue->initialized = false;
+
+    pthread_mutex_unlock(&queue->resize_mutex);
+}
+
+WEAK void resize_queue(halide_work_queue_t *queue, int n) {
+    if (on_worker_thread(queue)) {
+        // A shrink would have to join the calling thread, and the
+        // thread doing a shrink may be waiting to join this one.
+        halide_error(NULL, "Can't resize a thread pool from one of its own workers. "
+                     "The thread count is unchanged.\n");
+        return;
+    }
+
+    pthread_mutex_lock(&queue->resize_mutex);
+    pthread_mutex_lock(&queue->mutex);
+
+    if (!queue->initialized) {
+        // The pool will be created at this size on first use.
+        queue->num_threads = n;
+        pthread_mutex_unlock(&queue->mutex);
+        pthread_mutex_unlock(&queue->resize_mutex);
+        return;
+    }
+
+    if (n < 1) {
+        n = default_num_threads();
+    }
+
+    if (n >= queue->num_threads) {
+        queue->num_threads = n;
+        grow_thread_pool(queue);
+        pthread_mutex_unlock(&queue->mutex);
+    } else {
+        // Lower the thread count and wake everyone. Workers numbered
+        // beyond the new count finish any tasks they have claimed
+        // and then quit. Jobs already in flight still have
+        // sub-ranges for them, which the remaining threads steal.
+        int old_num_workers = queue->num_workers;
+        queue->num_threads = n;
+        queue->num_workers = n - 1;
+        if (queue->target_a_team_size > n) {
+            queue->target_a_team_size = n;
+        }
+        pthread_cond_broadcast(&queue->wakeup_a_team);
+        pthread_cond_broadcast(&queue->wakeup_b_team);
+        pthread_mutex_unlock(&queue->mutex);
+
+        for (int i = n - 1; i < old_num_workers; i++) {
+            void *retval;
+            pthread_join(queue->threads[i], &retval);
+        }
+
+        pthread_mutex_lock(&queue->mutex);
+        queue->num_unjoined = queue->num_workers;
+        pthread_mutex_unlock(&queue->mutex);
+    }
+
+    pthread_mutex_unlock(&queue->resize_mutex);
+}
+
+WEAK void wake_all(halide_work_queue_t *queue) {
+    if (queue->initialized) {
+        pthread_mutex_lock(&queue->mutex);
+        pthread_cond_broadcast(&queue->wakeup_a_team);
+        pthread_cond_broadcast(&queue->wakeup_b_team);
+        pthread_mutex_unlock(&queue->mutex);
+    }
+}
+
+WEAK halide_thread_pool *default_get_thread_pool(void *user_context) {
+    return NULL;
+}
+
+WEAK halide_work_queue_t *queue_for(void *user_context) {
+    halide_work_queue_t *queue = (halide_work_queue_t *)halide_get_thread_pool(user_context);
+    return queue ? queue : &halide_work_queue;
+}
+
+WEAK int default_do_par_for(void *user_context, halide_task f,
+                            int min, int size, uint8_t *closure) {
+    return do_par_for_on_queue(queue_for(user_context), user_context, f, min, size, closure, false);
+}
+
 WEAK int (*halide_custom_do_task)(void *user_context, halide_task, int, uint8_t *) = default_do_task;
 WEAK int (*halide_custom_do_par_for)(void *, halide_task, int, int, uint8_t *) = default_do_par_for;
 
+// Guided loops get an entry point of their own, so that whoever hooks
+// do_par_for (e.g. the JIT) can pass them on to the pool as guided.
+WEAK int default_do_guided_par_for(void *user_context, halide_task f,
+                                   int min, int size, uint8_t *closure) {
+    return do_par_for_on_queue(queue_for(user_context), user_context, f, min, size, closure, true);
+}
+WEAK int (*halide_custom_do_guided_par_for)(void *, halide_task, int, int, uint8_t *) = default_do_guided_par_for;
+WEAK halide_thread_pool *(*halide_custom_get_thread_pool)(void *) = default_get_thread_pool;
+
 }}} // namespace Halide::Runtime::Internal
 
 extern "C" {
@@ -304,35 +1211,97 @@ WEAK void halide_mutex_unlock(halide_mutex *mutex_arg) {
     pthread_mutex_unlock(mutex);
 }
 
+namespace {
+struct posix_semaphore {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int count;
+};
 
-WEAK void halide_shutdown_thread_pool() {
-    if (!halide_thread_pool_initialized) return;
+struct spawned_thread {
+    void (*f)(void *);
+    void *closure;
+    pthread_t handle;
+};
 
-    // Wake everyone up and tell them the party's over and it's time
-    // to go home
-    pthread_mutex_lock(&halide_work_queue.mutex);
-    halide_work_queue.shutdown = true;
-    pthread_cond_broadcast(&halide_work_queue.wakeup_owners);
-    pthread_cond_broadcast(&halide_work_queue.wakeup_a_team);
-    pthread_cond_broadcast(&halide_work_queue.wakeup_b_team);
-    pthread_mutex_unlock(&halide_work_queue.mutex);
+WEAK void *spawned_thread_main(void *arg) {
+    spawned_thread *t = (spawned_thread *)arg;
+    t->f(t->closure);
+    return NULL;
+}
+}
 
-    // Wait until they leave
-    for (int i = 0; i < halide_num_threads-1; i++) {
-        //fprintf(stderr, "Waiting for thread %d to exit\n", i);
-        void *retval;
-        pthread_join(halide_work_queue.threads[i], &retval);
+WEAK void halide_semaphore_release(halide_semaphore *s) {
+    posix_semaphore *sem = (posix_semaphore *)s;
+    pthread_mutex_lock(&sem->mutex);
+    sem->count++;
+    pthread_cond_broadcast(&sem->cond);
+    pthread_mutex_unlock(&sem->mutex);
+}
+
+WEAK void halide_semaphore_acquire(halide_semaphore *s) {
+    posix_semaphore *sem = (posix_semaphore *)s;
+    pthread_mutex_lock(&sem->mutex);
+    while (sem->count == 0) {
+        pthread_cond_wait(&sem->cond, &sem->mutex);
     }
+    sem->count--;
+    pthread_mutex_unlock(&sem->mutex);
+}
 
-    //fprintf(stderr, "All threads have quit. Destroying mutex and condition variable.\n");
-    // Tidy up
-    pthread_mutex_destroy(&halide_work_queue.mutex);
-    // Reinitialize in case we call another do_par_for
-    pthread_mutex_init(&halide_work_queue.mutex, NULL);
-    pthread_cond_destroy(&halide_work_queue.wakeup_owners);
-    pthread_cond_destroy(&halide_work_queue.wakeup_a_team);
-    pthread_cond_destroy(&halide_work_queue.wakeup_b_team);
-    halide_thread_pool_initialized = false;
+WEAK bool halide_semaphore_acquire_timeout(halide_semaphore *s, int timeout_ms) {
+    posix_semaphore *sem = (posix_semaphore *)s;
+    posix_timeval now;
+    gettimeofday(&now, NULL);
+    int64_t ns = (int64_t)now.tv_usec * 1000 + (int64_t)timeout_ms * 1000000;
+    posix_timespec deadline;
+    deadline.tv_sec = now.tv_sec + (long)(ns / 1000000000);
+    deadline.tv_nsec = (long)(ns % 1000000000);
+    pthread_mutex_lock(&sem->mutex);
+    if (sem->count == 0) {
+        pthread_cond_timedwait(&sem->cond, &sem->mutex, &deadline);
+    }
+    bool acquired = sem->count > 0;
+    if (acquired) {
+        sem->count--;
+    }
+    pthread_mutex_unlock(&sem->mutex);
+    return acquired;
+}
+
+WEAK halide_thread *halide_spawn_thread(void (*f)(void *), void *closure) {
+    spawned_thread *t = (spawned_thread *)malloc(sizeof(spawned_thread));
+    if (t == NULL) return NULL;
+    t->f = f;
+    t->closure = closure;
+    if (pthread_create(&t->handle, NULL, spawned_thread_main, t) != 0) {
+        free(t);
+        return NULL;
+    }
+    return (halide_thread *)t;
+}
+
+WEAK void halide_join_thread(halide_thread *thread) {
+    spawned_thread *t = (spawned_thread *)thread;
+    void *retval;
+    pthread_join(t->handle, &retval);
+    free(t);
+}
+
+
+WEAK void halide_shutdown_thread_pool() {
+    // Named pools go away entirely, as nothing can run on them once
+    // the runtime is unloaded.
+    halide_mutex_lock(&halide_named_thread_pools_lock);
+    while (halide_named_thread_pools) {
+        halide_work_queue_t *queue = halide_named_thread_pools;
+        halide_named_thread_pools = queue->next;
+        shutdown_queue(queue);
+        free(queue);
+    }
+    halide_mutex_unlock(&halide_named_thread_pools_lock);
+
+    shutdown_queue(&halide_work_queue);
 }
 
 namespace {
@@ -343,15 +1312,192 @@ WEAK void halide_posix_thread_pool_cleanup() {
 }
 
 WEAK void halide_set_num_threads(int n) {
-    if (halide_num_threads == n) {
+    resize_queue(&halide_work_queue, n);
+}
+
+WEAK halide_thread_pool *halide_create_thread_pool(const char *name, int num_threads, int priority) {
+    halide_work_queue_t *queue = (halide_work_queue_t *)malloc(sizeof(halide_work_queue_t));
+    if (!queue) return NULL;
+    memset(queue, 0, sizeof(halide_work_queue_t));
+    halide_string_to_string(queue->name, queue->name + sizeof(queue->name), name);
+    queue->num_threads = num_threads;
+    queue->priority = priority;
+
+    halide_mutex_lock(&halide_named_thread_pools_lock);
+    queue->next = halide_named_thread_pools;
+    halide_named_thread_pools = queue;
+    halide_mutex_unlock(&halide_named_thread_pools_lock);
+
+    return (halide_thread_pool *)queue;
+}
+
+WEAK halide_thread_pool *halide_find_thread_pool(const char *name) {
+    halide_mutex_lock(&halide_named_thread_pools_lock);
+    halide_work_queue_t *queue = halide_named_thread_pools;
+    while (queue && strcmp(queue->name, name)) {
+        queue = queue->next;
+    }
+    halide_mutex_unlock(&halide_named_thread_pools_lock);
+    return (halide_thread_pool *)queue;
+}
+
+WEAK void halide_destroy_thread_pool(halide_thread_pool *pool) {
+    halide_work_queue_t *queue = (halide_work_queue_t *)pool;
+    halide_mutex_lock(&halide_named_thread_pools_lock);
+    halide_work_queue_t **prev = &halide_named_thread_pools;
+    while (*prev && *prev != queue) {
+        prev = &((*prev)->next);
+    }
+    bool found = (*prev != NULL);
+    if (found) {
+        *prev = queue->next;
+    }
+    halide_mutex_unlock(&halide_named_thread_pools_lock);
+
+    if (found) {
+        shutdown_queue(queue);
+        free(queue);
+    }
+}
+
+WEAK void halide_set_thread_pool_num_threads(halide_thread_pool *pool, int n) {
+    resize_queue(pool ? (halide_work_queue_t *)pool : &halide_work_queue, n);
+}
+
+WEAK void halide_enable_thread_pool_stats(int enabled) {
+    halide_thread_pool_stats_enabled = enabled != 0;
+    halide_thread_pool_stats_set = true;
+}
+
+WEAK int halide_get_thread_pool_stats(halide_thread_pool *pool, halide_thread_pool_stats *stats,
+                                      halide_thread_pool_worker_stats *workers, int max_workers) {
+    halide_work_queue_t *queue = pool ? (halide_work_queue_t *)pool : &halide_work_queue;
+    pthread_mutex_lock(&queue->mutex);
+    if (stats) {
+        *stats = queue->stats;
+        stats->num_threads = queue->initialized ? queue->num_threads : 0;
+    }
+    int n = queue->num_worker_stats;
+    for (int i = 0; i < n && i < max_workers; i++) {
+        workers[i] = *queue->worker_stats[i];
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return n;
+}
+
+WEAK void halide_reset_thread_pool_stats(halide_thread_pool *pool) {
+    halide_work_queue_t *queue = pool ? (halide_work_queue_t *)pool : &halide_work_queue;
+    pthread_mutex_lock(&queue->mutex);
+    memset(&queue->stats, 0, sizeof(queue->stats));
+    for (int i = 0; i < queue->num_worker_stats; i++) {
+        memset(queue->worker_stats[i], 0, sizeof(halide_thread_pool_worker_stats));
+    }
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+WEAK void halide_do_async(void *user_context, int (*f)(void **), void **args,
+                          void (*done)(void *, int, void *), void *done_arg) {
+    halide_work_queue_t *queue = queue_for(user_context);
+    init_queue(queue);
+
+    async_work *w = NULL;
+    if (queue->num_threads > 1) {
+        w = (async_work *)malloc(sizeof(async_work));
+    }
+    if (!w) {
+        // There are no workers to hand the call to, so it runs here.
+        int result = f(args);
+        if (done) {
+            done(user_context, result, done_arg);
+        }
         return;
     }
 
-    if (halide_thread_pool_initialized) {
-        halide_shutdown_thread_pool();
+    w->f = f;
+    w->args = args;
+    w->user_context = user_context;
+    w->done = done;
+    w->done_arg = done_arg;
+    w->next = NULL;
+
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->async_tail) {
+        queue->async_tail->next = w;
+    } else {
+        queue->async_head = w;
     }
+    queue->async_tail = w;
+    queue->num_async++;
+    pthread_mutex_unlock(&queue->mutex);
+
+    // Any sleeping worker may pick it up, so wake the B team too.
+    wake_workers(queue, true);
+}
+
+WEAK halide_thread_pool *halide_get_thread_pool(void *user_context) {
+    return (*halide_custom_get_thread_pool)(user_context);
+}
 
-    halide_num_threads = n;
+WEAK halide_thread_pool *(*halide_set_custom_get_thread_pool(halide_thread_pool *(*f)(void *)))(void *) {
+    halide_thread_pool *(*result)(void *) = halide_custom_get_thread_pool;
+    halide_custom_get_thread_pool = f;
+    return result;
+}
+
+WEAK void halide_set_thread_affinity(halide_thread_affinity_t mode) {
+    halide_thread_affinity = mode;
+    halide_thread_affinity_set = true;
+    __sync_fetch_and_add(&halide_thread_affinity_epoch, 1);
+
+    // Wake everyone up so that sleeping workers re-pin themselves too.
+    wake_all(&halide_work_queue);
+    halide_mutex_lock(&halide_named_thread_pools_lock);
+    for (halide_work_queue_t *queue = halide_named_thread_pools; queue; queue = queue->next) {
+        wake_all(queue);
+    }
+    halide_mutex_unlock(&halide_named_thread_pools_lock);
+}
+
+WEAK void halide_set_thread_pool_spin_budget(int spin_count, int yield_count) {
+    halide_thread_pool_spin_count = spin_count;
+    halide_thread_pool_yield_count = yield_count;
+    halide_thread_pool_spin_budget_set = true;
+}
+
+WEAK void halide_set_worker_stack_size(size_t size) {
+    halide_worker_stack_size = size;
+}
+
+WEAK int32_t halide_get_stack_allocation_limit() {
+    // Only the workers' stacks are known. Other threads, such as the
+    // main one, may already be deep into a stack of any size, so
+    // their allocations go on the heap.
+    uintptr_t sp = (uintptr_t)__builtin_frame_address(0);
+    size_t left = 0;
+    halide_mutex_lock(&halide_worker_stacks_lock);
+    for (worker_stack *stack = halide_worker_stacks; stack; stack = stack->next) {
+        if (stack->lo < sp && sp <= stack->hi) {
+            left = sp - stack->lo;
+            break;
+        }
+    }
+    halide_mutex_unlock(&halide_worker_stacks_lock);
+    // Leave half of what's left for everything else, including
+    // later allocations made under the same limit, so that even a
+    // series of them can't use it all up.
+    left /= 2;
+    if (left > 0x7fffffff) {
+        left = 0x7fffffff;
+    }
+    return (int32_t)left;
+}
+
+WEAK void halide_get_thread_pool_wait_counters(halide_thread_pool_wait_counters *counters) {
+    *counters = halide_wait_counters;
+}
+
+WEAK void halide_reset_thread_pool_wait_counters() {
+    memset(&halide_wait_counters, 0, sizeof(halide_wait_counters));
 }
 
 WEAK int (*halide_set_custom_do_task(int (*f)(void *, halide_task, int, uint8_t *)))
@@ -379,4 +1525,22 @@ WEAK int halide_do_par_for(void *user_context, int (*f)(void *, int, uint8_t *),
   return (*halide_custom_do_par_for)(user_context, f, min, size, closure);
 }
 
+WEAK int (*halide_set_custom_do_guided_par_for(int (*f)(void *, halide_task, int, int, uint8_t *)))
+          (void *, halide_task, int, int, uint8_t *) {
+    int (*result)(void *, halide_task, int, int, uint8_t *) = halide_custom_do_guided_par_for;
+    halide_custom_do_guided_par_for = f;
+    return result;
+}
+
+WEAK int halide_do_guided_par_for(void *user_context, int (*f)(void *, int, uint8_t *),
+                                  int min, int size, uint8_t *closure) {
+    if (halide_custom_do_guided_par_for == default_do_guided_par_for &&
+        halide_custom_do_par_for != default_do_par_for) {
+        // Someone else is managing the threads, and doesn't
+        // distinguish guided loops.
+        return (*halide_custom_do_par_for)(user_context, f, min, size, closure);
+    }
+    return (*halide_custom_do_guided_par_for)(user_context, f, min, size, closure);
+}
+
 } // extern "C"
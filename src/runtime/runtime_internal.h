@@ -82,6 +82,29 @@ WEAK char *halide_int64_to_string(char *dst, char *end, int64_t arg, int digits)
 WEAK char *halide_uint64_to_string(char *dst, char *end, uint64_t arg, int digits);
 WEAK char *halide_pointer_to_string(char *dst, char *end, const void *arg);
 
+// A counting semaphore, for runtime services that wait a long time
+// for work and shouldn't spin while they do. Zero-filled storage is a
+// semaphore with a count of zero. Defined by the thread pool modules.
+struct halide_semaphore {
+    uint64_t _private[16];
+};
+WEAK void halide_semaphore_release(halide_semaphore *s);
+WEAK void halide_semaphore_acquire(halide_semaphore *s);
+// Like halide_semaphore_acquire, but give up after about timeout_ms
+// milliseconds, or sooner if woken for nothing. Returns whether the
+// semaphore was acquired.
+WEAK bool halide_semaphore_acquire_timeout(halide_semaphore *s, int timeout_ms);
+
+// Run f(closure) on a thread of its own, outside of the thread pool,
+// until it returns. Returns NULL if no thread could be started (or
+// the thread pool module doesn't have threads), in which case the
+// caller has to do the work some other way. Each thread started must
+// be joined, which waits for f to return, before the runtime is
+// unloaded.
+struct halide_thread;
+WEAK halide_thread *halide_spawn_thread(void (*f)(void *), void *closure);
+WEAK void halide_join_thread(halide_thread *thread);
+
 }
 
 // A convenient namespace for weak functions that are internal to the
@@ -0,0 +1,221 @@
+#include "runtime_internal.h"
+
+#include "HalideRuntime.h"
+#include "scoped_spin_lock.h"
+
+// Scratch arenas for allocations inside parallel loops, used by code
+// compiled with the scratch_arenas target feature. Each task takes an
+// arena for as long as it runs, so allocating from it needs no lock.
+// Allocations are bumped off the end of the arena, and freeing the
+// most recent one pops it, so the nested allocations Halide makes
+// reuse the same memory. Allocations that don't fit go to
+// halide_malloc, and the arena grows to fit them next time.
+//
+// Arenas outlive the pipelines that use them, and are shared by all
+// of them, so their memory comes from the system allocator rather
+// than from halide_malloc, which may be replaced at any time.
+
+namespace Halide { namespace Runtime { namespace Internal {
+
+struct ScratchArena {
+    // The next arena on the free list.
+    ScratchArena *next;
+    // What malloc returned, and the aligned start of the arena in it.
+    void *orig;
+    uint8_t *base;
+    size_t capacity;
+    // The offset of the end of the last allocation. Out-of-order
+    // frees leave holes below it.
+    size_t top;
+    // The bytes of live allocations that didn't fit, and the most the
+    // arena would have needed to fit everything since it was
+    // acquired.
+    size_t spilled, high_water;
+    // Allocations not yet freed. An arena released with live
+    // allocations (e.g. on an error path) goes back on the free list
+    // when the last of them is freed.
+    int live;
+    bool released;
+};
+
+// Sits just before each scratch allocation.
+struct ScratchHeader {
+    // The arena of the task that made the allocation, if any.
+    ScratchArena *arena;
+    // The arena's top before the allocation.
+    size_t prev_top;
+    // The bytes taken, including this header.
+    size_t size;
+    // False if the allocation didn't fit and came from halide_malloc.
+    bool in_arena;
+};
+
+const size_t kScratchHeaderSize = 32;
+const size_t kMaxScratchArenaSize = 16 * 1024 * 1024;
+
+WEAK ScratchArena *free_scratch_arenas = NULL;
+WEAK volatile int scratch_arenas_lock = 0;
+
+WEAK size_t round_up_scratch(size_t x) {
+    return (x + 31) & ~(size_t)31;
+}
+
+// Leaves room to align the arena to 32 bytes and to read a little
+// beyond its end, as halide_malloc promises.
+WEAK void *malloc_scratch_arena(size_t capacity) {
+    return malloc(capacity + 64);
+}
+
+WEAK void return_scratch_arena(ScratchArena *arena) {
+    // Grow the arena to fit everything the last task allocated.
+    if (arena->high_water > arena->capacity && arena->capacity < kMaxScratchArenaSize) {
+        size_t capacity = arena->capacity * 2;
+        if (capacity < arena->high_water) {
+            capacity = arena->high_water;
+        }
+        capacity = (capacity + 4095) & ~(size_t)4095;
+        if (capacity > kMaxScratchArenaSize) {
+            capacity = kMaxScratchArenaSize;
+        }
+        void *orig = malloc_scratch_arena(capacity);
+        if (orig != NULL) {
+            if (arena->orig != NULL) {
+                free(arena->orig);
+            }
+            arena->orig = orig;
+            arena->base = (uint8_t *)round_up_scratch((size_t)orig);
+            arena->capacity = capacity;
+        }
+    }
+    arena->top = 0;
+    arena->spilled = 0;
+    arena->high_water = 0;
+
+    ScopedSpinLock lock(&scratch_arenas_lock);
+    arena->next = free_scratch_arenas;
+    free_scratch_arenas = arena;
+}
+
+}}} // namespace Halide::Runtime::Internal
+
+extern "C" {
+
+WEAK void *halide_scratch_arena_acquire(void *user_context) {
+    ScratchArena *arena = NULL;
+    {
+        ScopedSpinLock lock(&scratch_arenas_lock);
+        arena = free_scratch_arenas;
+        if (arena != NULL) {
+            free_scratch_arenas = arena->next;
+        }
+    }
+    if (arena == NULL) {
+        // Starts out empty. It gets memory once it's known how much
+        // a task needs.
+        arena = (ScratchArena *)malloc(sizeof(ScratchArena));
+        if (arena == NULL) {
+            return NULL;
+        }
+        memset(arena, 0, sizeof(ScratchArena));
+    }
+    arena->next = NULL;
+    arena->live = 0;
+    arena->released = false;
+    return arena;
+}
+
+WEAK void halide_scratch_arena_release(void *user_context, void *arena_ptr) {
+    ScratchArena *arena = (ScratchArena *)arena_ptr;
+    if (arena == NULL) {
+        return;
+    }
+    arena->released = true;
+    if (arena->live == 0) {
+        return_scratch_arena(arena);
+    }
+}
+
+WEAK void *halide_scratch_alloc(void *user_context, void *arena_ptr, int32_t size) {
+    if (size <= 0) {
+        return NULL;
+    }
+    ScratchArena *arena = (ScratchArena *)arena_ptr;
+    size_t bytes = kScratchHeaderSize + round_up_scratch((size_t)size);
+    ScratchHeader *header;
+    bool in_arena = arena != NULL && arena->top + bytes <= arena->capacity;
+    if (in_arena) {
+        header = (ScratchHeader *)(arena->base + arena->top);
+        header->prev_top = arena->top;
+        arena->top += bytes;
+    } else {
+        // Also safe to read a little beyond the end, as halide_malloc
+        // promises.
+        header = (ScratchHeader *)halide_malloc(user_context, bytes);
+        if (header == NULL) {
+            return NULL;
+        }
+        header->prev_top = 0;
+    }
+    header->arena = arena;
+    header->size = bytes;
+    header->in_arena = in_arena;
+    if (arena != NULL) {
+        arena->live++;
+        if (!in_arena) {
+            arena->spilled += bytes;
+        }
+        // Count what didn't fit as if it had been bumped off the top.
+        if (arena->top + arena->spilled > arena->high_water) {
+            arena->high_water = arena->top + arena->spilled;
+        }
+    }
+    return (uint8_t *)header + kScratchHeaderSize;
+}
+
+WEAK void halide_scratch_free(void *user_context, void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    ScratchHeader *header = (ScratchHeader *)((uint8_t *)ptr - kScratchHeaderSize);
+    ScratchArena *arena = header->arena;
+    size_t bytes = header->size;
+    if (!header->in_arena) {
+        halide_free(user_context, header);
+    } else if (arena->top == header->prev_top + bytes) {
+        // The most recent allocation. Pop it.
+        arena->top = header->prev_top;
+    }
+    if (arena == NULL) {
+        return;
+    }
+    if (!header->in_arena) {
+        arena->spilled -= bytes;
+    }
+    arena->live--;
+    if (arena->live == 0) {
+        // Nothing left, even if frees came out of order.
+        arena->top = 0;
+        if (arena->released) {
+            return_scratch_arena(arena);
+        }
+    }
+}
+
+namespace {
+
+__attribute__((destructor))
+WEAK void halide_scratch_arena_cleanup() {
+    ScopedSpinLock lock(&scratch_arenas_lock);
+    while (free_scratch_arenas != NULL) {
+        ScratchArena *arena = free_scratch_arenas;
+        free_scratch_arenas = arena->next;
+        if (arena->orig != NULL) {
+            free(arena->orig);
+        }
+        free(arena);
+    }
+}
+
+}
+
+}
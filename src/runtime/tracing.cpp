@@ -1,6 +1,7 @@
 #include "runtime_internal.h"
 #include "HalideRuntime.h"
 #include "scoped_spin_lock.h"
+#include "scoped_mutex_lock.h"
 
 extern "C" {
 
@@ -12,9 +13,285 @@ namespace Halide { namespace Runtime { namespace Internal {
 
 WEAK int halide_trace_file = 0;
 WEAK int halide_trace_file_lock = 0;
-WEAK bool halide_trace_file_initialized = false;
+WEAK volatile bool halide_trace_file_initialized = false;
 WEAK bool halide_trace_file_internally_opened = false;
 
+// Binary trace packets aren't written out one at a time. Threads
+// reserve space for each packet in the current one of a ring of
+// large buffers with an atomic add, copy the packet in, and then
+// count its bytes as committed. The thread whose reservation runs off
+// the end of the buffer seals it and moves everyone on to the next
+// one, and a writer thread writes the sealed buffers out in order,
+// once the packets still being copied in are done. If there's no
+// writer thread, the sealing thread writes the buffer out itself. The
+// packets are the same either way, so util/HalideTrace.cpp can read
+// the file.
+const uint32_t trace_buffer_size = 1 << 20;
+const int num_trace_buffers = 4;
+// If the writer thread has had nothing to write for this long, it
+// writes out what's in the buffer being filled. Pipelines flush the
+// buffers when they finish, but not when they fail partway through,
+// and nothing flushes them while a long pipeline runs.
+const int trace_idle_flush_ms = 100;
+
+struct TraceBuffer {
+    uint8_t *data;
+    // The file the buffer gets written to.
+    int fd;
+    // Which buffer this is in the sequence of buffers filled so far.
+    uint32_t seq;
+    // Bytes handed out to packets. Runs past the end of the buffer
+    // once it's full.
+    volatile uint32_t cursor;
+    // Bytes of packets that have been completely copied in.
+    volatile uint32_t committed;
+    // How many bytes of packets the buffer holds, once it's sealed.
+    volatile uint32_t sealed_size;
+    // Whether someone is waiting for this buffer to be written.
+    volatile bool flush_requested;
+};
+
+WEAK TraceBuffer trace_buffers[num_trace_buffers];
+WEAK volatile bool trace_buffers_initialized = false;
+// False if the buffers couldn't be allocated, in which case packets
+// are written out one at a time as they used to be.
+WEAK bool trace_buffers_usable = false;
+WEAK bool trace_writer_running = false;
+WEAK halide_thread *trace_writer_thread = NULL;
+// Tells the writer thread to return the next time it wakes up.
+WEAK volatile bool trace_writer_stop = false;
+// The sequence number of the buffer being filled.
+WEAK volatile uint32_t trace_fill_seq = 0;
+// The file the buffer being filled will be written to.
+WEAK volatile int trace_buffer_fd = 0;
+// Sealed buffers waiting for the writer thread, buffers the writer
+// has finished with, and flushes the writer has finished.
+WEAK halide_semaphore trace_buffers_sealed;
+WEAK halide_semaphore trace_buffers_free;
+WEAK halide_semaphore trace_buffers_flushed;
+// Serializes setting up the buffers, flushing them, and switching
+// them to a different file.
+WEAK halide_mutex trace_buffers_lock;
+
+WEAK void write_trace_buffer(TraceBuffer *b) {
+    // Wait for the packets that were still being copied in when the
+    // buffer was sealed.
+    while (b->committed != b->sealed_size) {
+        __sync_synchronize();
+    }
+    __sync_synchronize();
+    uint32_t done = 0;
+    while (done < b->sealed_size) {
+        ssize_t written = write(b->fd, b->data + done, b->sealed_size - done);
+        if (written <= 0) {
+            halide_error(NULL, "Can't write to trace file\n");
+            break;
+        }
+        done += written;
+    }
+}
+
+WEAK bool seal_idle_trace_buffer(uint32_t seq);
+
+WEAK void trace_writer(void *) {
+    // The buffer to write next.
+    uint32_t seq = 0;
+    while (true) {
+        if (!halide_semaphore_acquire_timeout(&trace_buffers_sealed, trace_idle_flush_ms)) {
+            if (seal_idle_trace_buffer(seq)) {
+                seq++;
+            }
+            continue;
+        }
+        if (trace_writer_stop) {
+            return;
+        }
+        TraceBuffer *b = &trace_buffers[seq % num_trace_buffers];
+        bool flush_requested = b->flush_requested;
+        write_trace_buffer(b);
+        halide_semaphore_release(&trace_buffers_free);
+        if (flush_requested) {
+            halide_semaphore_release(&trace_buffers_flushed);
+        }
+        seq++;
+    }
+}
+
+// Move everyone on from buffer seq, which has been sealed, to the
+// next one. The next one must be free.
+WEAK void start_next_trace_buffer(uint32_t seq) {
+    TraceBuffer *next = &trace_buffers[(seq + 1) % num_trace_buffers];
+    next->fd = trace_buffer_fd;
+    next->seq = seq + 1;
+    next->committed = 0;
+    next->sealed_size = 0;
+    next->flush_requested = false;
+    __sync_synchronize();
+    // Threads that went to the buffer before everyone moved on to it
+    // can start reserving space now, which is fine, as it's about to
+    // be the one being filled.
+    next->cursor = 0;
+    __sync_synchronize();
+    trace_fill_seq = seq + 1;
+}
+
+// Called by the one thread whose reservation ran off the end of b, or
+// that's flushing it. size is how much of it holds packets.
+WEAK void seal_trace_buffer(TraceBuffer *b, uint32_t size) {
+    b->sealed_size = size;
+    if (trace_writer_running) {
+        halide_semaphore_release(&trace_buffers_sealed);
+        // Wait for the writer to be done with the next buffer.
+        halide_semaphore_acquire(&trace_buffers_free);
+    } else {
+        write_trace_buffer(b);
+    }
+    start_next_trace_buffer(b->seq);
+}
+
+// Called by the writer thread when it has written every sealed buffer
+// and seq is the one it would write next. If that's the buffer being
+// filled and anything has been traced into it, seal it and write it
+// out. Returns whether it did. This doesn't take trace_buffers_lock,
+// as a thread holding it may be waiting on the writer.
+WEAK bool seal_idle_trace_buffer(uint32_t seq) {
+    TraceBuffer *b = &trace_buffers[seq % num_trace_buffers];
+    if (trace_fill_seq != seq || b->cursor == 0) return false;
+    // Take all of the space that's left, as a flush does. If someone
+    // else got there first, they are sealing it, and will hand it to
+    // us as usual.
+    uint32_t pos = __sync_fetch_and_add(&b->cursor, trace_buffer_size + 1);
+    if (pos > trace_buffer_size) return false;
+    b->sealed_size = pos;
+    write_trace_buffer(b);
+    // We're done with this buffer, and every buffer before it has
+    // been written, so the next one is free.
+    halide_semaphore_release(&trace_buffers_free);
+    halide_semaphore_acquire(&trace_buffers_free);
+    start_next_trace_buffer(seq);
+    return true;
+}
+
+// Reserve space for a packet in the buffer being filled. Returns the
+// buffer, and the offset of the space in it.
+WEAK TraceBuffer *reserve_trace_packet(uint32_t size, uint32_t *offset) {
+    while (true) {
+        uint32_t seq = trace_fill_seq;
+        TraceBuffer *b = &trace_buffers[seq % num_trace_buffers];
+        uint32_t pos = __sync_fetch_and_add(&b->cursor, size);
+        if (pos + size <= trace_buffer_size) {
+            *offset = pos;
+            return b;
+        }
+        if (pos <= trace_buffer_size) {
+            seal_trace_buffer(b, pos);
+        } else {
+            // Someone else is sealing it. Wait for them to move
+            // everyone on to the next buffer.
+            while (trace_fill_seq == seq) {
+                __sync_synchronize();
+            }
+        }
+    }
+}
+
+// Write out everything in the buffers. Call with
+// trace_buffers_lock held.
+WEAK void flush_trace_buffers() {
+    if (!trace_buffers_usable) return;
+    while (true) {
+        uint32_t seq = trace_fill_seq;
+        TraceBuffer *b = &trace_buffers[seq % num_trace_buffers];
+        // Take all of the space that's left, so that no more packets
+        // go into this buffer.
+        uint32_t pos = __sync_fetch_and_add(&b->cursor, trace_buffer_size + 1);
+        if (pos <= trace_buffer_size) {
+            b->flush_requested = true;
+            seal_trace_buffer(b, pos);
+            if (trace_writer_running) {
+                halide_semaphore_acquire(&trace_buffers_flushed);
+            }
+            return;
+        }
+        // Someone else is sealing it, which doesn't write out
+        // anything that comes after. Wait and try the next buffer.
+        while (trace_fill_seq == seq) {
+            __sync_synchronize();
+        }
+    }
+}
+
+// Make sure the buffers exist, and that the one being filled goes to
+// fd.
+WEAK void prepare_trace_buffers(int fd) {
+    ScopedMutexLock lock(&trace_buffers_lock);
+    if (!trace_buffers_initialized) {
+        trace_buffers_usable = true;
+        for (int i = 0; i < num_trace_buffers; i++) {
+            trace_buffers[i].data = (uint8_t *)malloc(trace_buffer_size);
+            trace_buffers_usable = trace_buffers_usable && trace_buffers[i].data;
+        }
+        if (!trace_buffers_usable) {
+            for (int i = 0; i < num_trace_buffers; i++) {
+                free(trace_buffers[i].data);
+                trace_buffers[i].data = NULL;
+            }
+        } else {
+            TraceBuffer *b = &trace_buffers[0];
+            b->fd = fd;
+            b->seq = 0;
+            b->cursor = b->committed = b->sealed_size = 0;
+            b->flush_requested = false;
+            trace_fill_seq = 0;
+            trace_writer_stop = false;
+            trace_writer_thread = halide_spawn_thread(trace_writer, NULL);
+            trace_writer_running = trace_writer_thread != NULL;
+            if (trace_writer_running) {
+                // All of them but the one being filled are free.
+                for (int i = 1; i < num_trace_buffers; i++) {
+                    halide_semaphore_release(&trace_buffers_free);
+                }
+            }
+        }
+        trace_buffer_fd = fd;
+        __sync_synchronize();
+        trace_buffers_initialized = true;
+    } else if (trace_buffer_fd != fd) {
+        // The next buffer picks up the new file when this one is
+        // sealed.
+        trace_buffer_fd = fd;
+        flush_trace_buffers();
+    }
+}
+
+// Write out everything in the buffers, stop the writer thread, and
+// free the buffers, so that nothing is left running or allocated
+// once the runtime is unloaded. Call with trace_buffers_lock held.
+WEAK void destroy_trace_buffers() {
+    if (!trace_buffers_initialized) return;
+    flush_trace_buffers();
+    if (trace_writer_running) {
+        // The writer has written everything, so the only buffer it
+        // hasn't given back is the one being filled.
+        for (int i = 1; i < num_trace_buffers; i++) {
+            halide_semaphore_acquire(&trace_buffers_free);
+        }
+        trace_writer_stop = true;
+        __sync_synchronize();
+        halide_semaphore_release(&trace_buffers_sealed);
+        halide_join_thread(trace_writer_thread);
+        trace_writer_thread = NULL;
+        trace_writer_running = false;
+    }
+    if (trace_buffers_usable) {
+        for (int i = 0; i < num_trace_buffers; i++) {
+            free(trace_buffers[i].data);
+            trace_buffers[i].data = NULL;
+        }
+    }
+    trace_buffers_initialized = false;
+}
+
 WEAK int32_t default_trace(void *user_context, const halide_trace_event *e) {
     static int32_t ids = 1;
 
@@ -37,9 +314,21 @@ WEAK int32_t default_trace(void *user_context, const halide_trace_event *e) {
         size_t value_bytes = clamped_width * bytes;
         size_t int_arg_bytes = clamped_dimensions * sizeof(int32_t);
         size_t total_bytes = header_bytes + value_bytes + int_arg_bytes;
-        uint8_t buffer[4096];
         halide_assert(user_context, total_bytes <= 4096 && "Tracing packet too large");
 
+        if (!trace_buffers_initialized || trace_buffer_fd != fd) {
+            prepare_trace_buffers(fd);
+        }
+
+        uint8_t stack_buffer[4096];
+        uint8_t *buffer = stack_buffer;
+        TraceBuffer *trace_buffer = NULL;
+        if (trace_buffers_usable) {
+            uint32_t offset;
+            trace_buffer = reserve_trace_packet(total_bytes, &offset);
+            buffer = trace_buffer->data + offset;
+        }
+
         ((int32_t *)buffer)[0] = my_id;
         ((int32_t *)buffer)[1] = e->parent_id;
         buffer[8] = e->event;
@@ -70,9 +359,12 @@ WEAK int32_t default_trace(void *user_context, const halide_trace_event *e) {
             buffer[header_bytes + value_bytes + i] = ((uint8_t *)(e->coordinates))[i];
         }
 
-
-        size_t written = write(fd, &buffer[0], total_bytes);
-        halide_assert(user_context, written == total_bytes && "Can't write to trace file");
+        if (trace_buffer) {
+            __sync_fetch_and_add(&trace_buffer->committed, (uint32_t)total_bytes);
+        } else {
+            size_t written = write(fd, &buffer[0], total_bytes);
+            halide_assert(user_context, written == total_bytes && "Can't write to trace file");
+        }
 
     } else {
         stringstream ss(user_context);
@@ -181,7 +473,13 @@ WEAK trace_fn halide_set_custom_trace(trace_fn t) {
 }
 
 WEAK void halide_set_trace_file(int fd) {
+    if (trace_buffers_initialized) {
+        // Packets already traced go to the file they were traced to.
+        ScopedMutexLock lock(&trace_buffers_lock);
+        flush_trace_buffers();
+    }
     halide_trace_file = fd;
+    __sync_synchronize();
     halide_trace_file_initialized = true;
 }
 
@@ -191,6 +489,11 @@ extern int errno;
 #define O_CREAT 64
 #define O_WRONLY 1
 WEAK int halide_get_trace_file(void *user_context) {
+    // Once the trace file is set, this gets called for every event,
+    // so don't take the lock unless it might need setting.
+    if (halide_trace_file_initialized) {
+        return halide_trace_file;
+    }
     // Prevent multiple threads both trying to initialize the trace
     // file at the same time.
     ScopedSpinLock lock(&halide_trace_file_lock);
@@ -213,6 +516,10 @@ WEAK int32_t halide_trace(void *user_context, const halide_trace_event *e) {
 }
 
 WEAK int halide_shutdown_trace() {
+    if (trace_buffers_initialized) {
+        ScopedMutexLock lock(&trace_buffers_lock);
+        flush_trace_buffers();
+    }
     if (halide_trace_file_internally_opened) {
         int ret = close(halide_trace_file);
         halide_trace_file = 0;
@@ -227,6 +534,10 @@ WEAK int halide_shutdown_trace() {
 namespace {
 __attribute__((destructor))
 WEAK void halide_trace_cleanup() {
+    {
+        ScopedMutexLock lock(&trace_buffers_lock);
+        destroy_trace_buffers();
+    }
     halide_shutdown_trace();
 }
 }
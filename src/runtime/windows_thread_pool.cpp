@@ -36,7 +36,18 @@ extern WIN32API void DeleteCriticalSection(CriticalSection *);
 extern WIN32API void EnterCriticalSection(CriticalSection *);
 extern WIN32API void LeaveCriticalSection(CriticalSection *);
 extern WIN32API int32_t WaitForSingleObject(Thread, int32_t timeout);
+extern WIN32API bool CloseHandle(Thread);
 extern WIN32API bool InitOnceExecuteOnce(InitOnce *, bool WIN32API (*f)(InitOnce *, void *, void **), void *, void **);
+typedef struct {
+    void *BaseAddress;
+    void *AllocationBase;
+    uint32_t AllocationProtect;
+    size_t RegionSize;
+    uint32_t State;
+    uint32_t Protect;
+    uint32_t Type;
+} MemoryBasicInformation;
+extern WIN32API size_t VirtualQuery(const void *, MemoryBasicInformation *, size_t);
 
 WEAK int halide_do_task(void *user_context, halide_task f, int idx,
                         uint8_t *closure);
@@ -68,7 +79,6 @@ struct work {
 };
 
 // The work queue and thread pool is weak, so one big work queue is shared by all halide functions
-#define MAX_THREADS 64
 struct halide_work_queue_t {
     // Initialization of the critical section is guarded by this
     InitOnce init_once;
@@ -97,8 +107,21 @@ struct halide_work_queue_t {
     // more threads are required than are currently in the A team.
     ConditionVariable wakeup_b_team;
 
-    // Keep track of threads so they can be joined at shutdown
-    Thread threads[MAX_THREADS];
+    // Keep track of threads so they can be joined at shutdown or
+    // when the pool shrinks. Pool worker i is threads[i]. Grown on
+    // demand.
+    Thread *threads;
+    int threads_capacity;
+
+    // The number of pool workers currently running. Always
+    // halide_num_threads - 1 once the pool is initialized, as the
+    // thread calling do_par_for makes up the last one.
+    int num_workers;
+
+    // Serializes resizing the pool against other resizes and
+    // shutdown. Held while joining workers, so it can't be the main
+    // mutex.
+    windows_mutex resize_mutex;
 
     // Global flag indicating
     bool shutdown;
@@ -111,6 +134,10 @@ struct halide_work_queue_t {
 
 WEAK halide_work_queue_t halide_work_queue;
 
+// The stack size workers are created with, or 0 for the size in the
+// executable's header (usually 1MB, the same as the main thread).
+WEAK size_t halide_worker_stack_size = 0;
+
 WEAK bool WIN32API InitOnceCallback(InitOnce *, void *, void **) {
     InitializeCriticalSection(&halide_work_queue.mutex);
     return true;
@@ -126,18 +153,19 @@ WEAK int default_do_task(void *user_context, halide_task f, int idx,
     return f(user_context, idx, closure);
 }
 
-WEAK void *halide_worker_thread(void *void_arg) {
-    work *owned_job = (work *)void_arg;
-
+// Run by the owner of a job, with id -1, and by pool worker id, with
+// owned_job NULL.
+WEAK void worker_thread_loop(work *owned_job, int id) {
     // Grab the lock
     EnterCriticalSection(&halide_work_queue.mutex);
 
     // If I'm a job owner, then I was the thread that called
     // do_par_for, and I should only stay in this function until my
     // job is complete. If I'm a lowly worker thread, I should stay in
-    // this function as long as the work queue is running.
+    // this function as long as the work queue is running and the
+    // pool hasn't shrunk below me.
     while (owned_job != NULL ? owned_job->running()
-           : halide_work_queue.running()) {
+           : (halide_work_queue.running() && id < halide_num_threads - 1)) {
 
         if (halide_work_queue.jobs == NULL) {
             if (owned_job) {
@@ -195,11 +223,63 @@ WEAK void *halide_worker_thread(void *void_arg) {
             }
         }
     }
-    // halide_printf(NULL, "Worker quitting\n");
+    if (!owned_job) {
+        // halide_printf(NULL, "Worker quitting\n");
+        halide_work_queue.a_team_size--;
+    }
     LeaveCriticalSection(&halide_work_queue.mutex);
+}
+
+WEAK void *halide_worker_thread(void *void_arg) {
+    worker_thread_loop(NULL, (int)(intptr_t)void_arg);
     return NULL;
 }
 
+WEAK int default_num_threads() {
+    char *threadStr = getenv("HL_NUM_THREADS");
+    if (!threadStr) {
+        // Legacy name
+        threadStr = getenv("HL_NUMTHREADS");
+    }
+    if (!threadStr) {
+        threadStr = getenv("NUMBER_OF_PROCESSORS"); // Apparently a standard windows environment variable
+    }
+    int n = 8;
+    if (threadStr) {
+        n = atoi(threadStr);
+    } else {
+        // halide_printf(user_context, "HL_NUM_THREADS not defined. Defaulting to %d threads.\n", n);
+    }
+    return n < 1 ? 1 : n;
+}
+
+// Start pool workers until there are enough for halide_num_threads
+// threads in total. Must be called with the mutex held.
+WEAK void grow_thread_pool() {
+    int target = halide_num_threads - 1;
+    if (target > halide_work_queue.threads_capacity) {
+        int capacity = halide_work_queue.threads_capacity * 2;
+        if (capacity < target) capacity = target;
+        Thread *threads = (Thread *)malloc(capacity * sizeof(Thread));
+        if (halide_work_queue.threads) {
+            memcpy(threads, halide_work_queue.threads,
+                   halide_work_queue.num_workers * sizeof(Thread));
+            free(halide_work_queue.threads);
+        }
+        halide_work_queue.threads = threads;
+        halide_work_queue.threads_capacity = capacity;
+    }
+    for (int i = halide_work_queue.num_workers; i < target; i++) {
+        // halide_printf(user_context, "Creating thread %d\n", i);
+        // Reserve the stack size rather than committing it up front.
+        const int32_t stack_size_param_is_a_reservation = 0x00010000;
+        halide_work_queue.threads[i] = CreateThread(NULL, halide_worker_stack_size, halide_worker_thread, (void *)(intptr_t)i,
+                                                    halide_worker_stack_size ? stack_size_param_is_a_reservation : 0, NULL);
+        halide_work_queue.a_team_size++;
+    }
+    halide_work_queue.num_workers = target;
+}
+
 WEAK int default_do_par_for(void *user_context, int (*f)(void *, int, uint8_t *),
                            int min, int size, uint8_t *closure) {
     // halide_printf(user_context, "In do_par_for\n");
@@ -222,33 +302,14 @@ WEAK int default_do_par_for(void *user_context, int (*f)(void *, int, uint8_t *)
         InitializeConditionVariable(&halide_work_queue.wakeup_b_team);
         halide_work_queue.jobs = NULL;
 
-        if (!halide_num_threads) {
-            char *threadStr = getenv("HL_NUM_THREADS");
-            if (!threadStr) {
-                // Legacy name
-                threadStr = getenv("HL_NUMTHREADS");
-            }
-            if (!threadStr) {
-                threadStr = getenv("NUMBER_OF_PROCESSORS"); // Apparently a standard windows environment variable
-            }
-            if (threadStr) {
-                halide_num_threads = atoi(threadStr);
-            } else {
-                halide_num_threads = 8;
-                // halide_printf(user_context, "HL_NUM_THREADS not defined. Defaulting to %d threads.\n", halide_num_threads);
-            }
-        }
-        if (halide_num_threads > MAX_THREADS) {
-            halide_num_threads = MAX_THREADS;
-        } else if (halide_num_threads < 1) {
-            halide_num_threads = 1;
-        }
-        for (int i = 0; i < halide_num_threads-1; i++) {
-            // halide_printf(user_context, "Creating thread %d\n", i);
-            halide_work_queue.threads[i] = CreateThread(NULL, 0, halide_worker_thread, NULL, 0, NULL);
+        if (halide_num_threads < 1) {
+            halide_num_threads = default_num_threads();
         }
 
-        halide_work_queue.a_team_size = halide_num_threads;
+        // The calling thread counts as a member of the A team.
+        halide_work_queue.a_team_size = 1;
+        halide_work_queue.num_workers = 0;
+        grow_thread_pool();
 
         halide_thread_pool_initialized = true;
     }
@@ -292,7 +353,7 @@ WEAK int default_do_par_for(void *user_context, int (*f)(void *, int, uint8_t *)
     }
 
     // Do some work myself.
-    halide_worker_thread((void *)(&job));
+    worker_thread_loop(&job, -1);
 
     // Return zero if the job succeeded, otherwise return the exit
     // status of one of the failing jobs (whichever one failed last).
@@ -302,6 +363,12 @@ WEAK int default_do_par_for(void *user_context, int (*f)(void *, int, uint8_t *)
 WEAK int (*halide_custom_do_task)(void *user_context, halide_task, int, uint8_t *) = default_do_task;
 WEAK int (*halide_custom_do_par_for)(void *, halide_task, int, int, uint8_t *) = default_do_par_for;
 
+WEAK int default_do_guided_par_for(void *user_context, halide_task f,
+                                   int min, int size, uint8_t *closure) {
+    return (*halide_custom_do_par_for)(user_context, f, min, size, closure);
+}
+WEAK int (*halide_custom_do_guided_par_for)(void *, halide_task, int, int, uint8_t *) = default_do_guided_par_for;
+
 }}} // namespace Halide::Runtime::Internal
 
 extern "C" {
@@ -325,9 +392,94 @@ WEAK void halide_mutex_unlock(halide_mutex *mutex_arg) {
     LeaveCriticalSection(&mutex->critical_section);
 }
 
+namespace {
+struct windows_semaphore {
+    InitOnce once;
+    CriticalSection critical_section;
+    ConditionVariable cond;
+    int count;
+};
+
+WEAK WIN32API bool init_semaphore(InitOnce *, void *sem_arg, void **) {
+    windows_semaphore *sem = (windows_semaphore *)sem_arg;
+    InitializeCriticalSection(&sem->critical_section);
+    InitializeConditionVariable(&sem->cond);
+    return true;
+}
+
+struct spawned_thread {
+    void (*f)(void *);
+    void *closure;
+    Thread handle;
+};
+
+WEAK void *spawned_thread_main(void *arg) {
+    spawned_thread *t = (spawned_thread *)arg;
+    t->f(t->closure);
+    return NULL;
+}
+}
+
+WEAK void halide_semaphore_release(halide_semaphore *s) {
+    windows_semaphore *sem = (windows_semaphore *)s;
+    InitOnceExecuteOnce(&sem->once, init_semaphore, sem, NULL);
+    EnterCriticalSection(&sem->critical_section);
+    sem->count++;
+    WakeAllConditionVariable(&sem->cond);
+    LeaveCriticalSection(&sem->critical_section);
+}
+
+WEAK void halide_semaphore_acquire(halide_semaphore *s) {
+    windows_semaphore *sem = (windows_semaphore *)s;
+    InitOnceExecuteOnce(&sem->once, init_semaphore, sem, NULL);
+    EnterCriticalSection(&sem->critical_section);
+    while (sem->count == 0) {
+        SleepConditionVariableCS(&sem->cond, &sem->critical_section, -1);
+    }
+    sem->count--;
+    LeaveCriticalSection(&sem->critical_section);
+}
+
+WEAK bool halide_semaphore_acquire_timeout(halide_semaphore *s, int timeout_ms) {
+    windows_semaphore *sem = (windows_semaphore *)s;
+    InitOnceExecuteOnce(&sem->once, init_semaphore, sem, NULL);
+    EnterCriticalSection(&sem->critical_section);
+    if (sem->count == 0) {
+        SleepConditionVariableCS(&sem->cond, &sem->critical_section, timeout_ms);
+    }
+    bool acquired = sem->count > 0;
+    if (acquired) {
+        sem->count--;
+    }
+    LeaveCriticalSection(&sem->critical_section);
+    return acquired;
+}
+
+WEAK halide_thread *halide_spawn_thread(void (*f)(void *), void *closure) {
+    spawned_thread *t = (spawned_thread *)malloc(sizeof(spawned_thread));
+    if (t == NULL) return NULL;
+    t->f = f;
+    t->closure = closure;
+    t->handle = CreateThread(NULL, 0, spawned_thread_main, t, 0, NULL);
+    if (t->handle == NULL) {
+        free(t);
+        return NULL;
+    }
+    return (halide_thread *)t;
+}
+
+WEAK void halide_join_thread(halide_thread *thread) {
+    spawned_thread *t = (spawned_thread *)thread;
+    WaitForSingleObject(t->handle, -1);
+    CloseHandle(t->handle);
+    free(t);
+}
+
 WEAK void halide_shutdown_thread_pool() {
     if (!halide_thread_pool_initialized) return;
 
+    halide_mutex_lock((halide_mutex *)&halide_work_queue.resize_mutex);
+
     // Wake everyone up and tell them the party's over and it's time
     // to go home
     EnterCriticalSection(&halide_work_queue.mutex);
@@ -338,9 +490,13 @@ WEAK void halide_shutdown_thread_pool() {
     LeaveCriticalSection(&halide_work_queue.mutex);
 
     // Wait until they leave
-    for (int i = 0; i < halide_num_threads-1; i++) {
+    for (int i = 0; i < halide_work_queue.num_workers; i++) {
         WaitForSingleObject(halide_work_queue.threads[i], -1);
     }
+    free(halide_work_queue.threads);
+    halide_work_queue.threads = NULL;
+    halide_work_queue.threads_capacity = 0;
+    halide_work_queue.num_workers = 0;
 
     // Tidy up
     DeleteCriticalSection(&halide_work_queue.mutex);
@@ -351,6 +507,8 @@ WEAK void halide_shutdown_thread_pool() {
     // DestroyConditionVariable(&halide_work_queue.wakeup_a_team);
     // DestroyConditionVariable(&halide_work_queue.wakeup_b_team);
     halide_thread_pool_initialized = false;
+
+    halide_mutex_unlock((halide_mutex *)&halide_work_queue.resize_mutex);
 }
 
 namespace {
@@ -361,15 +519,131 @@ WEAK void halide_posix_thread_pool_cleanup() {
 }
 
 WEAK void halide_set_num_threads(int n) {
-    if (halide_num_threads == n) {
+    halide_mutex_lock((halide_mutex *)&halide_work_queue.resize_mutex);
+    InitOnceExecuteOnce(&halide_work_queue.init_once, InitOnceCallback, NULL, NULL);
+    EnterCriticalSection(&halide_work_queue.mutex);
+
+    if (!halide_thread_pool_initialized) {
+        // The pool will be created at this size on first use.
+        halide_num_threads = n;
+        LeaveCriticalSection(&halide_work_queue.mutex);
+        halide_mutex_unlock((halide_mutex *)&halide_work_queue.resize_mutex);
         return;
     }
 
-    if (halide_thread_pool_initialized) {
-        halide_shutdown_thread_pool();
+    if (n < 1) {
+        n = default_num_threads();
+    }
+
+    if (n >= halide_num_threads) {
+        halide_num_threads = n;
+        grow_thread_pool();
+        LeaveCriticalSection(&halide_work_queue.mutex);
+    } else {
+        // Lower the thread count and wake everyone. Workers numbered
+        // beyond the new count finish the task they are on and then
+        // quit.
+        int old_num_workers = halide_work_queue.num_workers;
+        halide_num_threads = n;
+        halide_work_queue.num_workers = n - 1;
+        if (halide_work_queue.target_a_team_size > n) {
+            halide_work_queue.target_a_team_size = n;
+        }
+        WakeAllConditionVariable(&halide_work_queue.wakeup_a_team);
+        WakeAllConditionVariable(&halide_work_queue.wakeup_b_team);
+        LeaveCriticalSection(&halide_work_queue.mutex);
+
+        for (int i = n - 1; i < old_num_workers; i++) {
+            WaitForSingleObject(halide_work_queue.threads[i], -1);
+        }
+    }
+
+    halide_mutex_unlock((halide_mutex *)&halide_work_queue.resize_mutex);
+}
+
+WEAK void halide_set_thread_affinity(halide_thread_affinity_t) {
+}
+
+WEAK void halide_set_thread_pool_spin_budget(int, int) {
+}
+
+WEAK void halide_set_worker_stack_size(size_t size) {
+    halide_worker_stack_size = size;
+}
+
+WEAK int32_t halide_get_stack_allocation_limit() {
+    // Every thread's stack is a single reservation, which grows down
+    // towards its base. The guard pages at the bottom come out of
+    // the half of what's left that isn't handed out below.
+    MemoryBasicInformation info;
+    uintptr_t sp = (uintptr_t)__builtin_frame_address(0);
+    if (VirtualQuery((void *)sp, &info, sizeof(info)) == 0) {
+        return 0;
     }
+    uintptr_t lo = (uintptr_t)info.AllocationBase;
+    size_t left = lo < sp ? sp - lo : 0;
+    // Leave half of what's left for everything else, including
+    // later allocations made under the same limit.
+    left /= 2;
+    if (left > 0x7fffffff) {
+        left = 0x7fffffff;
+    }
+    return (int32_t)left;
+}
 
-    halide_num_threads = n;
+WEAK void halide_get_thread_pool_wait_counters(halide_thread_pool_wait_counters *counters) {
+    memset(counters, 0, sizeof(*counters));
+}
+
+WEAK void halide_reset_thread_pool_wait_counters() {
+}
+
+WEAK void halide_enable_thread_pool_stats(int enabled) {
+}
+
+WEAK int halide_get_thread_pool_stats(halide_thread_pool *pool, halide_thread_pool_stats *stats,
+                                      halide_thread_pool_worker_stats *workers, int max_workers) {
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    return 0;
+}
+
+WEAK void halide_reset_thread_pool_stats(halide_thread_pool *pool) {
+}
+
+WEAK void halide_do_async(void *user_context, int (*f)(void **), void **args,
+                          void (*done)(void *, int, void *), void *done_arg) {
+    // Not supported yet. Run it now.
+    int result = f(args);
+    if (done) {
+        done(user_context, result, done_arg);
+    }
+}
+
+WEAK halide_thread_pool *halide_create_thread_pool(const char *name, int num_threads, int priority) {
+    return NULL;
+}
+
+WEAK halide_thread_pool *halide_find_thread_pool(const char *name) {
+    return NULL;
+}
+
+WEAK void halide_destroy_thread_pool(halide_thread_pool *pool) {
+}
+
+WEAK void halide_set_thread_pool_num_threads(halide_thread_pool *pool, int n) {
+    if (!pool) {
+        halide_set_num_threads(n);
+    }
+}
+
+WEAK halide_thread_pool *halide_get_thread_pool(void *user_context) {
+    return NULL;
+}
+
+WEAK halide_thread_pool *(*halide_set_custom_get_thread_pool(halide_thread_pool *(*f)(void *)))(void *) {
+    return NULL;
 }
 
 WEAK int (*halide_set_custom_do_task(int (*f)(void *, halide_task, int, uint8_t *)))
@@ -397,4 +671,22 @@ WEAK int halide_do_par_for(void *user_context, int (*f)(void *, int, uint8_t *),
     return (*halide_custom_do_par_for)(user_context, f, min, size, closure);
 }
 
+WEAK int (*halide_set_custom_do_guided_par_for(int (*f)(void *, halide_task, int, int, uint8_t *)))
+          (void *, halide_task, int, int, uint8_t *) {
+    int (*result)(void *, halide_task, int, int, uint8_t *) = halide_custom_do_guided_par_for;
+    halide_custom_do_guided_par_for = f;
+    return result;
+}
+
+WEAK int halide_do_guided_par_for(void *user_context, int (*f)(void *, int, uint8_t *),
+                                  int min, int size, uint8_t *closure) {
+    if (halide_custom_do_guided_par_for == default_do_guided_par_for &&
+        halide_custom_do_par_for != default_do_par_for) {
+        // Someone else is managing the threads, and doesn't
+        // distinguish guided loops.
+        return (*halide_custom_do_par_for)(user_context, f, min, size, closure);
+    }
+    return (*halide_custom_do_guided_par_for)(user_context, f, min, size, closure);
+}
+
 } // extern "C"
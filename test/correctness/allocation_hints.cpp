@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include "Halide.h"
+
+using namespace Halide;
+
+// Count the large allocations that reach the allocator. Only buffers
+// that ask for hints are mapped directly instead.
+
+const size_t big = 16 * 1024 * 1024;
+int big_malloc_count = 0;
+
+void *my_malloc(void *user_context, size_t x) {
+    if (x >= big) {
+        big_malloc_count++;
+    }
+    void *orig = malloc(x+40);
+    void *ptr = (void *)((((size_t)orig + 32) >> 5) << 5);
+    ((void **)ptr)[-1] = orig;
+    return ptr;
+}
+
+void my_free(void *user_context, void *ptr) {
+    free(((void**)ptr)[-1]);
+}
+
+int main(int argc, char **argv) {
+    const int W = 4096, H = 1024;
+
+    Var x, y;
+    Func f, g, h, out;
+    f(x, y) = x + y;
+    g(x, y) = x * 2 - y;
+    h(x, y) = f(x, y) * g(x, y);
+    out(x, y) = f(x, y) + g(x, y) + h(x, y);
+
+    // f doesn't ask for hints, and g asks for none, so both come from
+    // the allocator however big they are. h asks for huge pages spread
+    // across NUMA nodes. Without libnuma h still gets mapped, just not
+    // spread out.
+    f.compute_root();
+    g.compute_root().allocation_hints(halide_allocation_hint_none);
+    h.compute_root().parallel(y).allocation_hints(halide_allocation_hint_huge_pages |
+                                                  halide_allocation_hint_numa_interleave);
+
+    out.bound(x, 0, W).bound(y, 0, H);
+
+    out.set_custom_allocator(my_malloc, my_free);
+    Image<int> im = out.realize(W, H);
+
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            int fv = x + y, gv = x * 2 - y;
+            int correct = fv + gv + fv * gv;
+            if (im(x, y) != correct) {
+                printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), correct);
+                return -1;
+            }
+        }
+    }
+
+    // On platforms that can't map memory, every buffer comes from the
+    // allocator.
+    if (big_malloc_count != 2 && big_malloc_count != 3) {
+        printf("%d large allocations reached the allocator\n", big_malloc_count);
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include "Halide.h"
+
+using namespace Halide;
+
+#ifdef _MSC_VER
+#define DLLEXPORT __declspec(dllexport)
+#else
+#define DLLEXPORT
+#endif
+
+// A parallel for loop runner that runs the tasks in order, and keeps
+// track of which task of which loop is running.
+int current_task = -1, current_loop_size = 0;
+int recording_do_par_for(void *ctx, int (*f)(void *, int, uint8_t *), int min, int extent, uint8_t *closure) {
+    int old_task = current_task, old_loop_size = current_loop_size;
+    int result = 0;
+    for (int i = min; i < min + extent && result == 0; i++) {
+        current_task = i;
+        current_loop_size = extent;
+        result = f(ctx, i, closure);
+    }
+    current_task = old_task;
+    current_loop_size = old_loop_size;
+    return result;
+}
+
+// Records the task the first point of each stage was computed in.
+int stage_task[2], stage_loop_size[2];
+extern "C" DLLEXPORT int record_task(int stage, int x) {
+    if (x == 0) {
+        stage_task[stage] = current_task;
+        stage_loop_size[stage] = current_loop_size;
+    }
+    return x;
+}
+HalideExtern_2(int, record_task, int, int);
+
+int silent_trace(void *, const halide_trace_event *) {
+    return 0;
+}
+
+// Check whether two independent stages, the first of them async, get
+// computed by different tasks of the same two-task parallel loop.
+bool stages_overlap(bool trace_first) {
+    Var x;
+    Func p, q, out;
+    p(x) = record_task(0, x);
+    q(x) = record_task(1, x);
+    out(x) = p(x) + q(x);
+    p.compute_root().async();
+    q.compute_root();
+    if (trace_first) {
+        // Tracing rules out running p alongside q.
+        p.trace_stores();
+        p.set_custom_trace(&silent_trace);
+    }
+    out.set_custom_do_par_for(&recording_do_par_for);
+    for (int i = 0; i < 2; i++) {
+        stage_task[i] = -1;
+        stage_loop_size[i] = 0;
+    }
+    out.realize(16);
+    return (stage_loop_size[0] == 2 && stage_loop_size[1] == 2 &&
+            stage_task[0] != stage_task[1]);
+}
+
+int main(int argc, char **argv) {
+    Var x, y;
+    Param<int> k;
+    k.set(3);
+
+    // f, g and e don't depend on each other, so they may run
+    // concurrently. d depends on g, so it must not run alongside it.
+    Func f, g, e, d, h;
+    f(x, y) = x + y + k;
+    g(x, y) = x * y;
+    RDom r(0, 10);
+    e(x, y) = 0;
+    e(x, y) += x - y + r;
+    d(x, y) = g(x, y) * 2;
+    h(x, y) = f(x, y) + g(x, y) + e(x, y) + d(x, y);
+
+    f.compute_root().async().parallel(y);
+    g.compute_root().async();
+    e.compute_root().async().update().parallel(y);
+    d.compute_root();
+
+    Image<int> im = h.realize(64, 64);
+
+    for (int y = 0; y < 64; y++) {
+        for (int x = 0; x < 64; x++) {
+            int correct = (x + y + 3) + (x * y) + 10 * (x - y) + 45 + (x * y * 2);
+            if (im(x, y) != correct) {
+                printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), correct);
+                return -1;
+            }
+        }
+    }
+
+    if (!stages_overlap(false)) {
+        printf("The async stage wasn't run alongside the next one\n");
+        return -1;
+    }
+
+    if (stages_overlap(true)) {
+        printf("A traced async stage was run alongside the next one\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
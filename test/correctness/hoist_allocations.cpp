@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include "Halide.h"
+
+using namespace Halide;
+
+// Count the allocations that reach the allocator.
+
+int malloc_count = 0;
+
+void *my_malloc(void *user_context, size_t x) {
+    malloc_count++;
+    void *orig = malloc(x+40);
+    void *ptr = (void *)((((size_t)orig + 32) >> 5) << 5);
+    ((void **)ptr)[-1] = orig;
+    return ptr;
+}
+
+void my_free(void *user_context, void *ptr) {
+    free(((void**)ptr)[-1]);
+}
+
+int main(int argc, char **argv) {
+    const int W = 8192, H = 100;
+
+    // f and g are computed per row of h, and are too big for the
+    // stack. Their size doesn't depend on the row, so they should be
+    // allocated once for all of h, not once per row.
+    Param<int> k;
+    k.set(3);
+    Var x, y;
+    Func f, g, h;
+    f(x, y) = x + y + k;
+    g(x, y) = f(x, y) * 2 + f(x + k, y);
+    h(x, y) = g(x, y) + g(x + k, y);
+    f.compute_at(h, y);
+    g.compute_at(h, y);
+
+    h.set_custom_allocator(my_malloc, my_free);
+    Image<int> im = h.realize(W, H);
+
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            int f0 = x + y + 3, f1 = x + 3 + y + 3, f2 = x + 6 + y + 3;
+            int correct = (f0 * 2 + f1) + (f1 * 2 + f2);
+            if (im(x, y) != correct) {
+                printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), correct);
+                return -1;
+            }
+        }
+    }
+
+    if (malloc_count != 2) {
+        printf("%d allocations instead of 2\n", malloc_count);
+        return -1;
+    }
+
+    // Buffers that get copied to and from a device per row have a
+    // buffer_t made for them inside the row loop, and their device
+    // allocations are freed along with them, so they have to stay in
+    // the loop too.
+    Target target = get_jit_target_from_environment();
+    if (target.has_gpu_feature()) {
+        Func f_gpu, g_gpu, h_gpu;
+        f_gpu(x, y) = x + y + k;
+        g_gpu(x, y) = f_gpu(x, y) * 2 + f_gpu(x + k, y);
+        h_gpu(x, y) = g_gpu(x, y) + g_gpu(x + k, y);
+        f_gpu.compute_at(h_gpu, y);
+        g_gpu.compute_at(h_gpu, y).gpu_tile(x, 64);
+
+        Image<int> im2 = h_gpu.realize(W, H, target);
+
+        for (int y = 0; y < H; y++) {
+            for (int x = 0; x < W; x++) {
+                int f0 = x + y + 3, f1 = x + 3 + y + 3, f2 = x + 6 + y + 3;
+                int correct = (f0 * 2 + f1) + (f1 * 2 + f2);
+                if (im2(x, y) != correct) {
+                    printf("im2(%d, %d) = %d instead of %d\n", x, y, im2(x, y), correct);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "Halide.h"
 #include "HalideRuntime.h"
 
@@ -79,6 +80,40 @@ extern "C" DLLEXPORT int count_calls_staged(int32_t stage, uint8_t val, buffer_t
     return 0;
 }
 
+int call_count_expensive = 0;
+
+extern "C" DLLEXPORT int count_calls_expensive(buffer_t *out) {
+    if (out->host) {
+        call_count_expensive++;
+        // Take long enough that the result is worth keeping.
+        volatile int spin = 0;
+        for (int i = 0; i < 10000000; i++) {
+            spin = spin + 1;
+        }
+        for (int32_t i = 0; i < out->extent[0]; i++) {
+            for (int32_t j = 0; j < out->extent[1]; j++) {
+                out->host[i * out->stride[0] + j * out->stride[1]] = 17;
+            }
+        }
+    }
+    return 0;
+}
+
+int call_count_xy = 0;
+
+extern "C" DLLEXPORT int count_calls_xy(buffer_t *out) {
+    if (out->host) {
+        call_count_xy++;
+        for (int32_t i = 0; i < out->extent[0]; i++) {
+            for (int32_t j = 0; j < out->extent[1]; j++) {
+                out->host[i * out->stride[0] + j * out->stride[1]] =
+                    (uint8_t)(out->min[0] + i + 2 * (out->min[1] + j));
+            }
+        }
+    }
+    return 0;
+}
+
 int main(int argc, char **argv) {
 
     {
@@ -573,6 +608,246 @@ int main(int argc, char **argv) {
 
     }
 
+    {
+        // Test that cost-aware eviction keeps a small result that's
+        // expensive to compute, while large cheap results come and go.
+        Func expensive;
+        expensive.define_extern("count_calls_expensive",
+                                std::vector<ExternFuncArgument>(),
+                                UInt(8), 2);
+        expensive.compute_root().memoize();
+
+        Param<float> val;
+        Func cheap;
+        cheap.define_extern("count_calls_with_arg",
+                            Internal::vec(ExternFuncArgument(cast<uint8_t>(val))),
+                            UInt(8), 2);
+        cheap.compute_root().memoize();
+
+        Func small, large;
+        Var x, y;
+        small(x, y) = expensive(x, y);
+        large(x, y) = cheap(x, y);
+
+        // Room for the expensive result and one cheap one.
+        small.compile_jit();
+        large.compile_jit();
+        Internal::JITSharedRuntime::memoization_cache_set_size(16 * 16 + 256 * 256 + 1000);
+        Internal::JITSharedRuntime::memoization_cache_set_policy(halide_memoization_cache_greedy_dual_size);
+
+        call_count_expensive = 0;
+        call_count_with_arg = 0;
+        Image<uint8_t> out1 = small.realize(16, 16);
+        for (int v = 0; v < 10; v++) {
+            // By recency alone, the expensive result would be the
+            // first to go.
+            val.set((float)v);
+            Image<uint8_t> l = large.realize(256, 256);
+            assert(l(3, 4) == v);
+        }
+        Image<uint8_t> out2 = small.realize(16, 16);
+        assert(out1(3, 4) == 17 && out2(3, 4) == 17);
+
+        if (call_count_expensive != 1 || call_count_with_arg != 10) {
+            fprintf(stderr, "Expensive Func computed %d times, cheap Func %d times\n",
+                    call_count_expensive, call_count_with_arg);
+            return -1;
+        }
+
+        // Return cache settings to default.
+        Internal::JITSharedRuntime::memoization_cache_set_policy(halide_memoization_cache_lru);
+        Internal::JITSharedRuntime::memoization_cache_set_size(0);
+    }
+
+    {
+        // Test that results in their own partition aren't evicted to
+        // make room for results in the default one.
+        Func hot;
+        hot.define_extern("count_calls",
+                          std::vector<ExternFuncArgument>(),
+                          UInt(8), 2);
+        hot.compute_root().memoize("hot", 64 * 1024);
+
+        Param<float> val;
+        Func cheap;
+        cheap.define_extern("count_calls_with_arg",
+                            Internal::vec(ExternFuncArgument(cast<uint8_t>(val))),
+                            UInt(8), 2);
+        cheap.compute_root().memoize();
+
+        Func small, large;
+        Var x, y;
+        small(x, y) = hot(x, y);
+        large(x, y) = cheap(x, y);
+
+        // Only room for one large result in the default partition.
+        small.compile_jit();
+        large.compile_jit();
+        Internal::JITSharedRuntime::memoization_cache_set_size(256 * 256 + 1000);
+
+        call_count = 0;
+        call_count_with_arg = 0;
+        for (int v = 0; v < 10; v++) {
+            Image<uint8_t> s = small.realize(16, 16);
+            assert(s(3, 4) == 42);
+            val.set((float)v);
+            Image<uint8_t> l = large.realize(256, 256);
+            assert(l(3, 4) == v);
+        }
+
+        if (call_count != 1 || call_count_with_arg != 10) {
+            fprintf(stderr, "Partitioned Func computed %d times, default partition Func %d times\n",
+                    call_count, call_count_with_arg);
+            return -1;
+        }
+
+        // Return cache settings to default.
+        Internal::JITSharedRuntime::memoization_cache_set_size(0);
+    }
+
+    {
+        // Test the cache stats.
+        call_count = 0;
+        Func count_calls("stats_count_calls");
+        count_calls.define_extern("count_calls",
+                                  std::vector<ExternFuncArgument>(),
+                                  UInt(8), 2);
+        count_calls.compute_root().memoize();
+
+        Func f;
+        Var x, y;
+        f(x, y) = count_calls(x, y) + cast<uint8_t>(x);
+
+        halide_memoization_cache_stats before, after;
+        f.compile_jit();
+        Internal::JITSharedRuntime::memoization_cache_get_stats(&before);
+        for (int i = 0; i < 3; i++) {
+            Image<uint8_t> out = f.realize(10, 10);
+        }
+        assert(call_count == 1);
+
+        halide_memoization_cache_func_stats funcs[64];
+        int num_funcs = Internal::JITSharedRuntime::memoization_cache_get_stats(&after, funcs, 64);
+        if (after.hits != before.hits + 2 || after.misses != before.misses + 1 ||
+            after.stores != before.stores + 1) {
+            fprintf(stderr, "Cache stats saw %d hits, %d misses and %d stores instead of 2, 1 and 1\n",
+                    (int)(after.hits - before.hits), (int)(after.misses - before.misses),
+                    (int)(after.stores - before.stores));
+            return -1;
+        }
+
+        bool found = false;
+        for (int i = 0; i < num_funcs && i < 64; i++) {
+            if (strcmp(funcs[i].name, "stats_count_calls") == 0) {
+                found = true;
+                if (funcs[i].hits != 2 || funcs[i].misses != 1 ||
+                    funcs[i].num_entries != 1 || funcs[i].bytes_resident != 10 * 10) {
+                    fprintf(stderr, "Cache stats for %s: %d hits, %d misses, %d entries, %d bytes\n",
+                            funcs[i].name, (int)funcs[i].hits, (int)funcs[i].misses,
+                            funcs[i].num_entries, (int)funcs[i].bytes_resident);
+                    return -1;
+                }
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "No cache stats for stats_count_calls\n");
+            return -1;
+        }
+    }
+
+    {
+        // Test that a lookup for part of a cached result finds it.
+        Func count_calls;
+        count_calls.define_extern("count_calls_xy",
+                                  std::vector<ExternFuncArgument>(),
+                                  UInt(8), 2);
+        count_calls.compute_root().memoize();
+
+        Param<int> offset;
+        Func f;
+        Var x, y;
+        f(x, y) = count_calls(x + offset, y + offset);
+
+        call_count_xy = 0;
+        offset.set(0);
+        Image<uint8_t> whole = f.realize(64, 64);
+        // Tiles within the first result, and one that sticks out of it.
+        int offsets[] = {0, 16, 40, 60};
+        int sizes[] = {32, 16, 24, 8};
+        for (int t = 0; t < 4; t++) {
+            offset.set(offsets[t]);
+            Image<uint8_t> tile = f.realize(sizes[t], sizes[t]);
+            for (int j = 0; j < sizes[t]; j++) {
+                for (int i = 0; i < sizes[t]; i++) {
+                    uint8_t correct = (uint8_t)(i + offsets[t] + 2 * (j + offsets[t]));
+                    if (tile(i, j) != correct) {
+                        fprintf(stderr, "tile %d (%d, %d) = %d instead of %d\n",
+                                t, i, j, tile(i, j), correct);
+                        return -1;
+                    }
+                }
+            }
+        }
+
+        if (call_count_xy != 2) {
+            fprintf(stderr, "Computed %d times instead of 2\n", call_count_xy);
+            return -1;
+        }
+    }
+
+#ifndef _WIN32
+    {
+        // Test that a result stored in the persistent file is found
+        // there once it has been evicted from memory.
+        const char *path = "memoize_persistent.cache";
+        remove(path);
+
+        Param<float> val;
+        Func count_calls;
+        count_calls.define_extern("count_calls_with_arg",
+                                  Internal::vec(ExternFuncArgument(cast<uint8_t>(val))),
+                                  UInt(8), 2);
+        count_calls.compute_root().memoize();
+
+        Func f;
+        Var x, y;
+        f(x, y) = count_calls(x, y) + cast<uint8_t>(x);
+        f.compile_jit();
+
+        int result = Internal::JITSharedRuntime::memoization_cache_set_persistent_file(path, 1 << 20);
+        assert(result == 0);
+
+        call_count_with_arg = 0;
+        halide_memoization_cache_stats before, after;
+        Internal::JITSharedRuntime::memoization_cache_get_stats(&before);
+        for (int v = 0; v < 2; v++) {
+            val.set((float)v);
+            Image<uint8_t> out = f.realize(10, 10);
+            assert(out(3, 4) == v + 3);
+        }
+
+        // Empty the in-memory cache.
+        Internal::JITSharedRuntime::memoization_cache_set_size(1);
+        Internal::JITSharedRuntime::memoization_cache_set_size(0);
+
+        for (int v = 0; v < 2; v++) {
+            val.set((float)v);
+            Image<uint8_t> out = f.realize(10, 10);
+            assert(out(3, 4) == v + 3);
+        }
+        Internal::JITSharedRuntime::memoization_cache_get_stats(&after);
+
+        if (call_count_with_arg != 2 || after.persistent_hits != before.persistent_hits + 2) {
+            fprintf(stderr, "Computed %d times with %d hits in the persistent file instead of 2 and 2\n",
+                    call_count_with_arg, (int)(after.persistent_hits - before.persistent_hits));
+            return -1;
+        }
+
+        Internal::JITSharedRuntime::memoization_cache_set_persistent_file(NULL, 0);
+        remove(path);
+    }
+#endif
+
     fprintf(stderr, "Success!\n");
     return 0;
 }
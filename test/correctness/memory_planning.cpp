@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include "Halide.h"
+
+using namespace Halide;
+
+// Count the allocations that reach the allocator, and the most memory
+// in use at once.
+
+int malloc_count = 0;
+size_t bytes_in_use = 0, peak_bytes_in_use = 0;
+
+void *my_malloc(void *user_context, size_t x) {
+    malloc_count++;
+    bytes_in_use += x;
+    if (bytes_in_use > peak_bytes_in_use) {
+        peak_bytes_in_use = bytes_in_use;
+    }
+    void *orig = malloc(x+40);
+    void *ptr = (void *)((((size_t)orig + 32) >> 5) << 5);
+    ((void **)ptr)[-1] = orig;
+    ((size_t *)ptr)[-2] = x;
+    return ptr;
+}
+
+void my_free(void *user_context, void *ptr) {
+    bytes_in_use -= ((size_t *)ptr)[-2];
+    free(((void**)ptr)[-1]);
+}
+
+int main(int argc, char **argv) {
+    const int W = 256, H = 256, stages = 6;
+
+    // A chain of compute_root stages, each used only by the next. Only
+    // two of them are ever alive at once, so they should fit in two
+    // buffers' worth of memory.
+    Var x, y;
+    Func f[stages];
+    f[0](x, y) = x + y;
+    for (int i = 1; i < stages; i++) {
+        f[i](x, y) = f[i-1](x, y) + f[i-1](x+1, y) * 2;
+        f[i-1].compute_root();
+    }
+    Func out;
+    out(x, y) = f[stages-1](x, y);
+    f[stages-1].compute_root();
+
+    out.set_custom_allocator(my_malloc, my_free);
+    Image<int> im = out.realize(W, H);
+
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            int correct = 0;
+            // Each stage is a weighted sum of the first one along x.
+            int weight = 1;
+            for (int k = 0; k < stages; k++) {
+                if (k > 0) weight = weight * (stages - k) / k;
+                correct += weight * (1 << k) * (x + k + y);
+            }
+            if (im(x, y) != correct) {
+                printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), correct);
+                return -1;
+            }
+        }
+    }
+
+    // Every stage is a little wider than the one after it. None is more
+    // than (W + stages) * H ints.
+    size_t biggest = (W + stages) * H * sizeof(int);
+    if (malloc_count != 2 || peak_bytes_in_use > 2 * biggest) {
+        printf("%d allocations, with at most %d bytes in use at once\n",
+               malloc_count, (int)peak_bytes_in_use);
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
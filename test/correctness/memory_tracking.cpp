@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <string.h>
+#include "Halide.h"
+#include "HalideRuntime.h"
+
+using namespace Halide;
+
+const halide_memory_tracker_func_stats *find(const halide_memory_tracker_func_stats *funcs,
+                                             int num_funcs, const char *name) {
+    for (int i = 0; i < num_funcs; i++) {
+        if (strcmp(funcs[i].name, name) == 0) {
+            return &funcs[i];
+        }
+    }
+    printf("No memory stats for %s\n", name);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    const int W = 8192, H = 16;
+
+    // f and g are compute_root, and h is computed per row of the
+    // output, in parallel. The output has constant bounds, so the
+    // compiler knows how much memory each of them needs.
+    Var x, y;
+    Func f("f"), g("g"), h("h"), out("out");
+    f(x, y) = x + y;
+    g(x, y) = f(x, y) * 2;
+    h(x, y) = g(x, y) + f(x, y);
+    out(x, y) = h(x, y) + h(x + 1, y);
+    f.compute_root();
+    g.compute_root();
+    h.compute_at(out, y);
+    out.bound(x, 0, W).bound(y, 0, H).parallel(y);
+
+    Target target = get_jit_target_from_environment();
+    target.set_feature(Target::TrackMemory);
+    out.compile_jit(target);
+
+    Internal::JITSharedRuntime::memory_tracker_reset_stats();
+    Image<int> im = out.realize(W, H, target);
+
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            int correct = 3 * (x + y) + 3 * (x + 1 + y);
+            if (im(x, y) != correct) {
+                printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), correct);
+                return -1;
+            }
+        }
+    }
+
+    halide_memory_tracker_stats stats;
+    halide_memory_tracker_func_stats funcs[16];
+    int num_funcs = Internal::JITSharedRuntime::memory_tracker_get_stats(&stats, funcs, 16);
+    if (num_funcs > 16) num_funcs = 16;
+
+    const halide_memory_tracker_func_stats *fs = find(funcs, num_funcs, "f");
+    const halide_memory_tracker_func_stats *gs = find(funcs, num_funcs, "g");
+    const halide_memory_tracker_func_stats *hs = find(funcs, num_funcs, "h");
+    if (!fs || !gs || !hs) return -1;
+
+    int64_t root_bytes = (int64_t)(W + 1) * H * sizeof(int);
+    int64_t row_bytes = (int64_t)(W + 1) * sizeof(int);
+    if (fs->peak_bytes != root_bytes || fs->static_bound_bytes != root_bytes ||
+        gs->peak_bytes != root_bytes || gs->static_bound_bytes != root_bytes ||
+        fs->num_allocations != 1 || gs->num_allocations != 1) {
+        printf("Wrong stats for compute_root Funcs:\n"
+               "f: %lld bytes at peak, bound %lld, %d allocations\n"
+               "g: %lld bytes at peak, bound %lld, %d allocations\n",
+               (long long)fs->peak_bytes, (long long)fs->static_bound_bytes, (int)fs->num_allocations,
+               (long long)gs->peak_bytes, (long long)gs->static_bound_bytes, (int)gs->num_allocations);
+        return -1;
+    }
+
+    // Each parallel task allocates a row of h. How many are around at
+    // once depends on the thread count, but it's never more than the
+    // number of rows.
+    if (hs->num_allocations != H || hs->peak_bytes < row_bytes ||
+        hs->peak_bytes > hs->static_bound_bytes || hs->static_bound_bytes != row_bytes * H) {
+        printf("Wrong stats for h: %lld bytes at peak, bound %lld, %d allocations\n",
+               (long long)hs->peak_bytes, (long long)hs->static_bound_bytes, (int)hs->num_allocations);
+        return -1;
+    }
+
+    // Everything has been freed.
+    if (stats.current_bytes != 0 || fs->current_bytes != 0 ||
+        gs->current_bytes != 0 || hs->current_bytes != 0 ||
+        stats.peak_bytes < 2 * root_bytes + row_bytes) {
+        printf("%lld bytes still in use, with %lld at peak\n",
+               (long long)stats.current_bytes, (long long)stats.peak_bytes);
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
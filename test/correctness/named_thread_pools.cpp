@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include "Halide.h"
+
+using namespace Halide;
+
+halide_thread_pool *the_pool = NULL;
+int pool_requests = 0;
+
+halide_thread_pool *my_get_thread_pool(void *ctx) {
+    pool_requests++;
+    return the_pool;
+}
+
+int main(int argc, char **argv) {
+    Var x, y;
+    Func f;
+    f(x, y) = x * y;
+    f.parallel(y);
+    f.set_custom_get_thread_pool(&my_get_thread_pool);
+
+    // The shared runtime only exists once something has been compiled.
+    f.compile_jit();
+    the_pool = Internal::JITSharedRuntime::create_thread_pool("my_pool", 3);
+
+#if defined(__linux__) || defined(__ANDROID__)
+    if (!the_pool) {
+        printf("Failed to create a thread pool\n");
+        return -1;
+    }
+#endif
+
+    Image<int> im = f.realize(32, 32);
+
+    for (int j = 0; j < 32; j++) {
+        for (int i = 0; i < 32; i++) {
+            if (im(i, j) != i * j) {
+                printf("im[%d, %d] = %d instead of %d\n", i, j, im(i, j), i * j);
+                return -1;
+            }
+        }
+    }
+
+    if (pool_requests != 1) {
+        printf("Thread pool was requested %d times instead of once\n", pool_requests);
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
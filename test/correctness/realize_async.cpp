@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include "Halide.h"
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    Var x, y;
+    Param<int> offset;
+    Func f;
+    f(x, y) = x * y + offset;
+    f.parallel(y);
+
+    // Start several runs at once, each into its own buffer.
+    const int runs = 4;
+    offset.set(3);
+    std::vector<AsyncRealization> handles;
+    for (int i = 0; i < runs; i++) {
+        handles.push_back(f.realize_async(Internal::vec<int32_t>(100, 100)));
+    }
+
+    for (int i = 0; i < runs; i++) {
+        Image<int> im = handles[i].wait();
+        if (!handles[i].finished()) {
+            printf("Run %d isn't finished after waiting for it\n", i);
+            return -1;
+        }
+        for (int y = 0; y < 100; y++) {
+            for (int x = 0; x < 100; x++) {
+                if (im(x, y) != x * y + 3) {
+                    printf("im[%d, %d] = %d instead of %d\n", x, y, im(x, y), x * y + 3);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    // Dropping a handle without waiting must be safe too.
+    Image<int> out(10, 10);
+    f.realize_async(out);
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include "Halide.h"
+
+using namespace Halide;
+
+// Count the allocations that reach the allocator.
+
+int malloc_count = 0;
+
+void *my_malloc(void *user_context, size_t x) {
+    __sync_fetch_and_add(&malloc_count, 1);
+    void *orig = malloc(x+40);
+    void *ptr = (void *)((((size_t)orig + 32) >> 5) << 5);
+    ((void **)ptr)[-1] = orig;
+    return ptr;
+}
+
+void my_free(void *user_context, void *ptr) {
+    free(((void**)ptr)[-1]);
+}
+
+// f and g are computed per row of h, with sizes that depend on k,
+// so they go on the heap.
+Func make_pipeline(Param<int> k) {
+    Var x, y;
+    Func f, g, h;
+    f(x, y) = x + y + k;
+    g(x, y) = f(x, y) * 2 + f(x + k, y);
+    h(x, y) = g(x, y) + g(x + k, y);
+    h.parallel(y);
+    f.compute_at(h, y);
+    g.compute_at(h, y);
+    h.set_custom_allocator(my_malloc, my_free);
+    return h;
+}
+
+int main(int argc, char **argv) {
+    const int rows = 1024;
+
+    Param<int> k;
+    k.set(3);
+
+    Target target = get_jit_target_from_environment();
+    Image<int> reference = make_pipeline(k).realize(64, rows, target);
+    int heap_allocations = malloc_count;
+
+    target.set_feature(Target::ScratchArenas);
+    malloc_count = 0;
+    Image<int> im = make_pipeline(k).realize(64, rows, target);
+    int arena_allocations = malloc_count;
+
+    for (int y = 0; y < rows; y++) {
+        for (int x = 0; x < 64; x++) {
+            if (im(x, y) != reference(x, y)) {
+                printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), reference(x, y));
+                return -1;
+            }
+        }
+    }
+
+    // Only the first few tasks to use each arena should need to go to
+    // the allocator.
+    printf("%d allocations without scratch arenas, %d with\n", heap_allocations, arena_allocations);
+    if (arena_allocations * 2 > heap_allocations) {
+        printf("Scratch arenas didn't save allocations\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
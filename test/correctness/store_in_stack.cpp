@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include "Halide.h"
+
+#if defined(__linux__) || defined(__ANDROID__)
+#include <pthread.h>
+#endif
+
+using namespace Halide;
+
+// Count the allocations that reach the allocator.
+
+int malloc_count = 0;
+
+void *my_malloc(void *user_context, size_t x) {
+    malloc_count++;
+    void *orig = malloc(x+40);
+    void *ptr = (void *)((((size_t)orig + 32) >> 5) << 5);
+    ((void **)ptr)[-1] = orig;
+    return ptr;
+}
+
+void my_free(void *user_context, void *ptr) {
+    free(((void**)ptr)[-1]);
+}
+
+// On Linux, only the stacks of the thread pool's workers are known,
+// so rows computed by tasks on the main thread go on the heap. Count
+// those tasks.
+int main_thread_tasks = 0;
+#if defined(__linux__) || defined(__ANDROID__)
+pthread_t main_thread;
+
+int my_do_task(void *user_context, int (*f)(void *, int, uint8_t *), int idx, uint8_t *closure) {
+    if (pthread_equal(pthread_self(), main_thread)) {
+        main_thread_tasks++;
+    }
+    return f(user_context, idx, closure);
+}
+#endif
+
+int check(Image<int> im, int k) {
+    for (int y = 0; y < im.height(); y++) {
+        for (int x = 0; x < im.width(); x++) {
+            int correct = (x + y) * 2 + (x + k + y);
+            if (im(x, y) != correct) {
+                printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), correct);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    // f is computed per row of g, and its size depends on the width
+    // of the output, so it would normally go on the heap.
+    Param<int> k;
+    k.set(3);
+    Var x, y;
+    Func f, g;
+    f(x, y) = x + y;
+    g(x, y) = f(x, y) * 2 + f(x + k, y);
+    f.compute_at(g, y).store_in(MemoryType::Stack);
+    g.parallel(y);
+    g.set_custom_allocator(my_malloc, my_free);
+#if defined(__linux__) || defined(__ANDROID__)
+    main_thread = pthread_self();
+    g.set_custom_do_task(my_do_task);
+#endif
+
+    // 16KB rows fit on any worker's stack.
+    Image<int> small = g.realize(4096, 64);
+    if (check(small, 3)) return -1;
+    if (malloc_count > main_thread_tasks) {
+        printf("%d small rows went on the heap, but only %d were computed on the main thread\n",
+               malloc_count, main_thread_tasks);
+        return -1;
+    }
+
+    // 64MB rows don't fit on any stack, and go on the heap instead.
+    malloc_count = 0;
+    Image<int> big = g.realize(16 * 1024 * 1024, 2);
+    if (check(big, 3)) return -1;
+    if (malloc_count != 2) {
+        printf("%d big rows went on the heap instead of 2\n", malloc_count);
+        return -1;
+    }
+
+    // Rows of 1MB fit on a worker's stack one at a time, but not 24
+    // of them at once.
+    {
+        const int funcs = 24, width = 256 * 1024;
+        std::vector<Func> fs(funcs);
+        Func h;
+        Expr e = 0;
+        for (int i = 0; i < funcs; i++) {
+            fs[i](x, y) = x + y + i;
+            fs[i].compute_at(h, y).store_in(MemoryType::Stack);
+            e += fs[i](x, y);
+        }
+        h(x, y) = e;
+        h.parallel(y);
+        h.set_custom_allocator(my_malloc, my_free);
+
+        malloc_count = 0;
+        Image<int> im = h.realize(width, 4);
+        for (int y = 0; y < im.height(); y++) {
+            for (int x = 0; x < im.width(); x++) {
+                int correct = funcs * (x + y) + funcs * (funcs - 1) / 2;
+                if (im(x, y) != correct) {
+                    printf("im(%d, %d) = %d instead of %d\n", x, y, im(x, y), correct);
+                    return -1;
+                }
+            }
+        }
+        if (malloc_count == 0) {
+            printf("All %d rows went on the stack at once\n", funcs);
+            return -1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "Halide.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+using namespace Halide;
+
+// Trace the stores of a parallel loop to a file, and check that every
+// packet made it there whole, even though many threads were writing
+// packets at once. There are enough of them to fill the trace
+// buffers several times over.
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+    printf("Skipping test on Windows\n");
+    printf("Success!\n");
+    return 0;
+#else
+    const int W = 1000, H = 64;
+    const char *path = "tracing_to_file.bin";
+
+    Func f;
+    Var x, y;
+    f(x, y) = x * 1000 + y;
+    f.parallel(y).trace_stores();
+
+    // Set the file before anything is compiled, so that the shared
+    // runtime picks it up when it's created.
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        printf("Can't open %s\n", path);
+        return -1;
+    }
+    Internal::JITSharedRuntime::set_trace_file(fileno(out));
+    f.realize(W, H);
+    // The pipeline writes out what's still in the buffers when it's
+    // done.
+    Internal::JITSharedRuntime::set_trace_file(0);
+    fclose(out);
+
+    FILE *in = fopen(path, "rb");
+    std::vector<unsigned char> data;
+    unsigned char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    fclose(in);
+    remove(path);
+
+    std::vector<int> seen(W * H, 0);
+    size_t pos = 0;
+    while (pos < data.size()) {
+        if (pos + 32 > data.size()) {
+            printf("Truncated packet header at byte %d\n", (int)pos);
+            return -1;
+        }
+        const unsigned char *packet = &data[pos];
+        int event = packet[8], bits = packet[10], width = packet[11], dims = packet[13];
+        int bytes = 1;
+        while (bytes * 8 < bits) bytes <<= 1;
+        size_t size = 32 + width * bytes + dims * 4;
+        if (pos + size > data.size()) {
+            printf("Truncated packet at byte %d\n", (int)pos);
+            return -1;
+        }
+        if (event == halide_trace_store) {
+            int value, coords[2];
+            memcpy(&value, packet + 32, 4);
+            memcpy(coords, packet + 32 + width * bytes, 8);
+            if (dims != 2 || width != 1 || bits != 32 ||
+                coords[0] < 0 || coords[0] >= W || coords[1] < 0 || coords[1] >= H ||
+                value != coords[0] * 1000 + coords[1]) {
+                printf("Bad store packet at byte %d\n", (int)pos);
+                return -1;
+            }
+            seen[coords[1] * W + coords[0]]++;
+        }
+        pos += size;
+    }
+
+    for (int i = 0; i < W * H; i++) {
+        if (seen[i] != 1) {
+            printf("Store to (%d, %d) traced %d times\n", i % W, i / W, seen[i]);
+            return -1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+#endif
+}
@@ -0,0 +1,13 @@
+#include "Halide.h"
+#include <stdio.h>
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    // The shared runtime that would own the pool doesn't exist until
+    // something has been compiled for JIT.
+    Internal::JITSharedRuntime::create_thread_pool("too_soon", 2);
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "HalideRuntime.h"
+#include "static_image.h"
+#include "async_call.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+const int W = 64, H = 256;
+const int runs = 8;
+
+static int errors = 0;
+
+extern "C" void halide_error(void *user_context, const char *msg) {
+#ifdef _MSC_VER
+    // Calls run on the calling thread on Windows.
+    errors++;
+#else
+    // The failing run reports on a worker thread.
+    __sync_fetch_and_add(&errors, 1);
+#endif
+}
+
+// Everything a queued call refers to has to stay alive until its
+// callback runs.
+struct Run {
+    int offset;
+    buffer_t buf;
+    void *args[2];
+    volatile int calls;
+    volatile int result;
+};
+
+static void done(void *user_context, int result, void *done_arg) {
+    Run *run = (Run *)done_arg;
+    run->result = result;
+#ifdef _MSC_VER
+    run->calls++;
+#else
+    __sync_fetch_and_add(&run->calls, 1);
+#endif
+}
+
+static void nap() {
+#ifdef _WIN32
+    Sleep(1);
+#else
+    usleep(1000);
+#endif
+}
+
+// Wait for every run to report back, giving up after ten seconds.
+static bool wait_for(Run *r, int n) {
+    for (int i = 0; i < 10000; i++) {
+        bool all_done = true;
+        for (int j = 0; j < n; j++) {
+            all_done = all_done && r[j].calls != 0;
+        }
+        if (all_done) {
+            return true;
+        }
+        nap();
+    }
+    return false;
+}
+
+int main(int argc, char **argv) {
+    halide_set_num_threads(4);
+
+    // Queue several runs at once, each with its own offset and output.
+    Image<int> out[runs];
+    Run r[runs];
+    for (int i = 0; i < runs; i++) {
+        out[i] = Image<int>(W, H);
+        memset(&r[i], 0, sizeof(Run));
+        r[i].offset = i * 1000;
+        r[i].buf = *out[i];
+        r[i].args[0] = &r[i].offset;
+        r[i].args[1] = &r[i].buf;
+        r[i].result = -1;
+        async_call_async(r[i].args, done, &r[i]);
+    }
+
+    if (!wait_for(r, runs)) {
+        printf("Not every queued run called back\n");
+        return -1;
+    }
+
+    for (int i = 0; i < runs; i++) {
+        if (r[i].calls != 1 || r[i].result != 0) {
+            printf("Run %d called back %d times with result %d\n", i, r[i].calls, r[i].result);
+            return -1;
+        }
+        for (int y = 0; y < H; y++) {
+            for (int x = 0; x < W; x++) {
+                if (out[i](x, y) != x * y + r[i].offset) {
+                    printf("out[%d](%d, %d) = %d instead of %d\n",
+                           i, x, y, out[i](x, y), x * y + r[i].offset);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    if (errors) {
+        printf("The queued runs raised %d errors\n", errors);
+        return -1;
+    }
+
+    // A run that fails still calls back, with the error code.
+    Image<int> wrong(W / 2, H);
+    Run bad;
+    memset(&bad, 0, sizeof(Run));
+    bad.buf = *wrong;
+    bad.args[0] = &bad.offset;
+    bad.args[1] = &bad.buf;
+    async_call_async(bad.args, done, &bad);
+
+    if (!wait_for(&bad, 1)) {
+        printf("The failing run didn't call back\n");
+        return -1;
+    }
+    if (bad.calls != 1 || bad.result == 0 || errors == 0) {
+        printf("The failing run called back %d times with result %d and %d errors\n",
+               bad.calls, bad.result, errors);
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
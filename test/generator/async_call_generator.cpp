@@ -0,0 +1,24 @@
+#include "Halide.h"
+
+namespace {
+
+class AsyncCall : public Halide::Generator<AsyncCall> {
+public:
+    Param<int> offset{"offset", 0};
+
+    Func build() override {
+        Var x("x"), y("y");
+        Func f("f");
+
+        f(x, y) = x * y + offset;
+        f.parallel(y);
+        // So that the aottest can make a run fail.
+        f.bound(x, 0, 64);
+
+        return f;
+    }
+};
+
+Halide::RegisterGenerator<AsyncCall> register_my_gen{"async_call"};
+
+}  // namespace
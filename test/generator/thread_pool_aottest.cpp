@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "HalideRuntime.h"
+#include "static_image.h"
+#include "thread_pool.h"
+
+#if defined(__linux__) || defined(__ANDROID__)
+#include <pthread.h>
+#include <unistd.h>
+#define HALIDE_OWNS_THREADS 1
+#endif
+
+const int W = 64, H = 256;
+
+static int errors = 0;
+
+extern "C" void halide_error(void *user_context, const char *msg) {
+#ifdef HALIDE_OWNS_THREADS
+    // Workers may raise errors at the same time.
+    __sync_fetch_and_add(&errors, 1);
+#else
+    errors++;
+#endif
+}
+
+#ifdef HALIDE_OWNS_THREADS
+// While set, every task run on a worker thread tries to resize the
+// pool, which should be refused.
+static bool resize_from_tasks = false;
+static pthread_t main_thread;
+static int resizes_from_tasks = 0;
+
+extern "C" int halide_do_task(void *user_context, int (*f)(void *, int, uint8_t *),
+                              int idx, uint8_t *closure) {
+    if (resize_from_tasks && !pthread_equal(pthread_self(), main_thread)) {
+        __sync_fetch_and_add(&resizes_from_tasks, 1);
+        halide_set_num_threads(2);
+    } else if (resize_from_tasks) {
+        // Give the workers a chance to get to their tasks, even on a
+        // single core.
+        for (int i = 0; i < 1000 && !resizes_from_tasks; i++) {
+            usleep(1000);
+        }
+    }
+    return f(user_context, idx, closure);
+}
+#endif
+
+bool run_and_check(int threads) {
+    Image<int> out(W, H);
+    int result = thread_pool(out);
+    if (result != 0) {
+        printf("Running on %d threads returned %d\n", threads, result);
+        return false;
+    }
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            if (out(x, y) != x * y + 3) {
+                printf("On %d threads, out(%d, %d) = %d instead of %d\n",
+                       threads, x, y, out(x, y), x * y + 3);
+                return false;
+            }
+        }
+    }
+#ifdef HALIDE_OWNS_THREADS
+    halide_thread_pool_stats stats;
+    halide_get_thread_pool_stats(NULL, &stats, NULL, 0);
+    if (stats.num_threads != threads) {
+        printf("The pool has %d threads instead of %d\n", stats.num_threads, threads);
+        return false;
+    }
+#endif
+    return true;
+}
+
+#ifdef HALIDE_OWNS_THREADS
+// Add up the stats of the default pool and its workers.
+void get_stats(halide_thread_pool_stats *totals, halide_thread_pool_worker_stats *worker_totals) {
+    static halide_thread_pool_worker_stats workers[256];
+    int n = halide_get_thread_pool_stats(NULL, totals, workers, 256);
+    memset(worker_totals, 0, sizeof(*worker_totals));
+    for (int i = 0; i < n && i < 256; i++) {
+        worker_totals->tasks += workers[i].tasks;
+        worker_totals->async_calls += workers[i].async_calls;
+        worker_totals->working_ns += workers[i].working_ns;
+        worker_totals->sleeping_ns += workers[i].sleeping_ns;
+        worker_totals->mutex_wait_ns += workers[i].mutex_wait_ns;
+        worker_totals->b_team_transitions += workers[i].b_team_transitions;
+    }
+}
+#endif
+
+int main(int argc, char **argv) {
+    // Grow and shrink the default pool between realizations, including
+    // far past the core count and all the way down to no workers.
+    const int sizes[] = {4, 128, 3, 1, 16, 2};
+    for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+        halide_set_num_threads(sizes[i]);
+        if (!run_and_check(sizes[i])) {
+            return -1;
+        }
+    }
+
+    if (errors) {
+        printf("Resizing the pool raised %d errors\n", errors);
+        return -1;
+    }
+
+#ifdef HALIDE_OWNS_THREADS
+    // With stats off, nothing is recorded.
+    halide_thread_pool_stats totals;
+    halide_thread_pool_worker_stats worker_totals;
+    halide_set_num_threads(4);
+    halide_enable_thread_pool_stats(0);
+    halide_reset_thread_pool_stats(NULL);
+    if (!run_and_check(4)) {
+        return -1;
+    }
+    get_stats(&totals, &worker_totals);
+    if (totals.jobs || totals.owner_tasks || totals.owner_working_ns || totals.owner_wait_ns ||
+        worker_totals.tasks || worker_totals.async_calls || worker_totals.working_ns ||
+        worker_totals.sleeping_ns || worker_totals.mutex_wait_ns || worker_totals.b_team_transitions) {
+        printf("Stats were recorded while disabled\n");
+        return -1;
+    }
+
+    // With stats on, every job and every task is counted, by the time
+    // each realization returns.
+    const int runs = 10;
+    halide_enable_thread_pool_stats(1);
+    for (int i = 0; i < runs; i++) {
+        if (!run_and_check(4)) {
+            return -1;
+        }
+    }
+    halide_enable_thread_pool_stats(0);
+    get_stats(&totals, &worker_totals);
+    if (totals.num_threads != 4 || totals.jobs != runs) {
+        printf("Stats report %d threads and %d jobs instead of 4 and %d\n",
+               totals.num_threads, (int)totals.jobs, runs);
+        return -1;
+    }
+    if (totals.owner_tasks + worker_totals.tasks != (uint64_t)(runs * H)) {
+        printf("Stats report %d tasks run by the owner and %d by workers, instead of %d in all\n",
+               (int)totals.owner_tasks, (int)worker_totals.tasks, runs * H);
+        return -1;
+    }
+
+    // With no spin budget, every wait blocks straight away.
+    halide_thread_pool_wait_counters counters;
+    halide_set_thread_pool_spin_budget(0, 0);
+    // Let any waits that started under the old budget end first.
+    usleep(10000);
+    halide_reset_thread_pool_wait_counters();
+    halide_get_thread_pool_wait_counters(&counters);
+    if (counters.worker_spin_wakeups || counters.worker_yield_wakeups || counters.worker_blocks ||
+        counters.owner_spin_wakeups || counters.owner_yield_wakeups || counters.owner_blocks) {
+        printf("Wait counters aren't zero after a reset\n");
+        return -1;
+    }
+    for (int i = 0; i < runs; i++) {
+        if (!run_and_check(4)) {
+            return -1;
+        }
+    }
+    // Give the workers time to go back to waiting, even on a single
+    // core.
+    usleep(10000);
+    halide_get_thread_pool_wait_counters(&counters);
+    if (counters.worker_spin_wakeups || counters.worker_yield_wakeups ||
+        counters.owner_spin_wakeups || counters.owner_yield_wakeups) {
+        printf("Threads spun or yielded with no spin budget\n");
+        return -1;
+    }
+    if (counters.worker_blocks == 0) {
+        printf("Workers never blocked with no spin budget\n");
+        return -1;
+    }
+
+    // With a generous budget, idle workers catch the next job while
+    // still polling for it. That needs a core to poll on.
+    halide_set_thread_pool_spin_budget(1 << 20, 1 << 10);
+    halide_reset_thread_pool_wait_counters();
+    for (int i = 0; i < runs; i++) {
+        if (!run_and_check(4)) {
+            return -1;
+        }
+    }
+    halide_get_thread_pool_wait_counters(&counters);
+    if (sysconf(_SC_NPROCESSORS_ONLN) > 1 &&
+        counters.worker_spin_wakeups + counters.worker_yield_wakeups == 0) {
+        printf("Workers never woke while spinning or yielding\n");
+        return -1;
+    }
+    halide_set_thread_pool_spin_budget(1024, 16);
+
+    // Resizing from inside a parallel task is an error, and leaves the
+    // pool as it was.
+    halide_set_num_threads(4);
+    main_thread = pthread_self();
+    resize_from_tasks = true;
+    bool ok = run_and_check(4);
+    resize_from_tasks = false;
+    if (!ok) {
+        return -1;
+    }
+    if (resizes_from_tasks == 0) {
+        printf("No tasks ran on worker threads\n");
+        return -1;
+    }
+    if (errors != resizes_from_tasks) {
+        printf("%d resizes from worker threads raised %d errors\n", resizes_from_tasks, errors);
+        return -1;
+    }
+#endif
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,20 @@
+#include "Halide.h"
+
+namespace {
+
+class ThreadPool : public Halide::Generator<ThreadPool> {
+public:
+    Func build() override {
+        Var x("x"), y("y");
+        Func f("f");
+
+        f(x, y) = x * y + 3;
+        f.parallel(y);
+
+        return f;
+    }
+};
+
+Halide::RegisterGenerator<ThreadPool> register_my_gen{"thread_pool"};
+
+}  // namespace
@@ -0,0 +1,85 @@
+#include "Halide.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "clock.h"
+
+using namespace Halide;
+
+// A cache hit hands the pipeline the cached buffer rather than a copy
+// of it, so hitting on a large memoized result should cost about the
+// same as hitting on a small one, and much less than copying it.
+
+double time_hits(Func g, Image<float> out) {
+    double best = 1e20;
+    for (int i = 0; i < 10; i++) {
+        double t1 = current_time();
+        g.realize(out);
+        double t2 = current_time();
+        if (t2 - t1 < best) best = t2 - t1;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    const int size = 2048;
+
+    Var x, y;
+    Func f, g;
+    f(x, y) = sin(x * 0.1f + y);
+    // Only touch the corners of f, so that g itself is cheap.
+    g(x, y) = f(x, y) + f(x + size - 1, y + size - 1);
+    f.compute_root().memoize();
+
+    Func small_f, small_g;
+    small_f(x, y) = sin(x * 0.1f + y);
+    small_g(x, y) = small_f(x, y) + small_f(x + 1, y + 1);
+    small_f.compute_root().memoize();
+
+    Image<float> out(1, 1);
+    g.compile_jit();
+    small_g.compile_jit();
+    Internal::JITSharedRuntime::memoization_cache_set_size(size * size * 8);
+
+    // Populate the cache.
+    g.realize(out);
+    float correct = sinf(0.0f) + sinf((size - 1) * 0.1f + size - 1);
+    if (fabs(out(0, 0) - correct) > 0.001f) {
+        printf("out(0, 0) = %f instead of %f\n", out(0, 0), correct);
+        return -1;
+    }
+    small_g.realize(out);
+
+    double large_time = time_hits(g, out);
+    double small_time = time_hits(small_g, out);
+
+    if (fabs(out(0, 0) - (sinf(0.0f) + sinf(1.1f))) > 0.001f) {
+        printf("Wrong result from the small pipeline: %f\n", out(0, 0));
+        return -1;
+    }
+
+    std::vector<float> src(size * size), dst(size * size);
+    double copy_time = 1e20;
+    for (int i = 0; i < 10; i++) {
+        double t1 = current_time();
+        memcpy(&dst[0], &src[0], size * size * sizeof(float));
+        double t2 = current_time();
+        if (t2 - t1 < copy_time) copy_time = t2 - t1;
+    }
+
+    printf("Hit on a %dx%d result: %f ms\n"
+           "Hit on a 2x2 result: %f ms\n"
+           "Copying a %dx%d result: %f ms\n",
+           size, size, large_time, small_time, size, size, copy_time);
+
+    if (large_time > copy_time) {
+        // Timing on loaded machines is noisy, so only warn.
+        fprintf(stderr, "WARNING: A cache hit on a large result took longer than copying it\n");
+    }
+
+    Internal::JITSharedRuntime::memoization_cache_set_size(0);
+
+    printf("Success!\n");
+    return 0;
+}
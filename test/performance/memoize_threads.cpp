@@ -0,0 +1,82 @@
+#include "Halide.h"
+#include <stdio.h>
+#include <pthread.h>
+#include "clock.h"
+
+using namespace Halide;
+
+// Several threads each run their own pipeline with a memoized
+// stage. Nearly every run is a cache hit, so this mostly measures
+// contention in the memoization cache.
+
+const int max_threads = 8;
+const int iterations = 2000;
+
+struct MemoizedPipeline {
+    Param<int> k;
+    Func f, g;
+    Image<float> out;
+
+    MemoizedPipeline() : out(16, 16) {
+        Var x, y;
+        f(x, y) = sin(x * y + k);
+        g(x, y) = f(x, y) * 2;
+        f.compute_root().memoize();
+        g.compile_jit();
+    }
+};
+
+MemoizedPipeline *pipelines[max_threads];
+
+void *run(void *arg) {
+    MemoizedPipeline *p = (MemoizedPipeline *)arg;
+    for (int i = 0; i < iterations; i++) {
+        p->k.set(i % 16);
+        p->g.realize(p->out);
+    }
+    return NULL;
+}
+
+double time_threads(int n) {
+    pthread_t threads[max_threads];
+    double t1 = current_time();
+    for (int i = 0; i < n; i++) {
+        pthread_create(threads + i, NULL, run, pipelines[i]);
+    }
+    for (int i = 0; i < n; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    return current_time() - t1;
+}
+
+int main(int argc, char **argv) {
+    for (int i = 0; i < max_threads; i++) {
+        pipelines[i] = new MemoizedPipeline;
+    }
+
+    // Warm up the cache.
+    time_threads(max_threads);
+
+    double single_thread_time = 0;
+    for (int n = 1; n <= max_threads; n *= 2) {
+        double t = time_threads(n);
+        double ns_per_run = t * 1e6 / (n * iterations);
+        printf("%d threads: %f ms, %f ns per run\n", n, t, ns_per_run);
+        if (n == 1) {
+            single_thread_time = ns_per_run;
+        } else if (ns_per_run > single_thread_time * n) {
+            // Even with fewer cores than threads, runs shouldn't get
+            // slower than serializing them all. Timing on loaded
+            // machines is noisy, so only warn.
+            fprintf(stderr, "WARNING: Memoized runs on %d threads took %f ns each vs %f ns on one thread\n",
+                    n, ns_per_run, single_thread_time);
+        }
+    }
+
+    for (int i = 0; i < max_threads; i++) {
+        delete pipelines[i];
+    }
+
+    printf("Success!\n");
+    return 0;
+}
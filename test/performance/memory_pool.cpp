@@ -0,0 +1,115 @@
+#include "Halide.h"
+#include <stdio.h>
+#include "clock.h"
+
+using namespace Halide;
+
+// A pipeline shaped like local_laplacian, with a pyramid of small
+// compute_root intermediates, run many times on a small image. Every
+// run allocates and frees the same buffers, so reusing them from the
+// memory pool should make each run cheaper.
+
+const int J = 6;
+
+Func downsample(Func f) {
+    Var x, y;
+    Func downx, downy;
+    downx(x, y) = (f(2*x-1, y) + 3.0f * (f(2*x, y) + f(2*x+1, y)) + f(2*x+2, y)) / 8.0f;
+    downy(x, y) = (downx(x, 2*y-1) + 3.0f * (downx(x, 2*y) + downx(x, 2*y+1)) + downx(x, 2*y+2)) / 8.0f;
+    return downy;
+}
+
+Func upsample(Func f) {
+    Var x, y;
+    Func upx, upy;
+    upx(x, y) = 0.25f * f((x/2) - 1 + 2*(x % 2), y) + 0.75f * f(x/2, y);
+    upy(x, y) = 0.25f * upx(x, (y/2) - 1 + 2*(y % 2)) + 0.75f * upx(x, y/2);
+    return upy;
+}
+
+double time_runs(Func output, Image<float> out) {
+    double best = 1e20;
+    for (int trial = 0; trial < 5; trial++) {
+        double t1 = current_time();
+        for (int i = 0; i < 200; i++) {
+            output.realize(out);
+        }
+        double t2 = current_time();
+        if (t2 - t1 < best) best = t2 - t1;
+    }
+    return best / 200;
+}
+
+int main(int argc, char **argv) {
+    Var x, y;
+
+    Func input;
+    input(x, y) = sin(x * 0.1f) + cos(y * 0.1f);
+
+    Func g[J], l[J];
+    g[0](x, y) = input(x, y);
+    for (int j = 1; j < J; j++) {
+        g[j] = downsample(g[j-1]);
+    }
+    l[J-1] = g[J-1];
+    for (int j = J-2; j >= 0; j--) {
+        l[j](x, y) = g[j](x, y) - upsample(g[j+1])(x, y);
+    }
+    Func r[J];
+    r[J-1](x, y) = l[J-1](x, y) * 1.5f;
+    for (int j = J-2; j >= 0; j--) {
+        r[j](x, y) = upsample(r[j+1])(x, y) + l[j](x, y) * 1.5f;
+    }
+    Func output;
+    output(x, y) = r[0](x, y);
+
+    for (int j = 0; j < J; j++) {
+        g[j].compute_root().vectorize(x, 8);
+        l[j].compute_root().vectorize(x, 8);
+        if (j > 0) r[j].compute_root().vectorize(x, 8);
+    }
+
+    Image<float> out(256, 256);
+    output.compile_jit();
+
+    Internal::JITSharedRuntime::memory_pool_set_size(0);
+    double unpooled = time_runs(output, out);
+    Image<float> reference(256, 256);
+    output.realize(reference);
+
+    Internal::JITSharedRuntime::memory_pool_set_size(64 * 1024 * 1024);
+    double pooled = time_runs(output, out);
+
+    for (int y = 0; y < out.height(); y++) {
+        for (int x = 0; x < out.width(); x++) {
+            if (out(x, y) != reference(x, y)) {
+                printf("out(%d, %d) = %f instead of %f\n", x, y, out(x, y), reference(x, y));
+                return -1;
+            }
+        }
+    }
+
+    halide_memory_pool_stats stats;
+    Internal::JITSharedRuntime::memory_pool_get_stats(&stats);
+
+    printf("Without the memory pool: %f ms per run\n"
+           "With the memory pool: %f ms per run\n"
+           "%llu of %llu allocations reused a pooled block\n",
+           unpooled, pooled,
+           (unsigned long long)stats.pool_hits, (unsigned long long)stats.allocations);
+
+    if (stats.pool_hits == 0) {
+        printf("No allocations were served from the pool\n");
+        return -1;
+    }
+
+    if (pooled > unpooled) {
+        // Timing on loaded machines is noisy, so only warn.
+        fprintf(stderr, "WARNING: Running with the memory pool was slower than without it\n");
+    }
+
+    Internal::JITSharedRuntime::memory_pool_set_size(0);
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include "Halide.h"
+#include <stdio.h>
+#include "clock.h"
+
+using namespace Halide;
+
+// Parallelizing a short inner loop is only worthwhile if starting a
+// small parallel job is cheap. Compare an 8-wide parallel inner loop
+// against the same loop run serially.
+
+int main(int argc, char **argv) {
+    Var x, y, xo, xi;
+    Func f_serial, f_parallel;
+    RDom r(0, 256);
+    f_serial(x, y) = sum(sin(x + y + r));
+    f_parallel(x, y) = sum(sin(x + y + r));
+
+    f_serial.split(x, xo, xi, 8);
+    f_parallel.split(x, xo, xi, 8).parallel(xo);
+
+    const int W = 64, H = 2000;
+    Image<float> out_serial(W, H), out_parallel(W, H);
+    f_serial.realize(out_serial);
+    f_parallel.realize(out_parallel);
+
+    for (int j = 0; j < H; j++) {
+        for (int i = 0; i < W; i++) {
+            if (out_serial(i, j) != out_parallel(i, j)) {
+                printf("out_parallel(%d, %d) = %f instead of %f\n",
+                       i, j, out_parallel(i, j), out_serial(i, j));
+                return -1;
+            }
+        }
+    }
+
+    double serial_time = 1e20, parallel_time = 1e20;
+    for (int i = 0; i < 5; i++) {
+        double t1 = current_time();
+        f_serial.realize(out_serial);
+        double t2 = current_time();
+        f_parallel.realize(out_parallel);
+        double t3 = current_time();
+        if (t2 - t1 < serial_time) serial_time = t2 - t1;
+        if (t3 - t2 < parallel_time) parallel_time = t3 - t2;
+    }
+
+    printf("Serial inner loop: %f ms\n"
+           "Parallel inner loop: %f ms\n", serial_time, parallel_time);
+
+    if (parallel_time > serial_time * 1.5) {
+        // Timing on loaded machines is noisy, so only warn.
+        fprintf(stderr, "WARNING: Parallelizing an 8-wide inner loop was much slower than running it serially\n");
+    }
+
+    printf("Success!\n");
+    return 0;
+}
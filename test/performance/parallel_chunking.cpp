@@ -0,0 +1,61 @@
+#include "Halide.h"
+#include <stdio.h>
+#include "clock.h"
+
+using namespace Halide;
+
+// Compares static and guided chunking of a parallel loop with many
+// cheap tasks of uneven cost. Guided chunking claims many rows per
+// atomic operation, so it should win.
+
+int main(int argc, char **argv) {
+    const int W = 16, H = 200000;
+
+    Var x, y;
+    Func costly;
+    // Rows near the bottom of the image cost much more than those at
+    // the top.
+    RDom r(0, 64);
+    costly(x, y) = select(y > H - H / 16, sum(sin(x + y + r)), cast<float>(x + y));
+
+    Func f_static, f_guided;
+    f_static(x, y) = costly(x, y);
+    f_guided(x, y) = costly(x, y);
+    f_static.parallel(y);
+    f_guided.parallel(y, ParallelChunking::Guided);
+
+    Image<float> out_static(W, H), out_guided(W, H);
+    f_static.realize(out_static);
+    f_guided.realize(out_guided);
+
+    for (int j = 0; j < H; j++) {
+        for (int i = 0; i < W; i++) {
+            if (out_static(i, j) != out_guided(i, j)) {
+                printf("out_guided(%d, %d) = %f instead of %f\n",
+                       i, j, out_guided(i, j), out_static(i, j));
+                return -1;
+            }
+        }
+    }
+
+    double static_time = 1e20, guided_time = 1e20;
+    for (int i = 0; i < 10; i++) {
+        double t1 = current_time();
+        f_static.realize(out_static);
+        double t2 = current_time();
+        f_guided.realize(out_guided);
+        double t3 = current_time();
+        if (t2 - t1 < static_time) static_time = t2 - t1;
+        if (t3 - t2 < guided_time) guided_time = t3 - t2;
+    }
+
+    printf("Static chunking: %f ms\n"
+           "Guided chunking: %f ms\n", static_time, guided_time);
+
+    if (guided_time >= static_time) {
+        fprintf(stderr, "WARNING: Guided chunking was no faster than static chunking\n");
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "Halide.h"
+#include <stdio.h>
+#include "clock.h"
+
+using namespace Halide;
+
+// Measures the cost of dispatching many small parallel tasks as the
+// number of threads in the pool grows. Each row of the output is one
+// task, and each task does very little work, so the time is dominated
+// by the thread pool's task dispatch.
+
+int main(int argc, char **argv) {
+    const int W = 64, H = 100000;
+
+    Func f;
+    Var x, y;
+    f(x, y) = x + y;
+    f.parallel(y);
+
+    int max_threads = 64;
+    double single_thread_time = 0;
+
+    for (int t = 1; t <= max_threads; t *= 2) {
+        std::ostringstream ss;
+        ss << "HL_NUM_THREADS=" << t;
+        std::string str = ss.str();
+        char buf[32] = {0};
+        memcpy(buf, str.c_str(), str.size());
+        putenv(buf);
+        Halide::Internal::JITSharedRuntime::release_all();
+        f.compile_jit();
+
+        Image<int> im(W, H);
+        // Start the thread pool.
+        f.realize(im);
+
+        double min_time = 1e20;
+        for (int i = 0; i < 5; i++) {
+            double t1 = current_time();
+            f.realize(im);
+            double t2 = current_time() - t1;
+            if (t2 < min_time) min_time = t2;
+        }
+
+        double ns_per_task = (min_time * 1e6) / H;
+        printf("%2d threads: %f ms, %f ns per task\n", t, min_time, ns_per_task);
+
+        if (t == 1) {
+            single_thread_time = min_time;
+        } else if (min_time > single_thread_time * 2) {
+            // With more threads than cores this is expected, so it's
+            // a warning rather than a failure.
+            fprintf(stderr, "WARNING: Dispatch with %d threads is much slower "
+                    "than with one thread: %f ms vs %f ms\n",
+                    t, min_time, single_thread_time);
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}